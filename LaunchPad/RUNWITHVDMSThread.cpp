@@ -304,6 +304,7 @@ BOOL CRUNWITHVDMSThread::SetupINI(CINIFile& INIFile) {
   BOOL    vdms_sb_fm_enabled        = SettingGetBool  (_T("vdms.sb.fm"),    _T("enabled"),      TRUE);
   LONG    vdms_sb_fm_port           = SettingGetLong  (_T("vdms.sb.fm"),    _T("port"),         0x388);
   CString vdms_sb_fm_oplMode        = SettingGetString(_T("vdms.sb.fm"),    _T("oplMode"),      _T("Automatic"));
+  CString vdms_sb_fm_engine         = SettingGetString(_T("vdms.sb.fm"),    _T("engine"),       _T("fast"));
   LONG    vdms_sb_fm_sampleRate     = SettingGetLong  (_T("vdms.sb.fm"),    _T("sampleRate"),   44100);
   BOOL    vdms_sb_fm_useDevOut      = SettingGetBool  (_T("vdms.sb.fm"),    _T("useDevOut"),    TRUE);
   LONG    vdms_sb_fm_devOutType     = SettingGetLong  (_T("vdms.sb.fm"),    _T("devOutType"),   (LONG)DeviceUtil::DEV_DSOUND);
@@ -486,6 +487,7 @@ BOOL CRUNWITHVDMSThread::SetupINI(CINIFile& INIFile) {
     vdmsini += _T("port=") + VLPUtil::FormatString(_T("0x%x"), vdms_sb_fm_port) + _T("\n");
     vdmsini += _T("sampleRate=") + VLPUtil::FormatString(_T("%d"), vdms_sb_fm_sampleRate) + _T("\n");
     vdmsini += _T("oplMode=") + CString(GetOPLType(vdms_sb_fm_oplMode, vdms_sb_dsp_version)) + _T("\n");
+    vdmsini += _T("engine=") + vdms_sb_fm_engine + _T("\n");
     vdmsini += _T("[AdLibController.depends]\n");
     vdmsini += _T("VDMSrv=VDMServicesProvider\n");
 
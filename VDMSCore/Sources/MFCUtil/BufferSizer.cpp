@@ -0,0 +1,177 @@
+#include "stdafx.h"
+
+#include "BufferSizer.h"
+
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define BSZ_DECAY_COUNT     4096        // the histograms are halved whenever they hold this many samples
+#define BSZ_MIN_SAMPLES     64          // how many deliveries must be seen before the size is adapted
+#define BSZ_UPDATE_INTERVAL 1.0         // interval (seconds) between two re-evaluations of the size
+#define BSZ_HYSTERESIS      0.25        // how much smaller (relative) the measurements must call for before shrinking
+#define BSZ_SHRINK_HOLD     10.0        // for how long (seconds) they must do so
+#define BSZ_UNDERRUN_GROWTH 1.25        // how much the size grows by on underrun
+
+/////////////////////////////////////////////////////////////////////////////
+
+CBufferSizer::CBufferSizer(void)
+{
+  Init(125, 125, 125, 0);
+}
+
+CBufferSizer::~CBufferSizer(void)
+{
+}
+
+//
+// Sets the initial size and the bounds (milliseconds), and the percentile
+//  of the measurements the size is decided at (0 = fixed size); forgets
+//  all measurements
+//
+void CBufferSizer::Init(long initialSize, long minSize, long maxSize, int percentile) {
+  m_minSize = minSize;
+  m_maxSize = (maxSize > minSize) ? maxSize : minSize;
+  m_size = (initialSize < m_minSize) ? m_minSize : ((initialSize > m_maxSize) ? m_maxSize : initialSize);
+  m_percentile = (percentile < 0) ? 0 : ((percentile > 100) ? 100 : percentile);
+
+  memset(m_deliveries, 0, sizeof(m_deliveries));
+  memset(m_quanta, 0, sizeof(m_quanta));
+  m_numDeliveries = m_numQuanta = 0;
+
+  m_isUnderrun = false;
+  m_lastUpdate = 0.0;
+  m_shrinkSince = -1.0;
+}
+
+//
+// Records the interval (milliseconds) between two producer deliveries
+//
+void CBufferSizer::AddDelivery(double interval) {
+  AddSample(m_deliveries, m_numDeliveries, interval);
+}
+
+//
+// Records how much data (milliseconds) the device consumed, or committed
+//  itself to, at once
+//
+void CBufferSizer::AddDeviceQuantum(double quantum) {
+  AddSample(m_quanta, m_numQuanta, quantum);
+}
+
+//
+// Records that the device ran out of data
+//
+void CBufferSizer::AddUnderrun(void) {
+  m_isUnderrun = true;
+}
+
+//
+// Re-evaluates the size (at most every BSZ_UPDATE_INTERVAL); <time> is the
+//  current time in seconds.  Returns true if the size changed.
+//
+bool CBufferSizer::Update(double time) {
+  if (!IsAdaptive() || ((time >= m_lastUpdate) && ((time - m_lastUpdate) < BSZ_UPDATE_INTERVAL)))
+    return false;               // (a clock that went backwards, e.g. wrapped around, forces an update)
+
+  if (time < m_shrinkSince)
+    m_shrinkSince = time;
+
+  m_lastUpdate = time;
+
+  long lastSize = m_size;
+
+  if (m_isUnderrun) {
+    // Underruns mean the measurements missed something: grow regardless
+    m_size = (long)(m_size * BSZ_UNDERRUN_GROWTH) + 1;
+    m_shrinkSince = -1.0;
+    m_isUnderrun = false;
+  } else if (m_numDeliveries >= BSZ_MIN_SAMPLES) {
+    // Data must last from one delivery to the next, plus whatever the
+    //  device grabs at once
+    long estimate = GetPercentile(m_deliveries, m_numDeliveries) + GetPercentile(m_quanta, m_numQuanta);
+
+    if (estimate > m_size) {
+      m_size = estimate;
+      m_shrinkSince = -1.0;
+    } else if (estimate < m_size * (1.0 - BSZ_HYSTERESIS)) {
+      if (m_shrinkSince < 0.0) {
+        m_shrinkSince = time;
+      } else if ((time - m_shrinkSince) >= BSZ_SHRINK_HOLD) {
+        m_size -= ((m_size - estimate) / 4) + 1;
+        m_shrinkSince = time;
+      }
+    } else {
+      m_shrinkSince = -1.0;
+    }
+  }
+
+  if (m_size < m_minSize) m_size = m_minSize;
+  if (m_size > m_maxSize) m_size = m_maxSize;
+
+  return (m_size != lastSize);
+}
+
+//
+// Retrieves the current operating range (milliseconds)
+//
+long CBufferSizer::GetSize(void) const {
+  return m_size;
+}
+
+//
+// Retrieves the largest operating range the size may grow to
+//
+long CBufferSizer::GetMaxSize(void) const {
+  return IsAdaptive() ? m_maxSize : m_size;
+}
+
+//
+// Whether the size follows the measurements
+//
+bool CBufferSizer::IsAdaptive(void) const {
+  return (m_percentile > 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Adds a measurement (milliseconds) to a histogram, letting old
+//  measurements fade out so that the size follows changes in the host's
+//  behaviour.  Measurements beyond the histogram's range are pauses in
+//  playback (not jitter), and are ignored.
+//
+void CBufferSizer::AddSample(unsigned long* histogram, unsigned long& numSamples, double value) {
+  if (!IsAdaptive() || (value < 0.0) || (value >= BSZ_HISTOGRAM_LEN))
+    return;
+
+  histogram[(int)value]++;
+
+  if (++numSamples >= BSZ_DECAY_COUNT) {
+    numSamples = 0;
+
+    for (int i = 0; i < BSZ_HISTOGRAM_LEN; i++)
+      numSamples += (histogram[i] >>= 1);
+  }
+}
+
+//
+// Retrieves the (rounded-up) value below which m_percentile percent of a
+//  histogram's measurements fall
+//
+long CBufferSizer::GetPercentile(const unsigned long* histogram, unsigned long numSamples) const {
+  if (numSamples == 0)
+    return 0;
+
+  double threshold = numSamples * (m_percentile / 100.0);
+  unsigned long count = 0;
+
+  for (int i = 0; i < BSZ_HISTOGRAM_LEN; i++) {
+    count += histogram[i];
+
+    if (count >= threshold)
+      return i + 1;
+  }
+
+  return BSZ_HISTOGRAM_LEN;
+}
@@ -0,0 +1,54 @@
+#ifndef __BUFFERSIZER_H__
+#define __BUFFERSIZER_H__
+
+#define BSZ_HISTOGRAM_LEN   1024        // histogram range (milliseconds, 1ms resolution); longer intervals are pauses in playback
+
+//
+// Decides how much audio an output sink should buffer (its operating range,
+//  in milliseconds), from how irregularly the producer delivers data and
+//  how coarsely the device consumes it.  Both are tracked as (slowly
+//  decaying) histograms, and the size is set at a percentile of their sum:
+//  it grows as soon as the measurements (or an underrun) call for it, and
+//  only shrinks, by small steps, once the measurements have stayed well
+//  below it for a while.
+//
+// A percentile of 0 disables the adaptation (the size stays as initialized).
+//
+class CBufferSizer {
+  public:
+    CBufferSizer(void);
+    ~CBufferSizer(void);
+
+  public:
+    void Init(long initialSize, long minSize, long maxSize, int percentile);
+
+    void AddDelivery(double interval);
+    void AddDeviceQuantum(double quantum);
+    void AddUnderrun(void);
+
+    bool Update(double time);
+
+    long GetSize(void) const;
+    long GetMaxSize(void) const;
+    bool IsAdaptive(void) const;
+
+  protected:
+    void AddSample(unsigned long* histogram, unsigned long& numSamples, double value);
+    long GetPercentile(const unsigned long* histogram, unsigned long numSamples) const;
+
+  protected:
+    long m_size;                        // current operating range (milliseconds)
+    long m_minSize, m_maxSize;
+    int m_percentile;
+
+    unsigned long m_deliveries[BSZ_HISTOGRAM_LEN];  // intervals between producer deliveries
+    unsigned long m_numDeliveries;
+    unsigned long m_quanta[BSZ_HISTOGRAM_LEN];      // amounts of data consumed by the device at once
+    unsigned long m_numQuanta;
+
+    bool m_isUnderrun;                  // whether an underrun was reported since the last update
+    double m_lastUpdate;                // when the size was last re-evaluated (seconds)
+    double m_shrinkSince;               // since when the size could be smaller (seconds; < 0 if it could not)
+};
+
+#endif //__BUFFERSIZER_H__
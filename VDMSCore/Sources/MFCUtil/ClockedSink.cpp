@@ -0,0 +1,342 @@
+#include "stdafx.h"
+
+#include "ClockedSink.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define CSNK_DEFAULT_PERIOD   0.010     // default interval (seconds) between block transfers
+
+/////////////////////////////////////////////////////////////////////////////
+
+CClockedSink::CClockedSink(void)
+  : m_bytesPerSecond(44100 * 4), m_blockAlign(4), m_period(CSNK_DEFAULT_PERIOD), m_jitter(0.0), m_stallInterval(0.0), m_stallDuration(0.0), m_drift(0.0), m_seed(1)
+{
+  SetBuffering(125);
+  Reset();
+}
+
+CClockedSink::~CClockedSink(void)
+{
+}
+
+//
+// Sets the device's nominal data rate
+//
+void CClockedSink::SetFormat(long bytesPerSecond, int blockAlign) {
+  m_bytesPerSecond = bytesPerSecond;
+  m_blockAlign = (blockAlign > 0) ? blockAlign : 1;
+
+  SetWatermarks();
+}
+
+//
+// Sets the (fixed) buffer operating range (milliseconds), as in the real
+//  sinks
+//
+void CClockedSink::SetBuffering(long bufOpRange) {
+  m_bufferSizer.Init(bufOpRange, bufOpRange, bufOpRange, 0);
+  SetWatermarks();
+}
+
+//
+// Has the buffer operating range follow the measured delivery and device
+//  jitter, starting from the current range (see CBufferSizer)
+//
+void CClockedSink::SetAdaptiveBuffering(int percentile, long minSize, long maxSize) {
+  m_bufferSizer.Init(m_bufOpRange, minSize, maxSize, percentile);
+  SetWatermarks();
+}
+
+//
+// Sets the interval (seconds) between block transfers
+//
+void CClockedSink::SetPeriod(double period) {
+  m_period = (period > 0.0) ? period : CSNK_DEFAULT_PERIOD;
+}
+
+//
+// Sets the largest delay (seconds) of a block transfer
+//
+void CClockedSink::SetJitter(double jitter) {
+  m_jitter = (jitter > 0.0) ? jitter : 0.0;
+}
+
+//
+// Makes the device stop consuming data for <duration> seconds every
+//  <interval> seconds (0 = never)
+//
+void CClockedSink::SetStalls(double interval, double duration) {
+  m_stallInterval = (interval > 0.0) ? interval : 0.0;
+  m_stallDuration = (duration > 0.0) ? duration : 0.0;
+  m_nextStall = m_time + m_stallInterval;
+}
+
+//
+// Sets the device clock error (parts per million, positive = fast)
+//
+void CClockedSink::SetDrift(double ppm) {
+  m_drift = ppm;
+}
+
+//
+// Sets the seed of the jitter generator (runs are reproducible)
+//
+void CClockedSink::SetSeed(unsigned long seed) {
+  m_seed = seed;
+}
+
+//
+// Empties the queue, rewinds the clock and clears the statistics
+//
+void CClockedSink::Reset(void) {
+  m_time = 0.0;
+  m_isPlaying = false;
+  m_isStarved = false;
+  m_pullBase = 0.0;
+  m_nextPull = 0.0;
+  m_nextStall = m_stallInterval;
+  m_pullCredit = 0.0;
+  m_lastPull = 0.0;
+  m_lastDelivery = 0.0;
+
+  m_buffered = 0;
+  m_minBuffered = 0;
+  m_maxBuffered = 0;
+
+  m_playedBytes = 0.0;
+  m_primedBytes = 0.0;
+  m_underruns = 0;
+  m_underrunBytes = 0.0;
+  m_overruns = 0;
+  m_overrunBytes = 0.0;
+}
+
+//
+// Moves the clock forward by <deltaTime> seconds, letting the device
+//  consume data as it goes
+//
+void CClockedSink::Advance(double deltaTime) {
+  if (deltaTime > 0.0)
+    m_time += deltaTime;
+
+  if (!m_isPlaying) {                   // playback starts with the first packet
+    m_pullBase = m_nextPull = m_lastPull = m_time;
+    m_nextStall = m_time + m_stallInterval;
+    return;
+  }
+
+  while (m_nextPull <= m_time) {
+    // Transfer one block, at the device's own (drifting) rate
+    double blockBytes = m_bytesPerSecond * m_period * (1.0 + m_drift / 1000000.0) + m_pullCredit;
+    long length = (long)blockBytes;
+
+    length -= length % m_blockAlign;
+    m_pullCredit = blockBytes - length;
+
+    if (m_buffered >= length) {
+      m_buffered -= length;
+      m_isStarved = false;
+    } else {
+      if (!m_isStarved) {
+        m_underruns++;                  // count starvation episodes, not blocks
+        m_bufferSizer.AddUnderrun();
+      }
+
+      m_underrunBytes += length - m_buffered;
+      m_buffered = 0;
+      m_isStarved = true;
+    }
+
+    m_playedBytes += length;
+
+    // The time between transfers is how much data the device takes at once
+    m_bufferSizer.AddDeviceQuantum(1000.0 * (m_nextPull - m_lastPull));
+    m_lastPull = m_nextPull;
+
+    SchedulePull();
+  }
+}
+
+//
+// Queues <length> bytes (or drops them all if they do not fit, as the real
+//  sinks do); returns the load, i.e. the fill level relative to the middle
+//  of the optimal buffering range, as seen before queuing the data.  A
+//  device that has not started yet, or has run dry, is first primed with
+//  silence up to the target, as the real sinks do
+//
+double CClockedSink::PlayData(long length) {
+  long targetBytes = GetTargetBytes();
+
+  if (m_buffered == 0) {
+    long primeBytes = targetBytes - length;
+    primeBytes -= primeBytes % m_blockAlign;
+
+    if (primeBytes > 0) {
+      m_buffered = primeBytes;
+      m_primedBytes += primeBytes;
+    }
+  }
+
+  double load = (targetBytes > 0) ? ((double)m_buffered / targetBytes) : 1.0;
+
+  if (!m_isPlaying) {
+    m_isPlaying = true;
+    m_pullBase = m_nextPull = m_time + m_period;
+    m_lastPull = m_time;
+    m_nextStall = m_time + m_stallInterval;
+    m_minBuffered = m_maxBuffered = m_buffered + length;
+  } else {
+    if (m_buffered < m_minBuffered) m_minBuffered = m_buffered;
+    if (m_buffered > m_maxBuffered) m_maxBuffered = m_buffered;
+
+    m_bufferSizer.AddDelivery(1000.0 * (m_time - m_lastDelivery));
+  }
+
+  m_lastDelivery = m_time;
+
+  if (m_bufferSizer.Update(m_time))
+    SetWatermarks();
+
+  if (m_buffered + length > m_capacity) {
+    m_overruns++;
+    m_overrunBytes += length;
+  } else {
+    m_buffered += length;
+  }
+
+  return load;
+}
+
+//
+// Retrieves the current time (seconds)
+//
+double CClockedSink::GetTime(void) const {
+  return m_time;
+}
+
+//
+// Retrieves the device's nominal data rate
+//
+long CClockedSink::GetBytesPerSecond(void) const {
+  return m_bytesPerSecond;
+}
+
+//
+// Retrieves the buffer operating range (milliseconds)
+//
+long CClockedSink::GetBufOpRange(void) const {
+  return m_bufOpRange;
+}
+
+//
+// Retrieves how many bytes are queued
+//
+long CClockedSink::GetBuffered(void) const {
+  return m_buffered;
+}
+
+//
+// Retrieves the middle of the optimal buffering range (in bytes)
+//
+long CClockedSink::GetTargetBytes(void) const {
+  return (m_bufferedLo + m_bufferedHi) / 2;
+}
+
+//
+// Retrieves the least amount of queued data seen by PlayData
+//
+long CClockedSink::GetMinBuffered(void) const {
+  return m_minBuffered;
+}
+
+//
+// Retrieves the largest amount of queued data seen by PlayData
+//
+long CClockedSink::GetMaxBuffered(void) const {
+  return m_maxBuffered;
+}
+
+//
+// Retrieves how many bytes the device consumed (including silence)
+//
+double CClockedSink::GetPlayedBytes(void) const {
+  return m_playedBytes;
+}
+
+//
+// Retrieves how many bytes of silence were queued to prime the device
+//
+double CClockedSink::GetPrimedBytes(void) const {
+  return m_primedBytes;
+}
+
+//
+// Retrieves how many times the device starved
+//
+long CClockedSink::GetUnderruns(void) const {
+  return m_underruns;
+}
+
+//
+// Retrieves how many bytes of silence were played because of starvation
+//
+double CClockedSink::GetUnderrunBytes(void) const {
+  return m_underrunBytes;
+}
+
+//
+// Retrieves how many packets were dropped because the queue was full
+//
+long CClockedSink::GetOverruns(void) const {
+  return m_overruns;
+}
+
+//
+// Retrieves how many bytes were dropped because the queue was full
+//
+double CClockedSink::GetOverrunBytes(void) const {
+  return m_overrunBytes;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Deterministic pseudo-random numbers in [0, 1)
+//
+double CClockedSink::Random(void) {
+  m_seed = m_seed * 1103515245UL + 12345UL;
+  return ((m_seed >> 16) & 0x7fff) / 32768.0;
+}
+
+//
+// Decides when the next block transfer takes place
+//
+void CClockedSink::SchedulePull(void) {
+  double lastPull = m_nextPull;
+
+  m_pullBase += m_period;
+  m_nextPull = m_pullBase + m_jitter * Random();
+
+  if (m_nextPull < lastPull)
+    m_nextPull = lastPull;              // transfers never overtake one another
+
+  // During a stall no block is transferred; the missed transfers all take
+  //  place at once when the stall is over
+  if ((m_stallInterval > 0.0) && (m_nextPull >= m_nextStall)) {
+    if (m_nextPull < m_nextStall + m_stallDuration)
+      m_nextPull = m_nextStall + m_stallDuration;
+
+    m_nextStall += m_stallInterval;
+  }
+}
+
+//
+// Derives the optimal buffering range and the capacity (in bytes) from the
+//  buffer operating range, as the real sinks do
+//
+void CClockedSink::SetWatermarks(void) {
+  m_bufOpRange = m_bufferSizer.GetSize();
+  m_bufferedLo = (long)((double)m_bytesPerSecond * m_bufOpRange / 1000);
+  m_bufferedHi = m_bufferedLo * 2;
+  m_capacity   = (long)((double)m_bytesPerSecond * m_bufferSizer.GetMaxSize() / 1000) * 4;
+}
@@ -0,0 +1,96 @@
+#ifndef __CLOCKEDSINK_H__
+#define __CLOCKEDSINK_H__
+
+#include "BufferSizer.h"
+
+//
+// Model of an audio output device, driven by an external (virtual or real)
+//  clock: data is queued by PlayData, and consumed in periodic blocks at
+//  the device's rate as the clock is advanced.  The load returned by
+//  PlayData is computed the same way as by the real Wave sinks (fill level
+//  relative to the middle of the optimal buffering range), so producer
+//  feedback (CRateControl) can be exercised without audio hardware.
+//  Device imperfections can be injected: scheduling jitter, stalls (no
+//  data consumed for a while, then a catch-up burst) and clock drift.
+//  The buffering can be sized adaptively (see CBufferSizer), and the
+//  device is primed with silence when it starts or runs dry, as in the
+//  real sinks.
+//
+// No operating system services are used, so that the class can be built
+//  and run on any platform.
+//
+class CClockedSink {
+  public:
+    CClockedSink(void);
+    ~CClockedSink(void);
+
+  public:
+    void SetFormat(long bytesPerSecond, int blockAlign);
+    void SetBuffering(long bufOpRange);
+    void SetAdaptiveBuffering(int percentile, long minSize, long maxSize);
+    void SetPeriod(double period);
+    void SetJitter(double jitter);
+    void SetStalls(double interval, double duration);
+    void SetDrift(double ppm);
+    void SetSeed(unsigned long seed);
+    void Reset(void);
+
+    void Advance(double deltaTime);
+    double PlayData(long length);
+
+    double GetTime(void) const;
+    long GetBytesPerSecond(void) const;
+    long GetBufOpRange(void) const;
+    long GetBuffered(void) const;
+    long GetTargetBytes(void) const;
+    long GetMinBuffered(void) const;
+    long GetMaxBuffered(void) const;
+    double GetPlayedBytes(void) const;
+    double GetPrimedBytes(void) const;
+    long GetUnderruns(void) const;
+    double GetUnderrunBytes(void) const;
+    long GetOverruns(void) const;
+    double GetOverrunBytes(void) const;
+
+  protected:
+    double Random(void);
+    void SchedulePull(void);
+    void SetWatermarks(void);
+
+  protected:
+    long m_bytesPerSecond;              // nominal device rate
+    int m_blockAlign;
+    long m_bufOpRange;                  // buffer operating range (milliseconds), as in the real sinks
+    long m_bufferedLo, m_bufferedHi;    // optimal buffering range (in bytes)
+    long m_capacity;                    // how many bytes can be queued before data is dropped
+    CBufferSizer m_bufferSizer;         // decides m_bufOpRange, if adaptive
+
+    double m_period;                    // interval (seconds) between two block transfers by the device
+    double m_jitter;                    // largest delay (seconds) of a block transfer
+    double m_stallInterval;             // interval (seconds) between two stalls (0 = no stalls)
+    double m_stallDuration;             // how long (seconds) a stall lasts
+    double m_drift;                     // device clock error (parts per million, positive = device runs fast)
+    unsigned long m_seed;
+
+    double m_time;                      // current time (seconds)
+    bool m_isPlaying;                   // whether data was received yet (the device is idle until then)
+    bool m_isStarved;                   // whether the last block transfer found the queue empty
+    double m_pullBase;                  // time the next block transfer is due at (without jitter or stalls)
+    double m_nextPull;                  // time the next block transfer actually takes place at
+    double m_nextStall;                 // time the next stall begins at
+    double m_pullCredit;                // fractional bytes carried over between block transfers
+    double m_lastPull;                  // when the last block transfer took place
+    double m_lastDelivery;              // when data was last queued
+
+    long m_buffered;                    // how many bytes are queued
+    long m_minBuffered, m_maxBuffered;  // extremes of m_buffered, as seen by PlayData
+
+    double m_playedBytes;
+    double m_primedBytes;               // how many bytes of silence were queued to prime the device
+    long m_underruns;                   // how many times the device starved
+    double m_underrunBytes;             // how many bytes of silence were played as a result
+    long m_overruns;                    // how many packets were dropped because the queue was full
+    double m_overrunBytes;              // how many bytes were dropped as a result
+};
+
+#endif //__CLOCKEDSINK_H__
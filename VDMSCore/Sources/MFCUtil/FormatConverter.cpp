@@ -0,0 +1,138 @@
+#include "stdafx.h"
+
+#include "FormatConverter.h"
+
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+CFormatConverter::CFormatConverter(void)
+  : m_outChannels(2), m_outRate(44100), m_inChannels(2), m_inRate(44100), m_inBits(16), m_isResampling(false)
+{
+}
+
+CFormatConverter::~CFormatConverter(void)
+{
+}
+
+//
+// Sets the (16-bit) format the data is converted to
+//
+void CFormatConverter::SetOutputFormat(int numChannels, long sampleRate) {
+  m_outChannels = numChannels;
+  m_outRate = sampleRate;
+
+  m_isResampling = false;               // force the resampler to be (re)initialized
+  SetInputFormat(m_inChannels, m_inRate, m_inBits);
+}
+
+//
+// Sets the format of the data passed to Convert; a change in rate alone
+//  keeps the resampler going, so the output stays continuous
+//
+void CFormatConverter::SetInputFormat(int numChannels, long sampleRate, int bitsPerSample) {
+  if (sampleRate != m_outRate) {
+    if (m_isResampling && (numChannels == m_inChannels)) {
+      m_resampler.SetRates(sampleRate, m_outRate);
+    } else {
+      m_resampler.Init(numChannels, sampleRate, m_outRate, CResampler::QUALITY_MEDIUM);
+    }
+
+    m_isResampling = true;
+  } else {
+    m_isResampling = false;
+  }
+
+  m_inChannels = numChannels;
+  m_inRate = sampleRate;
+  m_inBits = bitsPerSample;
+}
+
+//
+// Converts <length> bytes of input data; returns a pointer to the output
+//  data (valid until the next call) and its length in <outLength>.  When
+//  resampling, the output lags the input by a few samples (filter delay).
+//
+const unsigned char* CFormatConverter::Convert(const unsigned char* data, long length, long* outLength) {
+  int numFrames = length / (m_inChannels * m_inBits / 8);
+
+  if (IsPassThrough()) {
+    *outLength = length;
+    return data;
+  }
+
+  if (m_isResampling) {
+    if (m_inBits == 8) {
+      m_resampler.Write(data, numFrames);
+    } else {
+      m_resampler.Write((const short*)data, numFrames);
+    }
+
+    numFrames = m_resampler.GetAvailable();
+
+    m_resampled.resize(numFrames * m_inChannels + 1);
+    numFrames = m_resampler.Read(&(m_resampled[0]), numFrames);
+
+    m_output.resize(numFrames * m_outChannels + 1);
+    Remix(&(m_resampled[0]), numFrames, &(m_output[0]));
+  } else {
+    m_output.resize(numFrames * m_outChannels + 1);
+
+    if (m_inBits == 8) {
+      Expand(data, numFrames, &(m_output[0]));
+    } else {
+      Remix((const short*)data, numFrames, &(m_output[0]));
+    }
+  }
+
+  *outLength = numFrames * m_outChannels * sizeof(short);
+  return (const unsigned char*)&(m_output[0]);
+}
+
+//
+// Whether the input data is already in the output format
+//
+bool CFormatConverter::IsPassThrough(void) const {
+  return (m_inRate == m_outRate) && (m_inChannels == m_outChannels) && (m_inBits == 16);
+}
+
+//
+// Converts 16-bit frames from the input to the output channel layout
+//
+void CFormatConverter::Remix(const short* src, int numFrames, short* dst) {
+  int i;
+
+  if (m_inChannels == m_outChannels) {
+    memcpy(dst, src, numFrames * m_inChannels * sizeof(short));
+  } else if (m_inChannels == 1) {       // mono -> stereo
+    for (i = 0; i < numFrames; i++) {
+      dst[2 * i] = dst[2 * i + 1] = src[i];
+    }
+  } else {                              // stereo -> mono
+    for (i = 0; i < numFrames; i++) {
+      dst[i] = (short)(((int)src[2 * i] + (int)src[2 * i + 1]) >> 1);
+    }
+  }
+}
+
+//
+// Converts unsigned 8-bit frames to 16-bit frames in the output channel
+//  layout
+//
+void CFormatConverter::Expand(const unsigned char* src, int numFrames, short* dst) {
+  int i;
+
+  if (m_inChannels == m_outChannels) {
+    for (i = 0; i < numFrames * m_inChannels; i++) {
+      dst[i] = (short)(((int)src[i] - 128) << 8);
+    }
+  } else if (m_inChannels == 1) {       // mono -> stereo
+    for (i = 0; i < numFrames; i++) {
+      dst[2 * i] = dst[2 * i + 1] = (short)(((int)src[i] - 128) << 8);
+    }
+  } else {                              // stereo -> mono
+    for (i = 0; i < numFrames; i++) {
+      dst[i] = (short)(((int)src[2 * i] + (int)src[2 * i + 1] - 256) << 7);
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef __FORMATCONVERTER_H__
+#define __FORMATCONVERTER_H__
+
+#include "Resampler.h"
+
+#include <vector>
+
+//
+// Converts PCM data (8- or 16-bit, mono or stereo, any rate) to one fixed
+//  16-bit output format, so that an output device can be opened once and
+//  for all and changes in the input format cost nothing.  Data that is
+//  already in the output format is passed through untouched; data at the
+//  output rate is only converted sample by sample; anything else goes
+//  through a band-limited resampler.
+//
+class CFormatConverter {
+  public:
+    CFormatConverter(void);
+    ~CFormatConverter(void);
+
+  public:
+    void SetOutputFormat(int numChannels, long sampleRate);
+    void SetInputFormat(int numChannels, long sampleRate, int bitsPerSample);
+
+    const unsigned char* Convert(const unsigned char* data, long length, long* outLength);
+
+    bool IsPassThrough(void) const;
+
+  protected:
+    void Remix(const short* src, int numFrames, short* dst);
+    void Expand(const unsigned char* src, int numFrames, short* dst);
+
+  protected:
+    int m_outChannels;
+    long m_outRate;
+
+    int m_inChannels;
+    long m_inRate;
+    int m_inBits;
+
+    bool m_isResampling;                // whether m_resampler is in use (rates differ)
+    CResampler m_resampler;
+
+    std::vector<short> m_resampled;     // resampler output (input channels)
+    std::vector<short> m_output;        // converted data (output format)
+};
+
+#endif //__FORMATCONVERTER_H__
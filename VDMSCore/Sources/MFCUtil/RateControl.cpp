@@ -0,0 +1,111 @@
+#include "stdafx.h"
+
+#include "RateControl.h"
+
+#include <math.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RCTL_SMOOTHING    0.5           // time constant (seconds) of the fill level averaging
+#define RCTL_KP           0.02          // proportional gain: correction per unit of fill level error
+#define RCTL_KI           0.001         // integral gain: correction per unit of fill level error, per second
+#define RCTL_MAX_DELTA    1.0           // longest interval (seconds) taken into account between two updates
+#define RCTL_CATCHUP_ERR  0.25          // fill level error beyond which the catch-up correction kicks in
+#define RCTL_KC           0.1           // catch-up gain: correction per unit of fill level error beyond RCTL_CATCHUP_ERR
+
+/////////////////////////////////////////////////////////////////////////////
+
+CRateControl::CRateControl(double maxCorrection, double maxCatchUp)
+  : m_maxCorrection(fabs(maxCorrection)), m_maxCatchUp(fabs(maxCatchUp))
+{
+  Reset();
+}
+
+CRateControl::~CRateControl(void)
+{
+}
+
+//
+// Forgets the fill level history (e.g. when a new stream is started)
+//
+void CRateControl::Reset(void) {
+  m_isPrimed = false;
+  m_avgLoad  = 1.0;
+  m_integral = 0.0;
+  m_ratio    = 1.0;
+}
+
+//
+// Takes into account the fill level reported by the sink <deltaTime>
+//  seconds after the previous update; returns the ratio by which the
+//  producer should multiply its output rate
+//
+double CRateControl::Update(double load, double deltaTime) {
+  if (load < 0.0)
+    load = 0.0;
+
+  if (deltaTime < 0.0)
+    deltaTime = 0.0;
+  if (deltaTime > RCTL_MAX_DELTA)
+    deltaTime = RCTL_MAX_DELTA;
+
+  // The fill level saw-tooths with every block written and played; average
+  //  it so that the controller only follows its trend
+  if (m_isPrimed) {
+    m_avgLoad += (load - m_avgLoad) * (1.0 - exp(-deltaTime / RCTL_SMOOTHING));
+  } else {
+    m_avgLoad  = load;
+    m_isPrimed = true;
+  }
+
+  // Positive error = the buffer is running low, so produce more
+  double error = 1.0 - m_avgLoad;
+  double proportional = RCTL_KP * error;
+
+  // Only integrate while the output is not saturated (anti-windup)
+  double integral = m_integral + RCTL_KI * error * deltaTime;
+
+  if (fabs(proportional + integral) <= m_maxCorrection)
+    m_integral = integral;
+
+  double correction = proportional + m_integral;
+
+  if (correction > m_maxCorrection)
+    correction = m_maxCorrection;
+  if (correction < -m_maxCorrection)
+    correction = -m_maxCorrection;
+
+  // Far off target (e.g. starting from an empty buffer), catch up faster
+  //  than the trim alone would; the integral term is not affected, as the
+  //  trim is saturated meanwhile
+  double catchUp = 0.0;
+
+  if (error > RCTL_CATCHUP_ERR)
+    catchUp = RCTL_KC * (error - RCTL_CATCHUP_ERR);
+  if (error < -RCTL_CATCHUP_ERR)
+    catchUp = RCTL_KC * (error + RCTL_CATCHUP_ERR);
+
+  if (catchUp > m_maxCatchUp)
+    catchUp = m_maxCatchUp;
+  if (catchUp < -m_maxCatchUp)
+    catchUp = -m_maxCatchUp;
+
+  m_ratio = 1.0 + correction + catchUp;
+
+  return m_ratio;
+}
+
+//
+// Retrieves the current output rate multiplier
+//
+double CRateControl::GetRatio(void) const {
+  return m_ratio;
+}
+
+//
+// Retrieves the current correction, in parts per million (for logging)
+//
+long CRateControl::GetCorrectionPPM(void) const {
+  double ppm = (m_ratio - 1.0) * 1000000.0;
+  return (long)((ppm >= 0.0) ? (ppm + 0.5) : (ppm - 0.5));
+}
@@ -0,0 +1,43 @@
+#ifndef __RATECONTROL_H__
+#define __RATECONTROL_H__
+
+#define RCTL_MAX_CORRECTION 0.005       // largest rate correction (+/- 5000ppm, about 9 cents)
+#define RCTL_MAX_CATCHUP    0.05        // largest additional correction while far off target (about 85 cents)
+
+//
+// Keeps a playback buffer at its target fill level by trimming a producer's
+//  output rate by small amounts (PI controller).  The producer passes the
+//  load reported by IWaveDataConsumer::PlayData (fill level relative to the
+//  target, 1.0 = on target) to Update, and scales its output rate by the
+//  ratio returned.  Unlike scaling whole blocks up or down, this absorbs
+//  clock drift between the emulation and the audio device without audible
+//  pitch changes or dropped data, at a constant latency.
+// The trim alone would take tens of seconds to fill an empty buffer (at
+//  start-up, or after an underrun), so while the fill level is far off
+//  target a bounded catch-up correction is added on top of it; it fades
+//  out as the fill level approaches the target, leaving the steady state
+//  to the trim.
+//
+class CRateControl {
+  public:
+    CRateControl(double maxCorrection = RCTL_MAX_CORRECTION, double maxCatchUp = RCTL_MAX_CATCHUP);
+    ~CRateControl(void);
+
+  public:
+    void Reset(void);
+    double Update(double load, double deltaTime);
+
+    double GetRatio(void) const;
+    long GetCorrectionPPM(void) const;
+
+  protected:
+    double m_maxCorrection;             // bound on the trim
+    double m_maxCatchUp;                // bound on the catch-up correction
+
+    bool m_isPrimed;                    // whether m_avgLoad holds a valid value
+    double m_avgLoad;                   // smoothed fill level (the sinks report it once per block)
+    double m_integral;                  // integral term; converges to the relative clock drift
+    double m_ratio;                     // current output rate multiplier
+};
+
+#endif //__RATECONTROL_H__
@@ -0,0 +1,352 @@
+#include "stdafx.h"
+
+#include "Resampler.h"
+
+#include <math.h>
+
+#ifdef RSMP_USE_SSE
+# include <xmmintrin.h>
+# ifdef _WIN32
+#  include <windows.h>
+#  ifndef PF_XMMI_INSTRUCTIONS_AVAILABLE
+#   define PF_XMMI_INSTRUCTIONS_AVAILABLE 6
+#  endif
+# endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RSMP_NUM_PHASES   256           // filter phases per input sample (coefficients are interpolated in-between)
+#define RSMP_MAX_TAPS     256           // longest filter (when downsampling by large factors)
+#define RSMP_COMPACT_LEN  4096          // consumed input frames that trigger compaction of the history buffers
+
+#define RSMP_PI           3.14159265358979323846
+
+//
+// Filter design parameters for each quality level
+//
+static const struct {
+  int numTaps;                          // filter length when not downsampling
+  double beta;                          // Kaiser window parameter (stop-band attenuation)
+  double rolloff;                       // pass-band edge, relative to the Nyquist frequency
+} qualityParams[] = {
+  {  8, 5.0, 0.85 },                    // QUALITY_LOW (~45dB)
+  { 16, 7.0, 0.90 },                    // QUALITY_MEDIUM (~70dB)
+  { 32, 9.0, 0.94 }                     // QUALITY_HIGH (~85dB, about the limit of 16-bit output)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Zeroth-order modified Bessel function of the first kind (Kaiser window)
+//
+static double BesselI0(double x) {
+  double sum = 1.0, term = 1.0;
+
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum  += term;
+
+    if (term < sum * 1e-12)
+      break;
+  }
+
+  return sum;
+}
+
+//
+// Filter inner loop, plain C; <numTaps> is a multiple of 4
+//
+static inline float DotProductC(const float* x, const float* c, int numTaps) {
+  float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+
+  for (int i = 0; i < numTaps; i += 4) {
+    acc0 += x[i + 0] * c[i + 0];
+    acc1 += x[i + 1] * c[i + 1];
+    acc2 += x[i + 2] * c[i + 2];
+    acc3 += x[i + 3] * c[i + 3];
+  }
+
+  return (acc0 + acc1) + (acc2 + acc3);
+}
+
+#ifdef RSMP_USE_SSE
+//
+// Filter inner loop, SSE; <numTaps> is a multiple of 4
+//
+static inline float DotProductSSE(const float* x, const float* c, int numTaps) {
+  __m128 acc = _mm_setzero_ps();
+
+  for (int i = 0; i < numTaps; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(c + i)));
+
+  float sums[4];
+  _mm_storeu_ps(sums, acc);
+
+  return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+//
+// Determines whether the processor supports SSE, and the OS saves the SSE
+//  registers across context switches
+//
+static bool IsSSEAvailable(void) {
+# if defined(_WIN32)
+  return IsProcessorFeaturePresent(PF_XMMI_INSTRUCTIONS_AVAILABLE) != FALSE;
+# elif defined(__SSE__)
+  return true;
+# else
+  return false;
+# endif
+}
+
+static const bool isSSEAvailable = IsSSEAvailable();
+#endif
+
+//
+// Filter inner loop; uses SSE when built in and supported at run time
+//
+static inline float DotProduct(const float* x, const float* c, int numTaps) {
+#ifdef RSMP_USE_SSE
+  if (isSSEAvailable)
+    return DotProductSSE(x, c, numTaps);
+#endif
+
+  return DotProductC(x, c, numTaps);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+CResampler::CResampler(void)
+  : m_numChannels(1), m_quality(QUALITY_MEDIUM), m_step(1.0), m_numTaps(0), m_cutoff(0.0), m_pos(0.0)
+{
+}
+
+CResampler::~CResampler(void)
+{
+}
+
+//
+// Sets up the converter; returns false if the parameters are invalid
+//
+bool CResampler::Init(int numChannels, double inRate, double outRate, quality_t quality) {
+  if ((numChannels < 1) || (numChannels > RSMP_MAX_CHANNELS) || (inRate <= 0.0) || (outRate <= 0.0))
+    return false;
+
+  m_numChannels = numChannels;
+  m_quality     = quality;
+  m_step        = inRate / outRate;
+  m_numTaps     = 0;
+
+  BuildFilter();
+  Reset();
+
+  return true;
+}
+
+//
+// Changes the conversion ratio.  The filter is only redesigned if the
+//  cutoff frequency moves significantly, so slowly varying ratios are cheap.
+//
+void CResampler::SetRates(double inRate, double outRate) {
+  if ((inRate <= 0.0) || (outRate <= 0.0))
+    return;
+
+  m_step = inRate / outRate;
+
+  double cutoff = qualityParams[m_quality].rolloff * ((m_step > 1.0) ? (1.0 / m_step) : 1.0);
+
+  if (fabs(cutoff - m_cutoff) > 0.02 * m_cutoff)
+    BuildFilter();
+}
+
+//
+// Discards all pending input; the next output frame corresponds to the
+//  next input frame written
+//
+void CResampler::Reset(void) {
+  int padding = (m_numTaps > 0) ? (m_numTaps / 2 - 1) : 0;
+
+  for (int ch = 0; ch < m_numChannels; ch++) {
+    m_history[ch].clear();
+    m_history[ch].resize(padding, 0.0f);
+  }
+
+  m_pos = 0.0;
+}
+
+//
+// Appends unsigned 8-bit (interleaved) input frames
+//
+void CResampler::Write(const unsigned char* data, int numFrames) {
+  for (int ch = 0; ch < m_numChannels; ch++) {
+    std::vector<float>& history = m_history[ch];
+    size_t offset = history.size();
+
+    history.resize(offset + numFrames);
+
+    for (int i = 0; i < numFrames; i++)
+      history[offset + i] = (float)(((int)data[i * m_numChannels + ch] - 128) << 8);
+  }
+}
+
+//
+// Appends signed 16-bit (interleaved) input frames
+//
+void CResampler::Write(const short* data, int numFrames) {
+  for (int ch = 0; ch < m_numChannels; ch++) {
+    std::vector<float>& history = m_history[ch];
+    size_t offset = history.size();
+
+    history.resize(offset + numFrames);
+
+    for (int i = 0; i < numFrames; i++)
+      history[offset + i] = (float)data[i * m_numChannels + ch];
+  }
+}
+
+//
+// Produces up to <maxFrames> signed 16-bit (interleaved) output frames;
+//  returns how many frames were produced
+//
+int CResampler::Read(short* data, int maxFrames) {
+  int i, k, ch;
+  int numFrames = 0;
+  int numInput  = (int)m_history[0].size();
+
+  if (m_numTaps == 0)
+    return 0;                           // not initialized
+
+  float* phase = &m_phase[0];
+
+  while ((numFrames < maxFrames) && ((int)m_pos + m_numTaps <= numInput)) {
+    int base    = (int)m_pos;
+    double p    = (m_pos - base) * RSMP_NUM_PHASES;
+    int row     = (int)p;
+    float alpha = (float)(p - row);
+
+    // Interpolate the coefficients between the two nearest phases
+    const float* c0 = &m_coefs[row * m_numTaps];
+    const float* c1 = c0 + m_numTaps;
+
+    for (k = 0; k < m_numTaps; k++)
+      phase[k] = c0[k] + alpha * (c1[k] - c0[k]);
+
+    for (ch = 0; ch < m_numChannels; ch++) {
+      float s = DotProduct(&m_history[ch][base], phase, m_numTaps);
+      i = (int)((s >= 0.0f) ? (s + 0.5f) : (s - 0.5f));
+      data[numFrames * m_numChannels + ch] = (short)((i > 32767) ? 32767 : (i < -32768) ? -32768 : i);
+    }
+
+    m_pos += m_step;
+    numFrames++;
+  }
+
+  Compact();
+
+  return numFrames;
+}
+
+//
+// Retrieves how many output frames can be produced with the input written
+//  so far
+//
+int CResampler::GetAvailable(void) {
+  if (m_numTaps == 0)
+    return 0;                           // not initialized
+
+  double span = (double)((int)m_history[0].size() - m_numTaps + 1) - m_pos;
+  return (span > 0.0) ? (int)ceil(span / m_step) : 0;
+}
+
+//
+// Retrieves how many input frames are waiting to be converted (not
+//  counting the filter's own delay)
+//
+int CResampler::GetBuffered(void) {
+  int numBuffered = (int)m_history[0].size() - (int)m_pos - (m_numTaps / 2 - 1);
+  return (numBuffered > 0) ? numBuffered : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Designs the polyphase filter for the current ratio, keeping the output
+//  continuous if the filter length changes
+//
+void CResampler::BuildFilter(void) {
+  int p, k, ch;
+
+  double cutoff = qualityParams[m_quality].rolloff * ((m_step > 1.0) ? (1.0 / m_step) : 1.0);
+  double beta   = qualityParams[m_quality].beta;
+
+  // Widen the filter when downsampling, so that the transition band stays
+  //  as narrow (relative to the output rate) as when upsampling
+  int numTaps = (int)ceil(qualityParams[m_quality].numTaps * qualityParams[m_quality].rolloff / cutoff);
+  numTaps = (numTaps + 3) & ~3;
+
+  if (numTaps > RSMP_MAX_TAPS)
+    numTaps = RSMP_MAX_TAPS;
+
+  // Re-align the pending input on the new filter length
+  if ((m_numTaps > 0) && (numTaps != m_numTaps)) {
+    double newPos = m_pos + (m_numTaps / 2 - 1) - (numTaps / 2 - 1);
+
+    if (newPos < 0.0) {
+      int padding = (int)ceil(-newPos);
+
+      for (ch = 0; ch < m_numChannels; ch++)
+        m_history[ch].insert(m_history[ch].begin(), padding, 0.0f);
+
+      newPos += padding;
+    }
+
+    m_pos = newPos;
+  }
+
+  m_numTaps = numTaps;
+  m_cutoff  = cutoff;
+
+  m_coefs.resize((RSMP_NUM_PHASES + 1) * m_numTaps);
+  m_phase.resize(m_numTaps);
+
+  double halfLen = m_numTaps / 2;
+  double norm    = BesselI0(beta);
+
+  for (p = 0; p <= RSMP_NUM_PHASES; p++) {
+    float* row = &m_coefs[p * m_numTaps];
+    double sum = 0.0;
+
+    for (k = 0; k < m_numTaps; k++) {
+      // Distance between the output instant and the input sample under tap k
+      double d = (halfLen - 1) + (double)p / RSMP_NUM_PHASES - k;
+      double u = d / halfLen;
+      double x = RSMP_PI * cutoff * d;
+
+      double sinc   = (fabs(x) < 1e-9) ? 1.0 : (sin(x) / x);
+      double window = (fabs(u) < 1.0) ? (BesselI0(beta * sqrt(1.0 - u * u)) / norm) : 0.0;
+
+      row[k] = (float)(cutoff * sinc * window);
+      sum += row[k];
+    }
+
+    // Unity gain at DC for every phase (no amplitude ripple)
+    for (k = 0; k < m_numTaps; k++)
+      row[k] = (float)(row[k] / sum);
+  }
+}
+
+//
+// Discards consumed input
+//
+void CResampler::Compact(void) {
+  int consumed = (int)m_pos;
+
+  if (consumed < RSMP_COMPACT_LEN)
+    return;
+
+  for (int ch = 0; ch < m_numChannels; ch++)
+    m_history[ch].erase(m_history[ch].begin(), m_history[ch].begin() + consumed);
+
+  m_pos -= consumed;
+}
@@ -0,0 +1,57 @@
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#include <vector>
+
+#define RSMP_MAX_CHANNELS 2
+
+//
+// Band-limited sample rate converter (windowed-sinc, polyphase).  Input is
+//  fed incrementally (Write), and output is produced as soon as enough
+//  input is available (Read).  The conversion ratio may be changed at any
+//  time (SetRates), e.g. to follow a drifting or measured input rate, and
+//  the output remains continuous.
+//
+// The filter inner loop is plain C, plus an SSE version when RSMP_USE_SSE is
+//  defined (as the projects do; VC6 requires the Processor Pack).  The SSE
+//  version is only used if the processor supports it, checked at run time.
+//
+class CResampler {
+  public:
+    enum quality_t { QUALITY_LOW, QUALITY_MEDIUM, QUALITY_HIGH };
+
+  public:
+    CResampler(void);
+    ~CResampler(void);
+
+  public:
+    bool Init(int numChannels, double inRate, double outRate, quality_t quality = QUALITY_MEDIUM);
+    void SetRates(double inRate, double outRate);
+    void Reset(void);
+
+    void Write(const unsigned char* data, int numFrames);   // unsigned 8-bit samples
+    void Write(const short* data, int numFrames);           // signed 16-bit samples
+    int Read(short* data, int maxFrames);                   // signed 16-bit samples
+
+    int GetAvailable(void);
+    int GetBuffered(void);
+
+  protected:
+    void BuildFilter(void);
+    void Compact(void);
+
+  protected:
+    int m_numChannels;
+    quality_t m_quality;
+    double m_step;                      // input frames per output frame
+
+    int m_numTaps;                      // filter length (multiple of 4)
+    double m_cutoff;                    // cutoff frequency, relative to the input Nyquist frequency
+    std::vector<float> m_coefs;         // (RSMP_NUM_PHASES + 1) rows of m_numTaps coefficients
+    std::vector<float> m_phase;         // coefficients interpolated for the current output frame
+
+    std::vector<float> m_history[RSMP_MAX_CHANNELS];  // pending input, one buffer per channel
+    double m_pos;                       // position of the first filter tap in m_history
+};
+
+#endif //__RESAMPLER_H__
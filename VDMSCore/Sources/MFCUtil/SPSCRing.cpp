@@ -0,0 +1,132 @@
+#include "stdafx.h"
+
+#include "SPSCRing.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+CSPSCRing::CSPSCRing(void)
+  : m_data(NULL), m_size(0), m_mask(0), m_writePos(0), m_readPos(0)
+{
+}
+
+CSPSCRing::~CSPSCRing(void)
+{
+  Destroy();
+}
+
+//
+// Allocates a buffer of at least <minSize> bytes; returns false if out of
+//  memory
+//
+bool CSPSCRing::Create(LONG minSize) {
+  Destroy();
+
+  LONG size = 16;
+
+  while ((size < minSize) && (size < 0x40000000))
+    size <<= 1;
+
+  if ((m_data = new BYTE[size]) == NULL)
+    return false;
+
+  m_size = size;
+  m_mask = size - 1;
+
+  Reset();
+
+  return true;
+}
+
+//
+// Releases the buffer
+//
+void CSPSCRing::Destroy(void) {
+  delete[] m_data;
+
+  m_data = NULL;
+  m_size = 0;
+  m_mask = 0;
+
+  Reset();
+}
+
+//
+// Discards all buffered data
+//
+void CSPSCRing::Reset(void) {
+  InterlockedExchange((LPLONG)&m_writePos, 0);
+  InterlockedExchange((LPLONG)&m_readPos, 0);
+}
+
+//
+// Appends up to <length> bytes; returns how many bytes were written (less
+//  than <length> if the buffer is full)
+//
+LONG CSPSCRing::Write(const void* data, LONG length) {
+  LONG writePos = m_writePos;
+  LONG numFree  = m_size - (writePos - m_readPos);
+
+  if (length > numFree)
+    length = numFree;
+
+  if (length <= 0)
+    return 0;
+
+  LONG offset = writePos & m_mask;
+  LONG length1 = (offset + length > m_size) ? (m_size - offset) : length;
+
+  memcpy(m_data + offset, data, length1);
+  memcpy(m_data, (const BYTE*)data + length1, length - length1);
+
+  // Publish the data (the interlocked operation is a full memory barrier)
+  InterlockedExchange((LPLONG)&m_writePos, writePos + length);
+
+  return length;
+}
+
+//
+// Removes up to <length> bytes; returns how many bytes were read (less
+//  than <length> if the buffer runs empty)
+//
+LONG CSPSCRing::Read(void* data, LONG length) {
+  LONG readPos = m_readPos;
+  LONG numUsed = m_writePos - readPos;
+
+  if (length > numUsed)
+    length = numUsed;
+
+  if (length <= 0)
+    return 0;
+
+  LONG offset = readPos & m_mask;
+  LONG length1 = (offset + length > m_size) ? (m_size - offset) : length;
+
+  memcpy(data, m_data + offset, length1);
+  memcpy((BYTE*)data + length1, m_data, length - length1);
+
+  // Release the space (the interlocked operation is a full memory barrier)
+  InterlockedExchange((LPLONG)&m_readPos, readPos + length);
+
+  return length;
+}
+
+//
+// Retrieves how many bytes are waiting to be read
+//
+LONG CSPSCRing::GetUsed(void) const {
+  return m_writePos - m_readPos;
+}
+
+//
+// Retrieves how many bytes can be written without overflowing
+//
+LONG CSPSCRing::GetFree(void) const {
+  return m_size - (m_writePos - m_readPos);
+}
+
+//
+// Retrieves the capacity of the buffer
+//
+LONG CSPSCRing::GetSize(void) const {
+  return m_size;
+}
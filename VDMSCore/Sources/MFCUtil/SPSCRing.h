@@ -0,0 +1,39 @@
+#ifndef __SPSCRING_H__
+#define __SPSCRING_H__
+
+//
+// Lock-free circular byte buffer for exactly one producer thread (Write)
+//  and one consumer thread (Read).  Neither side ever blocks or waits on
+//  the other: the producer only advances the write position and the
+//  consumer only advances the read position, each publishing its position
+//  with an interlocked operation once the data has been copied.
+// Create, Destroy and Reset are not thread-safe; call them while neither
+//  side is accessing the buffer.
+//
+class CSPSCRing {
+  public:
+    CSPSCRing(void);
+    ~CSPSCRing(void);
+
+  public:
+    bool Create(LONG minSize);
+    void Destroy(void);
+    void Reset(void);
+
+    LONG Write(const void* data, LONG length);   // producer side
+    LONG Read(void* data, LONG length);          // consumer side
+
+    LONG GetUsed(void) const;
+    LONG GetFree(void) const;
+    LONG GetSize(void) const;
+
+  protected:
+    BYTE* m_data;
+    LONG m_size;                        // capacity, in bytes (a power of two)
+    LONG m_mask;                        // m_size - 1
+
+    volatile LONG m_writePos;           // total bytes written to date (modulo 2^32); only advanced by the producer
+    volatile LONG m_readPos;            // total bytes read to date (modulo 2^32); only advanced by the consumer
+};
+
+#endif //__SPSCRING_H__
@@ -0,0 +1,203 @@
+#include "stdafx.h"
+
+#include "SinkTelemetry.h"
+
+#include "MFCUtil.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+CSinkTelemetry::CSinkTelemetry(void)
+  : m_bytesPerSecond(44100 * 4)
+{
+  InitializeCriticalSection(&m_mutex);
+  Reset();
+}
+
+CSinkTelemetry::~CSinkTelemetry(void)
+{
+  DeleteCriticalSection(&m_mutex);
+}
+
+//
+// Sets the data rate fill levels are converted to milliseconds with
+//
+void CSinkTelemetry::SetFormat(long bytesPerSecond) {
+  EnterCriticalSection(&m_mutex);
+  m_bytesPerSecond = (bytesPerSecond > 0) ? bytesPerSecond : 1;
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Clears the statistics
+//
+void CSinkTelemetry::Reset(void) {
+  EnterCriticalSection(&m_mutex);
+
+  m_underruns = 0;
+  m_underrunTime = 0.0;
+  m_overruns = 0;
+  m_overrunBytes = 0;
+  m_fill = m_peakFill = 0;
+
+  memset(m_latency, 0, sizeof(m_latency));
+
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Records <count> new underruns, and how long (milliseconds) the device ran
+//  dry for since this was last called (an underrun may be reported over
+//  several calls, the first of which counts it)
+//
+void CSinkTelemetry::AddUnderruns(long count, double duration) {
+  EnterCriticalSection(&m_mutex);
+
+  m_underruns += (count > 0) ? count : 0;
+  m_underrunTime += (duration > 0.0) ? duration : 0.0;
+
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Records that <length> bytes were dropped
+//
+void CSinkTelemetry::AddOverrun(long length) {
+  EnterCriticalSection(&m_mutex);
+
+  m_overruns++;
+  m_overrunBytes += length;
+
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Records how many bytes the sink held (waiting to be played) when data
+//  was delivered
+//
+void CSinkTelemetry::AddFill(long length) {
+  EnterCriticalSection(&m_mutex);
+
+  int bin = (int)(((double)length * 1000 / m_bytesPerSecond) / TLM_BIN_WIDTH);
+
+  m_fill = length;
+  m_peakFill = (length > m_peakFill) ? length : m_peakFill;
+  m_latency[(bin < TLM_HISTOGRAM_LEN) ? bin : (TLM_HISTOGRAM_LEN - 1)]++;
+
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Retrieves how many underruns occurred
+//
+long CSinkTelemetry::GetUnderruns(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = m_underruns;
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Retrieves how long (milliseconds) the device ran dry for, in total
+//
+long CSinkTelemetry::GetUnderrunTime(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = (long)m_underrunTime;
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Retrieves how many packets were dropped
+//
+long CSinkTelemetry::GetOverruns(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = m_overruns;
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Retrieves how much audio (milliseconds) was dropped, in total
+//
+long CSinkTelemetry::GetOverrunTime(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = (long)((double)m_overrunBytes * 1000 / m_bytesPerSecond);
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Retrieves the latest fill level (milliseconds)
+//
+long CSinkTelemetry::GetFill(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = (long)((double)m_fill * 1000 / m_bytesPerSecond);
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Retrieves the highest fill level (milliseconds)
+//
+long CSinkTelemetry::GetPeakFill(void) {
+  EnterCriticalSection(&m_mutex);
+  long retVal = (long)((double)m_peakFill * 1000 / m_bytesPerSecond);
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
+
+//
+// Copies (up to <numBins> bins of) the latency histogram; bin i counts the
+//  deliveries that found between i * TLM_BIN_WIDTH and (i + 1) *
+//  TLM_BIN_WIDTH milliseconds of audio in the sink
+//
+void CSinkTelemetry::GetLatencyHistogram(long* histogram, int numBins) {
+  EnterCriticalSection(&m_mutex);
+
+  for (int i = 0; i < numBins; i++)
+    histogram[i] = (i < TLM_HISTOGRAM_LEN) ? (long)m_latency[i] : 0;
+
+  LeaveCriticalSection(&m_mutex);
+}
+
+//
+// Summarizes the statistics (for logging)
+//
+CString CSinkTelemetry::GetReport(void) {
+  EnterCriticalSection(&m_mutex);
+
+  unsigned long numSamples = 0;
+  int i;
+
+  for (i = 0; i < TLM_HISTOGRAM_LEN; i++)
+    numSamples += m_latency[i];
+
+  CString retVal = Format(_T("%d underrun(s) (%dms of silence), %d overrun(s) (%dms dropped), fill %dms (peak %dms)"),
+                          m_underruns, (int)m_underrunTime, m_overruns, (int)((double)m_overrunBytes * 1000 / m_bytesPerSecond),
+                          (int)((double)m_fill * 1000 / m_bytesPerSecond), (int)((double)m_peakFill * 1000 / m_bytesPerSecond));
+
+  if (numSamples > 0) {
+    retVal += _T("; latency distribution:");
+
+    for (i = 0; i < TLM_HISTOGRAM_LEN; i++) {
+      if (m_latency[i] == 0)
+        continue;
+
+      if (i < TLM_HISTOGRAM_LEN - 1) {
+        retVal += Format(_T(" %d-%dms %0.1f%%"), i * TLM_BIN_WIDTH, (i + 1) * TLM_BIN_WIDTH, 100.0 * m_latency[i] / numSamples);
+      } else {
+        retVal += Format(_T(" %dms+ %0.1f%%"), i * TLM_BIN_WIDTH, 100.0 * m_latency[i] / numSamples);
+      }
+    }
+  }
+
+  LeaveCriticalSection(&m_mutex);
+
+  return retVal;
+}
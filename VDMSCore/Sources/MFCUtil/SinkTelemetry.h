@@ -0,0 +1,51 @@
+#ifndef __SINKTELEMETRY_H__
+#define __SINKTELEMETRY_H__
+
+#define TLM_HISTOGRAM_LEN   32          // how many bins the latency histogram has (the last one collects everything beyond)
+#define TLM_BIN_WIDTH       10          // width of a latency histogram bin (milliseconds)
+
+//
+// Playback statistics of an audio output sink: underruns (how many, and
+//  how much silence they caused), overruns (how many packets were dropped,
+//  and how much audio they held), the current and peak fill level, and a
+//  histogram of the fill levels seen on delivery (i.e. of the latency
+//  actually achieved).  All members are thread-safe, so that the
+//  statistics can be queried while the sink is playing.
+//
+class CSinkTelemetry {
+  public:
+    CSinkTelemetry(void);
+    ~CSinkTelemetry(void);
+
+  public:
+    void SetFormat(long bytesPerSecond);
+    void Reset(void);
+
+    void AddUnderruns(long count, double duration);
+    void AddOverrun(long length);
+    void AddFill(long length);
+
+    long GetUnderruns(void);
+    long GetUnderrunTime(void);
+    long GetOverruns(void);
+    long GetOverrunTime(void);
+    long GetFill(void);
+    long GetPeakFill(void);
+    void GetLatencyHistogram(long* histogram, int numBins);
+
+    CString GetReport(void);
+
+  protected:
+    CRITICAL_SECTION m_mutex;
+
+    long m_bytesPerSecond;
+
+    long m_underruns;
+    double m_underrunTime;              // milliseconds of silence caused by underruns
+    long m_overruns;
+    LONGLONG m_overrunBytes;            // how many bytes were dropped by overruns
+    long m_fill, m_peakFill;            // in bytes
+    unsigned long m_latency[TLM_HISTOGRAM_LEN];
+};
+
+#endif //__SINKTELEMETRY_H__
@@ -156,3 +156,34 @@ _bstr_t AFXAPI CFG_Get(
     } return defaultValue;
   }
 }
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Timing functions
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Retrieves the value of the system's monotonic clock (microseconds).  The
+//  clock is the same in all modules, so that timestamps taken in one module
+//  (e.g. the usDelta of MIDI messages) can be compared with the time in
+//  another.
+//
+LONGLONG AFXAPI TIM_GetMicros(void)
+{
+  static LARGE_INTEGER perfCountFreq = { 0 };
+
+  if ((perfCountFreq.QuadPart == 0) && !QueryPerformanceFrequency(&perfCountFreq))
+    perfCountFreq.QuadPart = 1;
+
+  if (perfCountFreq.QuadPart < 1000) {
+    return GetTickCount() * (LONGLONG)1000;
+  } else {
+    LARGE_INTEGER currentCount;
+    VERIFY(QueryPerformanceCounter(&currentCount));
+    // Split the conversion, so that it does not overflow on long uptimes
+    return (currentCount.QuadPart / perfCountFreq.QuadPart) * (LONGLONG)1000000 + ((currentCount.QuadPart % perfCountFreq.QuadPart) * (LONGLONG)1000000) / perfCountFreq.QuadPart;
+  }
+}
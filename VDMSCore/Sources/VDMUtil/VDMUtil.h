@@ -12,4 +12,6 @@ IUnknown* AFXAPI DEP_Get(IVDMQUERYLib::IVDMQueryDependenciesPtr& dependencies, _
 int AFXAPI CFG_Get(IVDMQUERYLib::IVDMQueryConfigurationPtr& configuration, _bstr_t name, int defaultValue, int base = 10, bool isSilent = false);
 _bstr_t AFXAPI CFG_Get(IVDMQUERYLib::IVDMQueryConfigurationPtr& configuration, _bstr_t name, _bstr_t defaultValue, bool isSilent = false);
 
+LONGLONG AFXAPI TIM_GetMicros(void);
+
 #endif //__VDMUTIL_H_
@@ -32,6 +32,7 @@ extern CComModule _Module;
 #include <mmsystem.h>
 #include <dsound.h>
 #pragma comment ( lib , "dsound.lib" )
+#pragma comment ( lib , "dxguid.lib" )
 
 //{{AFX_INSERT_LOCATION}}
 // Microsoft Visual C++ will insert additional declarations immediately before the previous line.
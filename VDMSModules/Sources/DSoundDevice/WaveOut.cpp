@@ -13,13 +13,19 @@
 
 #define INI_STR_DEVICEID      L"device"
 #define INI_STR_BUFOPRANGE    L"buffer"
+#define INI_STR_BUFMIN        L"bufferMin"
+#define INI_STR_BUFMAX        L"bufferMax"
+#define INI_STR_BUFPERCENTILE L"bufferPercentile"
+#define INI_STR_SAMPLERATE    L"sampleRate"
+#define INI_STR_CHANNELS      L"channels"
 #define INI_STR_WAVEOUT       L"WaveOut"
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define TOLERANCE_FREQ        10    // how much % change in frequency does not justify re-creating the DSound buffer due to format change
 #define BUF_CHUNKS            4     // how big the DSound buffer should be as a multiple of the normal audio buffering amount
 #define BUF_MINLEN            1500  // minimum buffer length (in milliseconds)
+#define BUF_NOTIFICATIONS     16    // how many DSound position notifications are spread over the DSound buffer
+#define LATENCY_DECAY         1024  // by how much (relative) the DSound latency peak decays with each write, so that it recovers from one-off spikes
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -41,7 +47,9 @@ STDMETHODIMP CWaveOut::InterfaceSupportsErrorInfo(REFIID riid)
 	static const IID* arr[] = 
 	{
     &IID_IVDMBasicModule,
-    &IID_IWaveDataConsumer
+    &IID_IWaveDataConsumer,
+    &IID_IWaveBufferInfo,
+    &IID_IWaveTelemetry
 	};
 	for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
 	{
@@ -81,6 +89,23 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
     // Try to obtain the buffer operating range (milliseconds), use default if none specified
     m_bufOpRange = CFG_Get(Config, INI_STR_BUFOPRANGE, 125, 10, false);
 
+    // Try to obtain the adaptive buffering settings (milliseconds, percentile; 0 = fixed buffering), use defaults if none specified
+    m_bufferSizer.Init(m_bufOpRange, CFG_Get(Config, INI_STR_BUFMIN, 20, 10, true), CFG_Get(Config, INI_STR_BUFMAX, 500, 10, true), CFG_Get(Config, INI_STR_BUFPERCENTILE, 99, 10, true));
+
+    // Try to obtain the DSound buffer's playback format, use default if none specified
+    m_sampleRate  = CFG_Get(Config, INI_STR_SAMPLERATE, 44100, 10, true);
+    m_numChannels = CFG_Get(Config, INI_STR_CHANNELS, 2, 10, true);
+
+    if ((m_sampleRate < DSBFREQUENCY_MIN) || (m_sampleRate > DSBFREQUENCY_MAX)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Sample rate (%dHz) is out of range; playing back at 44100Hz"), m_sampleRate));
+      m_sampleRate = 44100;
+    }
+
+    if ((m_numChannels < 1) || (m_numChannels > 2)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Number of channels (%d) is out of range; playing back in stereo"), m_numChannels));
+      m_numChannels = 2;
+    }
+
     /** Get modules ********************************************************/
 
     // Try to obtain an interface to a Wave-out module, use NULL if none available
@@ -90,13 +115,46 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
     return ce.Error();                // Propagate the error
   }
 
-  m_bufferDuration = max(BUF_MINLEN, BUF_CHUNKS * m_bufOpRange);  // Decide how long (in milliseconds) the DSound buffer should be
+  m_bufferDuration = max(BUF_MINLEN, BUF_CHUNKS * m_bufferSizer.GetMaxSize());  // Decide how long (in milliseconds) the DSound buffer should be
   m_deviceName = DSoundGetName(&m_deviceGUID);                    // Obtain information about the device (name and GUID)
 
-  // Create the garbage-collector thread (manages packets that have finished playing)
-  m_gcThread.Create(this, _T("DirectSound Garbage Collector"), true);      /* TODO: check that creation was successful */
-  m_gcThread.SetPriority(THREAD_PRIORITY_ABOVE_NORMAL);
-  m_gcThread.Resume();
+  // The DSound buffer always has the same format (16-bit PCM), whatever the
+  //  format of the data; the data is converted as it comes in, and format
+  //  changes never cause the buffer to be re-created
+  m_waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+  m_waveFormat.nChannels = m_numChannels;
+  m_waveFormat.nSamplesPerSec = m_sampleRate;
+  m_waveFormat.nAvgBytesPerSec = m_numChannels * m_sampleRate * 2;
+  m_waveFormat.nBlockAlign = m_numChannels * 2;
+  m_waveFormat.wBitsPerSample = 16;
+  m_waveFormat.cbSize = 0;
+
+  m_converter.SetOutputFormat(m_numChannels, m_sampleRate);
+  m_telemetry.SetFormat(m_waveFormat.nAvgBytesPerSec);
+
+  // Compute desired buffer length (in bytes)
+  m_bufferLen = (int)((m_bufferDuration / 1000.0) * m_waveFormat.nAvgBytesPerSec);
+  m_bufferLen = m_bufferLen + 4 - (m_bufferLen % 4);  // make sure we are properly aligned for stereo 16-bit sound
+  m_bufferLen = max(DSBSIZE_MIN, min(DSBSIZE_MAX, m_bufferLen));  // make sure the value falls within the acceptable DirectSound bounds
+
+  // Compute the ideal amount of buffering (in bytes)
+  UpdateBufferSize();
+
+  InterlockedExchange((LPLONG)&m_deviceBytes, 0);
+  InterlockedExchange((LPLONG)&m_targetBytes, (m_bufferedLo + m_bufferedHi) / 2);
+
+  // Create the buffer PlayData hands the data over through
+  if (!m_ring.Create(m_bufferLen))
+    return E_OUTOFMEMORY;
+
+  // Create the events the device-writer thread waits on (auto-reset)
+  m_hDataEvent   = CreateEvent(NULL, FALSE, FALSE, NULL);
+  m_hNotifyEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  // Create the device-writer thread (moves data to the DSound buffer, and silences played data)
+  m_writerThread.Create(this, _T("DirectSound Writer"), true);      /* TODO: check that creation was successful */
+  m_writerThread.SetPriority(THREAD_PRIORITY_ABOVE_NORMAL);
+  m_writerThread.Resume();
 
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut initialized (device ID = %d, '%s')"), m_deviceID, (LPCTSTR)m_deviceName));
 
@@ -104,6 +162,21 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
 }
 
 STDMETHODIMP CWaveOut::Destroy() {
+  // Report the buffering the measurements settled at, so that it can be
+  //  used as the starting point next time
+  if (m_bufferSizer.IsAdaptive())
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut buffer settled at %dms (set 'buffer = %d' to start there)"), m_bufferSize, m_bufferSize));
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut statistics: %s"), (LPCTSTR)m_telemetry.GetReport()));
+
+  // Signal the device-writer thread to quit (before taking the lock, which
+  //  the thread may be waiting on)
+  if (m_writerThread.GetThreadHandle() != NULL) {
+    m_writerThread.PostMessage(WM_QUIT, NULL, NULL);
+    SetEvent(m_hDataEvent);             // wake it up
+    m_writerThread.Join(1000);
+  }
+
   // Gain exclusive access to the DSound buffer and related variables
   CSingleLock lock(&m_mutex, TRUE);
 
@@ -111,9 +184,14 @@ STDMETHODIMP CWaveOut::Destroy() {
   if (m_lpDirectSound != NULL)
     DSoundClose();
 
-  // Signal the GC thread to quit
-  if (m_gcThread.GetThreadHandle() != NULL)
-    m_gcThread.Cancel();
+  if (m_hDataEvent != NULL)
+    CloseHandle(m_hDataEvent);
+  if (m_hNotifyEvent != NULL)
+    CloseHandle(m_hNotifyEvent);
+
+  m_hDataEvent = m_hNotifyEvent = NULL;
+
+  m_ring.Destroy();
 
   // Release the Wave-out module
   m_waveOut = NULL;
@@ -132,66 +210,22 @@ STDMETHODIMP CWaveOut::Destroy() {
 /////////////////////////////////////////////////////////////////////////////
 
 STDMETHODIMP CWaveOut::SetFormat(WORD channels, DWORD samplesPerSec, WORD bitsPerSample) {
-  HRESULT hrThis = S_OK, hrThat = S_OK, hr;
-
-  /* TODO: first store the format (!), then check DSound and try to open the
-     device if needed, then call a Close then an Open fn. for the secondary
-     buffer
-   */
-
-  // Gain exclusive access to the DSound buffer and related variables
-  CSingleLock lock(&m_mutex, TRUE);
-
-  if ((m_lpDirectSound == NULL) && (!DSoundOpen(false)))
-    hrThis = S_FALSE;         // The device is not open, and an attempt to open it failed
-
-  // Check if the buffer has to be (re)created either because it was not
-  //  created before, or following a change in playback format that requires
-  //  the buffer to be released then created again with the new format
-  if ((m_lpDirectSoundBuffer == NULL) ||
-      (m_waveFormat.nChannels != channels) ||
-      (m_waveFormat.nSamplesPerSec * (1.00 - TOLERANCE_FREQ / 100.0) > samplesPerSec) || // accept 10% tolerance in freq. change, avoids excessive overhead in
-      (m_waveFormat.nSamplesPerSec * (1.00 + TOLERANCE_FREQ / 100.0) < samplesPerSec) || // closing/re-opening the device (some games abuse the time-constant)
-      (m_waveFormat.wBitsPerSample != bitsPerSample))
+  HRESULT hrThis = S_OK, hrThat = S_OK;
+
+  // The DSound buffer stays as it is (in its own format) across format
+  //  changes; only the conversion of the data that follows is affected.
+  //  The converter is only ever used by the producer (SetFormat and
+  //  PlayData), so this needs no locking either.
+  if (((channels != 1) && (channels != 2)) ||
+      ((bitsPerSample != 8) && (bitsPerSample != 16)) ||
+      (samplesPerSec == 0))
   {
-    // If the buffer is open, try to close it first
-    if (m_lpDirectSoundBuffer != NULL)
-      DSoundCloseBuffer();
-
-    // Change the format
-    m_waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-    m_waveFormat.nChannels = channels;
-    m_waveFormat.nSamplesPerSec = samplesPerSec;
-    m_waveFormat.nAvgBytesPerSec = channels * samplesPerSec * bitsPerSample / 8;
-    m_waveFormat.nBlockAlign = channels * bitsPerSample / 8;
-    m_waveFormat.wBitsPerSample = bitsPerSample;
-    m_waveFormat.cbSize = 0;
-
-    // Compute desired buffer length (in bytes)
-    m_bufferLen = (int)((m_bufferDuration / 1000.0) * m_waveFormat.nAvgBytesPerSec);
-    m_bufferLen = m_bufferLen + 4 - (m_bufferLen % 4);  // make sure we are properly aligned for stereo 16-bit sound
-    m_bufferLen = max(DSBSIZE_MIN, min(DSBSIZE_MAX, m_bufferLen));  // make sure the value falls within the acceptable DirectSound bounds
-
-    // Open the buffer with the new format
-    DSoundOpenBuffer();
-
-    if ((m_lpDirectSoundBuffer != NULL) && FAILED(hr = m_lpDirectSoundBuffer->Play(0, 0, DSBPLAY_LOOPING)))
-      hrThis = hr;
-
-    // Initialize local buffer state
-    m_DSoundLatency = 0;  // the DSound latency for this audio format is unknown yet
-    m_bufferPos = 0;      // we are at the start of the buffer (no data is enqueued yet)
-    m_playedBytes = 0;    // no bytes went through DSound yet
-    m_sentBytes = 0;      // no bytes came from the application for playback yet
-    m_lastPlayPos = 0;    // we are at the start of the buffer (playback did not begin yet)
-
-    // Compute the ideal amount of buffering (in bytes)
-    m_bufferedLo = m_waveFormat.nAvgBytesPerSec * m_bufOpRange / 1000;
-    m_bufferedHi = m_bufferedLo * 2;
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Unsupported format (%d channels, %dHz, %d bits)"), (int)channels, (int)samplesPerSec, (int)bitsPerSample));
+    hrThis = S_FALSE;
+  } else {
+    m_converter.SetInputFormat(channels, samplesPerSec, bitsPerSample);
   }
 
-  lock.Unlock();
-
   // Forward the call to other module(s) daisy-chained after us (if any)
   if (m_waveOut != NULL)
     hrThat = m_waveOut->SetFormat(channels, samplesPerSec, bitsPerSample);
@@ -206,89 +240,70 @@ STDMETHODIMP CWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
   if (load == NULL)
     return E_POINTER;
 
-  HRESULT hrThis = S_OK, hrThat = S_OK, hr;
+  HRESULT hrThis = S_OK, hrThat = S_OK;
   DOUBLE loadThis = 1.0, loadThat = 1.0;
 
-  // Gain exclusive access to the DSound buffer and related variables
-  CSingleLock lock(&m_mutex, TRUE);
-
-  if (((m_lpDirectSound == NULL) && (!DSoundOpen(false))) ||
-      ((m_lpDirectSoundBuffer == NULL) && (!DSoundOpenBuffer())))
-  {
-    hrThis = S_FALSE;         // The device is not open, and an attempt to open it failed
+  // Hand the data over to the device-writer thread.  This never waits on
+  //  DirectSound, nor on the writer thread: driver calls (and their latency
+  //  spikes) stay out of the emulation threads.
+  if (m_ring.GetSize() == 0) {
+    hrThis = S_FALSE;         // Not initialized (or no memory for the ring buffer)
   } else {
-    try {
-      // Get an process playback indicators from the DSound buffer
-      DWORD dwCurrentWriteCursor, dwCurrentReadCursor;  // safe-write and read cursors in the DSound buffer
-      LONG  commitLen;  // how many bytes (the data between the safe-write and read cursors) were commited by DSound to the device and should not be touched
-
-      if (FAILED(hr = m_lpDirectSoundBuffer->GetCurrentPosition(&dwCurrentReadCursor, &dwCurrentWriteCursor)))
-        throw hr;
-
-      commitLen = (LONG)(m_bufferLen + dwCurrentWriteCursor - dwCurrentReadCursor) % m_bufferLen;
-      m_DSoundLatency = max(m_DSoundLatency, commitLen); // worst-case commit length, indicates latency in DSound mixing and output
-
-      // Work around horrible DirectSound bug, which makes the play cursor jerk
-      //  forward once in a while, then go backwards to its normal position.
-      if (((LONG)(m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen) > (3 * m_bufferLen / 4)) {
-        dwCurrentReadCursor = m_lastPlayPos;  // refuse to back up the play cursor !
-        commitLen = (LONG)(m_bufferLen + dwCurrentWriteCursor - dwCurrentReadCursor) % m_bufferLen; // recompute the commit range
-      }
+    DWORD curTime = timeGetTime();
 
-      // Compute how many bytes were played through the DSound device to date
-      m_playedBytes += (m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen;
-      m_lastPlayPos = dwCurrentReadCursor;
+    // Measure the jitter: how irregularly the data comes in, how much data
+    //  DSound commits itself to at once, and whether the writer found
+    //  playback ahead of the data in between two deliveries (after a
+    //  longer gap, that is a pause in playback, not an underrun)
+    LONG underruns = m_underruns;
+    LONG underrunBytes = InterlockedExchange((LPLONG)&m_underrunBytes, 0);
 
-      // Compute by how much we are leading playback
-      LONG bufferedBytes = max(0, m_sentBytes - m_playedBytes);
+    if (m_lastDelivery != 0) {
+      DWORD interval = curTime - m_lastDelivery;
 
-      // If lagging, adjust write cursor to avoid writing in an area that was already played
-      //  and is a candidate for silencing, or that is in the process of being played (commited).
-      if (bufferedBytes < commitLen) {
-        m_bufferPos = (dwCurrentReadCursor + m_DSoundLatency) % m_bufferLen;  // start writing at an early, write-safe position to avoid long audio interruptions
-        m_sentBytes = m_playedBytes + m_DSoundLatency; // adjust amount of (supposedly) sent bytes to match new write position
-      }
+      m_bufferSizer.AddDelivery(interval);
 
-      // Write the new audio data to the DirectSound buffer
-      BYTE* data1, * data2;
-      DWORD length1, length2;
-      DWORD maxLength = min(length, m_bufferLen);
+      if (interval < BSZ_HISTOGRAM_LEN) {
+        if (underruns != m_lastUnderruns)
+          m_bufferSizer.AddUnderrun();
 
-      if (FAILED(hr = m_lpDirectSoundBuffer->Lock(m_bufferPos, maxLength, (LPVOID*)(&data1), &length1, (LPVOID*)(&data2), &length2, 0)))
-        throw hr;
+        if (underrunBytes > 0)
+          m_telemetry.AddUnderruns(underruns - m_lastUnderruns, 1000.0 * underrunBytes / m_waveFormat.nAvgBytesPerSec);
+      }
+    }
 
-      if (data1 != NULL) memcpy(data1, data, length1);
-      if (data2 != NULL) memcpy(data2, data + length1, length2);
+    LONG commitBytes = InterlockedExchange((LPLONG)&m_commitBytes, 0);
 
-      if (FAILED(hr = m_lpDirectSoundBuffer->Unlock(data1, length1, data2, length2)))
-        hrThis = hr;
+    if (commitBytes > 0)
+      m_bufferSizer.AddDeviceQuantum(1000.0 * commitBytes / m_waveFormat.nAvgBytesPerSec);
 
-      // Make sure the buffer isn't stopped
-      if (FAILED(hr = m_lpDirectSoundBuffer->Play(0, 0, DSBPLAY_LOOPING)))
-        hrThis = hr;
+    m_lastUnderruns = underruns;
+    m_lastDelivery = curTime;
 
-      // Advance our write cursor, and count the data as successfully "sent"
-      m_bufferPos = (m_bufferPos + maxLength) % m_bufferLen;
-      m_sentBytes += maxLength;
+    if (m_bufferSizer.Update(curTime / 1000.0))
+      UpdateBufferSize();
 
-      _ASSERTE(m_playedBytes % m_bufferLen == (LONG)dwCurrentReadCursor);
-      _ASSERTE(m_sentBytes % m_bufferLen == m_bufferPos);
+    LONG outLength = 0;
+    const BYTE* outData = m_converter.Convert(data, length, &outLength);
 
-      // Compute how off-target we are with buffering
-      LONG loMark = max(m_bufferedLo, 2 * m_DSoundLatency);
-      LONG hiMark = max(m_bufferedHi, 3 * m_DSoundLatency);
+    m_telemetry.AddFill(m_ring.GetUsed() + m_deviceBytes);
 
-      if (bufferedBytes < loMark) {
-        loadThis = (double)bufferedBytes / loMark;
-      } else if (bufferedBytes > hiMark) {
-        loadThis = (double)bufferedBytes / hiMark;
-      }
-    } catch (HRESULT hr) {
-      hrThis = hr;              // Propagate the error
+    if (m_ring.GetFree() >= outLength) {
+      m_ring.Write(outData, outLength);
+      SetEvent(m_hDataEvent);
+    } else {
+      hrThis = S_FALSE;       // Overrun (the device is not consuming); drop whole packets only, to stay frame-aligned
+      m_telemetry.AddOverrun(outLength);
     }
-  }
 
-  lock.Unlock();
+    // Compute how off-target we are with buffering, relative to the middle
+    //  of the optimal range; producers trim their rate in proportion (see
+    //  CRateControl)
+    LONG targetBytes = m_targetBytes;
+
+    if (targetBytes > 0)
+      loadThis = (double)(m_ring.GetUsed() + m_deviceBytes) / targetBytes;
+  }
 
   // Forward the call to other module(s) daisy-chained after us (if any)
   if (m_waveOut != NULL)
@@ -302,91 +317,121 @@ STDMETHODIMP CWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// IWaveBufferInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CWaveOut::GetBufferSize(LONG * milliseconds) {
+  if (milliseconds == NULL)
+    return E_POINTER;
+
+  *milliseconds = m_bufferSize;
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IWaveTelemetry
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CWaveOut::GetErrorStats(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime) {
+  if ((underruns == NULL) || (underrunTime == NULL) || (overruns == NULL) || (overrunTime == NULL))
+    return E_POINTER;
+
+  *underruns    = m_telemetry.GetUnderruns();
+  *underrunTime = m_telemetry.GetUnderrunTime();
+  *overruns     = m_telemetry.GetOverruns();
+  *overrunTime  = m_telemetry.GetOverrunTime();
+
+  return S_OK;
+}
+
+STDMETHODIMP CWaveOut::GetFillStats(LONG * fill, LONG * peakFill) {
+  if ((fill == NULL) || (peakFill == NULL))
+    return E_POINTER;
+
+  *fill     = m_telemetry.GetFill();
+  *peakFill = m_telemetry.GetPeakFill();
+
+  return S_OK;
+}
+
+STDMETHODIMP CWaveOut::GetLatencyHistogram(LONG numBins, LONG * histogram, LONG * binWidth) {
+  if ((histogram == NULL) || (binWidth == NULL))
+    return E_POINTER;
+
+  if (numBins < 0)
+    return E_INVALIDARG;
+
+  m_telemetry.GetLatencyHistogram(histogram, numBins);
+  *binWidth = TLM_BIN_WIDTH;
+
+  return S_OK;
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // IRunnable
 /////////////////////////////////////////////////////////////////////////////
 
 unsigned int CWaveOut::Run(CThread& thread) {
   MSG message;
-  DWORD dwLastReadCursor = 0;
+  HANDLE events[] = { m_hDataEvent, m_hNotifyEvent };
+  DWORD lastSilenceTime = timeGetTime();
+  BYTE discardBuf[1024];
 
-  _ASSERTE(thread.GetThreadID() == m_gcThread.GetThreadID());
+  _ASSERTE(thread.GetThreadID() == m_writerThread.GetThreadID());
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Garbage collector thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Device writer thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
 
   while (true) {
     if (thread.GetMessage(&message, false)) {       // non-blocking message-"peek"
       switch (message.message) {
         case WM_QUIT:
-          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Garbage collector thread cancelled")));
+          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Device writer thread cancelled")));
           return 0;
 
         default:
           break;
       }
     } else {
+      // Wait for new data, or for playback to progress through the DSound
+      //  buffer (poll, should position notifications be unavailable)
+      WaitForMultipleObjects(sizeof(events) / sizeof(events[0]), events, FALSE, max(1, m_bufferSize / 4));
+
       // Gain exclusive access to the DSound buffer and related variables
       CSingleLock lock(&m_mutex, TRUE);
 
       try {
-        if (m_lpDirectSoundBuffer != NULL) {
+        // If the device is not open, attempt to (re)open it (at reasonable
+        //  intervals, see DSoundOpen)
+        if ((m_lpDirectSoundBuffer == NULL) && DSoundOpen(false) && DSoundOpenBuffer()) {
           HRESULT hr;
 
-          // Get an process playback indicators from the DSound buffer
-          DWORD dwCurrentWriteCursor, dwCurrentReadCursor;  // safe-write and read cursors in the DSound buffer
-
-          if (FAILED(hr = m_lpDirectSoundBuffer->GetCurrentPosition(&dwCurrentReadCursor, &dwCurrentWriteCursor)))
+          if (FAILED(hr = m_lpDirectSoundBuffer->Play(0, 0, DSBPLAY_LOOPING)))
             throw hr;
+        }
 
-          // Work around horrible DirectSound bug, which makes the play cursor jerk
-          //  forward once in a while, then go backwards to its normal position.
-          if (((LONG)(m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen) > (3 * m_bufferLen / 4)) {
-            dwCurrentReadCursor = m_lastPlayPos;  // refuse to back up the play cursor !
-          }
-
-          // Compute how many bytes were played through the DSound device to date
-          m_playedBytes += (m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen;
-          m_lastPlayPos = dwCurrentReadCursor;
-
-          // Compute what portion of the buffer has not been replenished and needs to be silenced
-          LONG dirtyBytes = m_playedBytes - m_sentBytes;
-
-          if (dirtyBytes > 0) {                   // if lagging, flush the buffer
-            dirtyBytes = m_bufferLen;             // the buffer has been starved for too long, all data is direty and must be silenced
-          } else if (dirtyBytes < -m_bufferLen) { // freak case; either playback stalled, or this thread was delayed and lost playback updates
-            dirtyBytes = -dirtyBytes;             // take the absolute value
-            m_playedBytes += (dirtyBytes - (dirtyBytes % m_bufferLen)); // get rid of the huge lag, or else the condition may trigger several times
-            dirtyBytes %= m_bufferLen;            // preventively erase data between the write and (adjusted) play position
-          } else {                                // in all other cases, preventively erase data between the write and play cursors
-            dirtyBytes = (m_bufferLen + dirtyBytes) % m_bufferLen;
-          }
-
-          _ASSERTE(m_playedBytes % m_bufferLen == (LONG)dwCurrentReadCursor);
-          _ASSERTE(m_sentBytes % m_bufferLen == m_bufferPos);
-
-          if (dirtyBytes > 0) {
-            // Write silence data to the DirectSound buffer
-            BYTE* data1, * data2;
-            DWORD length1, length2;
-            int silenceData = ((m_waveFormat.wBitsPerSample == 8) ? 0x80 : 0x00);
-
-            if (FAILED(hr = m_lpDirectSoundBuffer->Lock(m_bufferPos, dirtyBytes, (LPVOID*)(&data1), &length1, (LPVOID*)(&data2), &length2, 0)))
-              throw hr;
-
-            if (data1 != NULL) memset(data1, silenceData, length1);
-            if (data2 != NULL) memset(data2, silenceData, length2);
+        if (m_lpDirectSoundBuffer != NULL) {
+          DSoundWrite();
 
-            if (FAILED(hr = m_lpDirectSoundBuffer->Unlock(data1, length1, data2, length2)))
-              throw hr;
+          // Every now and then, silence data that was played (in case the
+          //  producers stop, or fall behind)
+          if ((timeGetTime() - lastSilenceTime) >= (DWORD)(m_bufferDuration / 2)) {
+            DSoundSilence();
+            lastSilenceTime = timeGetTime();
           }
+        } else {
+          while (m_ring.Read(discardBuf, sizeof(discardBuf)) > 0);  // nowhere to play the data
         }
       } catch (HRESULT hr) {
-        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Error encountered while cleaning up secondary DirectSound buffer\n0x%08x - %s"), (int)hr, (LPCTSTR)FormatMessage(hr)));
+        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Error encountered while writing to secondary DirectSound buffer\n0x%08x - %s"), (int)hr, (LPCTSTR)FormatMessage(hr)));
       }
 
       lock.Unlock();
-
-      Sleep(m_bufferDuration / 2);
     }
   }
 
@@ -498,7 +543,7 @@ bool CWaveOut::DSoundOpenBuffer(void) {
   DSBUFFERDESC DSBufferDesc;
   memset(&DSBufferDesc, 0, sizeof(DSBufferDesc));
   DSBufferDesc.dwSize = sizeof(DSBufferDesc);
-  DSBufferDesc.dwFlags = DSBCAPS_GLOBALFOCUS | DSBCAPS_GETCURRENTPOSITION2;
+  DSBufferDesc.dwFlags = DSBCAPS_GLOBALFOCUS | DSBCAPS_GETCURRENTPOSITION2 | DSBCAPS_CTRLPOSITIONNOTIFY;
   DSBufferDesc.dwBufferBytes = m_bufferLen;
   DSBufferDesc.dwReserved = 0;
   DSBufferDesc.lpwfxFormat = &m_waveFormat;
@@ -509,6 +554,34 @@ bool CWaveOut::DSoundOpenBuffer(void) {
   if (FAILED(hr = m_lpDirectSound->CreateSoundBuffer(&DSBufferDesc, &m_lpDirectSoundBuffer, NULL)))
     RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not open a secondary buffer on device %d ('%s'):\n0x%08x - %s"), m_deviceID, (LPCTSTR)m_deviceName, (int)hr, (LPCTSTR)FormatMessage(hr)));
 
+  // Initialize local buffer state
+  m_DSoundLatency = 0;  // the DSound latency for this buffer is unknown yet
+  m_bufferPos = 0;      // we are at the start of the buffer (no data is enqueued yet)
+  m_playedBytes = 0;    // no bytes went through DSound yet
+  m_sentBytes = 0;      // no bytes came from the application for playback yet
+  m_lastPlayPos = 0;    // we are at the start of the buffer (playback did not begin yet)
+  m_isLagging = true;   // no data was written yet (not an underrun)
+
+  // Have DSound wake up the writer thread as playback progresses
+  if (m_lpDirectSoundBuffer != NULL) {
+    LPDIRECTSOUNDNOTIFY lpNotify = NULL;
+    DSBPOSITIONNOTIFY positions[BUF_NOTIFICATIONS];
+
+    for (int i = 0; i < BUF_NOTIFICATIONS; i++) {
+      positions[i].dwOffset     = ((m_bufferLen / BUF_NOTIFICATIONS) * i) & ~3;
+      positions[i].hEventNotify = m_hNotifyEvent;
+    }
+
+    if (FAILED(hr = m_lpDirectSoundBuffer->QueryInterface(IID_IDirectSoundNotify, (LPVOID*)&lpNotify)) ||
+        FAILED(hr = lpNotify->SetNotificationPositions(BUF_NOTIFICATIONS, positions)))
+    {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Position notifications are not available on device %d ('%s'), polling instead:\n0x%08x - %s"), m_deviceID, (LPCTSTR)m_deviceName, (int)hr, (LPCTSTR)FormatMessage(hr)));
+    }
+
+    if (lpNotify != NULL)
+      lpNotify->Release();
+  }
+
   return (m_lpDirectSoundBuffer != NULL);
 }
 
@@ -535,6 +608,154 @@ void CWaveOut::DSoundCloseBuffer(void) {
   }
 }
 
+//
+// Moves as much data as possible from the ring buffer to the DSound buffer,
+//  and publishes the buffering state for PlayData; called by the writer
+//  thread with m_mutex held (throws HRESULT on DSound errors)
+//
+void CWaveOut::DSoundWrite(void) {
+  HRESULT hr;
+
+  // Get an process playback indicators from the DSound buffer
+  DWORD dwCurrentWriteCursor, dwCurrentReadCursor;  // safe-write and read cursors in the DSound buffer
+  LONG  commitLen;  // how many bytes (the data between the safe-write and read cursors) were commited by DSound to the device and should not be touched
+
+  if (FAILED(hr = m_lpDirectSoundBuffer->GetCurrentPosition(&dwCurrentReadCursor, &dwCurrentWriteCursor)))
+    throw hr;
+
+  commitLen = (LONG)(m_bufferLen + dwCurrentWriteCursor - dwCurrentReadCursor) % m_bufferLen;
+  LONG decayedLatency = m_DSoundLatency - m_DSoundLatency / LATENCY_DECAY;
+  decayedLatency -= decayedLatency % m_waveFormat.nBlockAlign;  // keep it whole frames, as it repositions m_bufferPos and m_sentBytes
+  m_DSoundLatency = max(decayedLatency, commitLen); // recent worst-case commit length, indicates latency in DSound mixing and output
+
+  if (commitLen > m_commitBytes)
+    InterlockedExchange((LPLONG)&m_commitBytes, commitLen);   // (PlayData may reset it in between, which only loses one measurement)
+
+  // Work around horrible DirectSound bug, which makes the play cursor jerk
+  //  forward once in a while, then go backwards to its normal position.
+  if (((LONG)(m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen) > (3 * m_bufferLen / 4)) {
+    dwCurrentReadCursor = m_lastPlayPos;  // refuse to back up the play cursor !
+    commitLen = (LONG)(m_bufferLen + dwCurrentWriteCursor - dwCurrentReadCursor) % m_bufferLen; // recompute the commit range
+  }
+
+  // Compute how many bytes were played through the DSound device to date
+  m_playedBytes += (m_bufferLen + dwCurrentReadCursor - m_lastPlayPos) % m_bufferLen;
+  m_lastPlayPos = dwCurrentReadCursor;
+
+  // Compute by how much we are leading playback
+  LONG bufferedBytes = (LONG)max(0, m_sentBytes - m_playedBytes);
+
+  // Decide the optimal buffering range (never less than what DSound itself holds on to)
+  LONG loMark = max(m_bufferedLo, 2 * m_DSoundLatency);
+  LONG hiMark = max(m_bufferedHi, 3 * m_DSoundLatency);
+  LONG targetBytes = (loMark + hiMark) / 2;
+
+  // If lagging, adjust write cursor to avoid writing in an area that was already played
+  //  and is a candidate for silencing, or that is in the process of being played (commited).
+  if (bufferedBytes < commitLen) {
+    if (!m_isLagging)
+      InterlockedIncrement((LPLONG)&m_underruns);   // count starvation episodes, not how long they last
+
+    m_isLagging = true;
+
+    InterlockedExchangeAdd((LPLONG)&m_underrunBytes, (LONG)(m_playedBytes + m_DSoundLatency - m_sentBytes));  // the hole left in the data
+
+    m_bufferPos = (dwCurrentReadCursor + m_DSoundLatency) % m_bufferLen;  // start writing at an early, write-safe position to avoid long audio interruptions
+    m_sentBytes = m_playedBytes + m_DSoundLatency; // adjust amount of (supposedly) sent bytes to match new write position
+    bufferedBytes = m_DSoundLatency;
+
+    // Prime the buffer with silence up to the target, so that the data that
+    //  follows does not start out (again) with next to nothing queued, and
+    //  starve until the producers' rate control caught up
+    LONG primeLen = min(targetBytes, m_bufferLen / 2) - bufferedBytes - m_ring.GetUsed();
+    primeLen -= primeLen % m_waveFormat.nBlockAlign;
+
+    if (primeLen > 0) {
+      DSoundSilence();                    // silence everything that is not being played
+
+      m_bufferPos = (m_bufferPos + primeLen) % m_bufferLen;
+      m_sentBytes += primeLen;
+      bufferedBytes += primeLen;
+    }
+  }
+
+  // Write as much new audio data as fits in the DirectSound buffer without
+  //  overwriting data that was not played yet
+  LONG length = min(m_ring.GetUsed(), m_bufferLen - bufferedBytes);
+  length -= length % m_waveFormat.nBlockAlign;
+
+  if (length > 0) {
+    BYTE* data1, * data2;
+    DWORD length1, length2;
+
+    if (FAILED(hr = m_lpDirectSoundBuffer->Lock(m_bufferPos, length, (LPVOID*)(&data1), &length1, (LPVOID*)(&data2), &length2, 0)))
+      throw hr;
+
+    if (data1 != NULL) m_ring.Read(data1, length1);
+    if (data2 != NULL) m_ring.Read(data2, length2);
+
+    if (FAILED(hr = m_lpDirectSoundBuffer->Unlock(data1, length1, data2, length2)))
+      throw hr;
+
+    // Make sure the buffer isn't stopped
+    if (FAILED(hr = m_lpDirectSoundBuffer->Play(0, 0, DSBPLAY_LOOPING)))
+      throw hr;
+
+    // Advance our write cursor, and count the data as successfully "sent"
+    m_bufferPos = (m_bufferPos + length) % m_bufferLen;
+    m_sentBytes += length;
+    bufferedBytes += length;
+    m_isLagging = false;
+  }
+
+  _ASSERTE((LONG)(m_playedBytes % m_bufferLen) == (LONG)dwCurrentReadCursor);
+  _ASSERTE((LONG)(m_sentBytes % m_bufferLen) == m_bufferPos);
+
+  // Publish the buffering state (see PlayData)
+  InterlockedExchange((LPLONG)&m_deviceBytes, bufferedBytes);
+  InterlockedExchange((LPLONG)&m_targetBytes, targetBytes);
+}
+
+//
+// Silences the portion of the DSound buffer that was played and not
+//  replenished since; called by the writer thread with m_mutex held (throws
+//  HRESULT on DSound errors)
+//
+void CWaveOut::DSoundSilence(void) {
+  HRESULT hr;
+
+  // Compute what portion of the buffer has not been replenished and needs to be silenced
+  LONGLONG dirtyBytes = m_playedBytes - m_sentBytes;
+
+  if (dirtyBytes > 0) {                   // if lagging, flush the buffer
+    dirtyBytes = m_bufferLen;             // the buffer has been starved for too long, all data is direty and must be silenced
+  } else if (dirtyBytes < -m_bufferLen) { // freak case; either playback stalled, or this thread was delayed and lost playback updates
+    dirtyBytes = -dirtyBytes;             // take the absolute value
+    m_playedBytes += (dirtyBytes - (dirtyBytes % m_bufferLen)); // get rid of the huge lag, or else the condition may trigger several times
+    dirtyBytes %= m_bufferLen;            // preventively erase data between the write and (adjusted) play position
+  } else {                                // in all other cases, preventively erase data between the write and play cursors
+    dirtyBytes = (m_bufferLen + dirtyBytes) % m_bufferLen;
+  }
+
+  _ASSERTE((LONG)(m_sentBytes % m_bufferLen) == m_bufferPos);
+
+  if (dirtyBytes > 0) {
+    // Write silence data to the DirectSound buffer
+    BYTE* data1, * data2;
+    DWORD length1, length2;
+    int silenceData = ((m_waveFormat.wBitsPerSample == 8) ? 0x80 : 0x00);
+
+    if (FAILED(hr = m_lpDirectSoundBuffer->Lock(m_bufferPos, (DWORD)dirtyBytes, (LPVOID*)(&data1), &length1, (LPVOID*)(&data2), &length2, 0)))
+      throw hr;
+
+    if (data1 != NULL) memset(data1, silenceData, length1);
+    if (data2 != NULL) memset(data2, silenceData, length2);
+
+    if (FAILED(hr = m_lpDirectSoundBuffer->Unlock(data1, length1, data2, length2)))
+      throw hr;
+  }
+}
+
 //
 //
 //
@@ -628,3 +849,16 @@ CString CWaveOut::DSoundGetName(LPGUID lpGUID) {
     return CString(_T("<unknown>"));
   }
 }
+
+//
+// Derives the optimal buffering range (in bytes) from the operating range
+//  currently decided by the buffer sizer, and publishes it for the writer
+//  thread
+//
+void CWaveOut::UpdateBufferSize(void) {
+  LONG bufferedLo = m_waveFormat.nAvgBytesPerSec * m_bufferSizer.GetSize() / 1000;
+
+  InterlockedExchange((LPLONG)&m_bufferedLo, bufferedLo);
+  InterlockedExchange((LPLONG)&m_bufferedHi, bufferedLo * 2);
+  InterlockedExchange((LPLONG)&m_bufferSize, m_bufferSizer.GetSize());
+}
@@ -20,6 +20,10 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
+#include <BufferSizer.h>
+#include <FormatConverter.h>
+#include <SinkTelemetry.h>
+#include <SPSCRing.h>
 #include <Thread.h>
 
 /////////////////////////////////////////////////////////////////////////////
@@ -30,11 +34,13 @@ class ATL_NO_VTABLE CWaveOut :
   public IRunnable,
 	public ISupportErrorInfo,
   public IVDMBasicModule,
-  public IWaveDataConsumer
+  public IWaveDataConsumer,
+  public IWaveBufferInfo,
+  public IWaveTelemetry
 {
 public:
 	CWaveOut()
-    : m_lpDirectSound(NULL), m_lpDirectSoundBuffer(0), m_deviceGUID(GUID_NULL), m_deviceName(_T("<unknown>")), m_bufferLen(0), m_bufferPos(0), m_playedBytes(0), m_sentBytes(0), m_lastPlayPos(0)
+    : m_lpDirectSound(NULL), m_lpDirectSoundBuffer(0), m_deviceGUID(GUID_NULL), m_deviceName(_T("<unknown>")), m_hDataEvent(NULL), m_hNotifyEvent(NULL), m_bufferLen(0), m_bufferPos(0), m_playedBytes(0), m_sentBytes(0), m_lastPlayPos(0), m_isLagging(true), m_deviceBytes(0), m_targetBytes(0), m_bufferSize(0), m_commitBytes(0), m_underruns(0), m_underrunBytes(0), m_lastUnderruns(0), m_lastDelivery(0)
   {
     m_waveFormat.nChannels = 0;
     m_waveFormat.nSamplesPerSec = 0;
@@ -50,6 +56,8 @@ BEGIN_COM_MAP(CWaveOut)
   COM_INTERFACE_ENTRY(ISupportErrorInfo)
   COM_INTERFACE_ENTRY(IVDMBasicModule)
   COM_INTERFACE_ENTRY(IWaveDataConsumer)
+  COM_INTERFACE_ENTRY(IWaveBufferInfo)
+  COM_INTERFACE_ENTRY(IWaveTelemetry)
 END_COM_MAP()
 
 // IRunnable
@@ -70,6 +78,16 @@ public:
   STDMETHOD(SetFormat)(WORD channels, DWORD samplesPerSec, WORD bitsPerSample);
   STDMETHOD(PlayData)(BYTE * data, LONG length, DOUBLE * load);
 
+// IWaveBufferInfo
+public:
+  STDMETHOD(GetBufferSize)(LONG * milliseconds);
+
+// IWaveTelemetry
+public:
+  STDMETHOD(GetErrorStats)(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime);
+  STDMETHOD(GetFillStats)(LONG * fill, LONG * peakFill);
+  STDMETHOD(GetLatencyHistogram)(LONG numBins, LONG * histogram, LONG * binWidth);
+
 protected:
   static BOOL CALLBACK DSEnumCallback(LPGUID lpGuid, LPCTSTR lpcstrDescription, LPCTSTR lpcstrModule, LPVOID lpContext);
 
@@ -78,8 +96,11 @@ protected:
   bool DSoundOpenBuffer(void);
   void DSoundClose(void);
   void DSoundCloseBuffer(void);
+  void DSoundWrite(void);
+  void DSoundSilence(void);
   HRESULT DSoundOpenHelper(void);
   CString DSoundGetName(LPGUID lpGUID = NULL);
+  void UpdateBufferSize(void);
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -112,6 +133,8 @@ protected:
 protected:
   int m_deviceID;
   int m_bufOpRange;
+  int m_sampleRate;
+  int m_numChannels;
 
 // Other member variables
 protected:
@@ -119,17 +142,36 @@ protected:
   GUID m_deviceGUID;
   LPDIRECTSOUND m_lpDirectSound;
   LPDIRECTSOUNDBUFFER m_lpDirectSoundBuffer;
-  WAVEFORMATEX m_waveFormat;
+  WAVEFORMATEX m_waveFormat;         // the DSound buffer's (fixed) format
 
-  CThread m_gcThread;
-  CCriticalSection m_mutex;
+  CThread m_writerThread;             // moves data from m_ring to the DSound buffer
+  CCriticalSection m_mutex;           // protects the DSound objects and buffer state (but not m_ring)
+
+  CFormatConverter m_converter;       // converts the data from the format set by SetFormat to the DSound buffer's format
+  CSPSCRing m_ring;                   // audio data handed over by PlayData, not yet written to DSound
+  HANDLE m_hDataEvent;                // signalled by PlayData when new data is available
+  HANDLE m_hNotifyEvent;              // signalled by DSound as playback crosses notification positions
 
   LONG m_bufferDuration;              // total length of audio buffer (in milliseconds)
   LONG m_bufferLen, m_bufferPos;      // size and current write position in buffer (in bytes)
-  LONG m_DSoundLatency;               // maximum observed DSound latency (in bytes)
-  LONG m_playedBytes, m_sentBytes;    // how many bytes of data were played (actually went through DSound device) to date and how many valid bytes were sent (produced)
+  LONG m_DSoundLatency;               // recent peak of the DSound latency (in bytes; slowly decays, see DSoundWrite)
+  LONGLONG m_playedBytes, m_sentBytes;  // how many bytes of data were played (actually went through DSound device) to date and how many valid bytes were sent (produced); 64-bit, as 32 bits only last a few hours
+  bool m_isLagging;                   // whether playback caught up with the data, and no data was written since
   LONG m_lastPlayPos;                 // last known position of the play cursor (used to compute how many bytes went through the DSound device since the last check)
-  LONG m_bufferedLo, m_bufferedHi;    // delimit the optimal range valid audio data should lead the play cursor by
+  volatile LONG m_bufferedLo, m_bufferedHi;  // delimit the optimal range valid audio data should lead the play cursor by (set by PlayData)
+  volatile LONG m_bufferSize;         // buffer operating range (in milliseconds) m_bufferedLo/Hi were derived from
+
+  volatile LONG m_deviceBytes;        // how many bytes valid audio data led the play cursor by, as of the last write to DSound
+  volatile LONG m_targetBytes;        // middle of the optimal buffering range (in bytes), as of the last write to DSound
+  volatile LONG m_commitBytes;        // largest DSound commit length (in bytes) seen by the writer since the last PlayData
+  volatile LONG m_underruns;          // how many times the writer found playback ahead of the data
+  volatile LONG m_underrunBytes;      // how much data the writer skipped because of that, since the last PlayData
+
+  CBufferSizer m_bufferSizer;         // decides the operating range (initially m_bufOpRange) from the measured jitter; used by PlayData only
+  LONG m_lastUnderruns;               // value of m_underruns as of the last PlayData
+  DWORD m_lastDelivery;               // when PlayData was last called (timeGetTime)
+
+  CSinkTelemetry m_telemetry;
 
 // Interfaces to dependency modules
 protected:
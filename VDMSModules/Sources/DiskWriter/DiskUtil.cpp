@@ -1,8 +1,15 @@
 #include "stdafx.h"
 #include "DiskUtil.h"
 
+#include <MFCUtil.h>
+#include <VDMUtil.h>
+
 #define MAX_FILES 9999        // how many files can exist
 
+#define AFW_POLL_INTERVAL   250     // how often (milliseconds) the I/O thread looks for commands, should a wake-up be missed
+#define AFW_QUIT_TIMEOUT    10000   // how long (milliseconds) to wait for pending operations to complete on Destroy
+#define AFW_QUEUE_TIMEOUT   10000   // how long (milliseconds) file operations other than writes and patches wait for room in the command queue
+
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
@@ -83,7 +90,11 @@ BOOL CSequentialFile::Seek(
   if (m_hFile == INVALID_HANDLE_VALUE)
     return FALSE;
 
-  if (SetFilePointer(m_hFile, lDistanceToMove, NULL, dwMoveMethod) == (DWORD)(-1))
+  // Positions beyond 4GB are only reachable with the high half of the
+  //  distance supplied (and only fail if GetLastError says so)
+  LONG lDistanceToMoveHigh = (lDistanceToMove < 0) ? -1 : 0;
+
+  if ((SetFilePointer(m_hFile, lDistanceToMove, &lDistanceToMoveHigh, dwMoveMethod) == (DWORD)(-1)) && (GetLastError() != NO_ERROR))
     return FALSE;
 
   return TRUE;
@@ -144,3 +155,516 @@ CString CSequentialFile::GetFileName(void) {
 
   return m_strFileName;
 }
+
+
+
+//////////////////////////////////////////////////////////////////////
+// CAsyncSequentialFile
+//////////////////////////////////////////////////////////////////////
+
+CAsyncSequentialFile::CAsyncSequentialFile() :
+  m_encoder(NULL),
+  m_hEvent(NULL),
+  m_numPosted(0),
+  m_numDone(0),
+  m_buffers(NULL),
+  m_curBuf(-1),
+  m_curLen(0),
+  m_isOpen(FALSE),
+  m_droppedBytes(0),
+  m_isErrLogged(false)
+{
+  for (int i = 0; i < AFW_NUMBUFFERS; i++)
+    m_bufState[i] = BUF_FREE;
+
+  m_patch.isPending = false;
+}
+
+CAsyncSequentialFile::~CAsyncSequentialFile()
+{
+  Destroy();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Allocates the buffers and starts the I/O thread
+//
+bool CAsyncSequentialFile::Init(
+  IVDMQUERYLib::IVDMRTEnvironmentPtr& env,
+  LPCTSTR szName)
+{
+  ASSERT(m_buffers == NULL);
+
+  m_env = env;
+
+  // Page-aligned memory, in multiples of the disk sector size
+  if ((m_buffers = (BYTE*)VirtualAlloc(NULL, AFW_NUMBUFFERS * AFW_BUFFERLEN, MEM_COMMIT, PAGE_READWRITE)) == NULL) {
+    DWORD lastError = GetLastError();
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not allocate %d bytes of disk buffers:\n0x%08x - %s"), AFW_NUMBUFFERS * AFW_BUFFERLEN, lastError, (LPCTSTR)FormatMessage(lastError)));
+    return false;
+  }
+
+  if (!m_commands.Create(AFW_NUMCOMMANDS * sizeof(command_t)) ||
+      ((m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+      !m_thread.Create(this, szName, true))
+  {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not create the disk I/O thread")));
+    Destroy();
+    return false;
+  }
+
+  m_thread.SetPriority(THREAD_PRIORITY_BELOW_NORMAL);
+  m_thread.Resume();
+
+  return true;
+}
+
+//
+// Completes all pending operations (closing the file, if still open), then
+//  stops the I/O thread and releases the buffers
+//
+void CAsyncSequentialFile::Destroy(void) {
+  if (m_thread.GetThreadHandle() != NULL) {
+    if (m_isOpen)
+      Close();
+
+    if (WaitForQueue())
+      PostCommand(CMD_QUIT);
+
+    if (!m_thread.Join(AFW_QUIT_TIMEOUT)) {
+      // The thread may still be using the buffers; leave them be
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Timed out while waiting for pending disk operations to complete")));
+      return;
+    }
+  }
+
+  if (m_hEvent != NULL) {
+    CloseHandle(m_hEvent);
+    m_hEvent = NULL;
+  }
+
+  if (m_buffers != NULL) {
+    VirtualFree(m_buffers, 0, MEM_RELEASE);
+    m_buffers = NULL;
+  }
+
+  m_commands.Destroy();
+  m_env = NULL;
+}
+
+//
+// Creates a new sequential file (closing the current one, if any); if an
+//  encoder is given, all the data is run through it, the encoder being
+//  handed (up to AFW_MAXPATCH bytes of) parameters as it begins
+//
+void CAsyncSequentialFile::Create(
+  LPCTSTR szPrefix,
+  LPCTSTR szExtension,
+  CStreamEncoder* encoder,
+  LPCVOID lpParams,
+  DWORD nParamsLength)
+{
+  ASSERT(nParamsLength <= AFW_MAXPATCH);
+
+  command_t command;
+
+  Submit();
+  FlushPatch();
+
+  _tcsncpy(command.prefix, szPrefix, sizeof(command.prefix) / sizeof(command.prefix[0]) - 1);
+  command.prefix[sizeof(command.prefix) / sizeof(command.prefix[0]) - 1] = _T('\0');
+  _tcsncpy(command.extension, szExtension, sizeof(command.extension) / sizeof(command.extension[0]) - 1);
+  command.extension[sizeof(command.extension) / sizeof(command.extension[0]) - 1] = _T('\0');
+  command.type = CMD_CREATE;
+  command.encoder = encoder;
+  command.length = (lpParams != NULL) ? min(nParamsLength, AFW_MAXPATCH) : 0;
+
+  if (command.length > 0)
+    memcpy(command.data, lpParams, command.length);
+
+  if (WaitForQueue()) {
+    m_commands.Write(&command, sizeof(command));
+    m_numPosted++;
+    SetEvent(m_hEvent);
+    m_isOpen = TRUE;
+  }
+
+  m_droppedBytes = 0;
+}
+
+//
+// Empties the file (the encoder, if any, begins anew with the given
+//  parameters)
+//
+void CAsyncSequentialFile::Truncate(
+  LPCVOID lpParams,
+  DWORD nParamsLength)
+{
+  ASSERT(nParamsLength <= AFW_MAXPATCH);
+
+  Submit();
+  FlushPatch();
+
+  if (WaitForQueue())
+    PostCommand(CMD_TRUNCATE, -1, 0, lpParams, (lpParams != NULL) ? min(nParamsLength, AFW_MAXPATCH) : 0);
+
+  m_droppedBytes = 0;
+}
+
+//
+// Appends data to the file; either all or none of the data is accepted
+//  (none if the I/O thread is lagging too far behind)
+//
+BOOL CAsyncSequentialFile::Write(
+  LPCVOID lpBuffer,
+  DWORD nNumberOfBytesToWrite)
+{
+  if (!m_isOpen || (m_buffers == NULL))
+    return FALSE;
+
+  // Check that there is room for all the data
+  DWORD capacity = (m_curBuf >= 0) ? (AFW_BUFFERLEN - m_curLen) : 0;
+  int i;
+
+  for (i = 0; i < AFW_NUMBUFFERS; i++) {
+    if (m_bufState[i] == BUF_FREE)
+      capacity += AFW_BUFFERLEN;
+  }
+
+  if (capacity < nNumberOfBytesToWrite) {
+    m_droppedBytes += nNumberOfBytesToWrite;
+    return FALSE;
+  }
+
+  // Copy the data, handing the buffers over as they fill up
+  const BYTE* data = (const BYTE*)lpBuffer;
+
+  while (nNumberOfBytesToWrite > 0) {
+    if (m_curBuf < 0) {
+      for (i = 0; (i < AFW_NUMBUFFERS) && (m_bufState[i] != BUF_FREE); i++);
+
+      ASSERT(i < AFW_NUMBUFFERS);
+
+      m_curBuf = i;
+      m_curLen = 0;
+      InterlockedExchange((LPLONG)&m_bufState[i], BUF_FILLING);
+    }
+
+    DWORD length = min(nNumberOfBytesToWrite, AFW_BUFFERLEN - m_curLen);
+
+    memcpy(m_buffers + m_curBuf * AFW_BUFFERLEN + m_curLen, data, length);
+    m_curLen += length;
+    data += length;
+    nNumberOfBytesToWrite -= length;
+
+    if (m_curLen >= AFW_BUFFERLEN)
+      Submit();
+  }
+
+  return TRUE;
+}
+
+//
+// Overwrites (up to AFW_MAXPATCH bytes of) data that was already written,
+//  e.g. to bring a header up to date; writing then resumes at the end of
+//  the file.  A patch that the I/O thread has not applied yet is replaced
+//  by the new one (patches are meant to bring the same data up to date),
+//  so this never waits for the disk
+//
+void CAsyncSequentialFile::Patch(
+  DWORD dwOffset,
+  LPCVOID lpBuffer,
+  DWORD nNumberOfBytesToWrite)
+{
+  ASSERT(nNumberOfBytesToWrite <= AFW_MAXPATCH);
+
+  if (!m_isOpen)
+    return;
+
+  Submit();
+
+  CSingleLock lock(&m_patchMutex, TRUE);
+
+  m_patch.isPending = true;
+  m_patch.sequence = m_numPosted;
+  m_patch.offset = dwOffset;
+  m_patch.length = min(nNumberOfBytesToWrite, AFW_MAXPATCH);
+  memcpy(m_patch.data, lpBuffer, m_patch.length);
+
+  lock.Unlock();
+
+  SetEvent(m_hEvent);
+}
+
+//
+// Tells the encoder (if any) that a point of interest was reached in the
+//  data, e.g. for it to be recorded as a cue point
+//
+void CAsyncSequentialFile::Mark(void) {
+  if (!m_isOpen)
+    return;
+
+  Submit();
+
+  if (WaitForQueue())
+    PostCommand(CMD_MARK);
+}
+
+//
+// Closes the file, once all its data is written
+//
+void CAsyncSequentialFile::Close(void) {
+  if (!m_isOpen)
+    return;
+
+  Submit();
+  FlushPatch();
+
+  if (WaitForQueue())
+    PostCommand(CMD_CLOSE);
+
+  if (m_droppedBytes > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The disk could not keep up: %d bytes were dropped from the file"), m_droppedBytes));
+
+  m_isOpen = FALSE;
+}
+
+//
+// Returns whether the file is open, as far as the producer is concerned
+//  (the I/O thread may not have created it yet, or may have failed to)
+//
+BOOL CAsyncSequentialFile::IsOpen(void) {
+  return m_isOpen;
+}
+
+//////////////////////////////////////////////////////////////////////
+// IRunnable
+//////////////////////////////////////////////////////////////////////
+
+unsigned int CAsyncSequentialFile::Run(CThread& thread) {
+  command_t command;
+
+  while (true) {
+    WaitForSingleObject(m_hEvent, AFW_POLL_INTERVAL);
+
+    // Apply the latest patch as soon as the commands posted before it are
+    //  carried out
+    for (ApplyPatch(); m_commands.GetUsed() >= (LONG)sizeof(command); ApplyPatch()) {
+      m_commands.Read(&command, sizeof(command));
+      m_numDone++;
+
+      if (command.type == CMD_QUIT) {
+        if (m_file.IsOpen())
+          m_file.Close();
+
+        return 0;
+      }
+
+      Execute(command);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Utility functions
+//////////////////////////////////////////////////////////////////////
+
+//
+// Carries out a file operation (I/O thread only); errors are logged once
+//  per file
+//
+void CAsyncSequentialFile::Execute(command_t& command) {
+  try {
+    switch (command.type) {
+      case CMD_CREATE:
+        if (m_file.IsOpen())
+          m_file.Close();
+
+        m_encoder = command.encoder;
+        m_isErrLogged = false;
+
+        if (!m_file.Create(command.prefix, command.extension, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN)) {
+          DWORD lastError = GetLastError();
+          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Error encountered while creating file '%sXXXX.%s'\n0x%08x - %s"), command.prefix, command.extension, lastError, (LPCTSTR)FormatMessage(lastError)));
+        } else if ((m_encoder != NULL) && !m_encoder->Begin(m_file, command.data, command.length)) {
+          throw GetLastError();
+        }
+        break;
+
+      case CMD_TRUNCATE:
+        if (m_file.IsOpen()) {
+          if (!m_file.Truncate() ||
+              ((m_encoder != NULL) && !m_encoder->Begin(m_file, command.data, command.length)))
+          {
+            throw GetLastError();
+          }
+        }
+        break;
+
+      case CMD_WRITE:
+        if (m_file.IsOpen()) {
+          LPCVOID lpBuffer = m_buffers + command.buffer * AFW_BUFFERLEN;
+
+          if ((m_encoder != NULL) ? !m_encoder->Encode(m_file, lpBuffer, command.length) : (m_file.Write(lpBuffer, command.length) != command.length))
+            throw GetLastError();
+        }
+
+        InterlockedExchange((LPLONG)&m_bufState[command.buffer], BUF_FREE);
+        break;
+
+      case CMD_PATCH:
+        if (m_file.IsOpen() &&
+            (!m_file.Seek(command.offset, FILE_BEGIN) ||
+             (m_file.Write(command.data, command.length) != command.length) ||
+             !m_file.Seek(0, FILE_END)))
+        {
+          throw GetLastError();
+        }
+        break;
+
+      case CMD_MARK:
+        if (m_file.IsOpen() && (m_encoder != NULL))
+          m_encoder->Mark();
+        break;
+
+      case CMD_CLOSE:
+        if (m_file.IsOpen()) {
+          CStreamEncoder* encoder = m_encoder;
+
+          m_encoder = NULL;
+
+          // Should the encoder fail to complete the file, the file is
+          //  left open (for the error to be reported), and is closed
+          //  along with the next one
+          if ((encoder != NULL) && !encoder->End(m_file))
+            throw GetLastError();
+
+          m_file.Close();
+        }
+        break;
+    }
+  } catch (DWORD lastError) {
+    if (command.type == CMD_WRITE)
+      InterlockedExchange((LPLONG)&m_bufState[command.buffer], BUF_FREE);
+
+    if (!m_isErrLogged) {           // only log once per file, as the error will probably occur again and again
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Error encountered while writing to file '%s'\n0x%08x - %s"), (LPCTSTR)m_file.GetFileName(), lastError, (LPCTSTR)FormatMessage(lastError)));
+      m_isErrLogged = true;
+    }
+  }
+}
+
+//
+// Applies the latest patch (I/O thread only), provided that all the
+//  commands posted before it were carried out
+//
+void CAsyncSequentialFile::ApplyPatch(void) {
+  command_t command;
+  CSingleLock lock(&m_patchMutex, TRUE);
+
+  if (!m_patch.isPending || ((LONG)(m_numDone - m_patch.sequence) < 0))
+    return;
+
+  command.type = CMD_PATCH;
+  command.offset = m_patch.offset;
+  command.length = m_patch.length;
+  memcpy(command.data, m_patch.data, m_patch.length);
+
+  m_patch.isPending = false;
+
+  lock.Unlock();
+
+  Execute(command);
+}
+
+//
+// Moves the latest patch (if not applied yet) to the command queue, so that
+//  it is applied before the file is closed or replaced; a patch meant for
+//  one file cannot be superseded by a patch meant for the next one
+//
+void CAsyncSequentialFile::FlushPatch(void) {
+  CSingleLock lock(&m_patchMutex, TRUE);
+
+  if (!m_patch.isPending)
+    return;
+
+  patch_t patch = m_patch;
+  m_patch.isPending = false;
+
+  lock.Unlock();
+
+  if (WaitForQueue())
+    PostCommand(CMD_PATCH, -1, patch.offset, patch.data, patch.length);
+}
+
+//
+// Hands the buffer being filled (if any) over to the I/O thread
+//
+void CAsyncSequentialFile::Submit(void) {
+  if (m_curBuf < 0)
+    return;
+
+  // Mark the buffer as queued before queuing it, as the I/O thread frees
+  //  it as soon as it is written
+  InterlockedExchange((LPLONG)&m_bufState[m_curBuf], BUF_QUEUED);
+
+  if ((m_curLen == 0) || !PostCommand(CMD_WRITE, m_curBuf, 0, NULL, m_curLen)) {
+    m_droppedBytes += m_curLen;
+    InterlockedExchange((LPLONG)&m_bufState[m_curBuf], BUF_FREE);
+  }
+
+  m_curBuf = -1;
+  m_curLen = 0;
+}
+
+//
+// Waits for the I/O thread to make room for a command in the queue, if it
+//  is full (the disk is lagging behind); unlike the data, file operations
+//  must not be dropped.  Returns false, and logs the loss, on time-out
+//
+bool CAsyncSequentialFile::WaitForQueue(void) {
+  for (int i = 0; (i < AFW_QUEUE_TIMEOUT / 10) && (m_commands.GetFree() < (LONG)sizeof(command_t)); i++)
+    Sleep(10);
+
+  if (m_commands.GetFree() < (LONG)sizeof(command_t)) {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Timed out while waiting for the disk to catch up: a file operation was lost")));
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Queues a file operation for the I/O thread; returns false if the queue
+//  is full
+//
+bool CAsyncSequentialFile::PostCommand(
+  int type,
+  int buffer,
+  DWORD offset,
+  LPCVOID lpData,
+  DWORD length)
+{
+  command_t command;
+
+  if (m_commands.GetFree() < (LONG)sizeof(command))
+    return false;
+
+  command.type = type;
+  command.encoder = NULL;
+  command.buffer = buffer;
+  command.offset = offset;
+  command.length = length;
+
+  if (lpData != NULL)
+    memcpy(command.data, lpData, length);
+
+  m_commands.Write(&command, sizeof(command));
+  m_numPosted++;
+  SetEvent(m_hEvent);
+
+  return true;
+}
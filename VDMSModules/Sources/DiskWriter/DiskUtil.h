@@ -1,6 +1,25 @@
 #ifndef __DISKUTIL_H_
 #define __DISKUTIL_H_
 
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IVDMQuery.tlb>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <SPSCRing.h>
+#include <Thread.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define AFW_NUMBUFFERS    4         // how many data buffers are cycled between the producer and the I/O thread
+#define AFW_BUFFERLEN     262144    // size of a data buffer (in bytes)
+#define AFW_NUMCOMMANDS   64        // how many file operations can be pending
+#define AFW_MAXPATCH      128       // largest amount of data (in bytes) a single patch can overwrite (or encoder parameters can take)
+
+/////////////////////////////////////////////////////////////////////////////
+
 class CSequentialFile {
   public:
     CSequentialFile(void);
@@ -22,4 +41,115 @@ class CSequentialFile {
     CString m_strFileName;
 };
 
+//
+// Transforms the data of a CAsyncSequentialFile on its way to the disk
+//  (e.g. compresses it), and writes it out along with whatever headers the
+//  resulting format calls for.  All methods are called by the I/O thread;
+//  on failure, they return false with the error available through
+//  GetLastError.
+//
+class CStreamEncoder {
+  public:
+    virtual ~CStreamEncoder(void) { }
+
+  public:
+    virtual bool Begin(CSequentialFile& file, LPCVOID lpParams, DWORD nParamsLength) = 0;
+    virtual bool Encode(CSequentialFile& file, LPCVOID lpBuffer, DWORD nNumberOfBytes) = 0;
+    virtual void Mark(void) = 0;
+    virtual bool End(CSequentialFile& file) = 0;
+};
+
+//
+// Sequential file written to by a dedicated I/O thread.  The producer only
+//  ever copies data into memory: large (page-aligned) buffers are filled in
+//  turn and handed over to the I/O thread as they fill up, along with the
+//  other file operations (creation, patches, closing), in order, through a
+//  lock-free queue.  Should the disk fall so far behind that no buffer is
+//  free, data is dropped (and reported) rather than stalling the producer.
+//  Patches do not go through the queue either: each one replaces the
+//  previous one (if not applied yet) in a single slot, which the I/O
+//  thread applies in order with the other operations, so the producer
+//  never waits on them.  The remaining operations (creation, truncation,
+//  closing) are rare, and wait for room in the queue instead.
+// The data can be run through an encoder (see CStreamEncoder) by the I/O
+//  thread, in which case Patch is not available.
+// Everything but Run must be called by one thread at a time.
+//
+class CAsyncSequentialFile : public IRunnable {
+  public:
+    CAsyncSequentialFile(void);
+    ~CAsyncSequentialFile(void);
+
+  public:
+    bool Init(IVDMQUERYLib::IVDMRTEnvironmentPtr& env, LPCTSTR szName);
+    void Destroy(void);
+
+    void Create(LPCTSTR szPrefix, LPCTSTR szExtension, CStreamEncoder* encoder = NULL, LPCVOID lpParams = NULL, DWORD nParamsLength = 0);
+    void Truncate(LPCVOID lpParams = NULL, DWORD nParamsLength = 0);
+    BOOL Write(LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite);
+    void Patch(DWORD dwOffset, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite);
+    void Mark(void);
+    void Close(void);
+
+    BOOL IsOpen(void);
+
+  // IRunnable
+  public:
+    unsigned int Run(CThread& thread);
+
+  protected:
+    enum { CMD_CREATE, CMD_TRUNCATE, CMD_WRITE, CMD_PATCH, CMD_MARK, CMD_CLOSE, CMD_QUIT };
+    enum { BUF_FREE, BUF_FILLING, BUF_QUEUED };
+
+    typedef struct {
+      int type;
+      int buffer;                       // CMD_WRITE: which buffer to write out
+      DWORD offset;                     // CMD_PATCH: where to write
+      DWORD length;                     // CMD_WRITE, CMD_PATCH: how many bytes (CMD_CREATE, CMD_TRUNCATE: of encoder parameters)
+      BYTE data[AFW_MAXPATCH];          // CMD_PATCH: what to write (CMD_CREATE, CMD_TRUNCATE: encoder parameters)
+      CStreamEncoder* encoder;          // CMD_CREATE: encoder to run the data through (NULL = none)
+      TCHAR prefix[MAX_PATH];           // CMD_CREATE: file name prefix
+      TCHAR extension[16];              // CMD_CREATE: file name extension
+    } command_t;
+
+    typedef struct {
+      bool isPending;                   // whether the slot holds a patch not applied yet
+      DWORD sequence;                   // how many commands were posted before the patch
+      DWORD offset;
+      DWORD length;
+      BYTE data[AFW_MAXPATCH];
+    } patch_t;
+
+  protected:
+    void Submit(void);
+    void FlushPatch(void);
+    void ApplyPatch(void);
+    void Execute(command_t& command);
+    bool WaitForQueue(void);
+    bool PostCommand(int type, int buffer = -1, DWORD offset = 0, LPCVOID lpData = NULL, DWORD length = 0);
+
+  protected:
+    CSequentialFile m_file;             // only ever accessed by the I/O thread
+    CStreamEncoder* m_encoder;          // encoder of the current file (I/O thread only)
+    CThread m_thread;
+    HANDLE m_hEvent;                    // signalled when commands are posted
+    CSPSCRing m_commands;
+    DWORD m_numPosted;                  // how many commands were posted (producer only)
+    DWORD m_numDone;                    // how many commands were carried out (I/O thread only)
+
+    patch_t m_patch;                    // latest patch (see Patch)
+    CCriticalSection m_patchMutex;      // protects m_patch (only ever held while copying it)
+
+    BYTE* m_buffers;                    // AFW_NUMBUFFERS buffers of AFW_BUFFERLEN bytes each
+    volatile LONG m_bufState[AFW_NUMBUFFERS];
+    int m_curBuf;                       // buffer being filled (-1 = none)
+    DWORD m_curLen;                     // how many bytes it holds
+
+    BOOL m_isOpen;                      // whether the file is open, as far as the producer is concerned
+    DWORD m_droppedBytes;               // how many bytes were dropped from the current file
+    bool m_isErrLogged;                 // whether an I/O error was logged for the current file (I/O thread only)
+
+    IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+};
+
 #endif //__DISKUTIL_H_
@@ -296,6 +296,14 @@ SOURCE=.\DiskWriter.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\FLACEncoder.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\FLACStream.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDIOut.cpp
 # End Source File
 # Begin Source File
@@ -317,6 +325,14 @@ SOURCE=.\DiskUtil.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\FLACEncoder.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\FLACStream.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDIOut.h
 # End Source File
 # Begin Source File
@@ -0,0 +1,494 @@
+#include "stdafx.h"
+#include "FLACEncoder.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define FLAC_MAXRICEPARAM   14      // highest Rice parameter that fits the 4-bit parameter fields
+
+/////////////////////////////////////////////////////////////////////////////
+
+BYTE CFLACEncoder::s_crc8[256];
+WORD CFLACEncoder::s_crc16[256];
+bool CFLACEncoder::s_isCRCInit = false;
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CFLACEncoder::CFLACEncoder(void)
+  : m_out(NULL), m_outLen(0), m_bitBuf(0), m_bitCount(0)
+{
+  InitCRCTables();
+  SetFormat(2, 44100, 16);
+}
+
+CFLACEncoder::~CFLACEncoder(void)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Sets the format of the PCM data to be encoded; returns false if FLAC
+//  frames cannot be produced for it (see IsFormatSupported)
+//
+bool CFLACEncoder::SetFormat(int channels, long samplesPerSec, int bitsPerSample) {
+  if (!IsFormatSupported(channels, samplesPerSec, bitsPerSample))
+    return false;
+
+  m_channels = channels;
+  m_samplesPerSec = samplesPerSec;
+  m_bitsPerSample = bitsPerSample;
+
+  // Common rates have a code of their own; others are spelled out at the
+  //  end of each frame header, if they fit
+  switch (samplesPerSec) {
+    case  88200: m_rateCode =  1; break;
+    case 176400: m_rateCode =  2; break;
+    case 192000: m_rateCode =  3; break;
+    case   8000: m_rateCode =  4; break;
+    case  16000: m_rateCode =  5; break;
+    case  22050: m_rateCode =  6; break;
+    case  24000: m_rateCode =  7; break;
+    case  32000: m_rateCode =  8; break;
+    case  44100: m_rateCode =  9; break;
+    case  48000: m_rateCode = 10; break;
+    case  96000: m_rateCode = 11; break;
+    default:
+      if ((samplesPerSec % 1000 == 0) && (samplesPerSec / 1000 < 256)) {
+        m_rateCode = 12;                // in kHz (8 bits)
+      } else if (samplesPerSec < 65536) {
+        m_rateCode = 13;                // in Hz (16 bits)
+      } else if ((samplesPerSec % 10 == 0) && (samplesPerSec / 10 < 65536)) {
+        m_rateCode = 14;                // in tens of Hz (16 bits)
+      } else {
+        m_rateCode = 0;                 // as in the STREAMINFO block
+      }
+  }
+
+  return true;
+}
+
+//
+// Encodes <numSamples> (at most FLAC_BLOCKSIZE) interleaved samples into
+//  <frame> (at least GetMaxFrameLength() bytes long); returns the length
+//  of the frame
+//
+long CFLACEncoder::EncodeFrame(const BYTE* pcm, long numSamples, DWORD frameNumber, BYTE* frame) {
+  if ((numSamples < 1) || (numSamples > FLAC_BLOCKSIZE))
+    return 0;
+
+  int ch;
+  long i;
+
+  // Split the channels
+  if (m_bitsPerSample == 8) {
+    for (i = 0; i < numSamples; i++) {
+      for (ch = 0; ch < m_channels; ch++)
+        m_signal[ch][i] = (long)(*(pcm++)) - 128;
+    }
+  } else {
+    for (i = 0; i < numSamples; i++) {
+      for (ch = 0; ch < m_channels; ch++, pcm += 2)
+        m_signal[ch][i] = (short)(WORD)(pcm[0] | (pcm[1] << 8));
+    }
+  }
+
+  // Pick the cheapest way of coding each channel (and, for stereo, the
+  //  cheapest pair of channels)
+  int assignment = m_channels - 1;      // independent channels
+  int signals[FLAC_MAXCHANNELS];
+  int signalBits[FLAC_MAXCHANNELS];
+
+  for (ch = 0; ch < m_channels; ch++) {
+    AnalyzeSubframe(m_signal[ch], numSamples, m_bitsPerSample, m_subframes[ch]);
+    signals[ch] = ch;
+    signalBits[ch] = m_bitsPerSample;
+  }
+
+  if (m_channels == 2) {
+    long* left  = m_signal[0];
+    long* right = m_signal[1];
+    long* mid   = m_signal[2];
+    long* side  = m_signal[3];
+
+    for (i = 0; i < numSamples; i++) {
+      mid[i]  = (left[i] + right[i]) >> 1;
+      side[i] = left[i] - right[i];
+    }
+
+    AnalyzeSubframe(mid, numSamples, m_bitsPerSample, m_subframes[2]);
+    AnalyzeSubframe(side, numSamples, m_bitsPerSample + 1, m_subframes[3]);
+
+    long bestBits = m_subframes[0].numBits + m_subframes[1].numBits;
+    long numBits;
+
+    if ((numBits = m_subframes[0].numBits + m_subframes[3].numBits) < bestBits) {
+      bestBits = numBits;
+      assignment = CH_LEFT_SIDE;
+      signals[0] = 0; signalBits[0] = m_bitsPerSample;
+      signals[1] = 3; signalBits[1] = m_bitsPerSample + 1;
+    }
+
+    if ((numBits = m_subframes[3].numBits + m_subframes[1].numBits) < bestBits) {
+      bestBits = numBits;
+      assignment = CH_SIDE_RIGHT;
+      signals[0] = 3; signalBits[0] = m_bitsPerSample + 1;
+      signals[1] = 1; signalBits[1] = m_bitsPerSample;
+    }
+
+    if ((numBits = m_subframes[2].numBits + m_subframes[3].numBits) < bestBits) {
+      bestBits = numBits;
+      assignment = CH_MID_SIDE;
+      signals[0] = 2; signalBits[0] = m_bitsPerSample;
+      signals[1] = 3; signalBits[1] = m_bitsPerSample + 1;
+    }
+  }
+
+  m_out = frame;
+  m_outLen = 0;
+  m_bitBuf = 0;
+  m_bitCount = 0;
+
+  // Frame header
+  int sizeCode = (numSamples == FLAC_BLOCKSIZE) ? 12 : 7;  // 12 = 4096 samples, 7 = spelled out (16 bits)
+
+  PutBits(0xfff8, 16);                  // sync code, fixed block size
+  PutBits(sizeCode, 4);
+  PutBits(m_rateCode, 4);
+  PutBits(assignment, 4);
+  PutBits((m_bitsPerSample == 8) ? 1 : 4, 3);
+  PutBits(0, 1);
+  PutUTF8(frameNumber);
+
+  if (sizeCode == 7)
+    PutBits(numSamples - 1, 16);
+
+  switch (m_rateCode) {
+    case 12: PutBits(m_samplesPerSec / 1000, 8); break;
+    case 13: PutBits(m_samplesPerSec, 16); break;
+    case 14: PutBits(m_samplesPerSec / 10, 16); break;
+  }
+
+  BYTE crc8 = 0;
+
+  for (i = 0; i < m_outLen; i++)
+    crc8 = s_crc8[crc8 ^ m_out[i]];
+
+  PutBits(crc8, 8);
+
+  // Subframes
+  for (ch = 0; ch < m_channels; ch++)
+    WriteSubframe(m_signal[signals[ch]], numSamples, signalBits[ch], m_subframes[signals[ch]]);
+
+  // Frame footer
+  AlignToByte();
+
+  WORD crc16 = 0;
+
+  for (i = 0; i < m_outLen; i++)
+    crc16 = (WORD)((crc16 << 8) ^ s_crc16[(crc16 >> 8) ^ m_out[i]]);
+
+  PutBits(crc16, 16);
+
+  return m_outLen;
+}
+
+//
+// Retrieves the largest size a frame can have in the current format
+//
+long CFLACEncoder::GetMaxFrameLength(void) const {
+  return FLAC_MAXFRAMELEN(m_channels, m_bitsPerSample);
+}
+
+//
+// Whether FLAC frames can be produced for a given PCM format
+//
+bool CFLACEncoder::IsFormatSupported(int channels, long samplesPerSec, int bitsPerSample) {
+  return (channels >= 1) && (channels <= FLAC_MAXCHANNELS) &&
+         (samplesPerSec > 0) && (samplesPerSec < (1 << 20)) &&  // as in the STREAMINFO block
+         ((bitsPerSample == 8) || (bitsPerSample == 16));
+}
+
+//////////////////////////////////////////////////////////////////////
+// Utility functions
+//////////////////////////////////////////////////////////////////////
+
+//
+// Decides how to code one channel (constant, verbatim or predicted), and
+//  how many bits that takes
+//
+void CFLACEncoder::AnalyzeSubframe(const long* signal, long numSamples, int bps, subframe_t& subframe) {
+  long i;
+
+  // Silence (or any other constant signal) only takes one sample
+  for (i = 1; (i < numSamples) && (signal[i] == signal[0]); i++);
+
+  if (i >= numSamples) {
+    subframe.type = SUB_CONSTANT;
+    subframe.numBits = 8 + bps;
+    return;
+  }
+
+  subframe.type = SUB_VERBATIM;
+  subframe.numBits = 8 + numSamples * bps;
+
+  if (numSamples <= FLAC_MAXORDER)
+    return;
+
+  // Pick the predictor that leaves the smallest prediction errors; the
+  //  errors of order n+1 are the differences between those of order n
+  LONGLONG sums[FLAC_MAXORDER + 1] = { 0, 0, 0, 0, 0 };
+  long last0 = signal[3];
+  long last1 = signal[3] - signal[2];
+  long last2 = last1 - (signal[2] - signal[1]);
+  long last3 = last2 - (signal[2] - 2 * signal[1] + signal[0]);
+
+  for (i = FLAC_MAXORDER; i < numSamples; i++) {
+    long err0 = signal[i];
+    long err1 = err0 - last0;
+    long err2 = err1 - last1;
+    long err3 = err2 - last2;
+    long err4 = err3 - last3;
+
+    sums[0] += (err0 < 0) ? -err0 : err0;
+    sums[1] += (err1 < 0) ? -err1 : err1;
+    sums[2] += (err2 < 0) ? -err2 : err2;
+    sums[3] += (err3 < 0) ? -err3 : err3;
+    sums[4] += (err4 < 0) ? -err4 : err4;
+
+    last0 = err0;
+    last1 = err1;
+    last2 = err2;
+    last3 = err3;
+  }
+
+  int order = 0;
+
+  for (int j = 1; j <= FLAC_MAXORDER; j++) {
+    if (sums[j] < sums[order])
+      order = j;
+  }
+
+  // Pick the partitioning of the residual that codes it best
+  ComputeResidual(signal, numSamples, order);
+
+  int partOrder = -1;
+  LONGLONG bestBits = 0;
+
+  for (int p = 0; p <= FLAC_MAXPARTORDER; p++) {
+    if ((numSamples % (1 << p) != 0) || ((numSamples >> p) <= order))
+      break;                            // partitions must split the block evenly, and the first one must hold more than the warm-up samples
+
+    LONGLONG numBits = ComputeRiceParams(numSamples, order, p, NULL);
+
+    if ((partOrder < 0) || (numBits < bestBits)) {
+      partOrder = p;
+      bestBits = numBits;
+    }
+  }
+
+  // The Rice costs are upper bounds, so a predicted subframe is never
+  //  larger than the verbatim one it replaces
+  bestBits += 8 + order * bps + 2 + 4;
+
+  if ((partOrder >= 0) && (bestBits < subframe.numBits)) {
+    subframe.type = SUB_FIXED;
+    subframe.order = order;
+    subframe.partOrder = partOrder;
+    subframe.numBits = (long)bestBits;
+
+    ComputeRiceParams(numSamples, order, partOrder, subframe.riceParam);
+  }
+}
+
+//
+// Writes out one channel, as decided by AnalyzeSubframe
+//
+void CFLACEncoder::WriteSubframe(const long* signal, long numSamples, int bps, const subframe_t& subframe) {
+  long i;
+
+  switch (subframe.type) {
+    case SUB_CONSTANT:
+      PutBits(0x00, 8);
+      PutSigned(signal[0], bps);
+      break;
+
+    case SUB_VERBATIM:
+      PutBits(0x02, 8);
+
+      for (i = 0; i < numSamples; i++)
+        PutSigned(signal[i], bps);
+
+      break;
+
+    case SUB_FIXED: {
+      PutBits((0x08 | subframe.order) << 1, 8);
+
+      for (i = 0; i < subframe.order; i++)
+        PutSigned(signal[i], bps);      // warm-up samples
+
+      PutBits(0, 2);                    // Rice coding, 4-bit parameters
+      PutBits(subframe.partOrder, 4);
+
+      ComputeResidual(signal, numSamples, subframe.order);
+
+      long partLen = numSamples >> subframe.partOrder;
+
+      for (int p = 0; p < (1 << subframe.partOrder); p++) {
+        int k = subframe.riceParam[p];
+        unsigned long mask = (1UL << k) - 1;
+
+        PutBits(k, 4);
+
+        for (i = (p == 0) ? subframe.order : p * partLen; i < (p + 1) * partLen; i++) {
+          unsigned long value = m_residual[i];
+          unsigned long quotient = value >> k;
+
+          // Unary-coded quotient (zeroes, then a one), then the remainder
+          if (quotient + 1 + k <= 24) {
+            PutBits((1UL << k) | (value & mask), quotient + 1 + k);
+          } else {
+            for (; quotient >= 24; quotient -= 24)
+              PutBits(0, 24);
+
+            PutBits(1, quotient + 1);
+            PutBits(value & mask, k);
+          }
+        }
+      }
+
+      break;
+    }
+  }
+}
+
+//
+// Computes the errors of a fixed predictor, folded to unsigned values
+//  (0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...) as expected by the Rice
+//  coder
+//
+void CFLACEncoder::ComputeResidual(const long* signal, long numSamples, int order) {
+  long i, err;
+
+  for (i = order; i < numSamples; i++) {
+    switch (order) {
+      case 0: err = signal[i]; break;
+      case 1: err = signal[i] - signal[i - 1]; break;
+      case 2: err = signal[i] - 2 * signal[i - 1] + signal[i - 2]; break;
+      case 3: err = signal[i] - 3 * signal[i - 1] + 3 * signal[i - 2] - signal[i - 3]; break;
+      default: err = signal[i] - 4 * signal[i - 1] + 6 * signal[i - 2] - 4 * signal[i - 3] + signal[i - 4]; break;
+    }
+
+    m_residual[i] = (err < 0) ? ((((unsigned long)(-err)) << 1) - 1) : (((unsigned long)err) << 1);
+  }
+}
+
+//
+// Picks the Rice parameter of each partition of the residual (stored in
+//  <riceParam>, if not NULL); returns how many bits the partitions take at
+//  most
+//
+LONGLONG CFLACEncoder::ComputeRiceParams(long numSamples, int order, int partOrder, BYTE* riceParam) {
+  long partLen = numSamples >> partOrder;
+  LONGLONG numBits = 0;
+
+  for (int p = 0; p < (1 << partOrder); p++) {
+    long start = (p == 0) ? order : p * partLen;
+    long count = (p + 1) * partLen - start;
+    LONGLONG sum = 0;
+
+    for (long i = start; i < start + count; i++)
+      sum += m_residual[i];
+
+    // A larger parameter costs one more bit per value, and saves about
+    //  half the unary bits; stop where that no longer pays
+    int k = 0;
+
+    while ((k < FLAC_MAXRICEPARAM) && (((LONGLONG)count << (k + 1)) < sum))
+      k++;
+
+    if (riceParam != NULL)
+      riceParam[p] = (BYTE)k;
+
+    // The sum of the quotients is no more than the quotient of the sum
+    numBits += 4 + (LONGLONG)count * (k + 1) + (sum >> k);
+  }
+
+  return numBits;
+}
+
+//
+// Appends up to 24 bits (most significant first) to the frame
+//
+void CFLACEncoder::PutBits(unsigned long value, int numBits) {
+  m_bitBuf = (m_bitBuf << numBits) | value;
+  m_bitCount += numBits;
+
+  while (m_bitCount >= 8) {
+    m_bitCount -= 8;
+    m_out[m_outLen++] = (BYTE)(m_bitBuf >> m_bitCount);
+  }
+}
+
+//
+// Appends a two's complement value
+//
+void CFLACEncoder::PutSigned(long value, int numBits) {
+  PutBits((unsigned long)value & ((1UL << numBits) - 1), numBits);
+}
+
+//
+// Appends a value coded as in UTF-8 (extended to 31 bits), as frame
+//  numbers are
+//
+void CFLACEncoder::PutUTF8(DWORD value) {
+  if (value < 0x80) {
+    PutBits(value, 8);
+    return;
+  }
+
+  int numBytes = (value < 0x800) ? 2 : (value < 0x10000) ? 3 : (value < 0x200000) ? 4 : (value < 0x4000000) ? 5 : 6;
+  int shift = 6 * (numBytes - 1);
+
+  PutBits(((0xff00 >> numBytes) & 0xff) | (value >> shift), 8);
+
+  while (shift > 0) {
+    shift -= 6;
+    PutBits(0x80 | ((value >> shift) & 0x3f), 8);
+  }
+}
+
+//
+// Pads the frame with zeroes up to the next byte boundary
+//
+void CFLACEncoder::AlignToByte(void) {
+  if (m_bitCount > 0)
+    PutBits(0, 8 - m_bitCount);
+}
+
+//
+// Computes the tables of the frame header (CRC-8, polynomial 0x07) and
+//  frame (CRC-16, polynomial 0x8005) checksums
+//
+void CFLACEncoder::InitCRCTables(void) {
+  if (s_isCRCInit)
+    return;
+
+  for (int i = 0; i < 256; i++) {
+    BYTE crc8 = (BYTE)i;
+    WORD crc16 = (WORD)(i << 8);
+
+    for (int j = 0; j < 8; j++) {
+      crc8  = (BYTE)((crc8 & 0x80) ? ((crc8 << 1) ^ 0x07) : (crc8 << 1));
+      crc16 = (WORD)((crc16 & 0x8000) ? ((crc16 << 1) ^ 0x8005) : (crc16 << 1));
+    }
+
+    s_crc8[i] = crc8;
+    s_crc16[i] = crc16;
+  }
+
+  s_isCRCInit = true;
+}
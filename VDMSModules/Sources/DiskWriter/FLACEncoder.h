@@ -0,0 +1,87 @@
+#ifndef __FLACENCODER_H_
+#define __FLACENCODER_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define FLAC_BLOCKSIZE      4096    // samples (per channel) in a frame
+#define FLAC_MAXCHANNELS    2       // VDMSound only ever produces mono or stereo
+#define FLAC_MAXORDER       4       // highest order of the fixed predictors
+#define FLAC_MAXPARTORDER   8       // highest residual partition order (256 partitions)
+
+// Largest encoded frame: header, verbatim subframes (the side channel being
+//  one bit wider), footer
+#define FLAC_MAXFRAMELEN(channels, bits) (16 + (channels) * (1 + ((bits) + 1) * FLAC_BLOCKSIZE / 8 + 1) + 2)
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// FLAC frame encoder: turns a block of interleaved PCM samples (8-bit
+//  unsigned or 16-bit signed little-endian, as found in Wave files) into a
+//  self-contained FLAC frame.  Each channel is coded with whichever of the
+//  fixed polynomial predictors (order 0 to 4) leaves the smallest residual,
+//  the residual being coded with partitioned Rice codes; stereo blocks
+//  are also tried as left/side, side/right and mid/side.  Frames do not
+//  depend on one another, so several encoders can work on different frames
+//  of the same stream at once.
+//
+// No operating system services are used.
+//
+class CFLACEncoder {
+  public:
+    CFLACEncoder(void);
+    ~CFLACEncoder(void);
+
+  public:
+    bool SetFormat(int channels, long samplesPerSec, int bitsPerSample);
+    long EncodeFrame(const BYTE* pcm, long numSamples, DWORD frameNumber, BYTE* frame);
+    long GetMaxFrameLength(void) const;
+
+    static bool IsFormatSupported(int channels, long samplesPerSec, int bitsPerSample);
+
+  protected:
+    enum { SUB_CONSTANT, SUB_VERBATIM, SUB_FIXED };
+    enum { CH_INDEPENDENT = 0, CH_LEFT_SIDE = 8, CH_SIDE_RIGHT = 9, CH_MID_SIDE = 10 };
+
+    typedef struct {
+      int type;
+      int order;                        // SUB_FIXED: predictor order
+      int partOrder;                    // SUB_FIXED: residual partition order
+      BYTE riceParam[1 << FLAC_MAXPARTORDER];
+      long numBits;                     // size of the encoded subframe
+    } subframe_t;
+
+  protected:
+    void AnalyzeSubframe(const long* signal, long numSamples, int bps, subframe_t& subframe);
+    void WriteSubframe(const long* signal, long numSamples, int bps, const subframe_t& subframe);
+
+    void ComputeResidual(const long* signal, long numSamples, int order);
+    LONGLONG ComputeRiceParams(long numSamples, int order, int partOrder, BYTE* riceParam);
+
+    void PutBits(unsigned long value, int numBits);
+    void PutSigned(long value, int numBits);
+    void PutUTF8(DWORD value);
+    void AlignToByte(void);
+
+    static void InitCRCTables(void);
+
+  protected:
+    int m_channels;
+    long m_samplesPerSec;
+    int m_bitsPerSample;
+    BYTE m_rateCode;                    // how the sample rate is coded in frame headers
+
+    long m_signal[FLAC_MAXCHANNELS + 2][FLAC_BLOCKSIZE];    // the channels (plus mid and side, for stereo)
+    unsigned long m_residual[FLAC_BLOCKSIZE];               // prediction errors of the predictor being looked at (folded to unsigned)
+    subframe_t m_subframes[FLAC_MAXCHANNELS + 2];
+
+    BYTE* m_out;                        // frame being written
+    long m_outLen;                      // how many whole bytes were written
+    unsigned long m_bitBuf;             // bits not yet written out
+    int m_bitCount;                     // how many of them (0-7 between calls)
+
+    static BYTE s_crc8[256];
+    static WORD s_crc16[256];
+    static bool s_isCRCInit;
+};
+
+#endif //__FLACENCODER_H_
@@ -0,0 +1,493 @@
+#include "stdafx.h"
+#include "FLACStream.h"
+
+#include <MFCUtil.h>
+#include <VDMUtil.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define FLAC_STREAMINFOLEN      34
+#define FLAC_SEEKTABLELEN       (18 * FLAC_SEEKPOINTS)
+#define FLAC_CUESHEETLEN(n)     (432 + 48 * (n))    // header, <n> tracks (of one index point each), lead-out track
+
+// The signature, the STREAMINFO and SEEKTABLE blocks, then room for a
+//  CUESHEET block of FLAC_MAXCUES tracks followed by a PADDING block
+#define FLAC_METADATALEN        (4 + 4 + FLAC_STREAMINFOLEN + 4 + FLAC_SEEKTABLELEN + 4 + FLAC_CUESHEETLEN(FLAC_MAXCUES) + 4)
+
+#define FLAC_BLOCK_STREAMINFO   0
+#define FLAC_BLOCK_PADDING      1
+#define FLAC_BLOCK_SEEKTABLE    3
+#define FLAC_BLOCK_CUESHEET     5
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Stores a big-endian value
+//
+static BYTE* PutBE(BYTE* dest, LONGLONG value, int numBytes) {
+  for (int i = numBytes - 1; i >= 0; i--)
+    *(dest++) = (BYTE)(value >> (8 * i));
+
+  return dest;
+}
+
+//
+// Stores the header of a metadata block
+//
+static BYTE* PutBlockHeader(BYTE* dest, bool isLast, int type, DWORD length) {
+  *(dest++) = (BYTE)((isLast ? 0x80 : 0x00) | type);
+  return PutBE(dest, length, 3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CFLACStream::CFLACStream(void)
+  : m_numThreads(0), m_isQuit(false), m_frameBytes(0), m_slotLen(0), m_pcm(NULL), m_pcmLen(0), m_frames(NULL), m_batchFrames(0), m_batchWorkers(0), m_metadata(NULL)
+{
+  for (int i = 0; i < FLAC_MAXTHREADS; i++) {
+    m_encoders[i] = NULL;
+    m_hStart[i] = NULL;
+    m_hDone[i] = NULL;
+  }
+}
+
+CFLACStream::~CFLACStream(void)
+{
+  Destroy();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Allocates the buffers and starts the helper threads; <numThreads> is how
+//  many threads may encode frames at once (0 = as many as there are
+//  processors, less one left to the emulation)
+//
+bool CFLACStream::Init(
+  IVDMQUERYLib::IVDMRTEnvironmentPtr& env,
+  int numThreads)
+{
+  ASSERT(m_pcm == NULL);
+
+  m_env = env;
+
+  if (numThreads <= 0) {
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    numThreads = (int)systemInfo.dwNumberOfProcessors - 1;
+  }
+
+  m_numThreads = max(1, min(numThreads, FLAC_MAXTHREADS));
+  m_slotLen = FLAC_MAXFRAMELEN(FLAC_MAXCHANNELS, 16);
+
+  int i;
+
+  try {
+    m_pcm = new BYTE[FLAC_BATCHFRAMES * FLAC_BLOCKSIZE * FLAC_MAXCHANNELS * 2];
+    m_frames = new BYTE[FLAC_BATCHFRAMES * m_slotLen];
+    m_metadata = new BYTE[FLAC_METADATALEN];
+
+    for (i = 0; i < m_numThreads; i++)
+      m_encoders[i] = new CFLACEncoder;
+  } catch (CMemoryException * pme) {
+    TCHAR errMsg[1024] = _T("<no description available>");
+    pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while allocating FLAC encoder memory:\n%s"), errMsg));
+    Destroy();
+    return false;
+  }
+
+  // The disk I/O thread is the first encoder thread; start the others
+  for (i = 1; i < m_numThreads; i++) {
+    if (((m_hStart[i] = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+        ((m_hDone[i] = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+        !m_threads[i].Create(this, _T("FLAC Encoder"), true))
+    {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not create the FLAC encoder threads")));
+      Destroy();
+      return false;
+    }
+
+    m_threads[i].SetPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    m_threads[i].Resume();
+  }
+
+  return true;
+}
+
+//
+// Stops the helper threads and releases the buffers (the disk I/O thread
+//  must be done with the stream)
+//
+void CFLACStream::Destroy(void) {
+  int i;
+
+  m_isQuit = true;
+
+  for (i = 1; i < FLAC_MAXTHREADS; i++) {
+    if (m_threads[i].GetThreadHandle() != NULL) {
+      SetEvent(m_hStart[i]);
+      m_threads[i].Join();
+    }
+
+    if (m_hStart[i] != NULL) {
+      CloseHandle(m_hStart[i]);
+      m_hStart[i] = NULL;
+    }
+
+    if (m_hDone[i] != NULL) {
+      CloseHandle(m_hDone[i]);
+      m_hDone[i] = NULL;
+    }
+  }
+
+  for (i = 0; i < FLAC_MAXTHREADS; i++) {
+    delete m_encoders[i];
+    m_encoders[i] = NULL;
+  }
+
+  delete[] m_pcm;
+  m_pcm = NULL;
+  delete[] m_frames;
+  m_frames = NULL;
+  delete[] m_metadata;
+  m_metadata = NULL;
+
+  m_numThreads = 0;
+  m_isQuit = false;
+  m_env = NULL;
+}
+
+//
+// Retrieves how many threads encode frames
+//
+int CFLACStream::GetNumThreads(void) {
+  return m_numThreads;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CStreamEncoder
+//////////////////////////////////////////////////////////////////////
+
+//
+// Starts a new stream, reserving room for the metadata
+//
+bool CFLACStream::Begin(
+  CSequentialFile& file,
+  LPCVOID lpParams,
+  DWORD nParamsLength)
+{
+  const PCMWAVEFORMAT* format = (const PCMWAVEFORMAT*)lpParams;
+
+  if ((m_pcm == NULL) ||
+      (format == NULL) || (nParamsLength < sizeof(PCMWAVEFORMAT)) ||
+      !CFLACEncoder::IsFormatSupported(format->wf.nChannels, format->wf.nSamplesPerSec, format->wBitsPerSample))
+  {
+    m_frameBytes = 0;
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return false;
+  }
+
+  m_format = *format;
+  m_format.wf.nBlockAlign = m_format.wf.nChannels * m_format.wBitsPerSample / 8;
+  m_frameBytes = FLAC_BLOCKSIZE * m_format.wf.nBlockAlign;
+
+  for (int i = 0; i < m_numThreads; i++)
+    m_encoders[i]->SetFormat(m_format.wf.nChannels, m_format.wf.nSamplesPerSec, m_format.wBitsPerSample);
+
+  m_pcmLen = 0;
+  m_frameNumber = 0;
+  m_numSamples = 0;
+  m_streamBytes = 0;
+  m_minFrameLen = m_maxFrameLen = 0;
+  m_numSeekPoints = 0;
+  m_seekInterval = m_format.wf.nSamplesPerSec;   // one point per second, to begin with
+  m_numCues = 0;
+  m_droppedCues = 0;
+
+  DWORD length = FormatMetadata();
+
+  return (file.Write(m_metadata, length) == length);
+}
+
+//
+// Collects PCM data, encoding it a batch of frames at a time
+//
+bool CFLACStream::Encode(
+  CSequentialFile& file,
+  LPCVOID lpBuffer,
+  DWORD nNumberOfBytes)
+{
+  if (m_frameBytes == 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return false;
+  }
+
+  const BYTE* data = (const BYTE*)lpBuffer;
+  DWORD batchBytes = FLAC_BATCHFRAMES * m_frameBytes;
+
+  while (nNumberOfBytes > 0) {
+    DWORD length = min(nNumberOfBytes, batchBytes - m_pcmLen);
+
+    memcpy(m_pcm + m_pcmLen, data, length);
+    m_pcmLen += length;
+    data += length;
+    nNumberOfBytes -= length;
+
+    if ((m_pcmLen >= batchBytes) && !EncodeBatch(file))
+      return false;
+  }
+
+  return true;
+}
+
+//
+// Records a cue point at the current position in the stream
+//
+void CFLACStream::Mark(void) {
+  if (m_frameBytes == 0)
+    return;
+
+  LONGLONG sample = m_numSamples + m_pcmLen / m_format.wf.nBlockAlign;
+
+  if ((m_numCues > 0) && (m_cues[m_numCues - 1] == sample))
+    return;
+
+  if (m_numCues >= FLAC_MAXCUES) {
+    m_droppedCues++;
+    return;
+  }
+
+  m_cues[m_numCues++] = sample;
+}
+
+//
+// Encodes what is left of the stream, then fills in the metadata
+//
+bool CFLACStream::End(CSequentialFile& file) {
+  if (m_frameBytes == 0)
+    return true;                        // the stream never began
+
+  m_pcmLen -= m_pcmLen % m_format.wf.nBlockAlign;
+
+  if ((m_pcmLen > 0) && !EncodeBatch(file))
+    return false;
+
+  if (m_droppedCues > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Only the first %d cue points were saved (%d more were dropped)"), FLAC_MAXCUES, m_droppedCues));
+
+  DWORD length = FormatMetadata();
+
+  return file.Seek(0, FILE_BEGIN) &&
+         (file.Write(m_metadata, length) == length) &&
+         file.Seek(0, FILE_END);
+}
+
+//////////////////////////////////////////////////////////////////////
+// IRunnable
+//////////////////////////////////////////////////////////////////////
+
+unsigned int CFLACStream::Run(CThread& thread) {
+  int worker;
+
+  for (worker = 1; (worker < FLAC_MAXTHREADS) && (&thread != &m_threads[worker]); worker++);
+
+  ASSERT(worker < FLAC_MAXTHREADS);
+
+  while (true) {
+    WaitForSingleObject(m_hStart[worker], INFINITE);
+
+    if (m_isQuit)
+      return 0;
+
+    EncodeFrames(worker);
+    SetEvent(m_hDone[worker]);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Utility functions
+//////////////////////////////////////////////////////////////////////
+
+//
+// Encodes the collected PCM data (the last frame may be short), sharing
+//  the frames between the helper threads and this one, then writes out
+//  the frames in order
+//
+bool CFLACStream::EncodeBatch(CSequentialFile& file) {
+  int i;
+
+  m_batchFrames = (m_pcmLen + m_frameBytes - 1) / m_frameBytes;
+  m_batchWorkers = min(m_numThreads, m_batchFrames);
+
+  for (i = 1; i < m_batchWorkers; i++)
+    SetEvent(m_hStart[i]);
+
+  EncodeFrames(0);
+
+  if (m_batchWorkers > 1)
+    WaitForMultipleObjects(m_batchWorkers - 1, &m_hDone[1], TRUE, INFINITE);
+
+  DWORD pcmLen = m_pcmLen;
+
+  m_pcmLen = 0;
+  m_frameNumber += m_batchFrames;
+
+  for (i = 0; i < m_batchFrames; i++) {
+    long numSamples = min(m_frameBytes, pcmLen - i * m_frameBytes) / m_format.wf.nBlockAlign;
+    DWORD length = m_frameLen[i];
+
+    AddSeekPoint(numSamples);
+
+    if (file.Write(m_frames + i * m_slotLen, length) != length)
+      return false;
+
+    if ((m_minFrameLen == 0) || (m_frameLen[i] < m_minFrameLen))
+      m_minFrameLen = m_frameLen[i];
+
+    if (m_frameLen[i] > m_maxFrameLen)
+      m_maxFrameLen = m_frameLen[i];
+
+    m_numSamples += numSamples;
+    m_streamBytes += length;
+  }
+
+  return true;
+}
+
+//
+// Encodes a thread's share of the batch (every m_batchWorkers-th frame)
+//
+void CFLACStream::EncodeFrames(int worker) {
+  for (int i = worker; i < m_batchFrames; i += m_batchWorkers) {
+    DWORD offset = i * m_frameBytes;
+    long numSamples = min(m_frameBytes, m_pcmLen - offset) / m_format.wf.nBlockAlign;
+
+    m_frameLen[i] = m_encoders[worker]->EncodeFrame(m_pcm + offset, numSamples, m_frameNumber + i, m_frames + i * m_slotLen);
+  }
+}
+
+//
+// Records a seek point at the frame about to be written, if it is far
+//  enough from the previous one; when the table is full, every other point
+//  is dropped and the interval between points doubled
+//
+void CFLACStream::AddSeekPoint(long frameSamples) {
+  if ((m_numSeekPoints > 0) && (m_numSamples < m_seekPoints[m_numSeekPoints - 1].sample + m_seekInterval))
+    return;
+
+  if (m_numSeekPoints >= FLAC_SEEKPOINTS) {
+    for (int i = 0; i < FLAC_SEEKPOINTS / 2; i++)
+      m_seekPoints[i] = m_seekPoints[2 * i];
+
+    m_numSeekPoints = FLAC_SEEKPOINTS / 2;
+    m_seekInterval *= 2;
+
+    if (m_numSamples < m_seekPoints[m_numSeekPoints - 1].sample + m_seekInterval)
+      return;
+  }
+
+  m_seekPoints[m_numSeekPoints].sample = m_numSamples;
+  m_seekPoints[m_numSeekPoints].offset = m_streamBytes;
+  m_seekPoints[m_numSeekPoints].numSamples = frameSamples;
+  m_numSeekPoints++;
+}
+
+//
+// Lays out the metadata as it stands (always FLAC_METADATALEN bytes);
+//  returns its length
+//
+DWORD CFLACStream::FormatMetadata(void) {
+  BYTE* dest = m_metadata;
+  int i;
+
+  *(dest++) = 'f';
+  *(dest++) = 'L';
+  *(dest++) = 'a';
+  *(dest++) = 'C';
+
+  // STREAMINFO (the MD5 signature of the samples is not computed)
+  dest = PutBlockHeader(dest, false, FLAC_BLOCK_STREAMINFO, FLAC_STREAMINFOLEN);
+  dest = PutBE(dest, FLAC_BLOCKSIZE, 2);
+  dest = PutBE(dest, FLAC_BLOCKSIZE, 2);
+  dest = PutBE(dest, m_minFrameLen, 3);
+  dest = PutBE(dest, m_maxFrameLen, 3);
+  dest = PutBE(dest,
+               ((LONGLONG)m_format.wf.nSamplesPerSec << 44) |
+               ((LONGLONG)(m_format.wf.nChannels - 1) << 41) |
+               ((LONGLONG)(m_format.wBitsPerSample - 1) << 36) |
+               (m_numSamples & ((((LONGLONG)1) << 36) - 1)), 8);
+  memset(dest, 0, 16);
+  dest += 16;
+
+  // SEEKTABLE (unused points are placeholders)
+  dest = PutBlockHeader(dest, false, FLAC_BLOCK_SEEKTABLE, FLAC_SEEKTABLELEN);
+
+  for (i = 0; i < FLAC_SEEKPOINTS; i++) {
+    if (i < m_numSeekPoints) {
+      dest = PutBE(dest, m_seekPoints[i].sample, 8);
+      dest = PutBE(dest, m_seekPoints[i].offset, 8);
+      dest = PutBE(dest, m_seekPoints[i].numSamples, 2);
+    } else {
+      dest = PutBE(dest, -1, 8);
+      dest = PutBE(dest, 0, 8);
+      dest = PutBE(dest, 0, 2);
+    }
+  }
+
+  // CUESHEET (not a CD), each cue point starting a track; the room left
+  //  over is padding
+  int numTracks = 0;
+  DWORD padLen = FLAC_CUESHEETLEN(FLAC_MAXCUES) + 4;
+
+  for (i = 0; i < m_numCues; i++) {
+    if (m_cues[i] < m_numSamples)
+      numTracks++;
+  }
+
+  if (numTracks > 0) {
+    dest = PutBlockHeader(dest, false, FLAC_BLOCK_CUESHEET, FLAC_CUESHEETLEN(numTracks));
+    memset(dest, 0, 128 + 8 + 259);     // media catalog number, lead-in samples, CD flag and reserved bits
+    dest += 128 + 8 + 259;
+    *(dest++) = (BYTE)(numTracks + 1);
+
+    int trackNumber = 0;
+
+    for (i = 0; i < m_numCues; i++) {
+      if (m_cues[i] >= m_numSamples)
+        continue;
+
+      dest = PutBE(dest, m_cues[i], 8);
+      *(dest++) = (BYTE)(++trackNumber);
+      memset(dest, 0, 12 + 14);         // ISRC, audio track without pre-emphasis, reserved bits
+      dest += 12 + 14;
+      *(dest++) = 1;                    // one index point: index 1, at the start of the track
+      dest = PutBE(dest, 0, 8);
+      *(dest++) = 1;
+      memset(dest, 0, 3);
+      dest += 3;
+    }
+
+    dest = PutBE(dest, m_numSamples, 8);  // lead-out track
+    *(dest++) = 255;
+    memset(dest, 0, 12 + 14);
+    dest += 12 + 14;
+    *(dest++) = 0;
+
+    padLen -= FLAC_CUESHEETLEN(numTracks) + 4;
+  }
+
+  dest = PutBlockHeader(dest, true, FLAC_BLOCK_PADDING, padLen);
+  memset(dest, 0, padLen);
+  dest += padLen;
+
+  ASSERT(dest - m_metadata == FLAC_METADATALEN);
+
+  return (DWORD)(dest - m_metadata);
+}
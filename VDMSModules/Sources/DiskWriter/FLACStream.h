@@ -0,0 +1,101 @@
+#ifndef __FLACSTREAM_H_
+#define __FLACSTREAM_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include "DiskUtil.h"
+#include "FLACEncoder.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define FLAC_MAXTHREADS     8       // most threads encoding frames at once (including the disk I/O thread)
+#define FLAC_BATCHFRAMES    16      // how many frames are encoded at once
+#define FLAC_SEEKPOINTS     512     // room reserved for seek points in the file
+#define FLAC_MAXCUES        254     // room reserved for cue points in the file (each one becomes a track of a CUESHEET block)
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Encodes the data of a CAsyncSequentialFile (PCM samples) to a FLAC
+//  stream, on the disk I/O thread.  Frames are encoded in batches; when
+//  more than one processor is available, the frames of a batch are shared
+//  between the I/O thread and helper threads.
+// The metadata (STREAMINFO, SEEKTABLE, and a CUESHEET holding the points
+//  marked in the data) only becomes known once the stream is complete; room
+//  for it is reserved at the start of the file, and it is written there at
+//  the end.  Until then the file can still be decoded (frames stand on
+//  their own), but not seeked into.
+// The parameters handed to Begin are a PCMWAVEFORMAT.
+//
+class CFLACStream : public CStreamEncoder, public IRunnable {
+  public:
+    CFLACStream(void);
+    ~CFLACStream(void);
+
+  public:
+    bool Init(IVDMQUERYLib::IVDMRTEnvironmentPtr& env, int numThreads);
+    void Destroy(void);
+
+    int GetNumThreads(void);
+
+  // CStreamEncoder
+  public:
+    bool Begin(CSequentialFile& file, LPCVOID lpParams, DWORD nParamsLength);
+    bool Encode(CSequentialFile& file, LPCVOID lpBuffer, DWORD nNumberOfBytes);
+    void Mark(void);
+    bool End(CSequentialFile& file);
+
+  // IRunnable
+  public:
+    unsigned int Run(CThread& thread);
+
+  protected:
+    bool EncodeBatch(CSequentialFile& file);
+    void EncodeFrames(int worker);
+    void AddSeekPoint(long frameSamples);
+    DWORD FormatMetadata(void);
+
+  protected:
+    typedef struct {
+      LONGLONG sample;                  // first sample of the frame
+      LONGLONG offset;                  // where the frame starts, relative to the first frame
+      long numSamples;
+    } seekpoint_t;
+
+  protected:
+    int m_numThreads;                   // how many threads encode frames (the I/O thread, and helpers)
+    CFLACEncoder* m_encoders[FLAC_MAXTHREADS];
+    CThread m_threads[FLAC_MAXTHREADS]; // helper threads (the first one is unused: it stands for the I/O thread)
+    HANDLE m_hStart[FLAC_MAXTHREADS];   // signalled when a batch is ready for a helper thread
+    HANDLE m_hDone[FLAC_MAXTHREADS];    // signalled when a helper thread is done with its share of a batch
+    volatile bool m_isQuit;
+
+    PCMWAVEFORMAT m_format;
+    DWORD m_frameBytes;                 // how many bytes of PCM data make a full frame (0 = no stream begun)
+    DWORD m_slotLen;                    // size of a frame slot (the largest frame of any supported format)
+
+    BYTE* m_pcm;                        // PCM data of the batch being collected
+    DWORD m_pcmLen;
+    BYTE* m_frames;                     // encoded frames of the batch (one slot of m_slotLen bytes each)
+    long m_frameLen[FLAC_BATCHFRAMES];
+    int m_batchFrames;                  // how many frames are in the batch
+    int m_batchWorkers;                 // how many threads share the batch
+    BYTE* m_metadata;                   // metadata blocks, as written at the start of the file
+
+    DWORD m_frameNumber;                // number of the next frame
+    LONGLONG m_numSamples;              // how many samples (per channel) were encoded
+    LONGLONG m_streamBytes;             // how many bytes of frames were written
+    long m_minFrameLen, m_maxFrameLen;
+
+    seekpoint_t m_seekPoints[FLAC_SEEKPOINTS];
+    int m_numSeekPoints;
+    LONGLONG m_seekInterval;            // samples between two seek points (doubled whenever the table fills up)
+
+    LONGLONG m_cues[FLAC_MAXCUES];
+    int m_numCues;
+    long m_droppedCues;                 // how many cue points did not fit
+
+    IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+};
+
+#endif //__FLACSTREAM_H_
@@ -15,6 +15,10 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
+#define FIXUP_INTERVAL        5000  // how often (milliseconds) the header in the file is brought up to date
+
+/////////////////////////////////////////////////////////////////////////////
+
 #include <MFCUtil.h>
 #pragma comment ( lib , "MFCUtil.lib" )
 
@@ -94,6 +98,10 @@ STDMETHODIMP CMIDIOut::Init(IUnknown * configuration) {
     return ce.Error();                // Propagate the error
   }
 
+  // Start the disk I/O thread (the producers never touch the disk themselves)
+  if (!m_fOut.Init(m_env, _T("MIDI Writer")))
+    return E_OUTOFMEMORY;
+
   NewFile();
 
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIOut initialized ('%s')"), (LPCTSTR)(m_path)));
@@ -104,6 +112,9 @@ STDMETHODIMP CMIDIOut::Init(IUnknown * configuration) {
 STDMETHODIMP CMIDIOut::Destroy() {
   SaveFile();
 
+  // Wait for all the data to reach the disk
+  m_fOut.Destroy();
+
   // Release the MIDI-out module
   m_midiOut = NULL;
 
@@ -164,93 +175,54 @@ STDMETHODIMP CMIDIOut::HandleRealTime(LONGLONG usDelta, BYTE data) {
 // Utility functions
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// The file operations below are only queued for the disk I/O thread (see
+//  CAsyncSequentialFile); errors are reported by that thread.  Each event
+//  is composed in m_dataBuf, then handed over as a whole (or dropped as a
+//  whole, should the disk not keep up).
+//
+
 void CMIDIOut::NewFile(void) {
   if (m_fOut.IsOpen()) {
     m_fOut.Truncate();
   } else {
-    if (!m_fOut.Create(m_path + _T("\\vdms"), _T("mid"))) {
-      DWORD lastError = GetLastError();
-      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("SetFormat: Error encountered while creating MIDI file '%s'\n0x%08x - %s"), m_path + "\\vdmsXXXX.mid", lastError, (LPCTSTR)FormatMessage(lastError)));
-    }
+    m_fOut.Create(m_path + _T("\\vdms"), _T("mid"));
   }
 
   InitHeader();
   m_fOut.Write(&m_midHdr, sizeof(m_midHdr));
+  m_runningStatus = 0;
+  m_lastFixup = timeGetTime();
 }
 
 void CMIDIOut::WriteSysEx(LONGLONG usDelta, const BYTE* data, LONG length) {
-  WriteEvent(usDelta, MIDI_EVENT_SYSTEM_SYSEX_ESCAPE, 0, 0, 0);
-
   if (m_fOut.IsOpen()) {
-    if (m_dataLen + 5 + length > sizeof(m_dataBuf)) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
-    }
-
-    LONG m_dataLen_orig = m_dataLen;
-
-    m_dataLen += GetVarLenVal((BYTE*)(&length), sizeof(length), m_dataBuf + m_dataLen);
-
-    if (length > 0) {
-      memcpy(m_dataBuf + m_dataLen, data, length);
-      m_dataLen += length;
+    if (10 + 5 + length > (LONG)sizeof(m_dataBuf)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("SysEx message too long (%d bytes), not saved"), length));
+      return;
     }
 
-    IncreaseTrackLength(m_dataLen - m_dataLen_orig);
+    AppendEvent(usDelta, MIDI_EVENT_SYSTEM_SYSEX_ESCAPE, 0, 0, 0);
+    AppendData(data, length);
+    CommitRecord();
   }
 }
 
 void CMIDIOut::WriteMeta(LONGLONG usDelta, BYTE metaCmd, const BYTE* data, LONG length) {
-  WriteEvent(usDelta, MIDI_EVENT_SYSTEM_METAEVENT, metaCmd, 0, 1);
-
   if (m_fOut.IsOpen()) {
-    if (m_dataLen + 5 + length > sizeof(m_dataBuf)) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
-    }
-
-    LONG m_dataLen_orig = m_dataLen;
+    if (10 + 1 + 5 + length > (LONG)sizeof(m_dataBuf))
+      return;
 
-    m_dataLen += GetVarLenVal((BYTE*)(&length), sizeof(length), m_dataBuf + m_dataLen);
-
-    if (length > 0) {
-      memcpy(m_dataBuf + m_dataLen, data, length);
-      m_dataLen += length;
-    }
-
-    IncreaseTrackLength(m_dataLen - m_dataLen_orig);
+    AppendEvent(usDelta, MIDI_EVENT_SYSTEM_METAEVENT, metaCmd, 0, 1);
+    AppendData(data, length);
+    CommitRecord();
   }
 }
 
 void CMIDIOut::WriteEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
-/* TODO: get rid of following kludge by passing proper usDelta from EmuMPU401 */
-usDelta = (LONGLONG)1000 * timeGetTime();
-
   if (m_fOut.IsOpen()) {
-    if (m_midHdr.dwTrackLength == SWAP_LONG(0)) {
-      m_lastTime = usDelta;
-      usDelta = 0;
-    } else {
-      LONGLONG thisTime = usDelta;
-      usDelta = (usDelta - m_lastTime) / 1000;
-      m_lastTime = thisTime;
-    }
-
-    if (m_dataLen + 10 + length > sizeof(m_dataBuf)) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
-    }
-
-    LONG m_dataLen_orig = m_dataLen;
-
-    m_dataLen += GetVarLenVal((BYTE*)(&usDelta), sizeof(usDelta), m_dataBuf + m_dataLen);
-
-    m_dataBuf[m_dataLen++] = status;
-
-    if (length > 0) m_dataBuf[m_dataLen++] = data1;
-    if (length > 1) m_dataBuf[m_dataLen++] = data2;
-
-    IncreaseTrackLength(m_dataLen - m_dataLen_orig);
+    AppendEvent(usDelta, status, data1, data2, length);
+    CommitRecord();
   }
 }
 
@@ -264,21 +236,83 @@ void CMIDIOut::SaveFile(void) {
     BYTE arg = 0;
     WriteMeta(m_lastTime, MIDI_META_END_OF_TRACK, &arg, sizeof(arg));
 
-    // Flush the buffers
-    if (m_dataLen > 0) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
-    }
-
     // Update header in file
-    m_fOut.Seek(0, FILE_BEGIN);
-    m_fOut.Write(&m_midHdr, sizeof(m_midHdr));
+    m_fOut.Patch(0, &m_midHdr, sizeof(m_midHdr));
 
     // Close file (saves)
     m_fOut.Close();
   }
 }
 
+//
+// Appends an event (delta-time, status and data bytes) to the record
+//
+//
+// Events are placed at the time they were stamped with at the source, or at
+//  the time they arrived if they were not stamped (usDelta < 0).  Delta-times
+//  are worked out from the start of the track, so that rounding to ticks does
+//  not accumulate; events stamped out of order are placed at the time of the
+//  previous event.
+//
+void CMIDIOut::AppendEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
+  if (usDelta < 0)
+    usDelta = TIM_GetMicros();
+
+  if (m_midHdr.dwTrackLength == SWAP_LONG(0)) {
+    m_startTime = usDelta;
+    m_lastTick  = 0;
+  }
+
+  m_lastTime   = usDelta;
+  m_recordTick = max((usDelta - m_startTime) / 1000, m_lastTick);   // millisecond ticks (see InitHeader)
+
+  LONGLONG deltaTicks = m_recordTick - m_lastTick;
+
+  m_dataLen += GetVarLenVal((BYTE*)(&deltaTicks), sizeof(deltaTicks), m_dataBuf + m_dataLen);
+
+  // A channel message with the same status as the one before it goes
+  //  without (running status); SysEx and meta-events cancel running status
+  if ((status >= 0xf0) || (status != m_runningStatus))
+    m_dataBuf[m_dataLen++] = status;
+
+  m_recordStatus = (status < 0xf0) ? status : 0;
+
+  if (length > 0) m_dataBuf[m_dataLen++] = data1;
+  if (length > 1) m_dataBuf[m_dataLen++] = data2;
+}
+
+//
+// Appends length-prefixed data (SysEx or meta-event payload) to the record
+//
+void CMIDIOut::AppendData(const BYTE* data, LONG length) {
+  m_dataLen += GetVarLenVal((BYTE*)(&length), sizeof(length), m_dataBuf + m_dataLen);
+
+  if (length > 0) {
+    memcpy(m_dataBuf + m_dataLen, data, length);
+    m_dataLen += length;
+  }
+}
+
+//
+// Hands the record over to be written, and every now and then brings the
+//  header in the file up to date (so that the file is usable even if never
+//  closed properly)
+//
+void CMIDIOut::CommitRecord(void) {
+  if (m_fOut.Write(m_dataBuf, m_dataLen)) {
+    IncreaseTrackLength(m_dataLen);
+    m_lastTick = m_recordTick;        // a dropped record's time goes into the next record's delta-time
+    m_runningStatus = m_recordStatus; // a dropped record's status byte must not be left out of the next record
+  }
+
+  m_dataLen = 0;
+
+  if ((timeGetTime() - m_lastFixup) >= FIXUP_INTERVAL) {
+    m_fOut.Patch(0, &m_midHdr, sizeof(m_midHdr));
+    m_lastFixup = timeGetTime();
+  }
+}
+
 void CMIDIOut::InitHeader(void) {
   m_midHdr.dwStructSignature  = SWAP_LONG(0x4d546864);
   m_midHdr.dwStructLength     = SWAP_LONG(6);
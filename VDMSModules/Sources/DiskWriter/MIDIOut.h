@@ -27,7 +27,7 @@ class ATL_NO_VTABLE CMIDIOut :
   public IMIDIEventHandler
 {
 public:
-	CMIDIOut() : m_dataLen(0)
+	CMIDIOut() : m_lastTime(0), m_startTime(0), m_lastTick(0), m_recordTick(0), m_runningStatus(0), m_recordStatus(0), m_dataLen(0), m_lastFixup(0)
 	{	}
 
 DECLARE_REGISTRY_RESOURCEID(IDR_MIDIOUT)
@@ -63,6 +63,11 @@ protected:
   void WriteEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
   void SaveFile(void);
 
+protected:
+  void AppendEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
+  void AppendData(const BYTE* data, LONG length);
+  void CommitRecord(void);
+
 protected:
   void InitHeader(void);
   void IncreaseTrackLength(LONG delta);
@@ -75,9 +80,15 @@ protected:
 // Other member variables
 protected:
   CString m_path;
-  CSequentialFile m_fOut;
+  CAsyncSequentialFile m_fOut;
+
+  LONGLONG m_lastTime;                // timestamp of the last event (microseconds, see TIM_GetMicros)
+  LONGLONG m_startTime;               // timestamp of the first event in the track
+  LONGLONG m_lastTick;                // time of the last event written (ticks since m_startTime)
+  LONGLONG m_recordTick;              // time of the event in the record being composed
 
-  LONGLONG m_lastTime;
+  BYTE m_runningStatus;               // status of the last channel message written, 0 = none (running status)
+  BYTE m_recordStatus;                // running status once the record being composed is written
 
 # pragma pack (push, 1)
 
@@ -96,8 +107,9 @@ protected:
 
 # pragma pack (pop)
 
-  BYTE m_dataBuf[65536];
+  BYTE m_dataBuf[65536];              // the record (event) being composed
   LONG m_dataLen;
+  DWORD m_lastFixup;                  // when the header in the file was last brought up to date (timeGetTime)
 
 // Interfaces to dependency modules
 protected:
@@ -12,6 +12,15 @@
 
 #define INI_STR_WAVEOUT       L"WaveOut"
 #define INI_STR_PATH          L"Path"
+#define INI_STR_FORMAT        L"format"
+#define INI_STR_THREADS       L"encoderThreads"
+
+#define INI_STR_FORMAT_WAV    _T("wav")
+#define INI_STR_FORMAT_FLAC   _T("flac")
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define FIXUP_INTERVAL        5000  // how often (milliseconds) the header in the file is brought up to date, so that the file is usable even if never closed properly
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -72,6 +81,8 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
   IVDMQUERYLib::IVDMQueryDependenciesPtr Depends;   // Dependency query object
   IVDMQUERYLib::IVDMQueryConfigurationPtr Config;   // Configuration query object
 
+  int numThreads = 0;
+
   // Grab a copy of the runtime environment (useful for logging, etc.)
   RTE_Set(m_env, configuration);
 
@@ -86,6 +97,18 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
     // Try to obtain a path where files will be stored, use current directory if none specified
     m_path  = (LPCTSTR)CFG_Get(Config, INI_STR_PATH, ".", true);  // silent: do not complain if no path is specified
 
+    // File format (Wave files switch to RF64 past 4GB; FLAC is lossless, and about half the size)
+    CString format = (LPCTSTR)CFG_Get(Config, INI_STR_FORMAT, INI_STR_FORMAT_WAV, true);
+
+    if (format.CompareNoCase(INI_STR_FORMAT_FLAC) == 0) {
+      m_useFLAC = true;
+    } else if (format.CompareNoCase(INI_STR_FORMAT_WAV) != 0) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Unknown file format '%s', using '%s' instead"), (LPCTSTR)format, INI_STR_FORMAT_WAV));
+    }
+
+    // How many threads may encode FLAC frames at once (0 = one per processor, less one)
+    numThreads = CFG_Get(Config, INI_STR_THREADS, 0, 10, true);
+
     /** Get modules ********************************************************/
 
     // Try to obtain an interface to a Wave-out module, use NULL if none available
@@ -97,7 +120,19 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
 
   InitHeader(0, 0, 0);
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut initialized ('%s')"), (LPCTSTR)(m_path)));
+  // Start the FLAC encoder threads, if needed, and the disk I/O thread
+  //  (the producers never touch the disk themselves)
+  if ((m_useFLAC && !m_flac.Init(m_env, numThreads)) ||
+      !m_fOut.Init(m_env, _T("Wave Writer")))
+  {
+    return E_OUTOFMEMORY;
+  }
+
+  if (m_useFLAC) {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut initialized ('%s', FLAC encoded by %d thread(s))"), (LPCTSTR)(m_path), m_flac.GetNumThreads()));
+  } else {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut initialized ('%s')"), (LPCTSTR)(m_path)));
+  }
 
   return S_OK;
 }
@@ -105,6 +140,10 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
 STDMETHODIMP CWaveOut::Destroy() {
   SaveFile();
 
+  // Wait for all the data to reach the disk
+  m_fOut.Destroy();
+  m_flac.Destroy();
+
   // Release the Wave-out module
   m_waveOut = NULL;
 
@@ -130,7 +169,7 @@ STDMETHODIMP CWaveOut::SetFormat(WORD channels, DWORD samplesPerSec, WORD bitsPe
       (m_wavHdr.wBitsPerSample != bitsPerSample))
   {
     // If there is any data in the current file, save and close it
-    if (m_wavHdr.dwDataChunkSize > 0) {
+    if (m_dataSize > 0) {
       SaveFile();
     }
 
@@ -166,52 +205,94 @@ STDMETHODIMP CWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
 // Utility functions
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// The file operations below are only queued for the disk I/O thread (see
+//  CAsyncSequentialFile); errors are reported by that thread
+//
+
 void CWaveOut::NewFile(WORD channels, DWORD samplesPerSec, WORD bitsPerSample) {
-  if (m_fOut.IsOpen()) {
-    m_fOut.Truncate();
+  CSingleLock lock(&m_lock, TRUE);    // protect m_wavHdr, m_fOut
+
+  // Formats FLAC cannot take are saved as Wave files
+  bool isFLAC = m_useFLAC && CFLACEncoder::IsFormatSupported(channels, samplesPerSec, bitsPerSample);
+
+  if (m_useFLAC && !isFLAC)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("FLAC does not support %d-bit, %d-channel data; saving to a Wave file instead"), bitsPerSample, channels));
+
+  PCMWAVEFORMAT format;
+
+  format.wf.wFormatTag      = WAVE_FORMAT_PCM;
+  format.wf.nChannels       = channels;
+  format.wf.nSamplesPerSec  = samplesPerSec;
+  format.wf.nAvgBytesPerSec = channels * samplesPerSec * bitsPerSample / 8;
+  format.wf.nBlockAlign     = channels * bitsPerSample / 8;
+  format.wBitsPerSample     = bitsPerSample;
+
+  // Reuse the current (empty) file, if it is of the right type
+  if (m_fOut.IsOpen() && (isFLAC == m_isFileFLAC)) {
+    m_fOut.Truncate(&format, sizeof(format));
   } else {
-    if (!m_fOut.Create(m_path + _T("\\vdms"), _T("wav"))) {
-      DWORD lastError = GetLastError();
-      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("SetFormat: Error encountered while creating wave file '%s'\n0x%08x - %s"), m_path + "\\vdmsXXXX.wav", lastError, (LPCTSTR)FormatMessage(lastError)));
+    if (m_fOut.IsOpen())
+      m_fOut.Close();
+
+    if (isFLAC) {
+      m_fOut.Create(m_path + _T("\\vdms"), _T("flac"), &m_flac, &format, sizeof(format));
+    } else {
+      m_fOut.Create(m_path + _T("\\vdms"), _T("wav"));
     }
   }
 
-  CSingleLock lock(&m_lock, TRUE);    // protect m_wavHdr
+  m_isFileFLAC = isFLAC;
+  m_dataSize = 0;
 
   InitHeader(channels, samplesPerSec, bitsPerSample);
-  m_fOut.Write(&m_wavHdr, sizeof(m_wavHdr));
+
+  if (!m_isFileFLAC)
+    m_fOut.Write(&m_wavHdr, sizeof(m_wavHdr));
+
+  m_lastFixup = timeGetTime();
 }
 
 void CWaveOut::AddCue(void) {
-  if ((m_cues.GetSize() < 1) || (m_wavHdr.dwDataChunkSize != m_cues.GetAt(m_cues.GetSize() - 1))) {
-    m_cues.Add(m_wavHdr.dwDataChunkSize);
+  // (Wave cue points only cover the first 4GB of data)
+  if ((m_cues.GetSize() < 1) || ((DWORD)m_dataSize != m_cues.GetAt(m_cues.GetSize() - 1))) {
+    m_cues.Add((DWORD)m_dataSize);
+
+    if (m_isFileFLAC)
+      m_fOut.Mark();                  // the FLAC encoder keeps its own cue list
   }
 }
 
 void CWaveOut::WriteData(BYTE * data, LONG length) {
   if (m_fOut.IsOpen()) {
-    CSingleLock lock(&m_lock, TRUE);  // protect m_wavHdr, m_dataLen
+    CSingleLock lock(&m_lock, TRUE);  // protect m_wavHdr, m_fOut
 
-    if (m_dataLen + length > sizeof(m_dataBuf)) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
-    }
+    // Only count the data if it was accepted (it is dropped as a whole if
+    //  the disk cannot keep up)
+    if (m_fOut.Write(data, length))
+      m_dataSize += length;
 
-    memcpy(m_dataBuf + m_dataLen, data, length);
-    m_dataLen += length;
+    // Every now and then, bring the header in the file up to date (without
+    //  the cue list, which is only written when the file is saved); FLAC
+    //  files need no such thing, as their frames stand on their own
+    if (!m_isFileFLAC && ((timeGetTime() - m_lastFixup) >= FIXUP_INTERVAL)) {
+      UpdateHeader(0);
 
-    m_wavHdr.dwDataChunkSize += length;
+      m_fOut.Patch(0, &m_wavHdr, sizeof(m_wavHdr));
+      m_lastFixup = timeGetTime();
+    }
   }
 }
 
 void CWaveOut::SaveFile(void) {
   if (m_fOut.IsOpen()) {
-    CSingleLock lock(&m_lock, TRUE);  // protect m_wavHdr, m_dataLen
+    CSingleLock lock(&m_lock, TRUE);  // protect m_wavHdr, m_fOut
 
-    // Flush the buffers
-    if (m_dataLen > 0) {
-      m_fOut.Write(m_dataBuf, m_dataLen);
-      m_dataLen = 0;
+    // FLAC files are completed by the encoder (metadata included)
+    if (m_isFileFLAC) {
+      m_cues.RemoveAll();
+      m_fOut.Close();
+      return;
     }
 
     // Write out the cue list
@@ -224,39 +305,33 @@ void CWaveOut::SaveFile(void) {
     m_fOut.Write(&m_wavTail, sizeof(m_wavTail));
 
     for (int i = 0; i < m_cues.GetSize(); i++) {
-      DWORD dwIdentifier    = i;
-      DWORD dwPosition      = i;
-      DWORD fccChunk        = MAKEFOURCC('d','a','t','a');
-      DWORD dwChunkStart    = 0;
-      DWORD dwBlockStart    = 0;
-      DWORD dwSampleOffset  = m_cues.GetAt(i);
-
-      m_fOut.Write(&dwIdentifier,   sizeof(dwIdentifier));
-      m_fOut.Write(&dwPosition,     sizeof(dwPosition));
-      m_fOut.Write(&fccChunk,       sizeof(fccChunk));
-      m_fOut.Write(&dwChunkStart,   sizeof(dwChunkStart));
-      m_fOut.Write(&dwBlockStart,   sizeof(dwBlockStart));
-      m_fOut.Write(&dwSampleOffset, sizeof(dwSampleOffset));
+      DWORD cuePoint[6];
+
+      cuePoint[0] = i;                              // dwIdentifier
+      cuePoint[1] = i;                              // dwPosition
+      cuePoint[2] = MAKEFOURCC('d','a','t','a');    // fccChunk
+      cuePoint[3] = 0;                              // dwChunkStart
+      cuePoint[4] = 0;                              // dwBlockStart
+      cuePoint[5] = m_cues.GetAt(i);                // dwSampleOffset
+
+      m_fOut.Write(cuePoint, sizeof(cuePoint));
     }
 
     m_cues.RemoveAll();
 
-    // Finalize headers
-    m_wavHdr.dwRiffChunkSize =
-      1 * sizeof(DWORD) +                             // length of 'RIFF' chunk
-      2 * sizeof(DWORD) + m_wavHdr.dwFmtChunkSize +   // length of 'fmt ' chunk + chunk header
-      2 * sizeof(DWORD) + m_wavHdr.dwDataChunkSize +  // length of 'data' chunk + chunk header
-      2 * sizeof(DWORD) + m_wavTail.dwCueChunkSize;   // length of 'cue ' chunk + chunk header
-
     // Pad file, if necessary
-    if (m_wavHdr.dwRiffChunkSize & 0x1) {
+    DWORD tailLength = 2 * sizeof(DWORD) + m_wavTail.dwCueChunkSize;   // length of 'cue ' chunk + chunk header
+
+    if ((m_dataSize + tailLength) & 0x1) {
       char pad = 0x00;
       m_fOut.Write(&pad, sizeof(pad));
     }
 
+    // Finalize headers
+    UpdateHeader(tailLength);
+
     // Update header in file
-    m_fOut.Seek(0, FILE_BEGIN);
-    m_fOut.Write(&m_wavHdr, sizeof(m_wavHdr));
+    m_fOut.Patch(0, &m_wavHdr, sizeof(m_wavHdr));
 
     // Close file (saves)
     m_fOut.Close();
@@ -265,9 +340,16 @@ void CWaveOut::SaveFile(void) {
 
 void CWaveOut::InitHeader(WORD channels, DWORD samplesPerSec, WORD bitsPerSample) {
   m_wavHdr.dwRiffChunkID    = MAKEFOURCC('R','I','F','F');
-  m_wavHdr.dwRiffChunkSize  = 36;
+  m_wavHdr.dwRiffChunkSize  = 72;
   m_wavHdr.dwRiffFormat     = MAKEFOURCC('W','A','V','E');
 
+  m_wavHdr.dwDs64ChunkID    = MAKEFOURCC('J','U','N','K');
+  m_wavHdr.dwDs64ChunkSize  = 28;
+  m_wavHdr.qwRiffSize       = 0;
+  m_wavHdr.qwDataSize       = 0;
+  m_wavHdr.qwSampleCount    = 0;
+  m_wavHdr.dwTableLength    = 0;
+
   m_wavHdr.dwFmtChunkID     = MAKEFOURCC('f','m','t',' ');
   m_wavHdr.dwFmtChunkSize   = 16;
   m_wavHdr.wFormatTag       = WAVE_FORMAT_PCM;
@@ -280,3 +362,36 @@ void CWaveOut::InitHeader(WORD channels, DWORD samplesPerSec, WORD bitsPerSample
   m_wavHdr.dwDataChunkID    = MAKEFOURCC('d','a','t','a');
   m_wavHdr.dwDataChunkSize  = 0;
 }
+
+//
+// Brings the sizes in the header up to date; <tailLength> is how many
+//  bytes follow the data chunk.  Past 4GB, the file becomes an RF64 file:
+//  the 32-bit sizes are set to -1, and the actual sizes are found in the
+//  ds64 chunk (which took the place of the JUNK chunk).
+//
+void CWaveOut::UpdateHeader(DWORD tailLength) {
+  LONGLONG riffSize =
+    1 * sizeof(DWORD) +                             // length of 'RIFF' chunk
+    2 * sizeof(DWORD) + m_wavHdr.dwDs64ChunkSize +  // length of 'JUNK'/'ds64' chunk + chunk header
+    2 * sizeof(DWORD) + m_wavHdr.dwFmtChunkSize +   // length of 'fmt ' chunk + chunk header
+    2 * sizeof(DWORD) + m_dataSize +                // length of 'data' chunk + chunk header
+    tailLength;
+
+  if (riffSize > 0xffffffff) {
+    m_wavHdr.dwRiffChunkID    = MAKEFOURCC('R','F','6','4');
+    m_wavHdr.dwRiffChunkSize  = 0xffffffff;
+    m_wavHdr.dwDs64ChunkID    = MAKEFOURCC('d','s','6','4');
+    m_wavHdr.qwRiffSize       = riffSize;
+    m_wavHdr.qwDataSize       = m_dataSize;
+    m_wavHdr.qwSampleCount    = (m_wavHdr.nBlockAlign > 0) ? (m_dataSize / m_wavHdr.nBlockAlign) : 0;
+    m_wavHdr.dwDataChunkSize  = 0xffffffff;
+  } else {
+    m_wavHdr.dwRiffChunkID    = MAKEFOURCC('R','I','F','F');
+    m_wavHdr.dwRiffChunkSize  = (DWORD)riffSize;
+    m_wavHdr.dwDs64ChunkID    = MAKEFOURCC('J','U','N','K');
+    m_wavHdr.qwRiffSize       = 0;
+    m_wavHdr.qwDataSize       = 0;
+    m_wavHdr.qwSampleCount    = 0;
+    m_wavHdr.dwDataChunkSize  = (DWORD)m_dataSize;
+  }
+}
@@ -16,6 +16,7 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include "DiskUtil.h"
+#include "FLACStream.h"
 
 /////////////////////////////////////////////////////////////////////////////
 // CWaveOut
@@ -27,7 +28,7 @@ class ATL_NO_VTABLE CWaveOut :
   public IWaveDataConsumer
 {
 public:
-  CWaveOut() : m_dataLen(0)
+  CWaveOut() : m_useFLAC(false), m_isFileFLAC(false), m_dataSize(0), m_lastFixup(0)
 	{	}
 
 DECLARE_REGISTRY_RESOURCEID(IDR_WAVEOUT)
@@ -63,25 +64,41 @@ protected:
 
 protected:
   void InitHeader(WORD channels, DWORD samplesPerSec, WORD bitsPerSample);
+  void UpdateHeader(DWORD tailLength);
 
 /////////////////////////////////////////////////////////////////////////////
 
 // Other member variables
 protected:
   CString m_path;
-  CSequentialFile m_fOut;
+  CAsyncSequentialFile m_fOut;
+  CFLACStream m_flac;
+
+  bool m_useFLAC;                     // whether FLAC is the preferred file format
+  bool m_isFileFLAC;                  // whether the current file is a FLAC file (else a Wave file)
+  LONGLONG m_dataSize;                // how many bytes of PCM data the current file holds
 
   CDWordArray m_cues;
 
 # pragma pack (push, 1)
 
   struct {
-    // RIFF chunk
+    // RIFF chunk ('RF64' once the file outgrows 4GB)
     DWORD dwRiffChunkID;
     DWORD dwRiffChunkSize;
 
     DWORD dwRiffFormat;
 
+    // JUNK chunk, turned into a ds64 chunk (64-bit sizes) once the file
+    //  outgrows 4GB
+    DWORD dwDs64ChunkID;
+    DWORD dwDs64ChunkSize;
+
+    LONGLONG qwRiffSize;
+    LONGLONG qwDataSize;
+    LONGLONG qwSampleCount;
+    DWORD dwTableLength;
+
     // FORMAT chunk
     DWORD dwFmtChunkID;
     DWORD dwFmtChunkSize;
@@ -108,8 +125,7 @@ protected:
 
 # pragma pack (pop)
 
-  BYTE m_dataBuf[65536];
-  LONG m_dataLen;
+  DWORD m_lastFixup;                  // when the header in the file was last brought up to date (timeGetTime)
   CCriticalSection m_lock;
 
 // Interfaces to dependency modules
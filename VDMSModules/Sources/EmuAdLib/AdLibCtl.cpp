@@ -2,7 +2,10 @@
 #include "stdafx.h"
 #include "EmuAdLib.h"
 #include "AdLibCtl.h"
+#include "OPLChipMAME.h"
+#include "OPLChipAccurate.h"
 
+#include <math.h>
 #include <stdexcept>
 #include <memory>
 
@@ -10,7 +13,6 @@
 
 /* TODO: put these in a .mc file or something */
 #define MSG_ERR_INTERFACE     _T("The dependency module '%1' does not support the '%2' interface.%0")
-#define MSG_ERR_NOINSTSLOTS   _T("Too many instances running (maximum %!d!1 allowed).%0")
 #define MSG_ERR_OPLINITFAILED _T("Unable to initialize OPL software synthesizer.%0")
 
 /////////////////////////////////////////////////////////////////////////////
@@ -21,12 +23,11 @@
 #define INI_STR_BASEPORT      L"port"
 #define INI_STR_RATE          L"sampleRate"
 #define INI_STR_OPLMODE       L"oplMode"
+#define INI_STR_ENGINE        L"engine"
 
 /////////////////////////////////////////////////////////////////////////////
 
 #define MAX_AUDIOBUF_SIZE     65536     // Allows for almost 1s of stereo audio data at 44.1kHz
-#define OPL2_INTERNAL_FREQ    3600000   // The OPL2 operates at 3.6MHz
-#define OPL3_INTERNAL_FREQ    14400000  // The OPL3 operates at 14.4MHz
 
 #define DUAL_OPL2_CHIP_DISCRIMINATOR  0x02
 /////////////////////////////////////////////////////////////////////////////
@@ -52,8 +53,6 @@ int _strmcmpi(const char* templ, ... );
 
 /////////////////////////////////////////////////////////////////////////////
 
-bool CAdLibCtl::isInstancesInitialized = false;
-CAdLibCtl* CAdLibCtl::instances[MAX_INSTANCES];
 CCriticalSection CAdLibCtl::OPLMutex;
 
 /////////////////////////////////////////////////////////////////////////////
@@ -123,6 +122,18 @@ STDMETHODIMP CAdLibCtl::Init(IUnknown * configuration) {
         m_oplMode = MODE_OPL2;
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An invalid value ('%s') was provided for the OPL mode ('%s').  Valid values are: 'OPL2', 'DUAL_OPL2', and 'OPL3'.\nUsing 'none' by default."), (LPCTSTR)oplMode, (LPCTSTR)CString(INI_STR_OPLMODE)));
     }
+    _bstr_t oplEngine = CFG_Get(Config, INI_STR_ENGINE, "fast", false);
+    switch (_strmcmpi((LPCSTR)oplEngine, "fast", "accurate", NULL)) {
+      case 0:
+        m_oplEngine = ENGINE_FAST;
+        break;
+      case 1:
+        m_oplEngine = ENGINE_ACCURATE;
+        break;
+      default:
+        m_oplEngine = ENGINE_FAST;
+        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An invalid value ('%s') was provided for the OPL engine ('%s').  Valid values are: 'fast' and 'accurate'.\nUsing 'fast' by default."), (LPCTSTR)oplEngine, (LPCTSTR)CString(INI_STR_ENGINE)));
+    }
 
     /** Get VDM services ***************************************************/
 
@@ -195,7 +206,7 @@ STDMETHODIMP CAdLibCtl::Init(IUnknown * configuration) {
   m_playbackThread.SetPriority(THREAD_PRIORITY_ABOVE_NORMAL);
   m_playbackThread.Resume();
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("AdLibCtl initialized (base port = 0x%03x, type = %s)"), m_basePort, m_oplMode == MODE_OPL2 ? _T("OPL2") : m_oplMode == MODE_DUAL_OPL2 ? _T("dual OPL2") : m_oplMode == MODE_OPL3 ? _T("OPL3") : _T("???")));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("AdLibCtl initialized (base port = 0x%03x, type = %s, engine = %s)"), m_basePort, m_oplMode == MODE_OPL2 ? _T("OPL2") : m_oplMode == MODE_DUAL_OPL2 ? _T("dual OPL2") : m_oplMode == MODE_OPL3 ? _T("OPL3") : _T("???"), (LPCTSTR)CString(m_OPLChip->getName())));
 
   return S_OK;
 }
@@ -205,6 +216,9 @@ STDMETHODIMP CAdLibCtl::Destroy() {
   if (m_playbackThread.GetThreadHandle() != NULL)
     m_playbackThread.Cancel();
 
+  // Report how much port traffic was short-circuited
+  OPLLogStats();
+
   // Put the OPL in a known state
   m_AdLibFSM2.reset();
   m_AdLibFSM1.reset();
@@ -348,6 +362,8 @@ unsigned int CAdLibCtl::Run(CThread& thread) {
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Playback thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
 
   m_renderLoad = 1.00;                              // we start off perfectly calibrated
+  m_renderCredit = 0.0;
+  m_rateControl.Reset();
 
   while (true) {
     if (thread.GetMessage(&message, false)) {       // non-blocking message-"peek"
@@ -371,13 +387,13 @@ unsigned int CAdLibCtl::Run(CThread& thread) {
           if (m_waveOut != NULL) try {
             switch (m_oplMode) {
               case MODE_OPL2:
-                m_waveOut->SetFormat(1, m_sampleRate, OPL_SAMPLE_BITS);   // mono OPL2 output
+                m_waveOut->SetFormat(1, m_sampleRate, 8 * sizeof(OPLSample_t));   // mono OPL2 output
                 break;
               case MODE_DUAL_OPL2:
-                m_waveOut->SetFormat(2, m_sampleRate, OPL_SAMPLE_BITS);   // setero OPL2 output
+                m_waveOut->SetFormat(2, m_sampleRate, 8 * sizeof(OPLSample_t));   // setero OPL2 output
                 break;
               case MODE_OPL3:
-                m_waveOut->SetFormat(2, m_sampleRate, OPL3_SAMPLE_BITS);  // stereo OPL3 output
+                m_waveOut->SetFormat(2, m_sampleRate, 8 * sizeof(OPLSample_t));   // stereo OPL3 output
                 break;
             }
           } catch (_com_error& ce) {
@@ -389,25 +405,14 @@ unsigned int CAdLibCtl::Run(CThread& thread) {
           m_curTime  = OPLMsg.timestamp;
         }
 
-        // Program the OPL (functions will return after the UpdateHandler()
-        //  callback has been invoked)
-        switch (m_oplMode) {
-          case MODE_OPL2:
-            _ASSERTE(OPLMsg.regSet == 0);
-            _ASSERTE(OPLMsg.chipID == OPL_CHIP0);
-            MAME::YM3812Write(OPL_CHIP0, 0, OPLMsg.regIdx);
-            MAME::YM3812Write(OPL_CHIP0, 1, OPLMsg.value);
-            break;
-          case MODE_DUAL_OPL2:
-            _ASSERTE(OPLMsg.regSet == 0);
-            MAME::YM3812Write(OPLMsg.chipID, 0, OPLMsg.regIdx);
-            MAME::YM3812Write(OPLMsg.chipID, 1, OPLMsg.value);
-            break;
-          case MODE_OPL3:
-            MAME::YMF262Write(OPL_CHIP0, 0 + (OPLMsg.regSet << 1), OPLMsg.regIdx);
-            MAME::YMF262Write(OPL_CHIP0, 1 + (OPLMsg.regSet << 1), OPLMsg.value);
-            break;
-        }
+        // Render the immediately preceding portion of the audio stream
+        //  before the operators are reprogrammed
+        OPLPlay(m_curTime - m_lastTime);
+
+        // Program the OPL
+        _ASSERTE((m_oplMode == MODE_OPL3) || (OPLMsg.regSet == 0));
+        _ASSERTE((m_oplMode == MODE_DUAL_OPL2) || (OPLMsg.chipID == OPL_CHIP0));
+        m_OPLChip->write(OPLMsg.chipID, OPLMsg.regSet, OPLMsg.regIdx, OPLMsg.value);
       }
 
       // Did we process any OPL writes (was the OPL kept active) ?
@@ -436,62 +441,43 @@ unsigned int CAdLibCtl::Run(CThread& thread) {
 /////////////////////////////////////////////////////////////////////////////
 
 //
-// This function will create an OPL emulation core.  It will also take care
-//  of associating this CAdLibCtl instance with a unique numeric ID that can
-//  then be easily looked up inside the OPL core callback functions.
+// This function will create an OPL emulation core (engine).
 //
 HRESULT CAdLibCtl::OPLCreate(int sampleRate) {
-  int i;
-
-  // Lock static instances array and access to OPL software synthesizer
+  // Lock access to OPL software synthesizer
   CSingleLock lock(&OPLMutex, TRUE);
 
-  // Initialize the static instances array (only once per DLL instance)
-  if (!isInstancesInitialized) {
-    isInstancesInitialized = true;
-
-    for (i = 0; i < MAX_INSTANCES; i++) {
-      instances[i] = NULL;
-    }
-  }
-
-  // Look for an empty slot in the static instances array
-  for (i = 0; i < MAX_INSTANCES; i++) {
-    if (instances[i] == NULL) {
-      m_instanceID = i;
+  // Instantiate the selected engine
+  switch (m_oplEngine) {
+    case ENGINE_ACCURATE:
+      m_OPLChip = new COPLChipAccurate();
+      break;
+    default:
+      m_OPLChip = new COPLChipMAME();
       break;
-    }
   }
 
-  // If an empty slot was found take it, return an error otherwise
-  if (m_instanceID < 0)
-    return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_NOINSTSLOTS, /*false, NULL, 0, */false, (int)MAX_INSTANCES), __uuidof(IVDMBasicModule), E_OUTOFMEMORY);
-
-  instances[m_instanceID] = this;
-
   // Initialize the OPL software synthesizer, return an error if failed
+  bool isCreated = false;
+
   switch (m_oplMode) {
     case MODE_OPL2:
-      if (MAME::YM3812Init(1, OPL2_INTERNAL_FREQ, sampleRate))
-        return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_OPLINITFAILED, /*false, NULL, 0, */false), __uuidof(IVDMBasicModule), E_FAIL);
-      // Install the callback handler(s)
-      MAME::YM3812SetUpdateHandler(OPL_CHIP0, OPLUpdateHandler, m_instanceID);
+      isCreated = m_OPLChip->create(IOPLChip::TYPE_OPL2, 1, sampleRate);
       break;
     case MODE_DUAL_OPL2:
-      if (MAME::YM3812Init(2, OPL2_INTERNAL_FREQ, sampleRate))
-        return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_OPLINITFAILED, /*false, NULL, 0, */false), __uuidof(IVDMBasicModule), E_FAIL);
-      // Install the callback handler(s)
-      MAME::YM3812SetUpdateHandler(OPL_CHIP0, OPLUpdateHandler, m_instanceID);
-      MAME::YM3812SetUpdateHandler(OPL_CHIP1, OPLUpdateHandler, m_instanceID);
+      isCreated = m_OPLChip->create(IOPLChip::TYPE_OPL2, 2, sampleRate);
       break;
     case MODE_OPL3:
-      if (MAME::YMF262Init(1, OPL3_INTERNAL_FREQ, sampleRate))
-        return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_OPLINITFAILED, /*false, NULL, 0, */false), __uuidof(IVDMBasicModule), E_FAIL);
-      // Install the callback handler(s)
-      MAME::YMF262SetUpdateHandler(OPL_CHIP0, OPLUpdateHandler, m_instanceID);
+      isCreated = m_OPLChip->create(IOPLChip::TYPE_OPL3, 1, sampleRate);
       break;
   }
 
+  if (!isCreated) {
+    delete m_OPLChip;
+    m_OPLChip = NULL;
+    return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_OPLINITFAILED, /*false, NULL, 0, */false), __uuidof(IVDMBasicModule), E_FAIL);
+  }
+
   return S_OK;
 }
 
@@ -499,23 +485,15 @@ HRESULT CAdLibCtl::OPLCreate(int sampleRate) {
 // This function will release and clean up after the OPL emulation core
 //
 void CAdLibCtl::OPLDestroy(void) {
-  // Lock static instances array and access to OPL software synthesizer
+  // Lock access to OPL software synthesizer
   CSingleLock lock(&OPLMutex, TRUE);
 
   // Release the OPL software synthesizer
-  switch (m_oplMode) {
-    case MODE_OPL2:
-    case MODE_DUAL_OPL2:
-      MAME::YM3812Shutdown();
-      break;
-    case MODE_OPL3:
-      MAME::YMF262Shutdown();
-      break;
+  if (m_OPLChip != NULL) {
+    m_OPLChip->destroy();
+    delete m_OPLChip;
+    m_OPLChip = NULL;
   }
-
-  // Release the slot in the static instance array
-  if (m_instanceID >= 0)
-    instances[m_instanceID] = NULL;
 }
 
 //
@@ -527,76 +505,58 @@ void CAdLibCtl::OPLPlay(DWORD deltaTime) {
     return; // why bother if no renderer is attached ?
 
   if (m_curTime > m_lastTime) {
-    // Compute by how much this transfer should be boosted or diminished, based on
-    //  playback performance (feedback indicating playback buffer overrun/underrun)
-    double scalingFactor = min(2.0, max(0.0, 1 / m_renderLoad));
+    // Compute how many samples we should transfer: the elapsed time's worth,
+    //  trimmed by a few hundred ppm so that the renderer's buffer stays on
+    //  target (the synthesis runs that much faster or slower, which is what
+    //  resampling its output would amount to).  Fractions of a sample are
+    //  carried over to the next transfer.
+    m_renderCredit += m_rateControl.Update(m_renderLoad, deltaTime / 1000.0) * m_sampleRate * (deltaTime / 1000.0);
+
+    long toTransfer = min(MAX_AUDIOBUF_SIZE, (long)m_renderCredit);
 
-    // Compute how many samples we should transfer
-    long toTransfer = min(MAX_AUDIOBUF_SIZE, (long)(scalingFactor * m_sampleRate * (deltaTime / 1000.0)));
+    m_renderCredit -= toTransfer;
+    m_renderCredit -= floor(m_renderCredit);        // do not try to catch up if the buffer size was exceeded
 
     int bufSize;        // how much relevant data is stored in the buffer <buf>
-    BYTE* buf = NULL;   // temporary storage for processing (e.g. decompressing -- up to 4x if ADPCM2) data
+    BYTE* buf = NULL;   // temporary storage for processing
 
-    MAME::OPLSAMPLE*  buf_opl2   = NULL;
-    MAME::OPL3SAMPLE* buf_opl3   = NULL;
-    MAME::OPL3SAMPLE* tbl_opl3[] = { NULL, NULL, NULL, NULL };
+    OPLSample_t* buf_opl = NULL;
 
 #   if STACK_HEAP_WORKAROUND
-    std::auto_ptr<MAME::OPLSAMPLE>  buf_opl2_auto(buf_opl2);
-    std::auto_ptr<MAME::OPL3SAMPLE> buf_opl3_auto(buf_opl3);
+    std::auto_ptr<OPLSample_t> buf_opl_auto(buf_opl);
 #   endif
 
     int i = 0;
 
+#   if STACK_HEAP_WORKAROUND
+    buf_opl_auto = std::auto_ptr<OPLSample_t>(new OPLSample_t[4 * toTransfer]);
+    buf_opl = buf_opl_auto.get();
+#   else
+    buf_opl = (OPLSample_t*)_alloca(4 * toTransfer * sizeof(buf_opl[0]));
+#   endif
+
     switch (m_oplMode) {
       case MODE_OPL2:
-#       if STACK_HEAP_WORKAROUND
-        buf_opl2_auto = std::auto_ptr<MAME::OPLSAMPLE>(new MAME::OPLSAMPLE[toTransfer]);
-        buf_opl2 = buf_opl2_auto.get();
-#       else
-        buf_opl2 = (MAME::OPLSAMPLE*)_alloca(toTransfer * sizeof(buf_opl2[0]));
-#       endif
-        MAME::YM3812UpdateOne(OPL_CHIP0, buf_opl2, toTransfer);
-        bufSize = toTransfer * sizeof(buf_opl2[0]);
-        buf     = (BYTE*)buf_opl2;
+        m_OPLChip->render(OPL_CHIP0, buf_opl, toTransfer);
+        bufSize = toTransfer * sizeof(buf_opl[0]);
         break;
       case MODE_DUAL_OPL2:
-#       if STACK_HEAP_WORKAROUND
-        buf_opl2_auto = std::auto_ptr<MAME::OPLSAMPLE>(new MAME::OPLSAMPLE[4 * toTransfer]);
-        buf_opl2 = buf_opl2_auto.get();
-#       else
-        buf_opl2 = (MAME::OPLSAMPLE*)_alloca(4 * toTransfer * sizeof(buf_opl2[0]));
-#       endif
-        MAME::YM3812UpdateOne(OPL_CHIP0, buf_opl2 + 2 * toTransfer, toTransfer);
-        MAME::YM3812UpdateOne(OPL_CHIP1, buf_opl2 + 3 * toTransfer, toTransfer);
+        m_OPLChip->render(OPL_CHIP0, buf_opl + 2 * toTransfer, toTransfer);
+        m_OPLChip->render(OPL_CHIP1, buf_opl + 3 * toTransfer, toTransfer);
         for (i = 0; i < toTransfer; i++) {
-          buf_opl2[2 * i + 0] = buf_opl2[2 * toTransfer + i];
-          buf_opl2[2 * i + 1] = buf_opl2[3 * toTransfer + i];
+          buf_opl[2 * i + 0] = buf_opl[2 * toTransfer + i];
+          buf_opl[2 * i + 1] = buf_opl[3 * toTransfer + i];
         }
-        bufSize = 2 * toTransfer * sizeof(buf_opl2[0]);
-        buf     = (BYTE*)buf_opl2;
+        bufSize = 2 * toTransfer * sizeof(buf_opl[0]);
         break;
       case MODE_OPL3:
-#       if STACK_HEAP_WORKAROUND
-        buf_opl3_auto = std::auto_ptr<MAME::OPL3SAMPLE>(new MAME::OPL3SAMPLE[4 * toTransfer]);
-        buf_opl3 = buf_opl3_auto.get();
-#       else
-        buf_opl3 = (MAME::OPL3SAMPLE*)_alloca(4 * toTransfer * sizeof(buf_opl3[0]));
-#       endif
-        tbl_opl3[0] = buf_opl3 + 2 * toTransfer;
-        tbl_opl3[1] = buf_opl3 + 3 * toTransfer;
-        tbl_opl3[2] = buf_opl3;
-        tbl_opl3[3] = buf_opl3 ;
-        MAME::YMF262UpdateOne(OPL_CHIP0, tbl_opl3, toTransfer);
-        for (i = 0; i < toTransfer; i++) {
-          buf_opl3[2 * i + 0] = buf_opl3[2 * toTransfer + i];
-          buf_opl3[2 * i + 1] = buf_opl3[3 * toTransfer + i];
-        }
-        bufSize = 2 * toTransfer * sizeof(buf_opl3[0]);
-        buf     = (BYTE*)buf_opl3;
+        m_OPLChip->render(OPL_CHIP0, buf_opl, toTransfer);
+        bufSize = 2 * toTransfer * sizeof(buf_opl[0]);
         break;
     }
 
+    buf = (BYTE*)buf_opl;
+
     // Play the data, and update the load factor
     try {
       m_renderLoad = m_waveOut->PlayData(buf, bufSize);
@@ -666,22 +626,60 @@ HRESULT CAdLibCtl::OPLWrite(BYTE address, BYTE data) {
 }
 
 
+//
+// This function will log statistics about the register writes that were
+//  suppressed by the OPL controller(s) because they changed nothing, and
+//  about the status port reads that were answered without querying the time
+//
+void CAdLibCtl::OPLLogStats(void) {
+  unsigned long totalHits = 0, totalSuppressed = 0;
+  unsigned long totalReads = 0, totalClockReads = 0;
+  unsigned long hits, suppressed, reads, clockReads;
+
+  for (int chip = 0; chip < (m_oplMode == MODE_DUAL_OPL2 ? 2 : 1); chip++) {
+    CAdLibCtlFSM& fsm = (chip == 0) ? m_AdLibFSM1 : m_AdLibFSM2;
+
+    fsm.getStatusStats(reads, clockReads);
+    totalReads += reads;
+    totalClockReads += clockReads;
+
+    for (int address = 0; address < 0x200; address++) {
+      fsm.getShadowStats(address, hits, suppressed);
+
+      if (hits == 0)
+        continue;
+
+      totalHits += hits;
+      totalSuppressed += suppressed;
+
+#     ifdef _DEBUG
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("OPL (id=%d) register 0x%03x: %lu writes, %lu suppressed"), chip, address, hits, suppressed));
+#     endif
+    }
+  }
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("OPL register writes: %lu received, %lu suppressed as redundant (%0.1f%%)"), totalHits, totalSuppressed, totalHits > 0 ? (float)(100.0 * totalSuppressed / totalHits) : 0.0f));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("OPL status reads: %lu received, %lu required a timer update"), totalReads, totalClockReads));
+}
+
+
 
 /////////////////////////////////////////////////////////////////////////////
 // IMPU401HWEmulationLayer
 /////////////////////////////////////////////////////////////////////////////
 
 void CAdLibCtl::resetOPL(void) {
+  if (m_OPLChip == NULL)
+    return;
+
   switch (m_oplMode) {
     case MODE_OPL2:
-      MAME::YM3812ResetChip(OPL_CHIP0);
+    case MODE_OPL3:
+      m_OPLChip->reset(OPL_CHIP0);
       break;
     case MODE_DUAL_OPL2:
-      MAME::YM3812ResetChip(OPL_CHIP0);
-      MAME::YM3812ResetChip(OPL_CHIP1);
-      break;
-    case MODE_OPL3:
-      MAME::YMF262ResetChip(OPL_CHIP0);
+      m_OPLChip->reset(OPL_CHIP0);
+      m_OPLChip->reset(OPL_CHIP1);
       break;
   }
 }
@@ -735,25 +733,6 @@ void CAdLibCtl::logInformation(const char* message) {
 
 
 
-/////////////////////////////////////////////////////////////////////////////
-// OPL callback function(s)
-/////////////////////////////////////////////////////////////////////////////
-
-//
-// This handler is called just before the OPL state changes, giving us the
-//  chance to render the immediately preceding portion of the audio stream
-//  just before the operators are reprogrammed.
-//
-void CAdLibCtl::OPLUpdateHandler(int param, int min_interval_usec) {
-  CAdLibCtl* pThis = instances[param];
-  if (pThis == NULL) return;
-
-  // Generate and output the data for the last time interval
-  pThis->OPLPlay(pThis->m_curTime - pThis->m_lastTime);
-}
-
-
-
 /////////////////////////////////////////////////////////////////////////////
 // Misc. utility function(s)
 /////////////////////////////////////////////////////////////////////////////
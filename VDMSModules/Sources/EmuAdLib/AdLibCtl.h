@@ -7,19 +7,6 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
-namespace MAME {
-  /* OPL2 code */
-# define HAS_YM3812 1
-# include "fmopl.h"
-# undef HAS_YM3812
-  /* OPL3 code */
-# define HAS_YMF262 1
-# include "ymf262.h"
-# undef HAS_YMF262
-}
-
-/////////////////////////////////////////////////////////////////////////////
-
 #define OPL_CHIP0 0         // First OPL chip (used in all modes)
 #define OPL_CHIP1 1         // Second OPL chip (used in dual-OPL2 mode only)
 
@@ -37,11 +24,12 @@ namespace MAME {
 /////////////////////////////////////////////////////////////////////////////
 
 #include "AdLibCtlFSM.h"
+#include "OPLChip.h"
+#include <RateControl.h>
 #include <Thread.h>
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define MAX_INSTANCES 16
 #define OPL_QUEUE_LEN 1024
 
 /////////////////////////////////////////////////////////////////////////////
@@ -97,7 +85,7 @@ class ATL_NO_VTABLE CAdLibCtl :
 {
 public:
 	CAdLibCtl()
-    : m_instanceID(-1), m_AdLibFSM1(this, OPL_CHIP0), m_AdLibFSM2(this, OPL_CHIP1)
+    : m_AdLibFSM1(this, OPL_CHIP0), m_AdLibFSM2(this, OPL_CHIP1), m_OPLChip(NULL)
     { }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_ADLIBCTL)
@@ -152,16 +140,13 @@ public:
   STDMETHOD(HandleByteWrite)(ULONG address, BYTE data);
   STDMETHOD(HandleWordWrite)(ULONG address, USHORT data);
 
-protected:
-  static void OPLTimerHandler(int channel, double interval_sec);
-  static void OPLUpdateHandler(int param, int min_interval_usec);
-
 protected:
   HRESULT OPLCreate(int sampleRate);
   void OPLDestroy(void);
   void OPLPlay(DWORD deltaTime);
   HRESULT OPLRead(BYTE address, BYTE * data);
   HRESULT OPLWrite(BYTE address, BYTE data);
+  void OPLLogStats(void);
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -177,6 +162,9 @@ protected:
   enum mode_t {
     MODE_OPL2, MODE_DUAL_OPL2, MODE_OPL3
   };
+  enum engine_t {
+    ENGINE_FAST, ENGINE_ACCURATE
+  };
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -185,15 +173,15 @@ protected:
   int m_basePort;
   int m_sampleRate;
   mode_t m_oplMode;
+  engine_t m_oplEngine;
 
 // Platform-independent classes
 protected:
   CAdLibCtlFSM m_AdLibFSM1, m_AdLibFSM2;  // two FSM's, one per OPL chip (second FSM/chip is only used when in dual OPL2 mode)
+  IOPLChip* m_OPLChip;                    // the FM synthesis engine (emulates one or two OPL chips)
 
 // Other member variables
 protected:
-  static bool isInstancesInitialized;
-  static CAdLibCtl* instances[MAX_INSTANCES];
   static CCriticalSection OPLMutex;
 
   CThread m_playbackThread;
@@ -201,8 +189,8 @@ protected:
 
   DWORD m_lastTime, m_curTime;
   double m_renderLoad;
-
-  int m_instanceID;
+  double m_renderCredit;                  // fraction of a sample due but not rendered yet
+  CRateControl m_rateControl;             // keeps the renderer's buffer on target despite clock drift
 
 // Interfaces to dependency modules
 protected:
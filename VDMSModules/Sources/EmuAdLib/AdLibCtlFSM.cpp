@@ -3,6 +3,7 @@
 #include "AdLibCtlFSM.h"
 
 #include <stdexcept>
+#include <limits.h>
 
 #define OPL_T1_PERIOD 80
 #define OPL_T2_PERIOD 320
@@ -21,10 +22,22 @@
 #define OPL_SIGNATURE_OPL2 0x06
 #define OPL_SIGNATURE_OPL3 0x00
 
+#define OPL_TIME_NEVER _I64_MAX
+
+// Number of status port reads commonly used by drivers as a delay after
+//  writing to the index port (3.3us) and to the data port (23us)
+#define OPL_INDEX_DELAY_READS 6
+#define OPL_DATA_DELAY_READS  35
+
 CAdLibCtlFSM::CAdLibCtlFSM(IAdLibHWEmulationLayer* hwemu, int chipID)
-  : m_type(TYPE_OPL2), m_status(OPL_SIGNATURE_OPL2), m_chipID(chipID), m_regIdx(0), m_OPL2_compat(false), m_hwemu(hwemu)
+  : m_type(TYPE_OPL2), m_status(OPL_SIGNATURE_OPL2), m_chipID(chipID), m_regIdx(0), m_OPL2_compat(false), m_nextExpiry(OPL_TIME_NEVER), m_delayWindow(0), m_delayReads(0), m_statusReads(0), m_statusClockReads(0), m_hwemu(hwemu)
 {
   _ASSERTE(m_hwemu != NULL);
+
+  memset(m_shadowHits, 0, sizeof(m_shadowHits));
+  memset(m_shadowSuppressed, 0, sizeof(m_shadowSuppressed));
+
+  clearShadow();
 }
 
 CAdLibCtlFSM::~CAdLibCtlFSM(void)
@@ -85,6 +98,9 @@ void CAdLibCtlFSM::reset(void) {
   // Various other reset operations
   m_OPL2_compat = false;
 
+  // The chip's registers are no longer known
+  clearShadow();
+
   m_hwemu->resetOPL();
 }
 
@@ -93,8 +109,28 @@ void CAdLibCtlFSM::reset(void) {
 //
 char CAdLibCtlFSM::read(int port) {
   if (port == 0) {
+    m_statusReads++;
+
+    // Drivers read the status port a fixed number of times after each
+    //  write as a delay; the first read of such a sequence is answered
+    //  normally, the following ones are served the same status byte.
+    if (m_delayReads > 0) {
+      m_delayReads--;
+      return m_status;
+    }
+
+    // If this is the first read following a write then the next few
+    //  reads are (most likely) part of a delay loop
+    m_delayReads  = (m_delayWindow > 0) ? (m_delayWindow - 1) : 0;
+    m_delayWindow = 0;
+
+    // No unmasked timer is running, the status byte cannot change
+    if (m_nextExpiry == OPL_TIME_NEVER)
+      return m_status;
+
     // Get the current time
     OPLTime_t tNow = m_hwemu->getTimeMicros();
+    m_statusClockReads++;
 
 #   ifdef _DEBUG
     char buf[1024];
@@ -102,6 +138,10 @@ char CAdLibCtlFSM::read(int port) {
     m_hwemu->logInformation(buf);
 #   endif
 
+    // Nothing expired since the status byte was last computed
+    if (tNow < m_nextExpiry)
+      return m_status;
+
     return updateTimers(tNow);
   } else {
     return 0x00;
@@ -126,19 +166,37 @@ void CAdLibCtlFSM::write(int port, char data) {
   switch (port) {
     case 0:   // address port (OPL2, OPL3)
       m_regIdx = data & 0xff;
+      m_delayWindow = OPL_INDEX_DELAY_READS;
+      m_delayReads = 0;
       return;
 
     case 1:   // data port (OPL2, OPL3)
     case 3:   // data port (OPL3)
       setRegister(m_regIdx, data);
+      m_delayWindow = OPL_DATA_DELAY_READS;
+      m_delayReads = 0;
       return;
 
     case 2:   // address port (OPL3)
       m_regIdx = (m_OPL2_compat && (data != 5)) ? (data & 0xff) : ((data & 0xff) | 0x100);
+      m_delayWindow = OPL_INDEX_DELAY_READS;
+      m_delayReads = 0;
       return;
   }
 }
 
+//
+// Retrieves the number of writes received by, and the number of writes
+//  suppressed for, a given register (useful for tuning)
+//
+void CAdLibCtlFSM::getShadowStats(int address, unsigned long& hits, unsigned long& suppressed) {
+  int regSet = (address >> 8) & 0x01;
+  int regIdx = address & 0xff;
+
+  hits       = m_shadowHits[regSet][regIdx];
+  suppressed = m_shadowSuppressed[regSet][regIdx];
+}
+
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -220,11 +278,59 @@ void CAdLibCtlFSM::setRegister(int address, char data) {
       return;
 
     default:
+      // Drop writes that would not change anything on the chip
+      if (isRedundantWrite(address, data))
+        return;
+
       m_hwemu->setOPLReg(m_chipID, address >> 8, address & 0xff, data & 0xff);
       return;
   }
 }
 
+//
+// Retrieves the number of status port reads, and how many of those had to
+//  query the current time (useful for tuning)
+//
+void CAdLibCtlFSM::getStatusStats(unsigned long& reads, unsigned long& clockReads) {
+  reads      = m_statusReads;
+  clockReads = m_statusClockReads;
+}
+
+//
+// Checks a register write against the shadow copy of the register file,
+//  and updates the shadow copy.  Returns true if the write can be dropped
+//  because it would leave the chip in the exact same state.  Writes that
+//  have side effects beyond the stored value (key-on retrigger in 0xB0-0xB8,
+//  rhythm key-on in 0xBD) are never dropped; the timer registers are taken
+//  care of in setRegister and never get here.
+//
+bool CAdLibCtlFSM::isRedundantWrite(int address, char data) {
+  int regSet = (address >> 8) & 0x01;
+  int regIdx = address & 0xff;
+
+  m_shadowHits[regSet][regIdx]++;
+
+  bool hasSideEffects = ((regIdx >= 0xb0) && (regIdx <= 0xb8)) || (regIdx == 0xbd);
+
+  if (!hasSideEffects && m_shadowValid[regSet][regIdx] && (m_shadowValue[regSet][regIdx] == (unsigned char)(data & 0xff))) {
+    m_shadowSuppressed[regSet][regIdx]++;
+    return true;
+  }
+
+  m_shadowValue[regSet][regIdx] = (unsigned char)(data & 0xff);
+  m_shadowValid[regSet][regIdx] = true;
+
+  return false;
+}
+
+//
+// Invalidates the shadow copy of the register file (next write to any
+//  register will always go through)
+//
+void CAdLibCtlFSM::clearShadow(void) {
+  memset(m_shadowValid, 0, sizeof(m_shadowValid));
+}
+
 //
 // Selectively clear the status (timer expiration and/or IRQ pending) flags
 //
@@ -240,6 +346,8 @@ void CAdLibCtlFSM::clearStatus(bool T1, bool T2) {
 void CAdLibCtlFSM::clearTimers(OPLTime_t tNow, bool T1, bool T2) {
   if (T1) m_timer1.expiry = tNow + m_timer1.period;
   if (T2) m_timer2.expiry = tNow + m_timer2.period;
+
+  updateDeadline();
 }
 
 //
@@ -262,5 +370,21 @@ char CAdLibCtlFSM::updateTimers(OPLTime_t tNow) {
     if (!m_timer2.isMasked) m_status |= (OPL_STATUS_IRQ_PENDING | OPL_STATUS_T2_EXPIRED);
   }
 
+  updateDeadline();
+
   return m_status;
 }
+
+//
+// Compute the earliest time at which the status byte may change, i.e. the
+//  next expiration of an enabled, unmasked timer
+//
+void CAdLibCtlFSM::updateDeadline(void) {
+  m_nextExpiry = OPL_TIME_NEVER;
+
+  if ((m_timer1.isEnabled) && (!m_timer1.isMasked) && (m_timer1.expiry < m_nextExpiry))
+    m_nextExpiry = m_timer1.expiry;
+
+  if ((m_timer2.isEnabled) && (!m_timer2.isMasked) && (m_timer2.expiry < m_nextExpiry))
+    m_nextExpiry = m_timer2.expiry;
+}
@@ -55,11 +55,17 @@ class CAdLibCtlFSM {
     char read(int port);
     void write(int port, char data);
 
+    void getShadowStats(int address, unsigned long& hits, unsigned long& suppressed);
+    void getStatusStats(unsigned long& reads, unsigned long& clockReads);
+
   protected:
     void setRegister(int address, char data);
     void clearStatus(bool T1 = true, bool T2 = true);
     void clearTimers(OPLTime_t tNow, bool T1 = true, bool T2 = true);
     char updateTimers(OPLTime_t tNow);
+    void updateDeadline(void);
+    bool isRedundantWrite(int address, char data);
+    void clearShadow(void);
 
   protected:
     type_t      m_type;                 // OPL type (OPL2, OPL3, etc.)
@@ -68,6 +74,19 @@ class CAdLibCtlFSM {
     int         m_regIdx;               // the currently-selected register index
     bool        m_OPL2_compat;          // OPL2 compatibility mode
     OPLTimer_t  m_timer1, m_timer2;     // the timer values
+    OPLTime_t   m_nextExpiry;           // earliest time at which an unmasked timer can change the status byte
+    int         m_delayWindow;          // length of the delay loop that may follow the last port write
+    int         m_delayReads;           // number of upcoming status reads that are part of a delay loop
+
+  protected:
+    unsigned long m_statusReads;        // number of status port reads
+    unsigned long m_statusClockReads;   // number of status port reads that required querying the time
+
+  protected:
+    unsigned char m_shadowValue[2][256];      // last value written to each register (both register sets)
+    bool          m_shadowValid[2][256];      // whether the shadow value is known to match the chip
+    unsigned long m_shadowHits[2][256];       // number of writes received, per register
+    unsigned long m_shadowSuppressed[2][256]; // number of writes dropped because they changed nothing
 
   protected:
     IAdLibHWEmulationLayer* m_hwemu;
@@ -304,6 +304,18 @@ SOURCE=.\fmopl.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\OPL3Core.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLChipAccurate.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLChipMAME.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.cpp
 # ADD CPP /Yc"stdafx.h"
 # End Source File
@@ -329,6 +341,22 @@ SOURCE=.\driver.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\OPL3Core.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLChip.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLChipAccurate.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLChipMAME.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.h
 # End Source File
 # End Group
@@ -371,6 +399,15 @@ SOURCE=.\fmopl.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\fmopltab.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\gentables.c
+# PROP Exclude_From_Build 1
+# End Source File
+# Begin Source File
+
 SOURCE=.\ymf262.c
 # PROP Exclude_From_Build 1
 # End Source File
@@ -378,6 +415,10 @@ SOURCE=.\ymf262.c
 
 SOURCE=.\ymf262.h
 # End Source File
+# Begin Source File
+
+SOURCE=.\ymf262tab.h
+# End Source File
 # End Group
 # Begin Source File
 
@@ -0,0 +1,1062 @@
+#include "stdafx.h"
+
+#include "OPL3Core.h"
+
+#include <math.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define EG_MAX_ATTENUATION    0x1ff     // envelope attenuation, in 0.1875dB steps (9 bits)
+
+#define TREMOLO_STEPS         210       // the tremolo LFO rises for 105 steps, then falls for 105
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Frequency multipliers (in halves)
+static const unsigned char multTable[16] = {
+  1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+// Key scale levels (by the top four bits of the F-number), and the shifts
+//  that implement the 0, 1.5, 3 and 6dB/octave settings
+static const unsigned char kslTable[16] = {
+  0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+static const unsigned char kslShift[4] = {
+  8, 1, 2, 0
+};
+
+// Envelope increments for rates 12 and up, by rate (bits 1-0) and by the
+//  envelope counter's low bits
+static const unsigned char egIncStep[4][4] = {
+  { 0, 0, 0, 0 },
+  { 1, 0, 0, 0 },
+  { 1, 0, 1, 0 },
+  { 1, 1, 1, 0 }
+};
+
+// Operator (slot) of each register offset 0x00-0x1f within a register set
+static const signed char regSlot[0x20] = {
+   0,  1,  2,  3,  4,  5, -1, -1,  6,  7,  8,  9, 10, 11, -1, -1,
+  12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// First operator (slot) of each channel; the second one is 3 slots further
+static const unsigned char channelSlot[OPL3_NUM_CHANNELS] = {
+  0, 1, 2, 6, 7, 8, 12, 13, 14, 18, 19, 20, 24, 25, 26, 30, 31, 32
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool COPL3Core::isTableBuilt = false;
+unsigned short COPL3Core::logSinTable[256];
+unsigned short COPL3Core::expTable[256];
+
+/////////////////////////////////////////////////////////////////////////////
+
+COPL3Core::COPL3Core(void)
+{
+  buildTables();
+  reset(false);
+}
+
+COPL3Core::~COPL3Core(void)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Puts the chip in its power-up state, in OPL2-compatible mode only (no
+//  second register set, waveforms selected with register 0x01) or as an
+//  OPL3
+//
+void COPL3Core::reset(bool isOPL2) {
+  int i;
+
+  memset(m_slots, 0, sizeof(m_slots));
+  memset(m_channels, 0, sizeof(m_channels));
+
+  m_isOPL2 = isOPL2;
+  m_isWaveSelect = false;
+
+  m_timer = 0;
+  m_egTimer = 0;
+  m_egTimerRem = false;
+  m_egState = false;
+  m_egTimerLo = 0;
+  m_egAdd = 0;
+
+  m_newm = false;
+  m_nts = false;
+  m_rhy = 0x00;
+
+  m_vibPos = 0;
+  m_vibShift = 1;
+  m_tremolo = 0;
+  m_tremoloPos = 0;
+  m_tremoloShift = 4;
+
+  m_noise = 1;
+  m_hhBit2 = m_hhBit3 = m_hhBit7 = m_hhBit8 = false;
+  m_tcBit3 = m_tcBit5 = false;
+
+  memset(m_mixBuf, 0, sizeof(m_mixBuf));
+
+  memset(m_writeBuf, 0, sizeof(m_writeBuf));
+  m_writeBufCur = m_writeBufLast = 0;
+  m_writeBufLastTime = 0;
+  m_sampleCount = 0;
+
+  m_zeroMod = 0;
+  m_zeroTrem = 0;
+
+  for (i = 0; i < OPL3_NUM_SLOTS; i++) {
+    slot_t& slot = m_slots[i];
+
+    slot.slotNum = i;
+    slot.mod = &m_zeroMod;
+    slot.trem = &m_zeroTrem;
+    slot.egRout = EG_MAX_ATTENUATION;
+    slot.egOut = EG_MAX_ATTENUATION;
+    slot.egGen = EG_RELEASE;
+  }
+
+  for (i = 0; i < OPL3_NUM_CHANNELS; i++) {
+    channel_t& channel = m_channels[i];
+
+    channel.slots[0] = &m_slots[channelSlot[i]];
+    channel.slots[1] = &m_slots[channelSlot[i] + 3];
+    m_slots[channelSlot[i]].channel = &channel;
+    m_slots[channelSlot[i] + 3].channel = &channel;
+
+    // Channels 0-2 pair with 3-5 (and 9-11 with 12-14) in 4-operator mode
+    if ((i % 9) < 3) {
+      channel.pair = &m_channels[i + 3];
+    } else if ((i % 9) < 6) {
+      channel.pair = &m_channels[i - 3];
+    } else {
+      channel.pair = NULL;
+    }
+
+    channel.out[0] = channel.out[1] = channel.out[2] = channel.out[3] = &m_zeroMod;
+    channel.chType = CH_2OP;
+    channel.chNum = i;
+    channel.cha = channel.chb = 0xffff;
+    channel.chc = channel.chd = 0x0000;
+
+    setupAlg(channel);
+  }
+}
+
+//
+// Programs a register (register set 1 is the OPL3's second bank, ignored
+//  in OPL2-compatible mode); the write is buffered, and reaches the chip
+//  OPL3_WRITEBUF_DELAY samples after the previous one (or right away if
+//  the chip has been idle long enough)
+//
+void COPL3Core::write(int regSet, int regIdx, int value) {
+  if ((regSet & 0x01) && m_isOPL2)
+    return;
+
+  writeBuf_t& entry = m_writeBuf[m_writeBufLast];
+
+  // The buffer is full: the oldest write cannot wait any longer
+  if (entry.isPending) {
+    writeReg(entry.reg, entry.data);
+    entry.isPending = false;
+    m_writeBufCur = (m_writeBufLast + 1) % OPL3_WRITEBUF_SIZE;
+    m_sampleCount = entry.time;
+  }
+
+  unsigned __int64 time = m_writeBufLastTime + OPL3_WRITEBUF_DELAY;
+
+  if (time < m_sampleCount)
+    time = m_sampleCount;
+
+  entry.isPending = true;
+  entry.reg = (unsigned short)(((regSet & 0x01) << 8) | (regIdx & 0xff));
+  entry.data = (unsigned char)(value & 0xff);
+  entry.time = time;
+
+  m_writeBufLastTime = time;
+  m_writeBufLast = (m_writeBufLast + 1) % OPL3_WRITEBUF_SIZE;
+}
+
+//
+// Applies a register write to the chip
+//
+void COPL3Core::writeReg(int regNum, int data) {
+  int high = (regNum >> 8) & 0x01;
+  int reg = regNum & 0xff;
+
+  switch (reg & 0xf0) {
+    case 0x00:
+      if (high) {
+        switch (reg & 0x0f) {
+          case 0x04:
+            set4Op(data);
+            break;
+          case 0x05:
+            m_newm = (data & 0x01) != 0;
+            break;
+        }
+      } else {
+        switch (reg & 0x0f) {
+          case 0x01:
+            m_isWaveSelect = (data & 0x20) != 0;
+            break;
+          case 0x08:
+            m_nts = ((data >> 6) & 0x01) != 0;
+            break;
+        }
+      }
+      break;
+
+    case 0x20:
+    case 0x30:
+      if (regSlot[reg & 0x1f] >= 0) {
+        slot_t& slot = m_slots[18 * high + regSlot[reg & 0x1f]];
+
+        slot.trem = (data & 0x80) ? &m_tremolo : &m_zeroTrem;
+        slot.regVib = (data & 0x40) != 0;
+        slot.regType = (data & 0x20) != 0;
+        slot.regKSR = (data & 0x10) != 0;
+        slot.regMult = data & 0x0f;
+      }
+      break;
+
+    case 0x40:
+    case 0x50:
+      if (regSlot[reg & 0x1f] >= 0) {
+        slot_t& slot = m_slots[18 * high + regSlot[reg & 0x1f]];
+
+        slot.regKSL = (data >> 6) & 0x03;
+        slot.regTL = data & 0x3f;
+        updateKSL(slot);
+      }
+      break;
+
+    case 0x60:
+    case 0x70:
+      if (regSlot[reg & 0x1f] >= 0) {
+        slot_t& slot = m_slots[18 * high + regSlot[reg & 0x1f]];
+
+        slot.regAR = (data >> 4) & 0x0f;
+        slot.regDR = data & 0x0f;
+      }
+      break;
+
+    case 0x80:
+    case 0x90:
+      if (regSlot[reg & 0x1f] >= 0) {
+        slot_t& slot = m_slots[18 * high + regSlot[reg & 0x1f]];
+
+        slot.regSL = (data >> 4) & 0x0f;
+
+        if (slot.regSL == 0x0f)
+          slot.regSL = 0x1f;          // the last step is -93dB, not -45dB
+
+        slot.regRR = data & 0x0f;
+      }
+      break;
+
+    case 0xe0:
+    case 0xf0:
+      if (regSlot[reg & 0x1f] >= 0) {
+        slot_t& slot = m_slots[18 * high + regSlot[reg & 0x1f]];
+
+        // The OPL2 only takes waveform changes while they are enabled,
+        //  and only has the first four; so does the OPL3 outside of OPL3
+        //  mode
+        if (m_isOPL2 && !m_isWaveSelect)
+          break;
+
+        slot.regWF = data & 0x07;
+
+        if (!m_newm)
+          slot.regWF &= 0x03;
+      }
+      break;
+
+    case 0xa0:
+      if ((reg & 0x0f) < 9)
+        writeA0(m_channels[9 * high + (reg & 0x0f)], data);
+      break;
+
+    case 0xb0:
+      if ((reg == 0xbd) && !high) {
+        m_tremoloShift = (((data >> 7) ^ 1) << 1) + 2;
+        m_vibShift = ((data >> 6) & 0x01) ^ 1;
+        updateRhythm(data);
+      } else if ((reg & 0x0f) < 9) {
+        channel_t& channel = m_channels[9 * high + (reg & 0x0f)];
+
+        writeB0(channel, data);
+
+        if (data & 0x20) {
+          keyOn(channel);
+        } else {
+          keyOff(channel);
+        }
+      }
+      break;
+
+    case 0xc0:
+      if ((reg & 0x0f) < 9)
+        writeC0(m_channels[9 * high + (reg & 0x0f)], data);
+      break;
+  }
+}
+
+//
+// Synthesizes <numSamples> sample frames at the native rate (see
+//  getChannels)
+//
+void COPL3Core::render(OPLSample_t* buffer, int numSamples) {
+  short frame[4];
+  int i;
+
+  if (m_isOPL2) {
+    for (i = 0; i < numSamples; i++) {
+      generate(frame);
+      buffer[i] = frame[0];
+    }
+  } else {
+    // Channels C and D are not connected on AdLib-compatible cards
+    for (i = 0; i < numSamples; i++) {
+      generate(frame);
+      buffer[2 * i + 0] = frame[0];
+      buffer[2 * i + 1] = frame[1];
+    }
+  }
+}
+
+//
+// Retrieves the number of channels in each rendered sample frame
+//
+int COPL3Core::getChannels(void) {
+  return m_isOPL2 ? 1 : 2;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline short ClipSample(int sample) {
+  if (sample > 32767)
+    return 32767;
+
+  if (sample < -32768)
+    return -32768;
+
+  return (short)sample;
+}
+
+//
+// Runs the chip for one native sample: the operators are processed in the
+//  chip's order, and each output (A/C, then B/D) is mixed part way through,
+//  so channels B and D come out one sample after A and C as on the chip
+//
+void COPL3Core::generate(short* frame) {
+  int mix[2];
+  int i;
+
+  frame[1] = ClipSample(m_mixBuf[1]);
+  frame[3] = ClipSample(m_mixBuf[3]);
+
+  for (i = 0; i < 15; i++)
+    processSlot(m_slots[i]);
+
+  mix[0] = mix[1] = 0;
+
+  for (i = 0; i < OPL3_NUM_CHANNELS; i++) {
+    channel_t& channel = m_channels[i];
+    short accm = (short)(*channel.out[0] + *channel.out[1] + *channel.out[2] + *channel.out[3]);
+
+    mix[0] += (short)(accm & channel.cha);
+    mix[1] += (short)(accm & channel.chc);
+  }
+
+  m_mixBuf[0] = mix[0];
+  m_mixBuf[2] = mix[1];
+
+  for (i = 15; i < 18; i++)
+    processSlot(m_slots[i]);
+
+  frame[0] = ClipSample(m_mixBuf[0]);
+  frame[2] = ClipSample(m_mixBuf[2]);
+
+  for (i = 18; i < 33; i++)
+    processSlot(m_slots[i]);
+
+  mix[0] = mix[1] = 0;
+
+  for (i = 0; i < OPL3_NUM_CHANNELS; i++) {
+    channel_t& channel = m_channels[i];
+    short accm = (short)(*channel.out[0] + *channel.out[1] + *channel.out[2] + *channel.out[3]);
+
+    mix[0] += (short)(accm & channel.chb);
+    mix[1] += (short)(accm & channel.chd);
+  }
+
+  m_mixBuf[1] = mix[0];
+  m_mixBuf[3] = mix[1];
+
+  for (i = 33; i < 36; i++)
+    processSlot(m_slots[i]);
+
+  // Tremolo: a triangle, one step every 64 samples
+  if ((m_timer & 0x3f) == 0x3f)
+    m_tremoloPos = (unsigned char)((m_tremoloPos + 1) % TREMOLO_STEPS);
+
+  if (m_tremoloPos < TREMOLO_STEPS / 2) {
+    m_tremolo = m_tremoloPos >> m_tremoloShift;
+  } else {
+    m_tremolo = (TREMOLO_STEPS - m_tremoloPos) >> m_tremoloShift;
+  }
+
+  // Vibrato: eight steps, one every 1024 samples
+  if ((m_timer & 0x3ff) == 0x3ff)
+    m_vibPos = (m_vibPos + 1) & 0x07;
+
+  m_timer++;
+
+  // Envelope counter: the envelope rates below 12 step on the counter's
+  //  trailing zeros, every other sample
+  if (m_egState) {
+    int shift = 0;
+
+    while ((shift < 36) && (((m_egTimer >> shift) & 1) == 0))
+      shift++;
+
+    m_egAdd = (shift > 12) ? 0 : (unsigned char)(shift + 1);
+    m_egTimerLo = (unsigned char)(m_egTimer & 0x03);
+  }
+
+  if (m_egTimerRem || m_egState) {
+    if (m_egTimer == ((((unsigned __int64)1) << 36) - 1)) {
+      m_egTimer = 0;
+      m_egTimerRem = true;
+    } else {
+      m_egTimer++;
+      m_egTimerRem = false;
+    }
+  }
+
+  m_egState = !m_egState;
+
+  // Register writes that are due
+  while (m_writeBuf[m_writeBufCur].isPending && (m_writeBuf[m_writeBufCur].time <= m_sampleCount)) {
+    writeBuf_t& entry = m_writeBuf[m_writeBufCur];
+
+    writeReg(entry.reg, entry.data);
+    entry.isPending = false;
+    m_writeBufCur = (m_writeBufCur + 1) % OPL3_WRITEBUF_SIZE;
+  }
+
+  m_sampleCount++;
+}
+
+void COPL3Core::processSlot(slot_t& slot) {
+  calcFeedback(slot);
+  calcEnvelope(slot);
+  calcPhase(slot);
+  calcOutput(slot);
+}
+
+void COPL3Core::calcFeedback(slot_t& slot) {
+  channel_t& channel = *slot.channel;
+
+  if (channel.fb != 0) {
+    slot.fbmod = (short)((slot.prout + slot.out) >> (0x09 - channel.fb));
+  } else {
+    slot.fbmod = 0;
+  }
+
+  slot.prout = slot.out;
+}
+
+//
+// Steps the envelope generator; the attenuation used for this sample is
+//  the one computed on the previous step
+//
+void COPL3Core::calcEnvelope(slot_t& slot) {
+  int egOut = slot.egRout + (slot.regTL << 2) + (slot.egKSL >> kslShift[slot.regKSL]) + *slot.trem;
+
+  slot.egOut = (short)((egOut > EG_MAX_ATTENUATION) ? EG_MAX_ATTENUATION : egOut);
+
+  bool isReset = false;
+  int regRate = 0;
+
+  if (slot.key && (slot.egGen == EG_RELEASE)) {
+    isReset = true;
+    regRate = slot.regAR;
+  } else {
+    switch (slot.egGen) {
+      case EG_ATTACK:
+        regRate = slot.regAR;
+        break;
+      case EG_DECAY:
+        regRate = slot.regDR;
+        break;
+      case EG_SUSTAIN:
+        if (!slot.regType)
+          regRate = slot.regRR;
+        break;
+      case EG_RELEASE:
+        regRate = slot.regRR;
+        break;
+    }
+  }
+
+  slot.pgReset = isReset;
+
+  int ks = slot.channel->ksv >> ((slot.regKSR ? 0 : 1) << 1);
+  int rate = ks + (regRate << 2);
+  int rateHi = rate >> 2;
+  int rateLo = rate & 0x03;
+
+  if (rateHi & 0x10)
+    rateHi = 0x0f;
+
+  int egShift = rateHi + m_egAdd;
+  int shift = 0;
+
+  if (regRate != 0) {
+    if (rateHi < 12) {
+      if (m_egState) {
+        switch (egShift) {
+          case 12:
+            shift = 1;
+            break;
+          case 13:
+            shift = (rateLo >> 1) & 0x01;
+            break;
+          case 14:
+            shift = rateLo & 0x01;
+            break;
+        }
+      }
+    } else {
+      shift = (rateHi & 0x03) + egIncStep[rateLo][m_egTimerLo];
+
+      if (shift & 0x04)
+        shift = 0x03;
+
+      if (!shift)
+        shift = m_egState ? 1 : 0;
+    }
+  }
+
+  int egRout = slot.egRout;
+  int egInc = 0;
+  bool isOff = false;
+
+  // Instant attack
+  if (isReset && (rateHi == 0x0f))
+    egRout = 0x00;
+
+  // Envelope off
+  if ((slot.egRout & 0x1f8) == 0x1f8)
+    isOff = true;
+
+  if ((slot.egGen != EG_ATTACK) && !isReset && isOff)
+    egRout = EG_MAX_ATTENUATION;
+
+  switch (slot.egGen) {
+    case EG_ATTACK:
+      if (slot.egRout == 0) {
+        slot.egGen = EG_DECAY;
+      } else if (slot.key && (shift > 0) && (rateHi != 0x0f)) {
+        egInc = ~(int)slot.egRout >> (4 - shift);
+      }
+      break;
+
+    case EG_DECAY:
+      if ((slot.egRout >> 4) == slot.regSL) {
+        slot.egGen = EG_SUSTAIN;
+      } else if (!isOff && !isReset && (shift > 0)) {
+        egInc = 1 << (shift - 1);
+      }
+      break;
+
+    case EG_SUSTAIN:
+    case EG_RELEASE:
+      if (!isOff && !isReset && (shift > 0))
+        egInc = 1 << (shift - 1);
+      break;
+  }
+
+  slot.egRout = (short)((egRout + egInc) & EG_MAX_ATTENUATION);
+
+  // Key on/off
+  if (isReset)
+    slot.egGen = EG_ATTACK;
+
+  if (!slot.key)
+    slot.egGen = EG_RELEASE;
+}
+
+//
+// Steps the phase generator (and, in rhythm mode, builds the hi-hat, snare
+//  drum and top cymbal phases out of the operators' phase bits and noise)
+//
+void COPL3Core::calcPhase(slot_t& slot) {
+  int fNum = slot.channel->fNum;
+
+  if (slot.regVib) {
+    int range = (fNum >> 7) & 0x07;
+
+    if (!(m_vibPos & 0x03)) {
+      range = 0;
+    } else if (m_vibPos & 0x01) {
+      range >>= 1;
+    }
+
+    range >>= m_vibShift;
+
+    if (m_vibPos & 0x04)
+      range = -range;
+
+    fNum += range;
+  }
+
+  unsigned long baseFreq = ((unsigned long)fNum << slot.channel->block) >> 1;
+  unsigned short phase = (unsigned short)(slot.pgPhase >> 9);
+
+  if (slot.pgReset)
+    slot.pgPhase = 0;
+
+  slot.pgPhase += (baseFreq * multTable[slot.regMult]) >> 1;
+  slot.pgPhaseOut = phase;
+
+  // Rhythm mode
+  unsigned long noise = m_noise;
+
+  if (slot.slotNum == 13) {           // hi-hat
+    m_hhBit2 = ((phase >> 2) & 1) != 0;
+    m_hhBit3 = ((phase >> 3) & 1) != 0;
+    m_hhBit7 = ((phase >> 7) & 1) != 0;
+    m_hhBit8 = ((phase >> 8) & 1) != 0;
+  }
+
+  if ((slot.slotNum == 17) && (m_rhy & 0x20)) {   // top cymbal
+    m_tcBit3 = ((phase >> 3) & 1) != 0;
+    m_tcBit5 = ((phase >> 5) & 1) != 0;
+  }
+
+  if (m_rhy & 0x20) {
+    int rmXor = (m_hhBit2 ^ m_hhBit7) | (m_hhBit3 ^ m_tcBit5) | (m_tcBit3 ^ m_tcBit5);
+
+    switch (slot.slotNum) {
+      case 13:                        // hi-hat
+        slot.pgPhaseOut = (unsigned short)(rmXor << 9);
+
+        if (rmXor ^ (noise & 1)) {
+          slot.pgPhaseOut |= 0xd0;
+        } else {
+          slot.pgPhaseOut |= 0x34;
+        }
+        break;
+
+      case 16:                        // snare drum
+        slot.pgPhaseOut = (unsigned short)((m_hhBit8 << 9) | ((m_hhBit8 ^ (noise & 1)) << 8));
+        break;
+
+      case 17:                        // top cymbal
+        slot.pgPhaseOut = (unsigned short)((rmXor << 9) | 0x80);
+        break;
+    }
+  }
+
+  // The noise generator steps once per operator
+  unsigned long nBit = ((noise >> 14) ^ noise) & 0x01;
+  m_noise = (noise >> 1) | (nBit << 22);
+}
+
+void COPL3Core::calcOutput(slot_t& slot) {
+  slot.out = calcWave(slot.regWF, (unsigned short)(slot.pgPhaseOut + *slot.mod), slot.egOut);
+}
+
+void COPL3Core::updateKSL(slot_t& slot) {
+  int ksl = (kslTable[slot.channel->fNum >> 6] << 2) - ((0x08 - slot.channel->block) << 5);
+
+  slot.egKSL = (unsigned char)((ksl < 0) ? 0 : ksl);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void COPL3Core::writeA0(channel_t& channel, int data) {
+  if (m_newm && (channel.chType == CH_4OP2))
+    return;                           // the pair's first channel sets the frequency
+
+  channel.fNum = (unsigned short)((channel.fNum & 0x300) | data);
+  channel.ksv = (unsigned char)((channel.block << 1) | ((channel.fNum >> (0x09 - (m_nts ? 1 : 0))) & 0x01));
+
+  updateKSL(*channel.slots[0]);
+  updateKSL(*channel.slots[1]);
+
+  if (m_newm && (channel.chType == CH_4OP)) {
+    channel.pair->fNum = channel.fNum;
+    channel.pair->ksv = channel.ksv;
+    updateKSL(*channel.pair->slots[0]);
+    updateKSL(*channel.pair->slots[1]);
+  }
+}
+
+void COPL3Core::writeB0(channel_t& channel, int data) {
+  if (m_newm && (channel.chType == CH_4OP2))
+    return;                           // the pair's first channel sets the frequency
+
+  channel.fNum = (unsigned short)((channel.fNum & 0xff) | ((data & 0x03) << 8));
+  channel.block = (unsigned char)((data >> 2) & 0x07);
+  channel.ksv = (unsigned char)((channel.block << 1) | ((channel.fNum >> (0x09 - (m_nts ? 1 : 0))) & 0x01));
+
+  updateKSL(*channel.slots[0]);
+  updateKSL(*channel.slots[1]);
+
+  if (m_newm && (channel.chType == CH_4OP)) {
+    channel.pair->fNum = channel.fNum;
+    channel.pair->block = channel.block;
+    channel.pair->ksv = channel.ksv;
+    updateKSL(*channel.pair->slots[0]);
+    updateKSL(*channel.pair->slots[1]);
+  }
+}
+
+void COPL3Core::writeC0(channel_t& channel, int data) {
+  channel.fb = (unsigned char)((data & 0x0e) >> 1);
+  channel.con = (unsigned char)(data & 0x01);
+
+  updateAlg(channel);
+
+  if (m_newm) {
+    channel.cha = ((data >> 4) & 0x01) ? 0xffff : 0x0000;
+    channel.chb = ((data >> 5) & 0x01) ? 0xffff : 0x0000;
+    channel.chc = ((data >> 6) & 0x01) ? 0xffff : 0x0000;
+    channel.chd = ((data >> 7) & 0x01) ? 0xffff : 0x0000;
+  } else {
+    channel.cha = channel.chb = 0xffff;
+    channel.chc = channel.chd = 0x0000;
+  }
+}
+
+//
+// Connects a channel's operators (and, for the second channel of a
+//  4-operator pair, the pair's four operators) according to its algorithm
+//
+void COPL3Core::setupAlg(channel_t& channel) {
+  if (channel.chType == CH_DRUM) {
+    if ((channel.chNum == 7) || (channel.chNum == 8)) {
+      // Hi-hat, snare drum, tom-tom and top cymbal: no modulation
+      channel.slots[0]->mod = &m_zeroMod;
+      channel.slots[1]->mod = &m_zeroMod;
+      return;
+    }
+
+    // Bass drum
+    channel.slots[0]->mod = &channel.slots[0]->fbmod;
+    channel.slots[1]->mod = (channel.alg & 0x01) ? &m_zeroMod : &channel.slots[0]->out;
+    return;
+  }
+
+  if (channel.alg & 0x08)
+    return;                           // first channel of a 4-operator pair: set up with the second
+
+  if (channel.alg & 0x04) {
+    channel_t& pair = *channel.pair;
+
+    pair.out[0] = pair.out[1] = pair.out[2] = pair.out[3] = &m_zeroMod;
+
+    switch (channel.alg & 0x03) {
+      case 0x00:                      // FM-FM
+        pair.slots[0]->mod = &pair.slots[0]->fbmod;
+        pair.slots[1]->mod = &pair.slots[0]->out;
+        channel.slots[0]->mod = &pair.slots[1]->out;
+        channel.slots[1]->mod = &channel.slots[0]->out;
+        channel.out[0] = &channel.slots[1]->out;
+        channel.out[1] = &m_zeroMod;
+        channel.out[2] = &m_zeroMod;
+        channel.out[3] = &m_zeroMod;
+        break;
+
+      case 0x01:                      // AM-FM
+        pair.slots[0]->mod = &pair.slots[0]->fbmod;
+        pair.slots[1]->mod = &pair.slots[0]->out;
+        channel.slots[0]->mod = &m_zeroMod;
+        channel.slots[1]->mod = &channel.slots[0]->out;
+        channel.out[0] = &pair.slots[1]->out;
+        channel.out[1] = &channel.slots[1]->out;
+        channel.out[2] = &m_zeroMod;
+        channel.out[3] = &m_zeroMod;
+        break;
+
+      case 0x02:                      // FM-AM
+        pair.slots[0]->mod = &pair.slots[0]->fbmod;
+        pair.slots[1]->mod = &m_zeroMod;
+        channel.slots[0]->mod = &pair.slots[1]->out;
+        channel.slots[1]->mod = &channel.slots[0]->out;
+        channel.out[0] = &pair.slots[0]->out;
+        channel.out[1] = &channel.slots[1]->out;
+        channel.out[2] = &m_zeroMod;
+        channel.out[3] = &m_zeroMod;
+        break;
+
+      case 0x03:                      // AM-AM
+        pair.slots[0]->mod = &pair.slots[0]->fbmod;
+        pair.slots[1]->mod = &m_zeroMod;
+        channel.slots[0]->mod = &pair.slots[1]->out;
+        channel.slots[1]->mod = &m_zeroMod;
+        channel.out[0] = &pair.slots[0]->out;
+        channel.out[1] = &channel.slots[0]->out;
+        channel.out[2] = &channel.slots[1]->out;
+        channel.out[3] = &m_zeroMod;
+        break;
+    }
+  } else {
+    if (channel.alg & 0x01) {         // AM
+      channel.slots[0]->mod = &channel.slots[0]->fbmod;
+      channel.slots[1]->mod = &m_zeroMod;
+      channel.out[0] = &channel.slots[0]->out;
+      channel.out[1] = &channel.slots[1]->out;
+    } else {                          // FM
+      channel.slots[0]->mod = &channel.slots[0]->fbmod;
+      channel.slots[1]->mod = &channel.slots[0]->out;
+      channel.out[0] = &channel.slots[1]->out;
+      channel.out[1] = &m_zeroMod;
+    }
+
+    channel.out[2] = &m_zeroMod;
+    channel.out[3] = &m_zeroMod;
+  }
+}
+
+void COPL3Core::updateAlg(channel_t& channel) {
+  channel.alg = channel.con;
+
+  if (m_newm) {
+    if (channel.chType == CH_4OP) {
+      channel.pair->alg = (unsigned char)(0x04 | (channel.con << 1) | channel.pair->con);
+      channel.alg = 0x08;
+      setupAlg(*channel.pair);
+    } else if (channel.chType == CH_4OP2) {
+      channel.alg = (unsigned char)(0x04 | (channel.pair->con << 1) | channel.con);
+      channel.pair->alg = 0x08;
+      setupAlg(channel);
+    } else {
+      setupAlg(channel);
+    }
+  } else {
+    setupAlg(channel);
+  }
+}
+
+//
+// Enters or leaves rhythm mode, and keys the drums on or off
+//
+void COPL3Core::updateRhythm(int data) {
+  channel_t& channel6 = m_channels[6];
+  channel_t& channel7 = m_channels[7];
+  channel_t& channel8 = m_channels[8];
+  int i;
+
+  m_rhy = (unsigned char)(data & 0x3f);
+
+  if (m_rhy & 0x20) {
+    // The drums come out twice as loud as melodic channels
+    channel6.out[0] = &channel6.slots[1]->out;
+    channel6.out[1] = &channel6.slots[1]->out;
+    channel6.out[2] = &m_zeroMod;
+    channel6.out[3] = &m_zeroMod;
+    channel7.out[0] = &channel7.slots[0]->out;
+    channel7.out[1] = &channel7.slots[0]->out;
+    channel7.out[2] = &channel7.slots[1]->out;
+    channel7.out[3] = &channel7.slots[1]->out;
+    channel8.out[0] = &channel8.slots[0]->out;
+    channel8.out[1] = &channel8.slots[0]->out;
+    channel8.out[2] = &channel8.slots[1]->out;
+    channel8.out[3] = &channel8.slots[1]->out;
+
+    for (i = 6; i < 9; i++)
+      m_channels[i].chType = CH_DRUM;
+
+    setupAlg(channel6);
+    setupAlg(channel7);
+    setupAlg(channel8);
+
+    // Hi-hat, top cymbal, tom-tom, snare drum, bass drum
+    if (m_rhy & 0x01) { channel7.slots[0]->key |= KEY_DRUM; } else { channel7.slots[0]->key &= ~KEY_DRUM; }
+    if (m_rhy & 0x02) { channel8.slots[1]->key |= KEY_DRUM; } else { channel8.slots[1]->key &= ~KEY_DRUM; }
+    if (m_rhy & 0x04) { channel8.slots[0]->key |= KEY_DRUM; } else { channel8.slots[0]->key &= ~KEY_DRUM; }
+    if (m_rhy & 0x08) { channel7.slots[1]->key |= KEY_DRUM; } else { channel7.slots[1]->key &= ~KEY_DRUM; }
+
+    if (m_rhy & 0x10) {
+      channel6.slots[0]->key |= KEY_DRUM;
+      channel6.slots[1]->key |= KEY_DRUM;
+    } else {
+      channel6.slots[0]->key &= ~KEY_DRUM;
+      channel6.slots[1]->key &= ~KEY_DRUM;
+    }
+  } else {
+    for (i = 6; i < 9; i++) {
+      m_channels[i].chType = CH_2OP;
+      setupAlg(m_channels[i]);
+      m_channels[i].slots[0]->key &= ~KEY_DRUM;
+      m_channels[i].slots[1]->key &= ~KEY_DRUM;
+    }
+  }
+}
+
+//
+// Pairs channels into 4-operator channels (register 0x104)
+//
+void COPL3Core::set4Op(int data) {
+  for (int bit = 0; bit < 6; bit++) {
+    int chNum = (bit < 3) ? bit : bit + 9 - 3;
+
+    if ((data >> bit) & 0x01) {
+      m_channels[chNum].chType = CH_4OP;
+      m_channels[chNum + 3].chType = CH_4OP2;
+      updateAlg(m_channels[chNum]);
+    } else {
+      m_channels[chNum].chType = CH_2OP;
+      m_channels[chNum + 3].chType = CH_2OP;
+      updateAlg(m_channels[chNum]);
+      updateAlg(m_channels[chNum + 3]);
+    }
+  }
+}
+
+void COPL3Core::keyOn(channel_t& channel) {
+  if (m_newm) {
+    if (channel.chType == CH_4OP) {
+      channel.slots[0]->key |= KEY_NORMAL;
+      channel.slots[1]->key |= KEY_NORMAL;
+      channel.pair->slots[0]->key |= KEY_NORMAL;
+      channel.pair->slots[1]->key |= KEY_NORMAL;
+    } else if ((channel.chType == CH_2OP) || (channel.chType == CH_DRUM)) {
+      channel.slots[0]->key |= KEY_NORMAL;
+      channel.slots[1]->key |= KEY_NORMAL;
+    }
+  } else {
+    channel.slots[0]->key |= KEY_NORMAL;
+    channel.slots[1]->key |= KEY_NORMAL;
+  }
+}
+
+void COPL3Core::keyOff(channel_t& channel) {
+  if (m_newm) {
+    if (channel.chType == CH_4OP) {
+      channel.slots[0]->key &= ~KEY_NORMAL;
+      channel.slots[1]->key &= ~KEY_NORMAL;
+      channel.pair->slots[0]->key &= ~KEY_NORMAL;
+      channel.pair->slots[1]->key &= ~KEY_NORMAL;
+    } else if ((channel.chType == CH_2OP) || (channel.chType == CH_DRUM)) {
+      channel.slots[0]->key &= ~KEY_NORMAL;
+      channel.slots[1]->key &= ~KEY_NORMAL;
+    }
+  } else {
+    channel.slots[0]->key &= ~KEY_NORMAL;
+    channel.slots[1]->key &= ~KEY_NORMAL;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Rebuilds the chip's ROMs: a quarter sine wave as attenuations (-log2, in
+//  1/256 steps), and the exponent table that turns attenuations back into
+//  linear levels (2^x, with the implicit leading 1)
+//
+void COPL3Core::buildTables(void) {
+  if (isTableBuilt)
+    return;
+
+  for (int i = 0; i < 256; i++) {
+    logSinTable[i] = (unsigned short)floor(-log(sin((i + 0.5) * 3.14159265358979323846 / 512.0)) / log(2.0) * 256.0 + 0.5);
+    expTable[i]    = (unsigned short)floor(pow(2.0, (255 - i) / 256.0) * 1024.0 + 0.5);
+  }
+
+  isTableBuilt = true;
+}
+
+short COPL3Core::calcExp(int level) {
+  if (level > 0x1fff)
+    level = 0x1fff;
+
+  return (short)((expTable[level & 0xff] << 1) >> (level >> 8));
+}
+
+//
+// Computes an operator's output for the given phase (10 bits) and
+//  attenuation (9 bits), in each of the OPL3's eight waveforms
+//
+short COPL3Core::calcWave(int waveform, unsigned short phase, unsigned short envelope) {
+  unsigned short out = 0;
+  unsigned short neg = 0;
+
+  phase &= 0x3ff;
+
+  switch (waveform) {
+    case 0:                           // sine
+      if (phase & 0x200)
+        neg = 0xffff;
+
+      out = (phase & 0x100) ? logSinTable[(phase & 0xff) ^ 0xff] : logSinTable[phase & 0xff];
+      break;
+
+    case 1:                           // half sine
+      if (phase & 0x200) {
+        out = 0x1000;
+      } else {
+        out = (phase & 0x100) ? logSinTable[(phase & 0xff) ^ 0xff] : logSinTable[phase & 0xff];
+      }
+      break;
+
+    case 2:                           // absolute sine
+      out = (phase & 0x100) ? logSinTable[(phase & 0xff) ^ 0xff] : logSinTable[phase & 0xff];
+      break;
+
+    case 3:                           // quarter sine
+      out = (phase & 0x100) ? 0x1000 : logSinTable[phase & 0xff];
+      break;
+
+    case 4:                           // alternating sine
+      if ((phase & 0x300) == 0x100)
+        neg = 0xffff;
+
+      if (phase & 0x200) {
+        out = 0x1000;
+      } else {
+        out = (phase & 0x80) ? logSinTable[((phase ^ 0xff) << 1) & 0xff] : logSinTable[(phase << 1) & 0xff];
+      }
+      break;
+
+    case 5:                           // camel sine
+      if (phase & 0x200) {
+        out = 0x1000;
+      } else {
+        out = (phase & 0x80) ? logSinTable[((phase ^ 0xff) << 1) & 0xff] : logSinTable[(phase << 1) & 0xff];
+      }
+      break;
+
+    case 6:                           // square
+      if (phase & 0x200)
+        neg = 0xffff;
+
+      out = 0;
+      break;
+
+    case 7:                           // logarithmic sawtooth
+      if (phase & 0x200) {
+        neg = 0xffff;
+        phase = (phase & 0x1ff) ^ 0x1ff;
+      }
+
+      out = (unsigned short)(phase << 3);
+      break;
+  }
+
+  return (short)(calcExp(out + (envelope << 3)) ^ neg);
+}
@@ -0,0 +1,197 @@
+#ifndef __OPL3CORE_H_
+#define __OPL3CORE_H_
+
+#include "OPLChip.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define OPL3_NATIVE_RATE      49716     // 14.31818MHz / 288 (OPL3), or 3.579545MHz / 72 (OPL2)
+
+#define OPL3_NUM_SLOTS        36        // operators
+#define OPL3_NUM_CHANNELS     18
+
+#define OPL3_WRITEBUF_SIZE    1024      // register writes waiting to reach the chip
+#define OPL3_WRITEBUF_DELAY   2         // native samples between two register writes
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+
+//
+// Sample-exact emulation of one YMF262 (OPL3) chip, also used for the
+//  YM3812 (OPL2) by running it in OPL2-compatible mode.  Each operator
+//  goes through the chip's own pipeline once per native sample: the
+//  envelope generator steps on the chip's global envelope counter, the
+//  phase generator and the vibrato/tremolo LFOs advance as on the chip,
+//  and the output is computed through the chip's log-sine and exponent
+//  tables (rebuilt here from their closed forms), with the same integer
+//  widths and the same operator order (so that feedback, rhythm and the
+//  noise generator interact as on the chip).  The model follows the
+//  reverse-engineered YMF262 die.
+// Register writes reach the chip at least OPL3_WRITEBUF_DELAY samples
+//  apart, as they would from a program that honours the chip's write
+//  delays: a key-off and a key-on written back to back retrigger the
+//  note, instead of cancelling out within a single sample.
+// Timers and the status register are not emulated here (see
+//  CAdLibCtlFSM).
+//
+class COPL3Core {
+  protected:
+    enum egState_t {
+      EG_ATTACK,
+      EG_DECAY,
+      EG_SUSTAIN,
+      EG_RELEASE
+    };
+
+    enum channelType_t {
+      CH_2OP,
+      CH_4OP,                           // first channel of a 4-operator pair
+      CH_4OP2,                          // second channel of a 4-operator pair
+      CH_DRUM
+    };
+
+    enum keyType_t {
+      KEY_NORMAL = 0x01,                // keyed on by the channel's key-on bit
+      KEY_DRUM   = 0x02                 // keyed on by the rhythm register
+    };
+
+    struct channel_t;
+
+    struct slot_t {
+      channel_t* channel;
+      int slotNum;
+
+      short out;                        // last output
+      short fbmod;                      // feedback, as a modulation input
+      short prout;                      // output before last
+      const short* mod;                 // modulation input
+
+      short egRout;                     // envelope attenuation (9 bits)
+      short egOut;                      // total attenuation (envelope, level, KSL, tremolo)
+      unsigned char egKSL;
+      egState_t egGen;
+      unsigned char key;                // see keyType_t
+      const unsigned char* trem;        // tremolo input
+
+      bool pgReset;
+      unsigned long pgPhase;            // phase accumulator (19 bits used)
+      unsigned short pgPhaseOut;        // phase, after rhythm substitution
+
+      bool regVib;
+      bool regType;                     // sustain
+      bool regKSR;
+      unsigned char regMult;
+      unsigned char regKSL;
+      unsigned char regTL;
+      unsigned char regAR;
+      unsigned char regDR;
+      unsigned char regSL;
+      unsigned char regRR;
+      unsigned char regWF;
+    };
+
+    struct writeBuf_t {
+      bool isPending;
+      unsigned short reg;               // register (bit 8 selects the second register set)
+      unsigned char data;
+      unsigned __int64 time;            // native sample the write is due on
+    };
+
+    struct channel_t {
+      slot_t* slots[2];
+      channel_t* pair;                  // the other channel of a 4-operator pair (NULL if none)
+      const short* out[4];              // operator outputs summed into the channel's output
+      channelType_t chType;
+      int chNum;
+
+      unsigned short fNum;
+      unsigned char block;
+      unsigned char fb;
+      unsigned char con;
+      unsigned char alg;
+      unsigned char ksv;
+      unsigned short cha, chb, chc, chd;  // output enables (all bits set, or clear)
+    };
+
+  public:
+    COPL3Core(void);
+    ~COPL3Core(void);
+
+  public:
+    void reset(bool isOPL2);
+    void write(int regSet, int regIdx, int value);
+    void render(OPLSample_t* buffer, int numSamples);
+    int getChannels(void);
+
+  protected:
+    void generate(short* frame);
+    void writeReg(int reg, int data);
+    void processSlot(slot_t& slot);
+    void calcFeedback(slot_t& slot);
+    void calcEnvelope(slot_t& slot);
+    void calcPhase(slot_t& slot);
+    void calcOutput(slot_t& slot);
+    void updateKSL(slot_t& slot);
+
+    void writeA0(channel_t& channel, int data);
+    void writeB0(channel_t& channel, int data);
+    void writeC0(channel_t& channel, int data);
+    void setupAlg(channel_t& channel);
+    void updateAlg(channel_t& channel);
+    void updateRhythm(int data);
+    void set4Op(int data);
+    void keyOn(channel_t& channel);
+    void keyOff(channel_t& channel);
+
+  protected:
+    static void buildTables(void);
+    static short calcExp(int level);
+    static short calcWave(int waveform, unsigned short phase, unsigned short envelope);
+
+  protected:
+    bool m_isOPL2;                      // OPL2-compatible mode only (no second register set)
+    bool m_isWaveSelect;                // OPL2 waveform select enable (register 0x01, bit 5)
+
+    slot_t m_slots[OPL3_NUM_SLOTS];
+    channel_t m_channels[OPL3_NUM_CHANNELS];
+
+    unsigned short m_timer;             // counts native samples (drives the LFOs)
+    unsigned __int64 m_egTimer;         // the envelope generator's 36-bit counter
+    bool m_egTimerRem;
+    bool m_egState;                     // the envelope generator steps every other sample
+    unsigned char m_egTimerLo;
+    unsigned char m_egAdd;
+
+    bool m_newm;                        // OPL3 mode (register 0x105, bit 0)
+    bool m_nts;                         // note select (register 0x08, bit 6)
+    unsigned char m_rhy;                // rhythm register (0xbd, bits 5-0)
+
+    unsigned char m_vibPos;
+    unsigned char m_vibShift;
+    unsigned char m_tremolo;
+    unsigned char m_tremoloPos;
+    unsigned char m_tremoloShift;
+
+    unsigned long m_noise;              // 23-bit noise LFSR
+    bool m_hhBit2, m_hhBit3, m_hhBit7, m_hhBit8;  // hi-hat and top cymbal phase bits (rhythm)
+    bool m_tcBit3, m_tcBit5;
+
+    int m_mixBuf[4];                    // channel outputs, mixed one operator cycle ahead
+
+    writeBuf_t m_writeBuf[OPL3_WRITEBUF_SIZE];
+    int m_writeBufCur;                  // next write to reach the chip
+    int m_writeBufLast;                 // next free entry
+    unsigned __int64 m_writeBufLastTime;  // when the last buffered write is due
+    unsigned __int64 m_sampleCount;     // native samples generated so far
+
+    short m_zeroMod;                    // a modulation/output input that is always 0
+    unsigned char m_zeroTrem;
+
+  protected:
+    static bool isTableBuilt;
+    static unsigned short logSinTable[256];
+    static unsigned short expTable[256];
+};
+
+#endif //__OPL3CORE_H_
@@ -0,0 +1,39 @@
+#ifndef __OPLCHIP_H_
+#define __OPLCHIP_H_
+
+//
+// Define the type of the (signed, 16-bit) samples produced by the OPL engines
+//
+typedef short OPLSample_t;
+
+#define OPL_MAX_CHIPS 2     // Maximum number of chips per engine (dual OPL2)
+
+
+
+//
+// This interface isolates the FM synthesis engine (the actual chip
+//  emulation) from the rest of the AdLib emulation (timers, port
+//  decoding, playback), so that engines with different accuracy vs.
+//  speed trade-offs can be used interchangeably.  An engine emulates
+//  one or more chips of the same type.
+//
+class IOPLChip {
+  public:
+    enum type_t { TYPE_OPL2, TYPE_OPL3 };
+
+  public:
+    virtual ~IOPLChip(void) { }
+
+  // render() produces <numSamples> sample frames for the given chip, each
+  //  frame made of getChannels() interleaved samples (1 for OPL2, 2 for OPL3)
+  public:
+    virtual bool create(type_t type, int numChips, int sampleRate) = 0;
+    virtual void destroy(void) = 0;
+    virtual void reset(int chipID) = 0;
+    virtual void write(int chipID, int regSet, int regIdx, int value) = 0;
+    virtual void render(int chipID, OPLSample_t* buffer, int numSamples) = 0;
+    virtual int getChannels(void) = 0;
+    virtual const char* getName(void) = 0;
+};
+
+#endif //__OPLCHIP_H_
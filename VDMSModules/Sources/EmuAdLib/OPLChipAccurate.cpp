@@ -0,0 +1,120 @@
+#include "stdafx.h"
+
+#include "OPLChipAccurate.h"
+
+#include <math.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// COPLChipAccurate
+
+COPLChipAccurate::COPLChipAccurate(void)
+  : m_type(TYPE_OPL2), m_numChips(0), m_step(1.0)
+{
+}
+
+COPLChipAccurate::~COPLChipAccurate(void)
+{
+  destroy();
+}
+
+//
+// Creates <numChips> chips of the given type, running at their native rate
+//  (returns false on failure)
+//
+bool COPLChipAccurate::create(type_t type, int numChips, int sampleRate) {
+  if ((m_numChips > 0) || (numChips < 1) || (numChips > OPL_MAX_CHIPS) || (sampleRate <= 0))
+    return false;
+
+  if ((type != TYPE_OPL2) && (type != TYPE_OPL3))
+    return false;
+
+  m_type     = type;
+  m_numChips = numChips;
+  m_step     = (double)OPL3_NATIVE_RATE / sampleRate;
+
+  for (int i = 0; i < m_numChips; i++) {
+    m_chips[i].reset(m_type == TYPE_OPL2);
+    m_resampler[i].Init(getChannels(), OPL3_NATIVE_RATE, sampleRate, CResampler::QUALITY_HIGH);
+  }
+
+  return true;
+}
+
+//
+// Releases the chips
+//
+void COPLChipAccurate::destroy(void) {
+  m_numChips = 0;
+}
+
+//
+// Resets a chip, and discards its pending native-rate output
+//
+void COPLChipAccurate::reset(int chipID) {
+  if ((chipID < 0) || (chipID >= m_numChips))
+    return;
+
+  m_chips[chipID].reset(m_type == TYPE_OPL2);
+  m_resampler[chipID].Reset();
+}
+
+//
+// Programs a chip register
+//
+void COPLChipAccurate::write(int chipID, int regSet, int regIdx, int value) {
+  if ((chipID < 0) || (chipID >= m_numChips))
+    return;
+
+  m_chips[chipID].write(regSet, regIdx, value);
+}
+
+//
+// Synthesizes audio data at the native rate, and resamples it to the output
+//  rate
+//
+void COPLChipAccurate::render(int chipID, OPLSample_t* buffer, int numSamples) {
+  int channels = getChannels();
+
+  if ((chipID < 0) || (chipID >= m_numChips)) {
+    memset(buffer, 0, numSamples * channels * sizeof(OPLSample_t));
+    return;
+  }
+
+  COPL3Core& chip = m_chips[chipID];
+  CResampler& resampler = m_resampler[chipID];
+
+  int numAvailable;
+
+  // Produce just enough native frames to cover the requested output (the
+  //  resampler keeps whatever is left over for the next call)
+  while ((numAvailable = resampler.GetAvailable()) < numSamples) {
+    int numNative = (int)ceil((numSamples - numAvailable) * m_step) + 1;
+
+    if ((int)m_native.size() < channels * numNative)
+      m_native.resize(channels * numNative);
+
+    chip.render(&m_native[0], numNative);
+    resampler.Write(&m_native[0], numNative);
+  }
+
+  int numRead = resampler.Read(buffer, numSamples);
+
+  // Not expected, but never leave the buffer partially uninitialized
+  if (numRead < numSamples)
+    memset(buffer + numRead * channels, 0, (numSamples - numRead) * channels * sizeof(OPLSample_t));
+}
+
+//
+// Retrieves the number of channels in each rendered sample frame
+//
+int COPLChipAccurate::getChannels(void) {
+  return (m_type == TYPE_OPL3) ? 2 : 1;
+}
+
+//
+// Retrieves the engine's name (for logging purposes)
+//
+const char* COPLChipAccurate::getName(void) {
+  return "accurate";
+}
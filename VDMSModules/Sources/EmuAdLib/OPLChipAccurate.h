@@ -0,0 +1,46 @@
+#ifndef __OPLCHIPACCURATE_H_
+#define __OPLCHIPACCURATE_H_
+
+#include "OPLChip.h"
+#include "OPL3Core.h"
+
+#include <Resampler.h>
+
+#include <vector>
+
+
+
+//
+// Accurate engine: a sample-exact OPL3 core (see COPL3Core, run in
+//  OPL2-compatible mode for OPL2 chips) at the chip's native sample rate,
+//  its output band-limited and resampled to the output sample rate (which
+//  delays register writes by about 0.4ms, half the filter's length).
+//  Unlike the fast engine it keeps no global state, so any number of
+//  instances may coexist; it costs several times as much CPU (see
+//  OPLBench).
+//
+class COPLChipAccurate : public IOPLChip {
+  public:
+    COPLChipAccurate(void);
+    virtual ~COPLChipAccurate(void);
+
+  public:
+    virtual bool create(type_t type, int numChips, int sampleRate);
+    virtual void destroy(void);
+    virtual void reset(int chipID);
+    virtual void write(int chipID, int regSet, int regIdx, int value);
+    virtual void render(int chipID, OPLSample_t* buffer, int numSamples);
+    virtual int getChannels(void);
+    virtual const char* getName(void);
+
+  protected:
+    type_t m_type;                      // OPL type (OPL2, OPL3)
+    int m_numChips;                     // how many chips were created
+    double m_step;                      // native samples per output sample
+
+    COPL3Core m_chips[OPL_MAX_CHIPS];
+    CResampler m_resampler[OPL_MAX_CHIPS];   // converts each chip's output to the output rate
+    std::vector<OPLSample_t> m_native;  // native-rate samples rendered by the cores
+};
+
+#endif //__OPLCHIPACCURATE_H_
@@ -0,0 +1,173 @@
+#include "stdafx.h"
+
+#include "OPLChipMAME.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace MAME {
+  /* OPL2 code */
+# define HAS_YM3812 1
+# include "fmopl.h"
+# undef HAS_YM3812
+  /* OPL3 code */
+# define HAS_YMF262 1
+# include "ymf262.h"
+# undef HAS_YMF262
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define OPL2_INTERNAL_FREQ    3600000   // The OPL2 operates at 3.6MHz
+#define OPL3_INTERNAL_FREQ    14400000  // The OPL3 operates at 14.4MHz
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool COPLChipMAME::isInUse[2] = { false, false };
+
+/////////////////////////////////////////////////////////////////////////////
+// COPLChipMAME
+
+COPLChipMAME::COPLChipMAME(void)
+  : m_type(TYPE_OPL2), m_numChips(0), m_isCreated(false)
+{
+}
+
+COPLChipMAME::~COPLChipMAME(void)
+{
+  destroy();
+}
+
+//
+// Creates <numChips> chips of the given type (returns false on failure,
+//  or if the MAME core of that type is already in use by another engine)
+//
+bool COPLChipMAME::create(type_t type, int numChips, int sampleRate) {
+  if ((m_isCreated) || (numChips < 1) || (numChips > OPL_MAX_CHIPS))
+    return false;
+
+  if ((type != TYPE_OPL2) && (type != TYPE_OPL3))
+    return false;
+
+  if (isInUse[type])
+    return false;
+
+  m_type     = type;
+  m_numChips = numChips;
+
+  switch (m_type) {
+    case TYPE_OPL2:
+      if (MAME::YM3812Init(m_numChips, OPL2_INTERNAL_FREQ, sampleRate))
+        return false;
+      break;
+
+    case TYPE_OPL3:
+      if (MAME::YMF262Init(m_numChips, OPL3_INTERNAL_FREQ, sampleRate))
+        return false;
+      break;
+
+    default:
+      return false;
+  }
+
+  isInUse[m_type] = true;
+  m_isCreated     = true;
+
+  return true;
+}
+
+//
+// Releases the chips
+//
+void COPLChipMAME::destroy(void) {
+  if (!m_isCreated)
+    return;
+
+  switch (m_type) {
+    case TYPE_OPL2:
+      MAME::YM3812Shutdown();
+      break;
+    case TYPE_OPL3:
+      MAME::YMF262Shutdown();
+      break;
+  }
+
+  isInUse[m_type] = false;
+  m_isCreated     = false;
+}
+
+//
+// Resets a chip
+//
+void COPLChipMAME::reset(int chipID) {
+  switch (m_type) {
+    case TYPE_OPL2:
+      MAME::YM3812ResetChip(chipID);
+      break;
+    case TYPE_OPL3:
+      MAME::YMF262ResetChip(chipID);
+      break;
+  }
+}
+
+//
+// Programs a chip register
+//
+void COPLChipMAME::write(int chipID, int regSet, int regIdx, int value) {
+  switch (m_type) {
+    case TYPE_OPL2:
+      MAME::YM3812Write(chipID, 0, regIdx);
+      MAME::YM3812Write(chipID, 1, value);
+      break;
+    case TYPE_OPL3:
+      MAME::YMF262Write(chipID, 0 + (regSet << 1), regIdx);
+      MAME::YMF262Write(chipID, 1 + (regSet << 1), value);
+      break;
+  }
+}
+
+//
+// Synthesizes audio data
+//
+void COPLChipMAME::render(int chipID, OPLSample_t* buffer, int numSamples) {
+  int i;
+  MAME::OPL3SAMPLE* tbl_opl3[4];
+
+  switch (m_type) {
+    case TYPE_OPL2:
+      MAME::YM3812UpdateOne(chipID, buffer, numSamples);
+      break;
+
+    case TYPE_OPL3:
+      // Render channels A and B (left, right); channels C and D are
+      //  not connected on AdLib-compatible cards and are discarded
+      if ((int)m_scratch.size() < 3 * numSamples)
+        m_scratch.resize(3 * numSamples);
+
+      tbl_opl3[0] = &m_scratch[0];
+      tbl_opl3[1] = &m_scratch[numSamples];
+      tbl_opl3[2] = &m_scratch[2 * numSamples];
+      tbl_opl3[3] = &m_scratch[2 * numSamples];
+      MAME::YMF262UpdateOne(chipID, tbl_opl3, numSamples);
+
+      for (i = 0; i < numSamples; i++) {
+        buffer[2 * i + 0] = tbl_opl3[0][i];
+        buffer[2 * i + 1] = tbl_opl3[1][i];
+      }
+      break;
+  }
+}
+
+//
+// Retrieves the number of channels in each rendered sample frame
+//
+int COPLChipMAME::getChannels(void) {
+  return (m_type == TYPE_OPL3) ? 2 : 1;
+}
+
+//
+// Retrieves the engine's name (for logging purposes)
+//
+const char* COPLChipMAME::getName(void) {
+  return "fast";
+}
+
@@ -0,0 +1,42 @@
+#ifndef __OPLCHIPMAME_H_
+#define __OPLCHIPMAME_H_
+
+#include "OPLChip.h"
+
+#include <vector>
+
+
+
+//
+// Fast engine: the MAME OPL2 (YM3812) and OPL3 (YMF262) cores, rendering
+//  directly at the output sample rate.
+// Each MAME core keeps its chips in a global table, so only one fast
+//  engine at a time may emulate OPL2 chips, and only one may emulate OPL3
+//  chips, per process.
+//
+class COPLChipMAME : public IOPLChip {
+  public:
+    COPLChipMAME(void);
+    virtual ~COPLChipMAME(void);
+
+  public:
+    virtual bool create(type_t type, int numChips, int sampleRate);
+    virtual void destroy(void);
+    virtual void reset(int chipID);
+    virtual void write(int chipID, int regSet, int regIdx, int value);
+    virtual void render(int chipID, OPLSample_t* buffer, int numSamples);
+    virtual int getChannels(void);
+    virtual const char* getName(void);
+
+  protected:
+    type_t m_type;                      // OPL type (OPL2, OPL3)
+    int m_numChips;                     // how many chips were created
+    bool m_isCreated;                   // whether this instance owns the MAME core of its type
+
+    std::vector<OPLSample_t> m_scratch; // temporary storage for the OPL3's four output channels
+
+  protected:
+    static bool isInUse[2];             // whether each MAME core (OPL2, OPL3) is owned by an engine
+};
+
+#endif //__OPLCHIPMAME_H_
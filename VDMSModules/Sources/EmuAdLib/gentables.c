@@ -0,0 +1,272 @@
+/*
+**
+** File: gentables.c - generates the constant lookup tables used by the
+**                     OPL2 (fmopl.c) and OPL3 (ymf262.c) emulation cores
+**
+** The tables used to be computed at run-time by init_tables() in each core,
+**  the first time a chip was created.  They never change, so they are now
+**  computed once by this program and stored as 'static const' arrays (read-
+**  only data, shared by all chips and all processes using the DLL).
+**
+** Usage:
+**   gentables fmopltab.h ymf262tab.h
+**
+** This program is not part of the EmuAdLib build; it only has to be rebuilt
+**  and re-run if the table computations below are changed.  The math is
+**  taken verbatim from the original init_tables() functions.
+**
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+
+/* envelope output entries */
+#define ENV_BITS		10
+#define ENV_LEN			(1<<ENV_BITS)
+#define ENV_STEP		(128.0/ENV_LEN)
+
+/* sinwave entries */
+#define SIN_BITS		10
+#define SIN_LEN			(1<<SIN_BITS)
+#define SIN_MASK		(SIN_LEN-1)
+
+#define TL_RES_LEN		(256)	/* 8 bits addressing (real chip) */
+
+#define OPL2_TL_TAB_LEN (12*2*TL_RES_LEN)
+#define OPL3_TL_TAB_LEN (13*2*TL_RES_LEN)
+
+static signed int opl2_tl_tab[OPL2_TL_TAB_LEN];
+static unsigned int opl2_sin_tab[SIN_LEN * 4];
+
+static signed int opl3_tl_tab[OPL3_TL_TAB_LEN];
+static unsigned int opl3_sin_tab[SIN_LEN * 8];
+
+
+/* total level table entry (common to OPL2 and OPL3) */
+static signed int tl_entry(int x)
+{
+	signed int n;
+	double m;
+
+	m = (1<<16) / pow(2, (x+1) * (ENV_STEP/4.0) / 8.0);
+	m = floor(m);
+
+	/* we never reach (1<<16) here due to the (x+1) */
+	/* result fits within 16 bits at maximum */
+
+	n = (int)m;		/* 16 bits here */
+	n >>= 4;		/* 12 bits here */
+	if (n&1)		/* round to nearest */
+		n = (n>>1)+1;
+	else
+		n = n>>1;
+					/* 11 bits here (rounded) */
+	n <<= 1;		/* 12 bits here (as in real chip) */
+
+	return n;
+}
+
+/* sinus table entry in 'decibel' scale (common to OPL2 and OPL3) */
+static unsigned int sin_entry(int i)
+{
+	signed int n;
+	double o,m;
+
+	/* non-standard sinus */
+	m = sin( ((i*2)+1) * PI / SIN_LEN ); /* checked against the real chip */
+
+	/* we never reach zero here due to ((i*2)+1) */
+
+	if (m>0.0)
+		o = 8*log(1.0/m)/log(2);	/* convert to 'decibels' */
+	else
+		o = 8*log(-1.0/m)/log(2);	/* convert to 'decibels' */
+
+	o = o / (ENV_STEP/4);
+
+	n = (int)(2.0*o);
+	if (n&1)						/* round to nearest */
+		n = (n>>1)+1;
+	else
+		n = n>>1;
+
+	return n*2 + (m>=0.0? 0: 1 );
+}
+
+static void init_opl2_tables(void)
+{
+	signed int i,x;
+
+	for (x=0; x<TL_RES_LEN; x++)
+	{
+		opl2_tl_tab[ x*2 + 0 ] = tl_entry(x);
+		opl2_tl_tab[ x*2 + 1 ] = -opl2_tl_tab[ x*2 + 0 ];
+
+		for (i=1; i<12; i++)
+		{
+			opl2_tl_tab[ x*2+0 + i*2*TL_RES_LEN ] =  opl2_tl_tab[ x*2+0 ]>>i;
+			opl2_tl_tab[ x*2+1 + i*2*TL_RES_LEN ] = -opl2_tl_tab[ x*2+0 + i*2*TL_RES_LEN ];
+		}
+	}
+
+	for (i=0; i<SIN_LEN; i++)
+		opl2_sin_tab[ i ] = sin_entry(i);
+
+	for (i=0; i<SIN_LEN; i++)
+	{
+		/* waveform 1:  __      __     */
+		/*             /  \____/  \____*/
+		/* output only first half of the sinus waveform (positive one) */
+
+		if (i & (1<<(SIN_BITS-1)) )
+			opl2_sin_tab[1*SIN_LEN+i] = OPL2_TL_TAB_LEN;
+		else
+			opl2_sin_tab[1*SIN_LEN+i] = opl2_sin_tab[i];
+
+		/* waveform 2:  __  __  __  __ */
+		/*             /  \/  \/  \/  \*/
+		/* abs(sin) */
+
+		opl2_sin_tab[2*SIN_LEN+i] = opl2_sin_tab[i & (SIN_MASK>>1) ];
+
+		/* waveform 3:  _   _   _   _  */
+		/*             / |_/ |_/ |_/ |_*/
+		/* abs(output only first quarter of the sinus waveform) */
+
+		if (i & (1<<(SIN_BITS-2)) )
+			opl2_sin_tab[3*SIN_LEN+i] = OPL2_TL_TAB_LEN;
+		else
+			opl2_sin_tab[3*SIN_LEN+i] = opl2_sin_tab[i & (SIN_MASK>>2)];
+	}
+}
+
+static void init_opl3_tables(void)
+{
+	signed int i,x;
+
+	for (x=0; x<TL_RES_LEN; x++)
+	{
+		opl3_tl_tab[ x*2 + 0 ] = tl_entry(x);
+		opl3_tl_tab[ x*2 + 1 ] = ~opl3_tl_tab[ x*2 + 0 ]; /* this *is* different from OPL2 (verified on real YMF262) */
+
+		for (i=1; i<13; i++)
+		{
+			opl3_tl_tab[ x*2+0 + i*2*TL_RES_LEN ] =  opl3_tl_tab[ x*2+0 ]>>i;
+			opl3_tl_tab[ x*2+1 + i*2*TL_RES_LEN ] = ~opl3_tl_tab[ x*2+0 + i*2*TL_RES_LEN ];  /* this *is* different from OPL2 (verified on real YMF262) */
+		}
+	}
+
+	for (i=0; i<SIN_LEN; i++)
+		opl3_sin_tab[ i ] = sin_entry(i);
+
+	for (i=0; i<SIN_LEN; i++)
+	{
+		/* waveform 1: output only first half of the sinus waveform (positive one) */
+		if (i & (1<<(SIN_BITS-1)) )
+			opl3_sin_tab[1*SIN_LEN+i] = OPL3_TL_TAB_LEN;
+		else
+			opl3_sin_tab[1*SIN_LEN+i] = opl3_sin_tab[i];
+
+		/* waveform 2: abs(sin) */
+		opl3_sin_tab[2*SIN_LEN+i] = opl3_sin_tab[i & (SIN_MASK>>1) ];
+
+		/* waveform 3: abs(output only first quarter of the sinus waveform) */
+		if (i & (1<<(SIN_BITS-2)) )
+			opl3_sin_tab[3*SIN_LEN+i] = OPL3_TL_TAB_LEN;
+		else
+			opl3_sin_tab[3*SIN_LEN+i] = opl3_sin_tab[i & (SIN_MASK>>2)];
+
+		/* waveform 4: output whole sinus waveform in half the cycle(step=2) and output 0 on the other half of cycle */
+		if (i & (1<<(SIN_BITS-1)) )
+			opl3_sin_tab[4*SIN_LEN+i] = OPL3_TL_TAB_LEN;
+		else
+			opl3_sin_tab[4*SIN_LEN+i] = opl3_sin_tab[i*2];
+
+		/* waveform 5: output abs(whole sinus) waveform in half the cycle(step=2) and output 0 on the other half of cycle */
+		if (i & (1<<(SIN_BITS-1)) )
+			opl3_sin_tab[5*SIN_LEN+i] = OPL3_TL_TAB_LEN;
+		else
+			opl3_sin_tab[5*SIN_LEN+i] = opl3_sin_tab[(i*2) & (SIN_MASK>>1) ];
+
+		/* waveform 6: output maximum in half the cycle and output minimum on the other half of cycle */
+		if (i & (1<<(SIN_BITS-1)) )
+			opl3_sin_tab[6*SIN_LEN+i] = 1;	/* negative */
+		else
+			opl3_sin_tab[6*SIN_LEN+i] = 0;	/* positive */
+
+		/* waveform 7: output sawtooth waveform */
+		if (i & (1<<(SIN_BITS-1)) )
+			x = ((SIN_LEN-1)-i)*16 + 1;	/* negative: from 8177 to 1 */
+		else
+			x = i*16;	/*positive: from 0 to 8176 */
+
+		if (x > OPL3_TL_TAB_LEN)
+			x = OPL3_TL_TAB_LEN;	/* clip to the allowed range */
+
+		opl3_sin_tab[7*SIN_LEN+i] = x;
+	}
+}
+
+static void write_signed(FILE *f, const char *decl, const signed int *tab, int len)
+{
+	int i;
+
+	fprintf(f, "%s = {\n", decl);
+	for (i=0; i<len; i++)
+		fprintf(f, "%s%6d%s", (i % 12) ? "" : "\t", tab[i], (i == len-1) ? "\n" : ((i % 12) == 11) ? ",\n" : ",");
+	fprintf(f, "};\n\n");
+}
+
+static void write_unsigned(FILE *f, const char *decl, const unsigned int *tab, int len)
+{
+	int i;
+
+	fprintf(f, "%s = {\n", decl);
+	for (i=0; i<len; i++)
+		fprintf(f, "%s%5u%s", (i % 12) ? "" : "\t", tab[i], (i == len-1) ? "\n" : ((i % 12) == 11) ? ",\n" : ",");
+	fprintf(f, "};\n\n");
+}
+
+static int write_header(const char *fileName, const char *core, const signed int *tl_tab, int tl_len, const unsigned int *sin_tab, int sin_len)
+{
+	FILE *f;
+
+	if ((f = fopen(fileName, "w")) == NULL)
+	{
+		fprintf(stderr, "gentables: unable to create '%s'\n", fileName);
+		return 0;
+	}
+
+	fprintf(f, "/*\n**\n** File: %s - constant lookup tables for %s\n**\n", fileName, core);
+	fprintf(f, "** DO NOT EDIT: this file was generated by gentables.c\n**\n*/\n\n");
+
+	write_signed(f, "static const signed int tl_tab[TL_TAB_LEN]", tl_tab, tl_len);
+	write_unsigned(f, "static const unsigned int sin_tab[SIN_LEN * SIN_WAVEFORMS]", sin_tab, sin_len);
+
+	fclose(f);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: gentables <fmopltab.h> <ymf262tab.h>\n");
+		return 1;
+	}
+
+	init_opl2_tables();
+	init_opl3_tables();
+
+	if (!write_header(argv[1], "fmopl.c", opl2_tl_tab, OPL2_TL_TAB_LEN, opl2_sin_tab, SIN_LEN * 4))
+		return 2;
+	if (!write_header(argv[2], "ymf262.c", opl3_tl_tab, OPL3_TL_TAB_LEN, opl3_sin_tab, SIN_LEN * 8))
+		return 2;
+
+	return 0;
+}
@@ -308,6 +308,10 @@ SOURCE=.\MPU401CtlFSM.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\MPU401CtlSeq.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.cpp
 # ADD CPP /Yc"stdafx.h"
 # End Source File
@@ -337,6 +341,10 @@ SOURCE=.\MPU401CtlFSM.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\MPU401CtlSeq.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.h
 # End Source File
 # End Group
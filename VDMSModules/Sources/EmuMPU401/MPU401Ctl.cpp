@@ -39,7 +39,8 @@ STDMETHODIMP CMPU401Ctl::InterfaceSupportsErrorInfo(REFIID riid)
   {
     &IID_IVDMBasicModule,
     &IID_IIOHandler,
-    &IID_IMIDIEventHandler
+    &IID_IMIDIEventHandler,
+    &IID_IMIDITimerTelemetry
   };
   for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
   {
@@ -121,10 +122,22 @@ STDMETHODIMP CMPU401Ctl::Init(IUnknown * configuration) {
     return ce.Error();          // Propagate the error
   }
 
-  // Create the timer thread (intelligent mode)
-  m_TimerThread.Create(this, _T("MPU timer thread"), true);  /* TODO: check that creation was successful */
-  m_TimerThread.SetPriority(THREAD_PRIORITY_TIME_CRITICAL);  /* TODO: make configurable in VDMS.ini file ? */
-  // leave the timer thread suspended until the interval is set
+  // Create the timer thread (intelligent mode); it waits for the period
+  //  to be set before it starts ticking
+  m_period = 0;
+  m_isQuit = false;
+
+  if (((m_hTimer = CreateWaitableTimer(NULL, FALSE, NULL)) == NULL) ||
+      ((m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+      !m_TimerThread.Create(this, _T("MPU timer thread"), true))
+  {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not create the MPU timer thread")));
+    Destroy();
+    return E_FAIL;
+  }
+
+  m_TimerThread.SetPriority(THREAD_PRIORITY_HIGHEST);  /* TODO: make configurable in VDMS.ini file ? */
+  m_TimerThread.Resume();
 
   // put the MPU in a known state
   m_MPUFSM.reset();
@@ -139,8 +152,26 @@ STDMETHODIMP CMPU401Ctl::Destroy() {
   m_MPUFSM.reset();
 
   // Signal the timer thread to quit
-  if (m_TimerThread.GetThreadHandle() != NULL)
-    m_TimerThread.Cancel();
+  if (m_TimerThread.GetThreadHandle() != NULL) {
+    m_isQuit = true;
+    SetEvent(m_hEvent);
+
+    if (!m_TimerThread.Join(MPU_TIMER_QUIT_TIMEOUT)) {
+      // The thread may still be using the handles below; leave them be
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Timed out while waiting for the MPU timer thread to exit")));
+      return E_FAIL;
+    }
+  }
+
+  if (m_hEvent != NULL) {
+    CloseHandle(m_hEvent);
+    m_hEvent = NULL;
+  }
+
+  if (m_hTimer != NULL) {
+    CloseHandle(m_hTimer);
+    m_hTimer = NULL;
+  }
 
   // Release the MIDI-out module
   m_midiOut = NULL;
@@ -255,6 +286,30 @@ STDMETHODIMP CMPU401Ctl::HandleRealTime(LONGLONG usDelta, BYTE data) {
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// IMIDITimerTelemetry
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMPU401Ctl::GetTimerStats(LONG * numTicks, LONG * numCaughtUp, LONG * numSkipped, LONG * avgJitter, LONG * maxJitter, LONGLONG * drift, LONG * wakeLatency) {
+  if ((numTicks == NULL) || (numCaughtUp == NULL) || (numSkipped == NULL) || (avgJitter == NULL) || (maxJitter == NULL) || (drift == NULL) || (wakeLatency == NULL))
+    return E_POINTER;
+
+  timerStats_t stats;
+  ReadTimerStats(stats);
+
+  *numTicks    = stats.numTicks;
+  *numCaughtUp = stats.numCaughtUp;
+  *numSkipped  = stats.numSkipped;
+  *avgJitter   = stats.avgJitter;
+  *maxJitter   = stats.maxJitter;
+  *drift       = stats.drift;
+  *wakeLatency = stats.wakeLatency;
+
+  return S_OK;
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // IMPU401HWEmulationLayer
 /////////////////////////////////////////////////////////////////////////////
@@ -279,6 +334,12 @@ void CMPU401Ctl::logInformation(const char* message) {
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, (LPCTSTR)CString(message));
 }
 
+//
+// The messages below are stamped with the time they were completed at by
+//  the DOS program, so that stages further down the MIDI chain can keep (or
+//  reproduce) the program's timing regardless of how long it took to reach
+//  them
+//
 void CMPU401Ctl::putEvent(unsigned char status, unsigned char data1, unsigned char data2, unsigned char length) {
   if (m_midiOut == NULL)
     return;
@@ -289,9 +350,11 @@ void CMPU401Ctl::putEvent(unsigned char status, unsigned char data1, unsigned ch
   _ASSERTE(status != MIDI_EVENT_SYSTEM_EOX);
   _ASSERTE(length + 1 == MIDI_evt_len[status & 0xff]);
 
+  CSingleLock lock(&m_outMutex, TRUE);
+
   HRESULT hr;
 
-  if (FAILED(hr = m_midiOut->HandleEvent(-1, status, data1, data2, length))) {
+  if (FAILED(hr = m_midiOut->HandleEvent(TIM_GetMicros(), status, data1, data2, length))) {
     RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("HandleEvent: 0x%08x - %s"), hr, (LPCTSTR)FormatMessage(hr)));
   }
 }
@@ -302,9 +365,11 @@ void CMPU401Ctl::putSysEx(const unsigned char * data, long length) {
 
   _ASSERTE(length + 1 >= MIDI_evt_len[MIDI_EVENT_SYSTEM_SYSEX]);
 
+  CSingleLock lock(&m_outMutex, TRUE);
+
   HRESULT hr;
 
-  if (FAILED(hr = m_midiOut->HandleSysEx(-1, (BYTE*)(data), length))) {
+  if (FAILED(hr = m_midiOut->HandleSysEx(TIM_GetMicros(), (BYTE*)(data), length))) {
     RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("HandleSysEx: 0x%08x - %s"), hr, (LPCTSTR)FormatMessage(hr)));
   }
 }
@@ -315,27 +380,29 @@ void CMPU401Ctl::putRealTime(unsigned char data) {
 
   _ASSERTE(IS_REALTIME_EVENT(data));
 
+  CSingleLock lock(&m_outMutex, TRUE);
+
   HRESULT hr;
 
-  if (FAILED(hr = m_midiOut->HandleRealTime(-1, data))) {
+  if (FAILED(hr = m_midiOut->HandleRealTime(TIM_GetMicros(), data))) {
     RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("HandleRealTime: 0x%08x - %s"), hr, (LPCTSTR)FormatMessage(hr)));
   }
 }
 
 void CMPU401Ctl::setTimerPeriod(long period) {
+  if (period < 0)
+    period = 0;
+
   CSingleLock lock(&m_mutex, TRUE);
 
-  bool needs_suspend = ((m_period > 0) && (period <= 0));
-  bool needs_resume  = ((m_period <= 0) && (period > 0));
+  bool isChanged = (m_period != period);
   m_period = period;
 
   lock.Unlock();
 
-  if (needs_suspend)
-    m_TimerThread.Suspend();
-
-  if (needs_resume)
-    m_TimerThread.Resume();
+  // Wake the timer thread up, so that it reschedules the next tick
+  if (isChanged)
+    SetEvent(m_hEvent);
 }
 
 
@@ -345,29 +412,174 @@ void CMPU401Ctl::setTimerPeriod(long period) {
 /////////////////////////////////////////////////////////////////////////////
 
 unsigned int CMPU401Ctl::Run(CThread& thread) {
-  MSG message;
-
   _ASSERTE(thread.GetThreadID() == m_TimerThread.GetThreadID());
 
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MPU timer thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
 
-  do {
-    if (thread.GetMessage(&message, false)) {
-      switch (message.message) {
-        case WM_QUIT:
-          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MPU timer thread cancelled")));
-          return 0;
-        default:
-          break;
+  long period = 0;                    // the period the ticks below are scheduled with
+  LONGLONG nextTick = 0;              // when the next tick is due
+
+  timeBeginPeriod(1);                 // so that the waits below are accurate to the millisecond
+
+  while (!m_isQuit) {
+    CSingleLock lock(&m_mutex, TRUE);
+    long newPeriod = m_period;
+    lock.Unlock();
+
+    if (newPeriod != period) {
+      if (period <= 0) {
+        // Started: the first tick is one period away
+        ResetTimerStats();
+        nextTick = TIM_GetMicros() + newPeriod;
+      } else if (newPeriod > 0) {
+        // Changed: the tick under way keeps its start, and takes the new length
+        nextTick += newPeriod - period;
+      } else {
+        // Stopped
+        LogTimerStats();
       }
-    } else {
-      CSingleLock lock(&m_mutex, TRUE);
-      long period = m_period;
-      lock.Unlock();
 
-      Sleep((DWORD)period);
+      period = newPeriod;
+    }
+
+    if (period <= 0) {
+      WaitForSingleObject(m_hEvent, INFINITE);
+      continue;
+    }
+
+    // Sleep while there is plenty of time left, asking to be woken up
+    //  early by how late the OS usually is, then poll the clock for what is
+    //  left (if the OS did wake the thread up early enough)
+    LONGLONG wakeTime = nextTick - m_wakeLatency;
+
+    if (TIM_GetMicros() < wakeTime) {
+      SleepUntil(wakeTime);
+      continue;                       // the period may have changed meanwhile
+    }
+
+    LONGLONG now;
+
+    while ((now = TIM_GetMicros()) < nextTick)
+      Sleep(0);
+
+    // Deliver the tick that is due, along with any that were missed (up to
+    //  a point; past that, ticks are skipped and the timer drifts)
+    LONGLONG late = now - nextTick;
+    LONG numDue = (LONG)(late / period) + 1;
+
+    CSingleLock statsLock(&m_statsMutex, TRUE);
+
+    if (numDue > MPU_TIMER_MAXCATCHUP) {
+      m_numSkipped += numDue - MPU_TIMER_MAXCATCHUP;
+      m_drift += (LONGLONG)(numDue - MPU_TIMER_MAXCATCHUP) * period;
+      nextTick += (LONGLONG)(numDue - MPU_TIMER_MAXCATCHUP) * period;
+      numDue = MPU_TIMER_MAXCATCHUP;
+    }
+
+    m_numTicks += numDue;
+    m_numCaughtUp += numDue - 1;
+    m_sumJitter += late;
+    m_maxJitter = max(m_maxJitter, late);
+
+    statsLock.Unlock();
 
+    for (LONG i = 0; i < numDue; i++) {
       m_MPUFSM.timerExpired();
+      nextTick += period;
     }
-  } while (true);
+  }
+
+  timeEndPeriod(1);
+
+  if (period > 0)
+    LogTimerStats();
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MPU timer thread cancelled")));
+
+  return 0;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Utility functions
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Sleeps on the waitable timer until the given time, or until the period
+//  changes; keeps track of how late the OS wakes the thread up, so that
+//  the thread can ask to be woken up that much earlier next time
+//
+void CMPU401Ctl::SleepUntil(LONGLONG wakeTime) {
+  LONGLONG timeLeft = wakeTime - TIM_GetMicros();
+
+  if (timeLeft <= 0)
+    return;
+
+  LARGE_INTEGER dueTime;
+  dueTime.QuadPart = -timeLeft * 10;  // relative, in 100ns units (a positive value would be an absolute time)
+
+  if (!SetWaitableTimer(m_hTimer, &dueTime, 0, NULL, NULL, FALSE)) {
+    WaitForSingleObject(m_hEvent, (DWORD)(-dueTime.QuadPart / 10000));
+    return;
+  }
+
+  HANDLE handles[] = { m_hEvent, m_hTimer };
+
+  if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+    return;
+
+  LONGLONG oversleep = TIM_GetMicros() - wakeTime;
+
+  if (oversleep < 0)
+    oversleep = 0;
+
+  if (oversleep > MPU_TIMER_MAXLATENCY)
+    oversleep = MPU_TIMER_MAXLATENCY;
+
+  CSingleLock lock(&m_statsMutex, TRUE);
+
+  // Adapt quickly when the OS gets slower, slowly when it gets faster
+  if (oversleep > m_wakeLatency) {
+    m_wakeLatency = (LONG)oversleep;
+  } else {
+    m_wakeLatency -= (m_wakeLatency - (LONG)oversleep) / 16;
+  }
+}
+
+void CMPU401Ctl::ResetTimerStats(void) {
+  CSingleLock lock(&m_statsMutex, TRUE);
+
+  m_numTicks = m_numCaughtUp = m_numSkipped = 0;
+  m_sumJitter = m_maxJitter = m_drift = 0;
+}
+
+void CMPU401Ctl::LogTimerStats(void) {
+  timerStats_t stats;
+  ReadTimerStats(stats);
+
+  if (stats.numTicks <= 0)
+    return;
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MPU timer delivered %d tick(s), late by %d.%03dms on average and by up to %d.%03dms; %d tick(s) delivered back to back"), stats.numTicks, stats.avgJitter / 1000, stats.avgJitter % 1000, stats.maxJitter / 1000, stats.maxJitter % 1000, stats.numCaughtUp));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MPU timer woke up %d.%03dms early to make up for the OS's wake-up latency"), stats.wakeLatency / 1000, stats.wakeLatency % 1000));
+
+  if (stats.numSkipped > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("MPU timer fell behind and skipped %d tick(s), drifting by %d.%03dms"), stats.numSkipped, (int)(stats.drift / 1000), (int)(stats.drift % 1000)));
+}
+
+//
+// Retrieves how well the MPU timer kept time since it was last started
+//  (may be called from any thread, while the timer runs)
+//
+void CMPU401Ctl::ReadTimerStats(timerStats_t& stats) {
+  CSingleLock lock(&m_statsMutex, TRUE);
+
+  stats.numTicks    = m_numTicks;
+  stats.numCaughtUp = m_numCaughtUp;
+  stats.numSkipped  = m_numSkipped;
+  stats.avgJitter   = (m_numTicks > 0) ? (LONG)(m_sumJitter / m_numTicks) : 0;
+  stats.maxJitter   = (LONG)m_maxJitter;
+  stats.drift       = m_drift;
+  stats.wakeLatency = m_wakeLatency;
 }
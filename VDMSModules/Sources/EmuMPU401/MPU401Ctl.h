@@ -19,6 +19,12 @@
 
 #include "MPU401CtlFSM.h"
 
+/////////////////////////////////////////////////////////////////////////////
+
+#define MPU_TIMER_MAXLATENCY    1000  // most the timer thread wakes up early (in microseconds) to make up for how late the OS wakes it up; it polls the clock for that stretch
+#define MPU_TIMER_MAXCATCHUP    8     // most ticks delivered back to back when the timer falls behind; ticks older than that are skipped
+#define MPU_TIMER_QUIT_TIMEOUT  1000  // how long to wait for the timer thread to exit
+
 /////////////////////////////////////////////////////////////////////////////
 // CMPU401Ctl
 class ATL_NO_VTABLE CMPU401Ctl : 
@@ -29,11 +35,13 @@ class ATL_NO_VTABLE CMPU401Ctl :
   public ISupportErrorInfo,
   public IVDMBasicModule,
   public IIOHandler,
-  public IMIDIEventHandler
+  public IMIDIEventHandler,
+  public IMIDITimerTelemetry
 {
 public:
   CMPU401Ctl()
-    : m_MPUFSM(this), m_period(0)
+    : m_MPUFSM(this), m_period(0), m_hTimer(NULL), m_hEvent(NULL), m_isQuit(false),
+      m_wakeLatency(MPU_TIMER_MAXLATENCY / 2), m_numTicks(0), m_numCaughtUp(0), m_numSkipped(0), m_sumJitter(0), m_maxJitter(0), m_drift(0)
     { }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_MPU401CTL)
@@ -46,6 +54,7 @@ BEGIN_COM_MAP(CMPU401Ctl)
   COM_INTERFACE_ENTRY(IVDMBasicModule)
   COM_INTERFACE_ENTRY(IIOHandler)
   COM_INTERFACE_ENTRY(IMIDIEventHandler)
+  COM_INTERFACE_ENTRY(IMIDITimerTelemetry)
 END_COM_MAP()
 
 // IMPU401HWEmulationLayer
@@ -89,8 +98,33 @@ public:
   STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE * data, LONG length);
   STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data);
 
+// IMIDITimerTelemetry
+public:
+  STDMETHOD(GetTimerStats)(LONG * numTicks, LONG * numCaughtUp, LONG * numSkipped, LONG * avgJitter, LONG * maxJitter, LONGLONG * drift, LONG * wakeLatency);
+
 /////////////////////////////////////////////////////////////////////////////
 
+// Utility functions
+protected:
+  //
+  // How well the MPU timer kept time since it was last started (see
+  //  IMIDITimerTelemetry)
+  //
+  typedef struct {
+    LONG numTicks;
+    LONG numCaughtUp;
+    LONG numSkipped;
+    LONG avgJitter;
+    LONG maxJitter;
+    LONGLONG drift;
+    LONG wakeLatency;
+  } timerStats_t;
+
+  void SleepUntil(LONGLONG wakeTime);
+  void ReadTimerStats(timerStats_t& stats);
+  void ResetTimerStats(void);
+  void LogTimerStats(void);
+
 // Module's settings
 protected:
   int m_basePort;
@@ -98,9 +132,37 @@ protected:
 
 // Other member variables
 protected:
+  //
+  // The MPU timer ticks at absolute times (see TIM_GetMicros), each one
+  //  period after the previous one was due rather than after it was
+  //  delivered, so that the time it takes to wake up and deliver a tick
+  //  never adds up.  The timer thread sleeps on a waitable timer (at the
+  //  1ms resolution set with timeBeginPeriod), asking to be woken up
+  //  early by how late the OS has recently woken it up (at most
+  //  MPU_TIMER_MAXLATENCY), then polls the clock for whatever is left;
+  //  ticks it wakes up too late for are delivered back to back.
+  //
   CThread m_TimerThread;
-  CCriticalSection m_mutex;
-  long m_period;
+  CCriticalSection m_mutex;           // regulates access to m_period
+  long m_period;                      // microseconds between ticks, 0 = timer stopped
+  HANDLE m_hTimer;                    // waitable timer the timer thread sleeps on
+  HANDLE m_hEvent;                    // signalled when the period changes (or when quitting)
+  volatile bool m_isQuit;
+
+  // Kept by the timer thread (see timerStats_t)
+  CCriticalSection m_statsMutex;      // regulates access to the statistics below
+  LONG m_wakeLatency;                 // how late (in microseconds) the OS usually wakes the timer thread up
+  LONG m_numTicks;
+  LONG m_numCaughtUp;
+  LONG m_numSkipped;
+  LONGLONG m_sumJitter;               // how late (in microseconds) ticks were delivered, in total
+  LONGLONG m_maxJitter;
+  LONGLONG m_drift;
+
+  // MIDI goes out from the emulated CPU's thread (UART mode, requests to
+  //  send data) and from the timer thread (the sequencer's tracks), while
+  //  the modules down the MIDI chain expect a single caller at a time
+  CCriticalSection m_outMutex;        // serializes the calls to m_midiOut
 
 // Platform-independent classes
 protected:
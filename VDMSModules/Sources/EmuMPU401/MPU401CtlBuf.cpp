@@ -11,9 +11,15 @@
 /////////////////////////////////////////////////////////////////////////////
 
 CMIDIInputBuffer::CMIDIInputBuffer(IMPU401HWEmulationLayer* hwemu)
-  : m_buf_len(0), m_buf_pos(0), m_IRQPending(false), m_hwemu(hwemu)
+  : m_numMessages(0), m_lastByte(0), m_IRQPending(0), m_hwemu(hwemu)
 {
   _ASSERTE(m_hwemu != NULL);
+
+  for (int i = 0; i < MIDI_MSG_SLOTS; i++)
+    m_messages[i] = 0;
+
+  m_replies.Create(MIDI_REPLY_BUF_LEN);
+  m_midiData.Create(MIDI_BUF_LEN);
 }
 
 CMIDIInputBuffer::~CMIDIInputBuffer(void)
@@ -22,80 +28,148 @@ CMIDIInputBuffer::~CMIDIInputBuffer(void)
 
 void CMIDIInputBuffer::putEvent(unsigned char status, unsigned char data1, unsigned char data2, unsigned char length) {
   // TODO: check if "recording" first
-  putByte(status);
-  if (length >= 1) putByte(data1);
-  if (length >= 2) putByte(data2);
+  unsigned char event[3] = { status, data1, data2 };
+  putMIDIData(event, 1 + min(length, 2));
 }
 
 void CMIDIInputBuffer::putSysEx(const unsigned char * data, long length) {
   // TODO: check if "recording" first
-  putByte(MIDI_EVENT_SYSTEM_SYSEX);
-  for (int i = 0; i < length; i++) putByte(data[i]);
-  putByte(MIDI_EVENT_SYSTEM_EOX);
+  if (m_midiData.GetFree() < length + 2) {
+    std::ostringstream oss;
+    oss << std::setbase(10) << "MIDI-in buffer is full (" << m_midiData.GetUsed() << "  bytes), discarding " << (length + 2) << "-byte SysEx.";
+    m_hwemu->logError(oss.str().c_str());
+    return;
+  }
+
+  unsigned char sysEx = MIDI_EVENT_SYSTEM_SYSEX, eox = MIDI_EVENT_SYSTEM_EOX;
+
+  // The message goes in whole before the IRQ is raised
+  m_midiData.Write(&sysEx, 1);
+  m_midiData.Write(data, length);
+  putMIDIData(&eox, 1);
 }
 
 void CMIDIInputBuffer::putRealTime(unsigned char data) {
   // TODO: check if "recording" first
-  putByte(data);
+  putMIDIData(&data, 1);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// Flushes the FIFO (emulated CPU's thread); the data is read out, as the
+//  MIDI-in side may be putting more in at the same time
+//
 void CMIDIInputBuffer::reset(void) {
-  m_mutex.Lock();
+  unsigned char discard[MIDI_BUF_LEN];
 
-  m_buf_len = 0;                    // flush the buffer
+  while (m_replies.Read(discard, (LONG)sizeof(discard)) > 0);
+  while (m_midiData.Read(discard, (LONG)sizeof(discard)) > 0);
 
-  // do *not* clear any pending interrupts
+  for (int i = 0; i < MIDI_MSG_SLOTS; i++) {
+    if (InterlockedExchange((LPLONG)&m_messages[i], 0) != 0)
+      InterlockedDecrement((LPLONG)&m_numMessages);
+  }
 
-  m_mutex.Unlock();
+  // do *not* clear any pending interrupts
 }
 
+//
+// Puts in a reply to a command (emulated CPU's thread)
+//
 void CMIDIInputBuffer::putByte(unsigned char data) {
-  m_mutex.Lock();
-
-  if (m_buf_len < MIDI_BUF_LEN) {
-    m_buf[(m_buf_pos + m_buf_len) % MIDI_BUF_LEN] = data;
-    m_buf_len = (m_buf_len + 1) % (MIDI_BUF_LEN + 1);
-
-    if (!m_IRQPending) {
-      m_hwemu->generateInterrupt();
-      m_IRQPending = true;
-    }
-  } else {
+  if (m_replies.Write(&data, 1) < 1) {
     std::ostringstream oss;
-    oss << std::setbase(10) << "MIDI-in buffer is full (" << m_buf_len << "  bytes), discarding data.";
+    oss << std::setbase(10) << "MIDI-in buffer is full (" << m_replies.GetUsed() << "  bytes of replies), discarding data.";
     m_hwemu->logError(oss.str().c_str());
+    return;
   }
 
-  m_mutex.Unlock();
+  raiseIRQ();
 }
 
-bool CMIDIInputBuffer::getByte(unsigned char* data) {
-  bool retVal = true;
+//
+// Puts in a message from the sequencer (any thread), in the given slot;
+//  the IRQ is only raised by flushMessages, so that messages put in
+//  together are signalled together
+//
+void CMIDIInputBuffer::putMessage(int slot, unsigned char message) {
+  _ASSERTE((slot >= 0) && (slot < MIDI_MSG_SLOTS));
+  _ASSERTE(message != 0);
 
-  m_mutex.Lock();
+  if (InterlockedExchange((LPLONG)&m_messages[slot], message) == 0)
+    InterlockedIncrement((LPLONG)&m_numMessages);
+}
 
-  m_IRQPending = false;           // reading this byte acknowledges the last IRQ (if any)
-  *data = m_buf[m_buf_pos];       // read the data byte at the head of the queue
+//
+// Raises an IRQ if there are sequencer messages waiting to be read
+//
+void CMIDIInputBuffer::flushMessages(void) {
+  if (m_numMessages > 0)
+    raiseIRQ();
+}
+
+//
+// Reads a byte out (emulated CPU's thread); returns false if the FIFO was
+//  empty, in which case data is set to the last byte read.  If the byte is
+//  a sequencer message, slot (if given) is set to the message's slot, and
+//  to -1 otherwise.
+//
+bool CMIDIInputBuffer::getByte(unsigned char* data, int* slot) {
+  InterlockedExchange((LPLONG)&m_IRQPending, 0);  // reading this byte acknowledges the last IRQ (if any)
+
+  bool retVal = (m_replies.Read(&m_lastByte, 1) > 0);
+  int messageSlot = -1;
 
-  if (m_buf_len > 1) {            // more than one data byte was waiting in the queue
-    m_buf_len--;
-    m_buf_pos = (m_buf_pos + 1) % MIDI_BUF_LEN;
+  for (int i = 0; !retVal && (m_numMessages > 0) && (i < MIDI_MSG_SLOTS); i++) {
+    LONG message = InterlockedExchange((LPLONG)&m_messages[i], 0);
 
-    m_hwemu->generateInterrupt(); // signal that additional data bytes are waiting in the queue
-    m_IRQPending = true;
-  } else if (m_buf_len > 0) {     // exactly one data byte was waiting in the queue
-    m_buf_len = 0;                // no need to advance queue head now; keep it where it is so that "undeflow" reads always return the last value.
-  } else {                        // the queue was empty
-    retVal = false;
+    if (message != 0) {
+      InterlockedDecrement((LPLONG)&m_numMessages);
+      m_lastByte = (unsigned char)message;
+      messageSlot = i;
+      retVal = true;
+    }
   }
 
-  m_mutex.Unlock();
+  if (!retVal)
+    retVal = (m_midiData.Read(&m_lastByte, 1) > 0);
+
+  if (slot != NULL)
+    *slot = messageSlot;
+
+  *data = m_lastByte;
+
+  if (!isEmpty())
+    raiseIRQ();                     // signal that additional data bytes are waiting in the queue
 
   return retVal;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+void CMIDIInputBuffer::putMIDIData(const unsigned char* data, long length) {
+  long numWritten = m_midiData.Write(data, length);
+
+  if (numWritten > 0)
+    raiseIRQ();
+
+  if (numWritten < length) {
+    std::ostringstream oss;
+    oss << std::setbase(10) << "MIDI-in buffer is full (" << m_midiData.GetUsed() << "  bytes), discarding data.";
+    m_hwemu->logError(oss.str().c_str());
+  }
+}
+
+//
+// Raises an IRQ, unless one was raised already and the emulated CPU did not
+//  read any data since
+//
+void CMIDIInputBuffer::raiseIRQ(void) {
+  if (InterlockedExchange((LPLONG)&m_IRQPending, 1) == 0)
+    m_hwemu->generateInterrupt();
+}
+
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1,12 +1,20 @@
 #ifndef __MPU401CTLBUF_H_
 #define __MPU401CTLBUF_H_
 
+#include <SPSCRing.h>
 #include <Thread.h>
 
 /* TODO: give the max. buffer length as a .INI setting */
 // Individual size of the IN/OUT MIDI buffers
 #define MIDI_BUF_LEN 256
 
+// Room for replies to commands (in the in-bound FIFO)
+#define MIDI_REPLY_BUF_LEN 16
+
+// How many kinds of messages the MPU's sequencer can have waiting for the
+//  host at one time (see CMIDIInputBuffer::putMessage)
+#define MIDI_MSG_SLOTS 16
+
 //
 // This interface can receive MIDI messages, either for storage (in the case
 //  of an in-bound FIFO, where MIDI messages are stored and will later be
@@ -34,11 +42,21 @@ class IMPU401HWEmulationLayer
     virtual void logError(const char* message) = 0;
     virtual void logWarning(const char* message) = 0;
     virtual void logInformation(const char* message) = 0;
-    virtual void setTimerPeriod(long period) = 0;
+    virtual void setTimerPeriod(long period) = 0;   // in microseconds, 0 stops the timer
 };
 
 //
-//
+// The MPU-401's in-bound FIFO.  MIDI data is put in by the MIDI-in side
+//  (putEvent, putSysEx, putRealTime; one thread at a time), while replies to
+//  commands are put in (putByte) and everything is read out (getByte) by the
+//  emulated CPU's thread.  The two kinds of data are kept in lock-free
+//  queues of their own, so neither side ever waits on the other; replies
+//  are read out ahead of any MIDI data still waiting.
+// Messages from the sequencer (track data requests, clock to host, etc.)
+//  may be put in from any thread (putMessage), each in a slot of its own
+//  (a message already waiting in its slot is not repeated); they are read
+//  out after the replies, and are signalled with a single IRQ for all the
+//  messages put in at once (flushMessages).
 //
 class CMIDIInputBuffer
   : public IMPU401MIDIConsumer
@@ -55,19 +73,26 @@ class CMIDIInputBuffer
   public:
     void reset(void);
     void putByte(unsigned char data);
-    bool getByte(unsigned char* data);
+    void putMessage(int slot, unsigned char message);
+    void flushMessages(void);
+    bool getByte(unsigned char* data, int* slot = NULL);
 
     inline bool isEmpty(void)
-      { return m_buf_len < 1; }
+      { return (m_replies.GetUsed() < 1) && (m_numMessages < 1) && (m_midiData.GetUsed() < 1); }
     inline bool isFull(void)
-      { return (m_buf_len >= MIDI_BUF_LEN); }
+      { return (m_midiData.GetFree() < 1); }
+
+  protected:
+    void putMIDIData(const unsigned char* data, long length);
+    void raiseIRQ(void);
 
   protected:
-    CCriticalSection m_mutex;
-    unsigned char m_buf[MIDI_BUF_LEN];
-    unsigned long m_buf_len;
-    unsigned long m_buf_pos;
-    bool m_IRQPending;
+    CSPSCRing m_replies;            // replies to commands (emulated CPU's thread only)
+    CSPSCRing m_midiData;           // MIDI data (MIDI-in side to emulated CPU's thread)
+    volatile LONG m_messages[MIDI_MSG_SLOTS];  // sequencer messages waiting to be read (0 = none)
+    volatile LONG m_numMessages;    // how many of the slots above are in use
+    unsigned char m_lastByte;       // the last byte read (what reading from an empty FIFO returns)
+    volatile LONG m_IRQPending;
 
   protected:
     IMPU401HWEmulationLayer* m_hwemu;
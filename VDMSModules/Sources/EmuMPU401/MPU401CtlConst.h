@@ -102,7 +102,7 @@
 #define CMD_RELATIVE_TEMPO_GRADUATION       0xe2
 #define CMD_MIDI_METRONOME                  0xe4
 #define CMD_MEASURE_LENGTH                  0xe6
-#define CMD_INTERNAL_CLOCK_LENGTH_TO_HOST        /* ? */
+#define CMD_INTERNAL_CLOCK_LENGTH_TO_HOST   0xe7
 #define CMD_ACTIVE_TRACK_MASK               0xec
 #define CMD_SEND_PLAY_COUNTER_MASK          0xed
 #define CMD_MIDI_CHANNEL_MASK_LO            0xee
@@ -126,6 +126,23 @@
 // Messages
 /////////////////////////////////////////////////////////////////////////////
 
+#define MSG_TRACK_DATA_REQUEST              0xf0 /* + track #! */
+#define MSG_TIMING_OVERFLOW                 0xf8
+#define MSG_CONDUCTOR_REQUEST               0xf9
+#define MSG_ALL_END                         0xfc
+#define MSG_CLOCK_TO_HOST                   0xfd
 #define MSG_CMD_ACK                         0xfe
 
+
+/////////////////////////////////////////////////////////////////////////////
+// Track data (sent by the host in answer to a data request)
+/////////////////////////////////////////////////////////////////////////////
+
+#define MARK_TIMING_OVERFLOW                0xf8 /* in place of a timing byte: wait MPU_TIMING_OVERFLOW clocks */
+#define MARK_NO_OPERATION                   0xf8
+#define MARK_MEASURE_END                    0xf9
+#define MARK_DATA_END                       0xfc
+
+#define MPU_TIMING_OVERFLOW                 240  /* clocks */
+
 #endif //__MPU401CTLCONST_H_
@@ -4,7 +4,7 @@
 #include "MPU401CtlConst.h"
 
 CMPU401CtlFSM::CMPU401CtlFSM(IMPU401HWEmulationLayer* hwemu)
-  : m_mode(M_INTELLIGENT), m_hwemu(hwemu), m_inBuf(hwemu), m_outBuf(hwemu)
+  : m_mode(M_INTELLIGENT), m_hwemu(hwemu), m_inBuf(hwemu), m_outBuf(hwemu), m_seq(hwemu, &m_inBuf)
 {
   _ASSERTE(m_hwemu != NULL);
 }
@@ -23,6 +23,7 @@ CMPU401CtlFSM::~CMPU401CtlFSM(void)
 void CMPU401CtlFSM::reset(void) {
   m_inBuf.reset();                  // flush the input buffer //TODO: it appears that the real MPU-401 (LAPC-I) does not flush this buffer when RESET is sent
   m_outBuf.reset();                 // flush the output buffer
+  m_seq.reset();                    // stop playing
 }
 
 //
@@ -31,13 +32,13 @@ void CMPU401CtlFSM::reset(void) {
 void CMPU401CtlFSM::putCommand(
     char command)
 {
-  int base = 0;
   std::ostringstream oss;
 
   switch (command & 0xff) {
     // REQUEST to switch to UART mode
     case CMD_UART_MODE:
       m_hwemu->logInformation("MPU-401 Switched to UART mode");
+      m_seq.reset();                // stop playing
       m_mode = M_UART;              // switched to UART mode
       m_inBuf.putByte(MSG_CMD_ACK); // acknowledge command
       return;
@@ -64,32 +65,17 @@ void CMPU401CtlFSM::putCommand(
       m_inBuf.putByte(0x01);        // revision number
       return;
 
-    case CMD_INT_CLOCK:
-      m_hwemu->logInformation("MPU-401 internal clock select");
-      m_inBuf.putByte(MSG_CMD_ACK); // acknowledge command
-      return;
-
-    case CMD_TIMEBASE_48:
-    case CMD_TIMEBASE_72:
-    case CMD_TIMEBASE_96:
-    case CMD_TIMEBASE_120:
-    case CMD_TIMEBASE_144:
-    case CMD_TIMEBASE_168:
-    case CMD_TIMEBASE_192:
-      base = ((command & 0xff) - CMD_TIMEBASE_48) * 24 + 48;
-      oss << "MPU-401 timebase select (" << base << " \?\?\?)";
-      m_hwemu->logInformation(oss.str().c_str());
-      m_inBuf.putByte(MSG_CMD_ACK); // acknowledge command
-//      m_hwemu->setTimerPeriod(1000 / base);
-      return;
-
 #endif
 
-    // Illegal or unsupported command
+    // Sequencer command (intelligent mode), or illegal or unsupported command
     default:
+      m_inBuf.putByte(MSG_CMD_ACK); // acknowledge command (ahead of any data the command returns)
+
+      if ((m_mode == M_INTELLIGENT) && m_seq.putCommand((unsigned char)command))
+        return;
+
       oss << std::setbase(16) << "Illegal or unsupported MPU-401 command (0x" << (command & 0xff) << ", " << (m_mode == M_UART ? "UART" : m_mode == M_INTELLIGENT ? "intelligent" : "<unknown>") << " mode), faking acknowledge";
       m_hwemu->logError(oss.str().c_str());
-      m_inBuf.putByte(MSG_CMD_ACK); // acknowledge command
       return;
   }
 }
@@ -107,6 +93,9 @@ char CMPU401CtlFSM::getStatus(void) {
 void CMPU401CtlFSM::putData(
     char data)
 {
+  if ((m_mode == M_INTELLIGENT) && m_seq.putData((unsigned char)data))
+    return;                         // track data, or a command's data byte
+
   m_outBuf.putByte(data);           // Transmit the data on to the MIDI device
 }
 
@@ -115,11 +104,15 @@ void CMPU401CtlFSM::putData(
 //
 char CMPU401CtlFSM::getData(void) {
   BYTE data = MSG_CMD_ACK;
+  int slot = -1;
 
-  if (!m_inBuf.getByte(&data)) {    // Input (buffered) data from the MIDI device
+  if (!m_inBuf.getByte(&data, &slot)) { // Input (buffered) data from the MIDI device
     m_hwemu->logError("Attempted to read from empty MPU-401 inbound FIFO");
   }
 
+  if (slot >= 0)
+    m_seq.messageRead(slot);        // the host may now answer the sequencer's request
+
   return data;
 }
 
@@ -127,7 +120,5 @@ char CMPU401CtlFSM::getData(void) {
 // Called when the MPU timer expires
 //
 void CMPU401CtlFSM::timerExpired(void) {
-#if 0 /* doesn't fix Legend games, and wouldn't want to break other games (yet) */
-  m_inBuf.putByte(CMD_TIMING_OVERFLOW);
-#endif
+  m_seq.timerExpired();
 }
@@ -2,6 +2,7 @@
 #define __MPU401CTLFSM_H_
 
 #include "MPU401CtlBuf.h"
+#include "MPU401CtlSeq.h"
 
 //
 // This class implements the finite state machine logic behind the MPU-401
@@ -42,6 +43,7 @@ class CMPU401CtlFSM
     IMPU401HWEmulationLayer* m_hwemu;
     CMIDIInputBuffer m_inBuf;
     CMIDIOutputBuffer m_outBuf;
+    CMPU401Sequencer m_seq;         // intelligent mode only
 };
 
 #endif //__MPU401CTLFSM_H_
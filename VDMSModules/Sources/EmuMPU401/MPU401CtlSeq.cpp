@@ -0,0 +1,644 @@
+#include "stdafx.h"
+
+#include "MPU401CtlSeq.h"
+#include "MPU401CtlConst.h"
+
+#include "MIDIConst.h"
+
+CMPU401Sequencer::CMPU401Sequencer(IMPU401HWEmulationLayer* hwemu, CMIDIInputBuffer* inBuf)
+  : m_timerPeriod(0), m_hwemu(hwemu), m_inBuf(inBuf)
+{
+  _ASSERTE(m_hwemu != NULL);
+  _ASSERTE(m_inBuf != NULL);
+
+  init();
+}
+
+CMPU401Sequencer::~CMPU401Sequencer(void)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+//
+// Stops playing and puts the sequencer back in its power-up state
+//
+void CMPU401Sequencer::reset(void) {
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_isPlaying)
+    allNotesOff();
+
+  init();
+  updateTimer();
+}
+
+//
+// Called when a command byte is output to the MPU-401's command/status port
+//  (in intelligent mode), after the command was acknowledged; returns false
+//  if the command is not a sequencer command
+//
+bool CMPU401Sequencer::putCommand(
+    unsigned char command)
+{
+  CSingleLock lock(&m_mutex, TRUE);
+
+  std::ostringstream oss;
+
+  // Start/stop commands
+  if (command < CMD_DISABLE_ALL_NOTES_OFF) {
+    startStop(command);
+    return true;
+  }
+
+  // Commands that take a data byte (sent next on the data port)
+  if ((command >= CMD_SET_TEMPO) && (command <= CMD_MIDI_CHANNEL_MASK_HI)) {
+    m_pendingCommand = command;
+    return true;
+  }
+
+  // Requests to send a MIDI message (or a system message) right away: the
+  //  message follows on the data port, and goes out as is; the track the
+  //  host was sending an event for (if any) gets the data after it
+  if (((command >= CMD_REQUEST_TO_SEND_DATA) && (command < CMD_REQUEST_TO_SEND_DATA + MPU_NUM_TRACKS)) ||
+      (command == CMD_REQUEST_TO_SEND_SYSTEM_MSG))
+  {
+    if (!m_isSendingMessage)
+      m_savedDataSlot = m_dataSlot;
+
+    m_isSendingMessage = true;
+    m_messageLength = m_messageReceived = 0;
+    m_dataSlot = -1;
+    return true;
+  }
+
+  // Requests for a track's play counter
+  if ((command >= CMD_REQUEST_PLAY_COUNTER) && (command < CMD_REQUEST_PLAY_COUNTER + MPU_NUM_TRACKS)) {
+    m_inBuf->putByte((unsigned char)min(m_tracks[command - CMD_REQUEST_PLAY_COUNTER].elapsed, MPU_TIMING_OVERFLOW - 1));
+    return true;
+  }
+
+  switch (command) {
+    case CMD_DISABLE_ALL_NOTES_OFF:
+      m_isAllNotesOff = false;
+      return true;
+
+    case CMD_DISABLE_REAL_TIME_OUT:
+      m_isRealTimeOut = false;
+      return true;
+
+    case CMD_CONDUCTOR_OFF:
+      m_isConductorOn = false;
+      return true;
+
+    case CMD_CONDUCTOR_ON:
+      m_isConductorOn = true;
+      return true;
+
+    case CMD_CLOCK_TO_HOST_OFF:
+      m_isClockToHost = false;
+      updateTimer();
+      return true;
+
+    case CMD_CLOCK_TO_HOST_ON:
+      m_isClockToHost = true;
+      m_clockToHostCount = 0;
+      updateTimer();
+      return true;
+
+    case CMD_TIMEBASE_48:
+    case CMD_TIMEBASE_72:
+    case CMD_TIMEBASE_96:
+    case CMD_TIMEBASE_120:
+    case CMD_TIMEBASE_144:
+    case CMD_TIMEBASE_168:
+    case CMD_TIMEBASE_192:
+      m_timebase = (command - CMD_TIMEBASE_48) * 24 + 48;
+      oss << "MPU-401 timebase select (" << m_timebase << " clocks per beat)";
+      m_hwemu->logInformation(oss.str().c_str());
+      updateTimer();
+      return true;
+
+    case CMD_RESET_RELATIVE_TEMPO:
+      m_relativeTempo = 0x40;
+      updateTimer();
+      return true;
+
+    case CMD_REQUEST_TEMPO:
+      m_inBuf->putByte((unsigned char)m_tempo);
+      return true;
+
+    case CMD_REQUEST_AND_CLEAR_PLAY_COUNTER:
+      m_inBuf->putByte(0x00);       // nothing is recorded
+      return true;
+
+    case CMD_CLEAR_PLAY_COUNTERS:
+      {
+        for (int i = 0; i <= MPU_NUM_TRACKS; i++)
+          m_tracks[i].elapsed = m_tracks[i].counter = 0;
+      }
+      return true;
+
+    case CMD_CLEAR_PLAY_MAP:
+      allNotesOff();
+      clearTracks();
+      return true;
+
+    case CMD_FSK_CLOCK:
+    case CMD_MIDI_CLOCK:
+      m_hwemu->logWarning("MPU-401 external clock select, using the internal clock instead");
+      return true;
+
+    // Switches that only matter to recording, to MIDI-in, to the metronome
+    //  or to external clocks, none of which are emulated
+    case CMD_TIMING_BYTE_ALWAYS:
+    case CMD_MODE_MESS_ON:
+    case CMD_EXCLUSIVE_THRU_ON:
+    case CMD_COMMON_TO_HOST_ON:
+    case CMD_REAL_TIME_TO_HOST_ON:
+    case CMD_INT_CLOCK:
+    case CMD_METRONOME_ON:
+    case CMD_METRONOME_OFF:
+    case CMD_METRONOME_W_ACCENTS:
+    case CMD_BENDER_OFF:
+    case CMD_BENDER_ON:
+    case CMD_MIDI_THRU_OFF:
+    case CMD_MIDI_THRU_ON:
+    case CMD_DATA_IN_STOP_MODE_OFF:
+    case CMD_DATA_IN_STOP_MODE_ON:
+    case CMD_SEND_MEASURE_END_OFF:
+    case CMD_SEND_MEASURE_END_ON:
+    case CMD_REAL_TIME_AFFECTION_OFF:
+    case CMD_REAL_TIME_AFFECTION_ON:
+    case CMD_FSK_TO_INTERNAL:
+    case CMD_FSK_TO_MIDI:
+    case CMD_EXCLUSIVE_TO_HOST_OFF:
+    case CMD_EXCLUSIVE_TO_HOST_ON:
+    case CMD_CLEAR_RECORD_COUNTER:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+//
+// Called when a data byte is output to the MPU-401's data port (in
+//  intelligent mode); returns false if the byte is not meant for the
+//  sequencer (it is then plain MIDI data)
+//
+bool CMPU401Sequencer::putData(
+    unsigned char data)
+{
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_pendingCommand != 0) {
+    setParameter(m_pendingCommand, data);
+    m_pendingCommand = 0;
+    return true;
+  }
+
+  if (m_isSendingMessage) {
+    putMessageData(data);
+    return false;                   // the message goes out as is
+  }
+
+  if (m_dataSlot < 0)
+    return false;
+
+  putTrackData(m_dataSlot, data);
+  m_inBuf->flushMessages();         // in case the event played right away, and the next one is requested
+
+  return true;
+}
+
+//
+// Called when the host read one of the sequencer's messages; if it was a
+//  data request, the data that follows answers it
+//
+void CMPU401Sequencer::messageRead(
+    int slot)
+{
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if ((slot < 0) || (slot > MPU_SLOT_CONDUCTOR) || (m_tracks[slot].state != TS_WAITING))
+    return;
+
+  if (m_isSendingMessage) {
+    m_savedDataSlot = slot;         // once the message is through
+  } else {
+    m_dataSlot = slot;
+  }
+}
+
+//
+// Called on every clock: plays the events that are due, and asks the host
+//  for the events that follow them, all with a single IRQ
+//
+void CMPU401Sequencer::timerExpired(void) {
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_isPlaying) {
+    for (int i = 0; i <= MPU_NUM_TRACKS; i++) {
+      track_t& track = m_tracks[i];
+
+      if ((track.state == TS_IDLE) || (track.state == TS_ENDED))
+        continue;
+
+      track.elapsed++;
+
+      if (track.state == TS_RECEIVING) {
+        track.counter--;
+      } else if ((track.state == TS_SCHEDULED) && (--track.counter <= 0)) {
+        playEvent(i);
+      }
+    }
+  }
+
+  if (m_isClockToHost && (++m_clockToHostCount >= m_clockToHostRate)) {
+    m_clockToHostCount = 0;
+    m_inBuf->putMessage(MPU_SLOT_CLOCK, MSG_CLOCK_TO_HOST);
+  }
+
+  m_inBuf->flushMessages();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+void CMPU401Sequencer::init(void) {
+  m_isPlaying = false;
+  m_isConductorOn = false;
+  m_isRealTimeOut = true;
+  m_isAllNotesOff = true;
+  m_activeTracks = 0x00;
+
+  m_tempo = 100;
+  m_relativeTempo = 0x40;
+  m_timebase = 120;
+
+  m_isClockToHost = false;
+  m_clockToHostRate = MPU_TIMING_OVERFLOW / 4;
+  m_clockToHostCount = 0;
+
+  m_pendingCommand = 0;
+
+  m_isSendingMessage = false;
+  m_messageLength = m_messageReceived = 0;
+  m_messageStatus = 0x00;
+
+  memset(m_notesOn, 0, sizeof(m_notesOn));
+
+  clearTracks();
+}
+
+//
+// Carries out a start/stop command (MIDI start/stop/continue in bits 1-0,
+//  play start/stop/continue in bits 3-2, record start/stop in bits 5-4)
+//
+void CMPU401Sequencer::startStop(
+    unsigned char command)
+{
+  if (m_isRealTimeOut) {
+    switch (command & 0x03) {
+      case CMD_MIDI_STOP:
+        m_hwemu->putRealTime(MIDI_EVENT_SYS_RT_STOP);
+        break;
+
+      case CMD_MIDI_START:
+        m_hwemu->putRealTime(MIDI_EVENT_SYS_RT_START);
+        break;
+
+      case CMD_MIDI_CONTINUE:
+        m_hwemu->putRealTime(MIDI_EVENT_SYS_RT_CONTINUE);
+        break;
+    }
+  }
+
+  switch (command & 0x0c) {
+    case CMD_PLAY_STOP:
+      if (m_isPlaying) {
+        m_hwemu->logInformation("MPU-401 play stop");
+        m_isPlaying = false;
+
+        if (m_isAllNotesOff)
+          allNotesOff();
+      }
+      break;
+
+    case CMD_PLAY_START:
+      m_hwemu->logInformation("MPU-401 play start");
+      clearTracks();
+      m_isPlaying = true;
+
+      // Ask for the first event of every active track, all at once
+      {
+        for (int i = 0; i < MPU_NUM_TRACKS; i++) {
+          if (m_activeTracks & (1 << i))
+            requestData(i);
+        }
+      }
+
+      if (m_isConductorOn)
+        requestData(MPU_SLOT_CONDUCTOR);
+
+      m_inBuf->flushMessages();
+      break;
+
+    case CMD_PLAY_CONTINUE:
+      m_hwemu->logInformation("MPU-401 play continue");
+      m_isPlaying = true;
+      break;
+  }
+
+  if ((command & 0x30) == CMD_RECORD_START)
+    m_hwemu->logWarning("MPU-401 record start, recording is not supported");
+
+  updateTimer();
+}
+
+//
+// Carries out a command that takes a data byte
+//
+void CMPU401Sequencer::setParameter(
+    unsigned char command,
+    unsigned char data)
+{
+  switch (command) {
+    case CMD_SET_TEMPO:
+      m_tempo = max(min((int)data, MPU_MAX_TEMPO), MPU_MIN_TEMPO);
+      updateTimer();
+      break;
+
+    case CMD_RELATIVE_TEMPO:
+      m_relativeTempo = max((int)data, 1);
+      updateTimer();
+      break;
+
+    case CMD_INTERNAL_CLOCK_LENGTH_TO_HOST:
+      m_clockToHostRate = (data == 0) ? 256 / 4 : max((int)data / 4, 1);  // 0 stands for 256
+      break;
+
+    case CMD_ACTIVE_TRACK_MASK:
+      m_activeTracks = data;
+      break;
+
+    default:
+      // Relative tempo graduation, metronome, measure length, play counter
+      //  and channel masks: nothing to do
+      break;
+  }
+}
+
+//
+// Takes in the next byte of a track's event: a timing byte (or a timing
+//  overflow), followed by a MIDI message (which may use the track's running
+//  status) or a mark; the conductor's events are MPU commands instead
+//
+void CMPU401Sequencer::putTrackData(
+    int slot,
+    unsigned char data)
+{
+  track_t& track = m_tracks[slot];
+  std::ostringstream oss;
+
+  // Timing bytes count from when the track's last event was due, which is
+  //  a while back by the time the host answers the request for this one:
+  //  the counter starts out with that much taken off (the event is played
+  //  as soon as it is complete if it is already due)
+  if (track.state == TS_WAITING) {
+    if (data < MSG_TRACK_DATA_REQUEST) {
+      track.counter = data - track.elapsed;
+      track.length = track.numReceived = 0;
+      track.state = TS_RECEIVING;
+    } else if (data == MARK_TIMING_OVERFLOW) {
+      track.counter = MPU_TIMING_OVERFLOW - track.elapsed;
+      track.type = ET_NO_OPERATION;
+      scheduleEvent(slot);
+    } else {
+      oss << std::setbase(16) << "Invalid MPU-401 timing byte (0x" << (data & 0xff) << ", track " << std::setbase(10) << slot << "), ignoring";
+      m_hwemu->logError(oss.str().c_str());
+    }
+
+    return;
+  }
+
+  _ASSERTE(track.state == TS_RECEIVING);
+
+  if (track.numReceived > 0) {
+    track.data[track.numReceived++] = data;
+
+    if (track.numReceived >= track.length)
+      scheduleEvent(slot);
+
+    return;
+  }
+
+  // The first byte of the event
+  if ((slot == MPU_SLOT_CONDUCTOR) && (data >= CMD_SET_TEMPO) && (data <= CMD_MIDI_CHANNEL_MASK_HI)) {
+    track.type = ET_COMMAND;
+    track.data[0] = data;
+    track.length = 2;
+    track.numReceived = 1;
+  } else if ((slot != MPU_SLOT_CONDUCTOR) && IS_MIDI_EVENT(data) && !IS_SYSTEM_EVENT(data)) {
+    track.type = ET_MIDI;
+    track.data[0] = track.runningStatus = data;
+    track.length = MIDI_evt_len[data];
+    track.numReceived = 1;
+  } else if ((slot != MPU_SLOT_CONDUCTOR) && !IS_MIDI_EVENT(data) && (track.runningStatus != 0)) {
+    track.type = ET_MIDI;
+    track.data[0] = track.runningStatus;
+    track.data[1] = data;
+    track.length = MIDI_evt_len[track.runningStatus];
+    track.numReceived = 2;
+
+    if (track.numReceived >= track.length)
+      scheduleEvent(slot);
+  } else if (data == MARK_DATA_END) {
+    track.type = ET_DATA_END;
+    scheduleEvent(slot);
+  } else {
+    if ((data != MARK_NO_OPERATION) && (data != MARK_MEASURE_END)) {
+      oss << std::setbase(16) << "Unsupported MPU-401 track data (0x" << (data & 0xff) << ", track " << std::setbase(10) << slot << "), ignoring";
+      m_hwemu->logError(oss.str().c_str());
+    }
+
+    track.type = ET_NO_OPERATION;
+    scheduleEvent(slot);
+  }
+}
+
+//
+// Follows the message the host asked to send (see putCommand) one byte at
+//  a time, to tell when it is through
+//
+void CMPU401Sequencer::putMessageData(
+    unsigned char data)
+{
+  if (IS_REALTIME_EVENT(data))
+    return;                         // may come in the middle of anything
+
+  if (m_messageLength < 0) {
+    // System exclusive, ended by EOX (or by any other status byte)
+    if (IS_MIDI_EVENT(data))
+      endMessage();
+
+    return;
+  }
+
+  if (m_messageReceived == 0) {
+    if (data == MIDI_EVENT_SYSTEM_SYSEX) {
+      m_messageLength = -1;
+      m_messageStatus = 0x00;
+      return;
+    }
+
+    if (IS_MIDI_EVENT(data)) {
+      m_messageLength = MIDI_evt_len[data];
+      m_messageStatus = IS_SYSTEM_EVENT(data) ? 0x00 : data;
+    } else if (m_messageStatus != 0x00) {
+      m_messageLength = MIDI_evt_len[m_messageStatus];
+      m_messageReceived = 1;        // running status
+    } else {
+      m_messageLength = 1;          // stray data byte
+    }
+  }
+
+  if (++m_messageReceived >= m_messageLength)
+    endMessage();
+}
+
+//
+// The message the host asked to send is through: the data that follows
+//  goes back to the track the host was sending an event for, if any
+//
+void CMPU401Sequencer::endMessage(void) {
+  m_isSendingMessage = false;
+  m_messageLength = m_messageReceived = 0;
+
+  if ((m_savedDataSlot >= 0) && (m_tracks[m_savedDataSlot].state == TS_WAITING || m_tracks[m_savedDataSlot].state == TS_RECEIVING))
+    m_dataSlot = m_savedDataSlot;
+
+  m_savedDataSlot = -1;
+}
+
+//
+// The host is done sending a track's event: it plays once the track's
+//  counter runs out (right away if it already has)
+//
+void CMPU401Sequencer::scheduleEvent(
+    int slot)
+{
+  track_t& track = m_tracks[slot];
+
+  m_dataSlot = -1;
+  track.state = TS_SCHEDULED;
+
+  if (track.counter <= 0)
+    playEvent(slot);
+}
+
+void CMPU401Sequencer::playEvent(
+    int slot)
+{
+  track_t& track = m_tracks[slot];
+
+  switch (track.type) {
+    case ET_MIDI:
+      {
+        unsigned char status = track.data[0];
+        unsigned char key = track.data[1] & 0x7f;
+        unsigned char* notes = m_notesOn[GET_CHANNEL(status)];
+
+        // Keep track of the notes left on
+        if ((GET_EVENT(status) == MIDI_EVENT_NOTE_ON) && (track.data[2] != 0)) {
+          notes[key / 8] |= (1 << (key % 8));
+        } else if ((GET_EVENT(status) == MIDI_EVENT_NOTE_ON) || (GET_EVENT(status) == MIDI_EVENT_NOTE_OFF)) {
+          notes[key / 8] &= ~(1 << (key % 8));
+        }
+
+        m_hwemu->putEvent(status, track.data[1], track.data[2], track.length - 1);
+      }
+      break;
+
+    case ET_COMMAND:
+      setParameter(track.data[0], track.data[1]);
+      break;
+
+    case ET_DATA_END:
+      track.state = TS_ENDED;
+
+      // Tell the host once every track is done
+      {
+        for (int i = 0; i <= MPU_NUM_TRACKS; i++) {
+          if ((m_tracks[i].state != TS_IDLE) && (m_tracks[i].state != TS_ENDED))
+            return;
+        }
+      }
+
+      m_inBuf->putMessage(MPU_SLOT_ALL_END, MSG_ALL_END);
+      return;
+
+    default:
+      break;
+  }
+
+  requestData(slot);
+}
+
+//
+// Asks the host for a track's next event (the request goes out with the
+//  next flushMessages); the next event's timing counts from when the last
+//  one was due, even if it was played late
+//
+void CMPU401Sequencer::requestData(
+    int slot)
+{
+  m_tracks[slot].state = TS_WAITING;
+  m_tracks[slot].elapsed = (m_tracks[slot].counter < 0) ? -m_tracks[slot].counter : 0;
+
+  m_inBuf->putMessage(slot, (slot == MPU_SLOT_CONDUCTOR) ? MSG_CONDUCTOR_REQUEST : (unsigned char)(MSG_TRACK_DATA_REQUEST + slot));
+}
+
+//
+// Turns off the notes the sequencer left on
+//
+void CMPU401Sequencer::allNotesOff(void) {
+  for (int channel = 0; channel < 16; channel++) {
+    for (int key = 0; key < 128; key++) {
+      if (m_notesOn[channel][key / 8] & (1 << (key % 8)))
+        m_hwemu->putEvent((unsigned char)(MIDI_EVENT_NOTE_OFF | channel), (unsigned char)key, 0x40, 2);
+    }
+  }
+
+  memset(m_notesOn, 0, sizeof(m_notesOn));
+}
+
+void CMPU401Sequencer::clearTracks(void) {
+  for (int i = 0; i <= MPU_NUM_TRACKS; i++) {
+    m_tracks[i].state = TS_IDLE;
+    m_tracks[i].counter = m_tracks[i].elapsed = 0;
+    m_tracks[i].type = ET_NO_OPERATION;
+    m_tracks[i].length = m_tracks[i].numReceived = 0;
+    m_tracks[i].runningStatus = 0;
+  }
+
+  m_dataSlot = m_savedDataSlot = -1;
+}
+
+//
+// Runs the MPU timer at the current tempo and timebase, for as long as
+//  there is something to clock (playing, or clock to host)
+//
+void CMPU401Sequencer::updateTimer(void) {
+  long period = 0;
+
+  if (m_isPlaying || m_isClockToHost)
+    period = (long)(60000000.0 * 0x40 / ((double)m_tempo * m_timebase * m_relativeTempo) + 0.5);
+
+  if (period != m_timerPeriod) {
+    m_timerPeriod = period;
+    m_hwemu->setTimerPeriod(period);
+  }
+}
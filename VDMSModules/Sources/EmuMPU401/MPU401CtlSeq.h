@@ -0,0 +1,122 @@
+#ifndef __MPU401CTLSEQ_H_
+#define __MPU401CTLSEQ_H_
+
+#include "MPU401CtlBuf.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MPU_NUM_TRACKS      8
+
+// Slots of the sequencer's messages to the host (see CMIDIInputBuffer)
+#define MPU_SLOT_CONDUCTOR  MPU_NUM_TRACKS  // one slot per track's data request, then the conductor's
+#define MPU_SLOT_CLOCK      (MPU_NUM_TRACKS + 1)
+#define MPU_SLOT_ALL_END    (MPU_NUM_TRACKS + 2)
+
+#define MPU_MIN_TEMPO       8         // beats per minute
+#define MPU_MAX_TEMPO       250
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// The MPU-401's intelligent-mode sequencer: plays back up to eight tracks
+//  (and a conductor track, which changes the tempo), fed by the host one
+//  event at a time.  Whenever a track has played its event, the sequencer
+//  asks the host for the next one (MSG_TRACK_DATA_REQUEST + track); the
+//  host answers with a timing byte (how many clocks until the event is
+//  due) followed by the event itself.  The clock is the MPU timer (see
+//  IMPU401HWEmulationLayer::setTimerPeriod), which runs at timebase clocks
+//  per beat, at the tempo (in beats per minute) set by the host.
+// The sequencer may be called from the emulated CPU's thread (commands,
+//  data) and from the timer thread (clocks) at the same time.
+//
+class CMPU401Sequencer
+{
+  protected:
+    enum trackState_t {
+      TS_IDLE,                        // not playing
+      TS_WAITING,                     // waiting for the host to send an event
+      TS_RECEIVING,                   // part of an event was sent, waiting for the rest
+      TS_SCHEDULED,                   // the event is due once the counter runs out
+      TS_ENDED                        // the host has no more events for the track
+    };
+
+    enum eventType_t {
+      ET_MIDI,                        // a MIDI message
+      ET_COMMAND,                     // an MPU command and its data byte (conductor only)
+      ET_NO_OPERATION,                // nothing (timing overflow, measure end)
+      ET_DATA_END                     // the track's last event
+    };
+
+    struct track_t {
+      trackState_t state;
+      int counter;                    // how many clocks until the event is due
+      int elapsed;                    // how many clocks since the track's last event
+      eventType_t type;
+      unsigned char data[3];          // the event (status and data bytes)
+      int length;                     // how many bytes the event takes ...
+      int numReceived;                // ... and how many of them were sent so far
+      unsigned char runningStatus;
+    };
+
+  public:
+    CMPU401Sequencer(IMPU401HWEmulationLayer* hwemu, CMIDIInputBuffer* inBuf);
+    ~CMPU401Sequencer(void);
+
+  public:
+    void reset(void);
+    bool putCommand(unsigned char command);
+    bool putData(unsigned char data);
+    void messageRead(int slot);
+    void timerExpired(void);
+
+  protected:
+    void init(void);
+    void startStop(unsigned char command);
+    void setParameter(unsigned char command, unsigned char data);
+    void putTrackData(int slot, unsigned char data);
+    void putMessageData(unsigned char data);
+    void endMessage(void);
+    void scheduleEvent(int slot);
+    void playEvent(int slot);
+    void requestData(int slot);
+    void allNotesOff(void);
+    void clearTracks(void);
+    void updateTimer(void);
+
+  protected:
+    CCriticalSection m_mutex;         // regulates access to everything below
+
+    track_t m_tracks[MPU_NUM_TRACKS + 1];   // the tracks, then the conductor
+    int m_dataSlot;                   // which track the host is sending an event for (-1 = none)
+    unsigned char m_pendingCommand;   // command waiting for its data byte (0 = none)
+
+    bool m_isSendingMessage;          // whether the host is sending a message it asked to send (see putCommand) ...
+    int m_messageLength;              // ... how many bytes the message takes (-1 = up to EOX) ...
+    int m_messageReceived;            // ... and how many of them were sent so far
+    unsigned char m_messageStatus;    // running status of the messages sent
+    int m_savedDataSlot;              // which track the host was sending an event for before the message (-1 = none)
+
+    bool m_isPlaying;
+    bool m_isConductorOn;
+    bool m_isRealTimeOut;             // whether start/stop/continue go out as MIDI real-time messages
+    bool m_isAllNotesOff;             // whether the notes left on are turned off when playing stops
+    unsigned char m_activeTracks;     // bit mask of the tracks played
+
+    int m_tempo;                      // beats per minute
+    int m_relativeTempo;              // 0x40 = 1.0
+    int m_timebase;                   // clocks per beat
+
+    bool m_isClockToHost;
+    int m_clockToHostRate;            // clocks between clock-to-host messages
+    int m_clockToHostCount;
+
+    long m_timerPeriod;               // the MPU timer's period (microseconds) as last set, 0 = stopped
+
+    unsigned char m_notesOn[16][128 / 8];   // notes played and not yet turned off, by channel
+
+  protected:
+    IMPU401HWEmulationLayer* m_hwemu;
+    CMIDIInputBuffer* m_inBuf;
+};
+
+#endif //__MPU401CTLSEQ_H_
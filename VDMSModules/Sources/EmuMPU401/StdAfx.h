@@ -28,6 +28,9 @@ extern CComModule _Module;
 
 #include <afxmt.h>
 
+#include <mmsystem.h>
+#pragma comment ( lib , "winmm.lib" )
+
 #include <vector>
 #include <queue>
 #include <iomanip>
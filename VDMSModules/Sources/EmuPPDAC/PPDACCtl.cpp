@@ -19,6 +19,8 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include <MFCUtil.h>
+#include <RateControl.h>
+#include <Resampler.h>
 #pragma comment ( lib , "MFCUtil.lib" )
 
 #include <VDMUtil.h>
@@ -307,13 +309,20 @@ unsigned int CPPDACCtl::Run(CThread& thread) {
 
   // Set up the renderer (if any)
   if (m_waveOut != NULL) try {
-    m_waveOut->SetFormat(1, m_sampleRate, 8);
+    m_waveOut->SetFormat(1, m_sampleRate, 16);
   } catch (_com_error& ce) {
     CString args = Format(_T("%d, %d, %d"), 1, m_sampleRate, 16);
     RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("SetFormat(%s): 0x%08x - %s"), (LPCTSTR)args, ce.Error(), ce.ErrorMessage()));
   }
 
-  CByteArray buffer;
+  // The DAC is written to at an arbitrary (and varying) rate; its data is
+  //  band-limited and converted to the output rate
+  CResampler resampler;
+  resampler.Init(1, m_sampleRate, m_sampleRate, CResampler::QUALITY_MEDIUM);
+
+  CRateControl rateControl;     // keeps the renderer's buffer on target despite clock drift
+
+  std::vector<short> buffer;
 
   while (true) {
     if (thread.GetMessage(&message, false)) {       // non-blocking message-"peek"
@@ -332,30 +341,35 @@ unsigned int CPPDACCtl::Run(CThread& thread) {
       if (m_bufPtr > 0) {
         ASSERT(m_curTime >= m_lastTime);
 
-        // Compute per-sample scaling factor
-        double scalingFactor = min(2.0, max(0.0, 1 / m_renderLoad));
-        ASSERT(scalingFactor >= 0.0);
+        // Compute the (trimmed) number of output samples per DAC sample
+        double elapsedTime   = (m_curTime - m_lastTime) / 1000000.0;
+        double ratio         = rateControl.Update(m_renderLoad, elapsedTime);
 
-        double sampleLength  = min(m_sampleRate / 5000.0, scalingFactor * m_sampleRate * ((m_curTime - m_lastTime) / 1000000.0) / m_bufPtr);
+        double sampleLength  = min(m_sampleRate / 5000.0, ratio * m_sampleRate * elapsedTime / m_bufPtr);
         ASSERT(sampleLength  >= 0.0);
 
-        // Adjust buffer size, if necessary
-        int bufSize = (int)(sampleLength * m_bufPtr + 0.5);
-
-        if (buffer.GetUpperBound() + 1 < bufSize)
-          buffer.SetSize(bufSize);
-
-        // Resample DAC data into the buffer
-        for (int i = 0; i < bufSize; i++)
-          buffer[i] = m_buffer[(int)(i / sampleLength)];
+        // Feed the DAC data at its measured rate (output samples per DAC sample)
+        if (sampleLength > 0.0) {
+          resampler.SetRates(1.0, sampleLength);
+          resampler.Write((const unsigned char*)m_buffer, m_bufPtr);
+        }
 
         m_lastTime = m_curTime;
         m_bufPtr   = 0;
 
         m_lock.Unlock();
 
-        try {
-          m_renderLoad = m_waveOut->PlayData(buffer.GetData(), bufSize);
+        // Resample DAC data into the buffer
+        int bufSize = resampler.GetAvailable();
+
+        if ((int)buffer.size() < bufSize)
+          buffer.resize(bufSize);
+
+        if (bufSize > 0)
+          bufSize = resampler.Read(&buffer[0], bufSize);
+
+        if (bufSize > 0) try {
+          m_renderLoad = m_waveOut->PlayData((BYTE*)&buffer[0], bufSize * sizeof(short));
         } catch (_com_error& ce) {
           CString args = Format(_T("%p, %d"), m_buffer, m_bufPtr);
           RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("PlayData(%s): 0x%08x - %s"), (LPCTSTR)args, ce.Error(), ce.ErrorMessage()));
@@ -33,6 +33,8 @@
 #define INI_STR_FORCENUMBITS  L"forceNumBits"
 #define INI_STR_FORCECHANNELS L"forceChannels"
 
+#define INI_STR_OUTPUTRATE    L"outputRate"
+
 /////////////////////////////////////////////////////////////////////////////
 
 // KLUDGE: in Win2k's NTVDM it looks as if a thread's reserved stack size is
@@ -124,6 +126,15 @@ STDMETHODIMP CSBCompatCtl::Init(IUnknown * configuration) {
     m_forcedBitsPerSample = CFG_Get(Config, INI_STR_FORCENUMBITS, -1, 10, true);
     m_forcedNumChannels   = CFG_Get(Config, INI_STR_FORCECHANNELS, -1, 10, true);
 
+    // Render all playback at a single rate, so that the sound card does not
+    //  have to be re-programmed (and the OS does not resample) on every change
+    m_outputRate = CFG_Get(Config, INI_STR_OUTPUTRATE, -1, 10, true);
+
+    if ((m_outputRate > -1) && ((m_outputRate < MIN_PLAYBACK_RATE) || (m_outputRate > 192000))) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Output rate (%dHz) is out of range; playing back at the applications' own rates"), m_outputRate));
+      m_outputRate = -1;
+    }
+
     /** Get VDM services ***************************************************/
 
     // Obtain VDM Services instance
@@ -492,19 +503,18 @@ STDMETHODIMP CSBCompatCtl::HandleTransfer(BYTE channel, TTYPE_T type, TMODE_T mo
   int bufSizeLimit;   // maximum amount of data that <buf> can accomodate
   BYTE* buf = NULL;   // temporary storage for processing (e.g. decompressing -- up to 4x if ADPCM2) data
 
-  // Compute by how much this transfer should be boosted or diminished, based on
-  //  playback performance (feedback indicating playback buffer overrun/underrun)
-  double scalingFactor = min(2.0, max(0.0, 1 / m_renderLoad));
-
   // Compute the maximum amount of bytes we can exchange in this transaction
   long maxTransfer = min(
       m_DSPBlockSize - (m_transferredBytes % m_DSPBlockSize), // SB block limit
       maxData << alignment);                                  // DMA terminal count limit
 
-  // Compute how many bytes should be transferred based on average bandwidth, on
-  //  the time elapsed since the last transfer (+/- 1 time uncertainty), and on
-  //  the scaling factor computed above.
-  long toTransfer = scalingFactor * max(0.0, (m_avgBandwidth * (double)(deltaTime + 1)) / 1000.0);
+  // Compute how many bytes should be transferred based on average bandwidth, and
+  //  on the time elapsed since the last transfer.  Whatever cannot be transferred
+  //  now (rounding, block limits) is carried over to the next transfer, so that
+  //  the DMA runs at exactly the programmed rate on average; drift between this
+  //  rate and the renderer's clock is absorbed by the playback rate control.
+  m_transferCredit += (m_avgBandwidth * (double)deltaTime) / 1000.0;
+  long toTransfer = (long)max(0.0, m_transferCredit);
 
   // Round (down) the number of bytes to transfer in such a way so that
   //  the transfer will not break a 16-bit sample down the middle, split a
@@ -537,6 +547,12 @@ STDMETHODIMP CSBCompatCtl::HandleTransfer(BYTE channel, TTYPE_T type, TMODE_T mo
     }
   }
 
+  // Carry over the remainder (but do not try to catch up after long stalls)
+  m_transferCredit -= toTransfer;
+
+  if (m_transferCredit > m_avgBandwidth / 10.0)
+    m_transferCredit = m_avgBandwidth / 10.0;
+
   // Now that we know how much we need to transfer, allocate the transfer buffer
   bufSizeLimit = toTransfer * (m_codec == CODEC_ADPCM_2 ? 4 : m_codec == CODEC_ADPCM_3 ? 3 : m_codec == CODEC_ADPCM_4 ? 2 : 1);
 # if STACK_HEAP_WORKAROUND
@@ -601,7 +617,29 @@ STDMETHODIMP CSBCompatCtl::HandleTransfer(BYTE channel, TTYPE_T type, TMODE_T mo
 
       // Play the data, and update the load factor
       if (m_waveOut != NULL) try {
-        m_renderLoad = m_waveOut->PlayData(buf, bufSize);
+        // Convert to the playback rate, trimmed so that the renderer's buffer
+        //  stays on target; decoded data is either unsigned 8-bit or signed 16-bit
+        m_resampler.SetRates(m_sampleRate, m_playbackRate * m_rateControl.Update(m_renderLoad, deltaTime / 1000.0));
+
+        int bytesPerSample = ((m_codec == CODEC_PCM) || (m_codec == CODEC_PCM_SIGNED)) ? (m_bitsPerSample >> 3) : 1;
+        int numFrames = bufSize / (m_numChannels * bytesPerSample);
+
+        if (bytesPerSample == 2) {
+          m_resampler.Write((const short*)buf, numFrames);
+        } else {
+          m_resampler.Write(buf, numFrames);
+        }
+
+        numFrames = m_resampler.GetAvailable();
+
+        if ((int)m_resampleBuf.size() < numFrames * m_numChannels)
+          m_resampleBuf.resize(numFrames * m_numChannels);
+
+        if (numFrames > 0)
+          numFrames = m_resampler.Read(&m_resampleBuf[0], numFrames);
+
+        if (numFrames > 0)
+          m_renderLoad = m_waveOut->PlayData((BYTE*)&m_resampleBuf[0], numFrames * m_numChannels * sizeof(short));
       } catch (_com_error& ce) {
         CString args = Format(_T("%p, %d"), buf, bufSize);
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("PlayData(%s): 0x%08x - %s"), (LPCTSTR)args, ce.Error(), ce.ErrorMessage()));
@@ -646,7 +684,7 @@ STDMETHODIMP CSBCompatCtl::HandleTransfer(BYTE channel, TTYPE_T type, TMODE_T mo
   }
 
 # if _DEBUG
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("DMA transferring: after %dms, %d bytes (%d bytes in last burst) @ %dcps to/from %p, type = %d, mode = %d, dir = %d, A/I = %d; load factor = %0.5f"), (int)(deltaTime), (int)m_transferredBytes, (int)toTransfer, (int)m_avgBandwidth, (int)physicalAddr, (int)type, (int)mode, (int)isDescending, (int)isAutoInit, (float)m_renderLoad));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("DMA transferring: after %dms, %d bytes (%d bytes in last burst) @ %dcps to/from %p, type = %d, mode = %d, dir = %d, A/I = %d; load factor = %0.5f, rate correction = %dppm"), (int)(deltaTime), (int)m_transferredBytes, (int)toTransfer, (int)m_avgBandwidth, (int)physicalAddr, (int)type, (int)mode, (int)isDescending, (int)isAutoInit, (float)m_renderLoad, (int)m_rateControl.GetCorrectionPPM()));
 # endif
 
   // Release the lock
@@ -742,6 +780,7 @@ void CSBCompatCtl::startTransfer(transfer_t type, char E2Reply, bool isSynchrono
   m_transferStartTime = timeGetTime();  // when the transfer started
   m_lastTransferTime = m_transferStartTime;
   m_transferredBytes = 0;               // how many bytes were transferred to date
+  m_transferCredit = 0.0;               // no bytes are due yet
 
   m_transferType     = type;
   m_activeDMAChannel = m_DMA8Channel;
@@ -789,10 +828,16 @@ void CSBCompatCtl::startTransfer(transfer_t type, int numChannels, int samplesPe
   // Lock all transfer variables (DMA ch., sample rate, etc.)
   m_mutex.Lock(250);
 
+  // Single-cycle transfers are restarted for every block of the same
+  //  stream, so only a new stream format discards the resampler's history
+  //  and the rate control's state
+  bool isNewStream = (!m_isStreamSet) || (numChannels != m_numChannels) || (bitsPerSample != m_bitsPerSample) || (codec != m_codec);
+
   // Set up the transfer state
   m_transferStartTime = timeGetTime();  // when the transfer started
   m_lastTransferTime = m_transferStartTime;
   m_transferredBytes = 0;               // how many bytes were transferred to date
+  m_transferCredit = 0.0;               // no bytes are due yet
   m_avgBandwidth = numChannels * samplesPerSecond * bitsPerSample / 8;
   m_DSPBlockSize = samplesPerBlock * bitsPerSample / 8;
   m_bitsPerSample = bitsPerSample;      // how many bits in a sample
@@ -802,7 +847,20 @@ void CSBCompatCtl::startTransfer(transfer_t type, int numChannels, int samplesPe
   m_isAutoInit = isAutoInit;            // indicates whether the SB should treat this as an A/I xfer
 
   m_transferType = type;
-  m_renderLoad = 1.00;
+
+  // Playback goes through the resampler, at the configured output rate (if
+  //  any) or at the stream's own rate
+  m_sampleRate   = samplesPerSecond;
+  m_playbackRate = (m_outputRate > -1) ? m_outputRate : samplesPerSecond;
+
+  if (isNewStream) {
+    m_renderLoad = 1.00;
+    m_resampler.Init(numChannels, m_sampleRate, m_playbackRate, CResampler::QUALITY_MEDIUM);
+    m_rateControl.Reset();
+    m_isStreamSet = true;
+  } else {
+    m_resampler.SetRates(m_sampleRate, m_playbackRate * m_rateControl.GetRatio());
+  }
 
   if (bitsPerSample < 16) {
     m_SBDSP.ack8BitIRQ();               // clear any pending IRQs
@@ -823,11 +881,9 @@ void CSBCompatCtl::startTransfer(transfer_t type, int numChannels, int samplesPe
     switch (m_codec) {
       case CODEC_PCM:
       case CODEC_PCM_SIGNED:
-        m_waveOut->SetFormat(numChannels, samplesPerSecond, bitsPerSample);
-        break;
       case CODEC_ADPCM_2:
       case CODEC_ADPCM_4:
-        m_waveOut->SetFormat(numChannels, samplesPerSecond, 8);
+        m_waveOut->SetFormat(numChannels, m_playbackRate, 16);  // resampled in HandleTransfer
         break;
       case CODEC_ADPCM_3:
       default:
@@ -23,6 +23,9 @@
 #include "SBCompatCtlDSP.h"
 #include "SBCompatCtlMixer.h"
 
+#include <RateControl.h>
+#include <Resampler.h>
+
 /////////////////////////////////////////////////////////////////////////////
 // CSBCompatCtl
 class ATL_NO_VTABLE CSBCompatCtl : 
@@ -37,7 +40,7 @@ class ATL_NO_VTABLE CSBCompatCtl :
 {
 public:
   CSBCompatCtl()
-    : m_SBMixer(this), m_SBDSP(this, &m_SBMixer)
+    : m_isStreamSet(false), m_SBMixer(this), m_SBDSP(this, &m_SBMixer)
     { }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_SBCOMPATCTL)
@@ -102,12 +105,15 @@ protected:
   int m_forcedBitsPerSample;    // debug - number of bits/sample to override that provided by DOS applications
   int m_forcedNumChannels;      // debug - number of channels to override that provided by DOS applications
 
+  int m_outputRate;             // sample rate at which all playback is rendered (-1 = the DOS application's own rate)
+
 // Other member variables
 protected:
   DWORD m_transferStartTime;    // time when a DMA transfer was started
   DWORD m_transferPauseTime;    // time when a DMA transfer was halted (via a DSP "pause" command)
   DWORD m_lastTransferTime;     // time when the last chunk of data was processed in the current DMA transfer
   long m_transferredBytes;      // number of bytes processed to date as part of the current DMA transfer
+  double m_transferCredit;      // number of bytes due for transfer (based on the elapsed time) but not transferred yet
   long m_avgBandwidth;          // average bandwidth expected to be required by current DMA transfer based on audio parameters (sample rate, bits/sample, mono/stereo, etc.)
   long m_DSPBlockSize;          // how many bytes of data can be transferred during the current DMA transfer before an IRQ needs to be generated
   int m_bitsPerSample;          // how many bits are in an audio sample; used to differentiate between 8-bit and 16-bit audio decoding, and to align chunks of data sent to the DSP for decoding
@@ -119,6 +125,13 @@ protected:
   transfer_t m_transferType;
   double m_renderLoad;
 
+  int m_sampleRate;             // sample rate of the audio stream being transferred
+  int m_playbackRate;           // nominal sample rate of the data sent to the renderer
+  CResampler m_resampler;       // converts the audio stream to the playback rate (trimmed by m_rateControl)
+  CRateControl m_rateControl;   // keeps the renderer's buffer on target despite clock drift
+  bool m_isStreamSet;           // whether the resampler and rate control were set up for the current stream format
+  std::vector<short> m_resampleBuf;
+
   BYTE m_E2Reply;
 
   CCriticalSection m_mutex;
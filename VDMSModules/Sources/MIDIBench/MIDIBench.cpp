@@ -0,0 +1,382 @@
+// MIDIBench.cpp : measures how many MIDI messages per second make it
+//  through chains of modules such as the one in VDMS.ini, with every module
+//  reaching the next one through COM, then with the MIDIToolkit modules
+//  fused into a pipeline; then how the compiled MIDI Mapper tables compare
+//  with the patch-only filter the MIDI Mapper used to have.
+//
+// Usage: MIDIBench [millions of messages]
+//
+// The MIDIToolkit modules are stood in for by objects that implement the
+//  same interfaces and use the same filters and pipeline code; the other
+//  modules (MIDI Player, SysEx Indicator) only pass messages on.
+//
+// The exit code is non-zero if the two ways of going through a chain do not
+//  deliver the same messages (or if the compiled tables do not map patches
+//  the way the patch-only filter does), so that the tool can be run
+//  unattended.
+//
+
+#include "stdafx.h"
+
+#include "../MIDIToolkit/MIDIFilters.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_MILLIONS      10
+
+#define NUM_MESSAGES          256       // length of the message pattern played over and over
+#define NUM_RUNS              3         // the fastest run counts (the others may have been interrupted)
+
+/////////////////////////////////////////////////////////////////////////////
+
+enum { MOD_MAPPER, MOD_PASSTHRU, MOD_PLAYER, MOD_INDICATOR };
+
+typedef struct {
+  const char* name;
+  int numModules;
+  int modules[6];                       // the chain, from the MPU-401 onwards
+} chain_t;
+
+static const chain_t chains[] = {
+  { "default",       3, { MOD_MAPPER, MOD_PLAYER, MOD_INDICATOR } },
+  { "+delay",        4, { MOD_MAPPER, MOD_PASSTHRU, MOD_PLAYER, MOD_INDICATOR } },
+  { "+shaper+delay", 5, { MOD_MAPPER, MOD_PASSTHRU, MOD_PASSTHRU, MOD_PLAYER, MOD_INDICATOR } }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Stands in for a module: messages go through the module's filter (if any),
+//  then on to the next module (if any).  A MIDIToolkit module also exposes
+//  IMIDIStage, and once fused goes through its pipeline instead.
+//
+class CModule : public IMIDIEventHandler, public IMIDIStage {
+  public:
+    CModule(void) : m_filter(NULL), m_isToolkit(false), m_isFused(false), m_numReceived(0), m_checksum(0) { }
+
+  public:
+    void Init(CMIDIFilter* filter, IMIDIEventHandler* next, bool isToolkit) {
+      m_filter    = filter;
+      m_next      = next;
+      m_isToolkit = isToolkit;
+      m_isFused   = false;
+    }
+
+    void Fuse(void) {
+      m_pipeline.Build(m_filter, m_next);
+      m_isFused = true;
+    }
+
+    void Destroy(void) {
+      m_pipeline.Clear();
+      m_next = NULL;
+    }
+
+    void ResetCounters(void) {
+      m_numReceived = 0;
+      m_checksum = 0;
+    }
+
+  // IUnknown (the objects live on the stack)
+  public:
+    STDMETHOD(QueryInterface)(REFIID riid, void** ppv) {
+      if ((riid == IID_IUnknown) || (riid == __uuidof(IMIDIEventHandler))) {
+        *ppv = (IMIDIEventHandler*)this;
+      } else if (m_isToolkit && (riid == __uuidof(IMIDIStage))) {
+        *ppv = (IMIDIStage*)this;
+      } else {
+        *ppv = NULL;
+        return E_NOINTERFACE;
+      }
+
+      return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)(void) { return 1; }
+    STDMETHOD_(ULONG, Release)(void) { return 1; }
+
+  // IMIDIEventHandler
+  public:
+    STDMETHOD(HandleEvent)(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
+      if (m_isFused)
+        return m_pipeline.HandleEvent(usDelta, status, data1, data2, length);
+
+      if ((m_filter != NULL) && !m_filter->FilterEvent(usDelta, status, data1, data2, length))
+        return S_OK;
+
+      if (m_next != NULL)
+        return m_next->HandleEvent(usDelta, status, data1, data2, length);
+
+      // End of the chain
+      m_numReceived++;
+      m_checksum = m_checksum * 31 + ((status << 16) | (data1 << 8) | data2);
+
+      return S_OK;
+    }
+
+    STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE* data, LONG length) {
+      return E_NOTIMPL;
+    }
+
+    STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data) {
+      return E_NOTIMPL;
+    }
+
+  // IMIDIStage
+  public:
+    STDMETHOD_(const CMIDIPipeline*, GetPipeline)(void) {
+      return &m_pipeline;
+    }
+
+  public:
+    long m_numReceived;
+    unsigned long m_checksum;
+
+  protected:
+    CMIDIFilter* m_filter;
+    IMIDIEventHandlerPtr m_next;
+    bool m_isToolkit, m_isFused;
+    CMIDIPipeline m_pipeline;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// The patch-only filter the MIDI Mapper used before its maps were compiled
+//  into tables (kept here for comparison)
+//
+class CPatchOnlyFilter : public CMIDIFilter {
+  public:
+    CPatchOnlyFilter(void) {
+      for (int i = 0; i < 128; i++)
+        m_patchMap[i] = (BYTE)i;
+    }
+
+  public:
+    void SetPatch(BYTE from, BYTE to) {
+      m_patchMap[from & 0x7f] = (BYTE)(to & 0x7f);
+    }
+
+    virtual bool FilterEvent(LONGLONG& usDelta, BYTE& status, BYTE& data1, BYTE& data2, BYTE& length) {
+      if ((status & 0xf0) == 0xc0)
+        data1 = m_patchMap[data1 & 0x7f];
+
+      return true;
+    }
+
+  protected:
+    BYTE m_patchMap[128];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  BYTE status, data1, data2, length;
+} message_t;
+
+static message_t messages[NUM_MESSAGES];
+
+//
+// Fills in the message pattern: mostly notes, with the odd program change
+//  and controller (deterministic, so that every chain plays the same "song")
+//
+static void MakeMessages(void) {
+  unsigned long seed = 1;
+
+  for (int i = 0; i < NUM_MESSAGES; i++) {
+    seed = seed * 1103515245UL + 12345UL;
+
+    BYTE channel = (BYTE)((seed >> 16) & 0x0f);
+    BYTE value   = (BYTE)((seed >> 20) & 0x7f);
+
+    if ((i % 16) == 15) {
+      messages[i].status = (BYTE)(0xc0 | channel);  // program change
+      messages[i].data1  = value;
+      messages[i].data2  = 0;
+      messages[i].length = 2;
+    } else if ((i % 16) == 7) {
+      messages[i].status = (BYTE)(0xb0 | channel);  // control change
+      messages[i].data1  = value;
+      messages[i].data2  = 64;
+      messages[i].length = 3;
+    } else {
+      messages[i].status = (BYTE)(((i & 1) ? 0x80 : 0x90) | channel);
+      messages[i].data1  = value;
+      messages[i].data2  = 100;
+      messages[i].length = 3;
+    }
+  }
+}
+
+//
+// Sends a number of messages into the first module of a chain, a few times
+//  over; returns the CPU time spent by the fastest run (in seconds)
+//
+static double RunChain(CModule& first, CModule& last, long numMessages) {
+  double bestTime = -1.0;
+
+  for (int run = 0; run < NUM_RUNS; run++) {
+    last.ResetCounters();
+
+    clock_t start = clock();
+
+    for (long i = 0; i < numMessages; i++) {
+      const message_t& message = messages[i % NUM_MESSAGES];
+      first.HandleEvent(-1, message.status, message.data1, message.data2, message.length);
+    }
+
+    clock_t end = clock();
+
+    double time = (double)(end - start) / CLOCKS_PER_SEC;
+
+    if ((bestTime < 0.0) || (time < bestTime))
+      bestTime = time;
+  }
+
+  return bestTime;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+  int millions = (argc > 1) ? atoi(argv[1]) : DEFAULT_MILLIONS;
+
+  if ((argc > 2) || (millions < 1) || (millions > 2000)) {
+    fprintf(stderr, "Usage: MIDIBench [millions of messages]\n");
+    return 2;
+  }
+
+  long numMessages = millions * 1000000L;
+  int numFailed = 0;
+
+  // A patch map that changes every patch, so that it shows in the checksum
+  CMIDIMapFilter patchFilter;
+  CPatchOnlyFilter patchOnlyFilter;
+  int patch, channel;
+
+  for (patch = 0; patch < 128; patch++) {
+    for (channel = 0; channel < 16; channel++)
+      patchFilter.Set(CMIDIMapFilter::MAP_PATCH, channel, patch, 127 - patch);
+
+    patchOnlyFilter.SetPatch(patch, 127 - patch);
+  }
+
+  patchFilter.Compile();
+
+  // The same, plus every other kind of map (a velocity curve, a drum kit
+  //  on channel 10 and a transposition, a controller swap)
+  CMIDIMapFilter fullFilter;
+
+  for (patch = 0; patch < 128; patch++) {
+    for (channel = 0; channel < 16; channel++) {
+      fullFilter.Set(CMIDIMapFilter::MAP_PATCH, channel, patch, 127 - patch);
+      fullFilter.Set(CMIDIMapFilter::MAP_VELOCITY, channel, patch, (patch == 0) ? 0 : 64 + patch / 2);
+      fullFilter.Set(CMIDIMapFilter::MAP_NOTE, channel, patch, (channel == 9) ? (patch ^ 1) : min(patch + 2, 127));
+    }
+  }
+
+  for (channel = 0; channel < 16; channel++) {
+    fullFilter.Set(CMIDIMapFilter::MAP_CONTROLLER, channel, 7, 11);
+    fullFilter.Set(CMIDIMapFilter::MAP_CONTROLLER, channel, 11, 7);
+  }
+
+  fullFilter.Compile();
+
+  MakeMessages();
+
+  printf("Sending %d million messages through each chain\n\n", millions);
+  printf("%-14s %7s %14s %14s %8s\n", "chain", "fused", "COM msgs/s", "fused msgs/s", "speedup");
+
+  for (int i = 0; i < (int)(sizeof(chains) / sizeof(chains[0])); i++) {
+    const chain_t& chain = chains[i];
+    CModule modules[6];
+    int j;
+
+    // Put the chain together from the end, as the modules are initialized
+    for (j = chain.numModules - 1; j >= 0; j--) {
+      IMIDIEventHandler* next = (j < chain.numModules - 1) ? (IMIDIEventHandler*)&modules[j + 1] : NULL;
+
+      switch (chain.modules[j]) {
+        case MOD_MAPPER:
+          modules[j].Init(&patchFilter, next, true);
+          break;
+        case MOD_PASSTHRU:
+          modules[j].Init(NULL, next, true);
+          break;
+        default:
+          modules[j].Init(NULL, next, false);
+          break;
+      }
+    }
+
+    CModule& last = modules[chain.numModules - 1];
+
+    double comTime = RunChain(modules[0], last, numMessages);
+    unsigned long comChecksum = last.m_checksum;
+    long comReceived = last.m_numReceived;
+
+    for (j = chain.numModules - 1; j >= 0; j--) {
+      if ((chain.modules[j] == MOD_MAPPER) || (chain.modules[j] == MOD_PASSTHRU))
+        modules[j].Fuse();
+    }
+
+    double fusedTime = RunChain(modules[0], last, numMessages);
+    bool isSame = (last.m_checksum == comChecksum) && (last.m_numReceived == comReceived) && (comReceived == numMessages);
+
+    printf("%-14s %7d %14.0f %14.0f %7.2fx %s\n", chain.name, modules[0].GetPipeline()->GetNumFused(),
+           (comTime > 0.0) ? numMessages / comTime : 0.0,
+           (fusedTime > 0.0) ? numMessages / fusedTime : 0.0,
+           (fusedTime > 0.0) ? comTime / fusedTime : 0.0,
+           isSame ? "ok" : "FAILED");
+
+    if (!isSame)
+      numFailed++;
+
+    for (j = 0; j < chain.numModules; j++)
+      modules[j].Destroy();
+  }
+
+  // The MIDI Mapper on its own, followed by a module that only counts
+  static const struct {
+    const char* name;
+    CMIDIFilter* filter;
+  } filters[] = {
+    { "patch-only",    &patchOnlyFilter },
+    { "table patch",   &patchFilter },
+    { "table full",    &fullFilter }
+  };
+
+  unsigned long patchOnlyChecksum = 0;
+
+  printf("\n%-14s %14s\n", "mapper", "msgs/s");
+
+  for (int k = 0; k < (int)(sizeof(filters) / sizeof(filters[0])); k++) {
+    CModule mapper, end;
+
+    end.Init(NULL, NULL, false);
+    mapper.Init(filters[k].filter, &end, true);
+    mapper.Fuse();
+
+    double time = RunChain(mapper, end, numMessages);
+    bool isSame = (end.m_numReceived == numMessages);
+
+    // The patch-only filter and the table holding the same patch map must
+    //  agree
+    if (k == 0)
+      patchOnlyChecksum = end.m_checksum;
+    else if (filters[k].filter == &patchFilter)
+      isSame = isSame && (end.m_checksum == patchOnlyChecksum);
+
+    printf("%-14s %14.0f %s\n", filters[k].name,
+           (time > 0.0) ? numMessages / time : 0.0,
+           isSame ? "ok" : "FAILED");
+
+    if (!isSame)
+      numFailed++;
+
+    mapper.Destroy();
+    end.Destroy();
+  }
+
+  return (numFailed > 0) ? 1 : 0;
+}
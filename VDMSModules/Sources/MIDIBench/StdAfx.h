@@ -0,0 +1,27 @@
+// stdafx.h : include file for standard system include files,
+//      or project specific include files that are used frequently,
+//      but are changed infrequently
+
+#if !defined(AFX_STDAFX_H__86FA86C7_E476_4354_82E7_31381D4EE9BC__INCLUDED_)
+#define AFX_STDAFX_H__86FA86C7_E476_4354_82E7_31381D4EE9BC__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// The MIDIToolkit sources compiled into this project rely on this
+//  header (through the precompiled header) for their standard includes
+
+#include <windows.h>
+#include <comdef.h>
+
+#include <crtdbg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//{{AFX_INSERT_LOCATION}}
+// Microsoft Visual C++ will insert additional declarations immediately before the previous line.
+
+#endif // !defined(AFX_STDAFX_H__86FA86C7_E476_4354_82E7_31381D4EE9BC__INCLUDED_)
@@ -300,6 +300,10 @@ SOURCE=.\MIDIOut.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIStream.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.cpp
 # ADD CPP /Yc"stdafx.h"
 # End Source File
@@ -317,6 +321,10 @@ SOURCE=.\MIDIOut.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIStream.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.h
 # End Source File
 # End Group
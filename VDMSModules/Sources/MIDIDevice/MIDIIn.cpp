@@ -16,7 +16,7 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define UM_MIM_TIMESTAMP  (WM_USER + 0x100)
+#define UM_MIM_QUEUED     (WM_USER + 0x100)    // messages were queued while the recorder thread was asleep
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -114,6 +114,12 @@ STDMETHODIMP CMIDIIn::Init(IUnknown * configuration) {
 
   m_deviceName = MidiInGetName();     // Obtain information about the device (its name)
 
+  if (!m_queue.Create(MIDIIN_QUEUELEN * sizeof(record_t)))
+    return E_OUTOFMEMORY;
+
+  m_isWaiting = 1;
+  m_numLost = m_numLostLogged = 0;
+
   // Create the garbage-collector thread (frees up memory allocated during asynchronous MIDI SysEx uploads)
   m_recThread.Create(this, _T("MIDI-In Recorder"), true);      /* TODO: check that creation was successful */
   m_recThread.SetPriority(THREAD_PRIORITY_TIME_CRITICAL);
@@ -133,6 +139,8 @@ STDMETHODIMP CMIDIIn::Destroy() {
   if (m_recThread.GetThreadHandle() != NULL)
     m_recThread.Cancel();
 
+  m_queue.Destroy();
+
   // Release the MIDI-out module
   m_midiOut = NULL;
 
@@ -151,8 +159,6 @@ STDMETHODIMP CMIDIIn::Destroy() {
 
 unsigned int CMIDIIn::Run(CThread& thread) {
   MSG message;
-  DWORD thisTime = 0, lastTime = 0;
-  bool sentLastEvent = true;
 
   _ASSERTE(thread.GetThreadID() == m_recThread.GetThreadID());
 
@@ -168,7 +174,6 @@ unsigned int CMIDIIn::Run(CThread& thread) {
     BYTE     status  = _MIM_STATUS(midiMsg);
     BYTE     data1   = _MIM_DATA1(midiMsg);
     BYTE     data2   = _MIM_DATA2(midiMsg);
-    int      length  = MIDI_evt_len[status & 0xff];
 
     switch (message.message) {
       case WM_QUIT:
@@ -183,32 +188,12 @@ unsigned int CMIDIIn::Run(CThread& thread) {
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDI-in device closed (handle = 0x%08x)"), hMidiIn));
         break;
 
-      case UM_MIM_TIMESTAMP:
-        lastTime = lastTime == 0 ? message.lParam : sentLastEvent ? thisTime : lastTime;
-        thisTime = message.lParam;
+      case UM_MIM_QUEUED:
+        DrainQueue();
         break;
 
-      case MM_MIM_DATA:
-        if (m_midiOut != NULL) {
-          HRESULT hr;
-
-          sentLastEvent = false;
-
-          if (length < 1) {
-            RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Invalid MIDI event received from driver: %d %d %d (%08x)"), status & 0xff, data1 & 0xff, data2 & 0xff, (int)midiMsg));
-            break;
-          }
-
-          if (FAILED(hr = m_midiOut->HandleEvent((thisTime - lastTime) * 1000l, status, data1, data2, length - 1))) {
-            RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not push MIDI event:\n0x%08x - %s"), (int)hr, (LPCTSTR)FormatMessage(hr)));
-          } else {
-            sentLastEvent = true;
-          }
-        } break;
-
       case MM_MIM_ERROR:
         if (m_midiOut != NULL) {
-          sentLastEvent = false;
           RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Invalid MIDI event received from external device: %d %d %d (%08x)"), status & 0xff, data1 & 0xff, data2 & 0xff, (int)midiMsg));
         } break;
 
@@ -229,10 +214,62 @@ unsigned int CMIDIIn::Run(CThread& thread) {
 // Utility functions
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// Forwards the messages waiting in the queue (recorder thread), until the
+//  queue is empty and the callback was told to wake the thread up again
+//
+void CMIDIIn::DrainQueue(void) {
+  record_t records[MIDIIN_BATCHLEN];
+
+  while (true) {
+    LONG numRecords;
+
+    InterlockedExchange((LPLONG)&m_isWaiting, 0);
+
+    while ((numRecords = m_queue.Read(records, (LONG)sizeof(records)) / (LONG)sizeof(records[0])) > 0) {
+      for (int i = 0; i < numRecords; i++) {
+        BYTE status = _MIM_STATUS(records[i].midiMsg);
+        BYTE data1  = _MIM_DATA1(records[i].midiMsg);
+        BYTE data2  = _MIM_DATA2(records[i].midiMsg);
+        int  length = MIDI_evt_len[status & 0xff];
+
+        if (m_midiOut == NULL)
+          continue;
+
+        if (length < 1) {
+          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Invalid MIDI event received from driver: %d %d %d (%08x)"), status & 0xff, data1 & 0xff, data2 & 0xff, (int)records[i].midiMsg));
+          continue;
+        }
+
+        HRESULT hr;
+
+        // Stamp the event with the time it was received at by the driver
+        if (FAILED(hr = m_midiOut->HandleEvent(m_startTime + records[i].msTime * (LONGLONG)1000, status, data1, data2, length - 1))) {
+          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not push MIDI event:\n0x%08x - %s"), (int)hr, (LPCTSTR)FormatMessage(hr)));
+        }
+      }
+    }
+
+    // Going to sleep: from now on the callback wakes the thread up, unless
+    //  a message slipped in before it could know
+    InterlockedExchange((LPLONG)&m_isWaiting, 1);
+
+    if (m_queue.GetUsed() < (LONG)sizeof(record_t))
+      break;
+  }
+
+  if (m_numLost != m_numLostLogged) {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d incoming MIDI message(s) were lost because the recorder thread could not keep up"), m_numLost - m_numLostLogged));
+    m_numLostLogged = m_numLost;
+  }
+}
+
 //
 // Callback function invoked by MIDI driver when the device is opened/closed,
-//  or when a MIDI event (or SysEx) is received.  Necessary to obtain the
-//  MIDI event timestamp (can only be obtained through callback method).
+//  or when a MIDI event (or SysEx) is received.  Incoming events are queued
+//  right here, with their timestamps (only available to a callback
+//  function); the recorder thread is only posted a message if it has to be
+//  woken up.
 //
 void CALLBACK CMIDIIn::MidiInProc(HMIDIIN hmi, UINT wMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2) {
   CMIDIIn* pThis = (CMIDIIn*)dwInstance;
@@ -255,8 +292,25 @@ void CALLBACK CMIDIIn::MidiInProc(HMIDIIN hmi, UINT wMsg, DWORD dwInstance, DWOR
 #       error Incosistency between MIM_xxx and MM_MIM_xxx macros, will result in abnormal runtime behaviour!
 #       endif
         _ASSERTE(hmi == pThis->m_hMidiIn);
-        pThis->m_recThread.PostMessage(UM_MIM_TIMESTAMP, (WPARAM)hmi, dwParam2);
-        pThis->m_recThread.PostMessage(wMsg, (WPARAM)hmi, dwParam1);
+
+        if (wMsg == MIM_DATA) {
+          record_t record;
+
+          record.msTime  = dwParam2;
+          record.midiMsg = dwParam1;
+
+          if (pThis->m_queue.GetFree() < (LONG)sizeof(record)) {
+            pThis->m_numLost++;     // only this callback ever changes it
+            break;
+          }
+
+          pThis->m_queue.Write(&record, sizeof(record));
+
+          if (InterlockedExchange((LPLONG)&pThis->m_isWaiting, 0) != 0)
+            pThis->m_recThread.PostMessage(UM_MIM_QUEUED, (WPARAM)hmi, NULL);
+        } else {
+          pThis->m_recThread.PostMessage(wMsg, (WPARAM)hmi, dwParam1);
+        }
         break;
     }
   } catch (...) { }
@@ -284,7 +338,7 @@ bool CMIDIIn::MidiInOpen(bool isInteractive) {
   MMRESULT errCode;
 
   // Attempt to open the MIDI-in device
-  while ((errCode = midiInOpen(&m_hMidiIn, m_deviceID, m_recThread.GetThreadID(), NULL, CALLBACK_THREAD)) != MMSYSERR_NOERROR) {
+  while ((errCode = midiInOpen(&m_hMidiIn, m_deviceID, (DWORD)MidiInProc, (DWORD)this, CALLBACK_FUNCTION)) != MMSYSERR_NOERROR) {
     if (isErrLog) {         // do we log the error ?
       RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not open the device %d ('%s'):\n0x%08x - %s"), m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiInGetError(errCode)));
       isErrLog = false;     // only log this error once, as it will probably (re)occur several times in a row
@@ -309,7 +363,8 @@ bool CMIDIIn::MidiInOpen(bool isInteractive) {
     isErrLog    = true;     // Next time we get an error, log it
     isErrPrompt = true;     // Next time we get an error, prompt the user (if interactive)
 
-    midiInStart(m_hMidiIn); // start recording
+    m_startTime = TIM_GetMicros();
+    midiInStart(m_hMidiIn); // start recording (the driver's timestamps count from here)
 
     return true;
   } else {                  // The device could not be open, and the user did not retry
@@ -10,6 +10,9 @@
 /* TODO: put this in the .INI file ? */
 #define MIDIIN_OPEN_RETRY_INTERVAL   2
 
+#define MIDIIN_QUEUELEN     4096    // how many incoming messages can wait for the recorder thread
+#define MIDIIN_BATCHLEN     64      // how many messages the recorder thread takes out of the queue at once
+
 /////////////////////////////////////////////////////////////////////////////
 
 #pragma warning ( disable : 4192 )
@@ -20,6 +23,7 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
+#include <SPSCRing.h>
 #include <Thread.h>
 
 /////////////////////////////////////////////////////////////////////////////
@@ -33,7 +37,7 @@ class ATL_NO_VTABLE CMIDIIn :
 {
 public:
 	CMIDIIn()
-    : m_hMidiIn(NULL), m_deviceName(_T("<unknown>"))
+    : m_hMidiIn(NULL), m_startTime(0), m_deviceName(_T("<unknown>")), m_isWaiting(1), m_numLost(0), m_numLostLogged(0)
     { }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_MIDIIN)
@@ -62,6 +66,9 @@ public:
 protected:
   static void CALLBACK MidiInProc(HMIDIIN hmi, UINT wMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2);
 
+protected:
+  void DrainQueue(void);
+
 protected:
   bool MidiInOpen(bool isInteractive = true);
   void MidiInClose(void);
@@ -78,8 +85,25 @@ protected:
 protected:
   CString m_deviceName;
   HMIDIIN m_hMidiIn;
+  LONGLONG m_startTime;       // when recording started (microseconds, see TIM_GetMicros)
   CThread m_recThread;
 
+  //
+  // Incoming messages are queued, with the driver's timestamps, straight
+  //  from the driver's callback; the recorder thread is only woken up (with
+  //  a thread message) when it went to sleep on an empty queue, and then
+  //  forwards whatever it finds in the queue, in batches.
+  //
+  typedef struct {
+    DWORD msTime;             // timestamp (milliseconds since recording started)
+    DWORD midiMsg;            // status and data bytes, packed as by the driver
+  } record_t;
+
+  CSPSCRing m_queue;
+  volatile LONG m_isWaiting;  // whether the recorder thread went to sleep on an empty queue (the callback must wake it up)
+  volatile LONG m_numLost;    // how many messages did not fit in the queue
+  LONG m_numLostLogged;
+
 // Interfaces to dependency modules
 protected:
   IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
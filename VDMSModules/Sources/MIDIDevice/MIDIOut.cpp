@@ -12,8 +12,13 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #define INI_STR_DEVICEID      L"device"
+#define INI_STR_MODE          L"mode"
+#define INI_STR_LOOKAHEAD     L"lookahead"
 #define INI_STR_MIDIOUT       L"MidiOut"
 
+#define INI_STR_MODE_DIRECT   _T("direct")
+#define INI_STR_MODE_STREAM   _T("stream")
+
 /////////////////////////////////////////////////////////////////////////////
 
 #define UM_MOM_ERROR      (WM_USER + 0x100)
@@ -75,6 +80,27 @@ STDMETHODIMP CMIDIOut::Init(IUnknown * configuration) {
     // Try to obtain the MIDI-Out settings, use defaults if none specified
     m_deviceID = CFG_Get(Config, INI_STR_DEVICEID, -1, 10, false);
 
+    CString mode = (LPCTSTR)CFG_Get(Config, INI_STR_MODE, INI_STR_MODE_DIRECT, true);
+    m_isStream = false;
+
+    if (mode.CompareNoCase(INI_STR_MODE_STREAM) == 0) {
+      m_isStream = true;
+    } else if (mode.CompareNoCase(INI_STR_MODE_DIRECT) != 0) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Unknown playback mode '%s', using '%s' instead"), (LPCTSTR)mode, INI_STR_MODE_DIRECT));
+    }
+
+    // The stream must be kept ahead of the device by more than one buffer,
+    //  with the buffers in the pool
+    int lookahead = CFG_Get(Config, INI_STR_LOOKAHEAD, 40, 10, true);
+    int lookaheadLo = 2 * MDS_PERIOD, lookaheadHi = (MIDIHDR_POOL - 2) * MDS_PERIOD;
+
+    if ((lookahead < lookaheadLo) || (lookahead > lookaheadHi)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The lookahead (%dms) must be between %dms and %dms"), lookahead, lookaheadLo, lookaheadHi));
+      lookahead = max(lookaheadLo, min(lookahead, lookaheadHi));
+    }
+
+    m_lookahead = lookahead * (LONGLONG)1000;
+
     /** Get modules ********************************************************/
 
     // Try to obtain an interface to a MIDI-out module, use NULL if none available
@@ -86,17 +112,70 @@ STDMETHODIMP CMIDIOut::Init(IUnknown * configuration) {
 
   m_deviceName = MidiOutGetName();    // Obtain information about the device (its name)
 
-  // Create the garbage-collector thread (frees up memory allocated during asynchronous MIDI SysEx uploads)
+  // Allocate the SysEx memory once and for all
+  try {
+    m_arena = new CHAR[MIDIHDR_POOL * MIDIHDR_SLOTLEN];
+  } catch (CMemoryException * pme) {
+    TCHAR errMsg[1024] = _T("<no description available>");
+    pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while allocating MIDI system-exclusive memory (%d bytes):\n%s"), MIDIHDR_POOL * MIDIHDR_SLOTLEN, errMsg));
+    return E_OUTOFMEMORY;
+  }
+
+  // Create the garbage-collector thread (reports device notifications; finished SysEx uploads are recycled by MidiOutProc)
   m_gcThread.Create(this, _T("MIDI-Out Garbage Collector"), true);      /* TODO: check that creation was successful */
   m_gcThread.SetPriority(THREAD_PRIORITY_LOWEST);
   m_gcThread.Resume();
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIOut initialized (device ID = %d, '%s')"), m_deviceID, (LPCTSTR)m_deviceName));
+  // Create the stream thread (opens the device, and keeps it supplied with stream buffers)
+  if (m_isStream) {
+    if (!m_queue.Create(MDS_QUEUELEN) ||
+        ((m_hStreamEvent = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+        !m_streamThread.Create(this, _T("MIDI-Out Stream"), true))
+    {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not create the MIDI stream thread")));
+      Destroy();
+      return E_FAIL;
+    }
+
+    m_isQuit = false;
+    m_hasPending = false;
+    m_numLate = m_numDropped = 0;
+
+    m_streamThread.SetPriority(THREAD_PRIORITY_HIGHEST);
+    m_streamThread.Resume();
+  }
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIOut initialized (device ID = %d, '%s', %s)"), m_deviceID, (LPCTSTR)m_deviceName, m_isStream ? (LPCTSTR)Format(_T("stream, lookahead = %dms"), (int)(m_lookahead / 1000)) : _T("direct")));
 
   return S_OK;
 }
 
 STDMETHODIMP CMIDIOut::Destroy() {
+  // Stop the stream thread (it may be using the device)
+  if (m_streamThread.GetThreadHandle() != NULL) {
+    m_isQuit = true;
+    SetEvent(m_hStreamEvent);
+
+    if (!m_streamThread.Join(MDS_QUIT_TIMEOUT)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Timed out while waiting for the MIDI stream thread to exit")));
+      return E_FAIL;
+    }
+
+    if (m_numLate > 0)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d MIDI message(s) arrived too late to be played on time; consider a longer lookahead"), m_numLate));
+
+    if (m_numDropped > 0)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d MIDI message(s) were dropped because the stream queue was full"), m_numDropped));
+  }
+
+  if (m_hStreamEvent != NULL) {
+    CloseHandle(m_hStreamEvent);
+    m_hStreamEvent = NULL;
+  }
+
+  m_queue.Destroy();
+
   // Release the MIDI device
   if (m_hMidiOut != NULL)
     MidiOutClose();
@@ -105,6 +184,10 @@ STDMETHODIMP CMIDIOut::Destroy() {
   if (m_gcThread.GetThreadHandle() != NULL)
     m_gcThread.Cancel();
 
+  // Release the SysEx memory
+  delete[] m_arena;
+  m_arena = NULL;
+
   // Release the MIDI-out module
   m_midiOut = NULL;
 
@@ -124,7 +207,9 @@ STDMETHODIMP CMIDIOut::Destroy() {
 STDMETHODIMP CMIDIOut::HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
   HRESULT hrThis = S_OK, hrThat = S_OK;
 
-  if ((m_hMidiOut == NULL) && (!MidiOutOpen(false))) {
+  if (m_isStream) {
+    MidiStreamPost(usDelta, status | (data1 << 8) | (data2 << 16), NULL, 0);
+  } else if ((m_hMidiOut == NULL) && (!MidiOutOpen(false))) {
     hrThis = S_FALSE;         // The device is not open, and an attempt to open it failed
   } else {
     union {
@@ -152,49 +237,59 @@ STDMETHODIMP CMIDIOut::HandleSysEx(LONGLONG usDelta, BYTE * data, LONG length) {
 
   HRESULT hrThis = S_OK, hrThat = S_OK;
 
-  if ((m_hMidiOut == NULL) && (!MidiOutOpen(false))) {
+  if (m_isStream) {
+    MidiStreamPost(usDelta, 0, data, length);
+  } else if ((m_hMidiOut == NULL) && (!MidiOutOpen(false))) {
     hrThis = S_FALSE;         // The device is not open, and an attempt to open it failed
   } else {
+    LONG totalBytes = length + 2;
+    bool isPooled = (totalBytes <= MIDIHDR_SLOTLEN) && (m_freeHdrs > 0);
     MIDIHDR* midiHdr = NULL;
-    LPSTR sysExMsg = NULL;
 
-    try {
-      midiHdr  = new MIDIHDR;
-      sysExMsg = new CHAR[length + 2];
+    // The message is always sent in one header: the next pooled one if it
+    //  is free and large enough, else one allocated for this message alone
+    //  (released by the garbage collector thread once played), so that the
+    //  caller never waits on the device
+    if (isPooled) {
+      midiHdr = &(m_midiHdrs[m_nextHdr]);
+
+      _ASSERTE((midiHdr->dwFlags & MHDR_PREPARED) == MHDR_PREPARED);
+      _ASSERTE((midiHdr->dwFlags & MHDR_INQUEUE) == 0);
+
+      // The header was prepared for the whole slot, and is only shortened
+      //  to fit the data
+      midiHdr->dwBufferLength = totalBytes;
+      midiHdr->dwFlags &= ~MHDR_DONE;
+
+      InterlockedDecrement((LPLONG)&m_freeHdrs);
+    } else {
+      midiHdr = MidiOutAllocBuffer(totalBytes);
+    }
+
+    if (midiHdr != NULL) {
+      LPSTR sysExMsg = midiHdr->lpData;
 
       sysExMsg[0] = (char)(0xf0);           // SYSEX event
       memcpy(&(sysExMsg[1]), data, length); // the actual SysEx data
       sysExMsg[length + 1] = (char)(0xf7);  // EOX event
 
-      midiHdr->lpData = sysExMsg;
-      midiHdr->dwBufferLength = length + 2;
-      midiHdr->dwBytesRecorded = 0;
-      midiHdr->dwUser = (DWORD)midiHdr;
-      midiHdr->dwFlags = 0;
-
       MMRESULT errCode;
 
-      if ((errCode = midiOutPrepareHeader(m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
-        CString args = Format(_T("0x%08x, %p, %d"), m_hMidiOut, midiHdr, sizeof(*midiHdr));
-        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutPrepareHeader(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
-        AfxThrowUserException();
-      }
-
       if ((errCode = midiOutLongMsg(m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
         CString args = Format(_T("0x%08x, %p, %d"), m_hMidiOut, midiHdr, sizeof(*midiHdr));
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutLongMsg(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
-        AfxThrowUserException();
+
+        if (isPooled) {
+          InterlockedIncrement((LPLONG)&m_freeHdrs);
+        } else {
+          MidiOutFreeBuffer(m_hMidiOut, midiHdr);
+        }
+
+        hrThis = S_FALSE;
+      } else if (isPooled) {
+        m_nextHdr = (m_nextHdr + 1) % MIDIHDR_POOL;
       }
-    } catch (CMemoryException * pme) {
-      TCHAR errMsg[1024] = _T("<no description available>");
-      pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
-      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while handling a MIDI system-exclusive message:\nmidiHdr  = %p (%d bytes)\nsysExMsg = %p (%d bytes)\n%s"), midiHdr, sizeof(*midiHdr), sysExMsg, length + 2, errMsg));
-      delete midiHdr;
-      delete[] sysExMsg;
-      hrThis = S_FALSE;
-    } catch (CUserException * /*pue*/) {
-      delete midiHdr;
-      delete[] sysExMsg;
+    } else {
       hrThis = S_FALSE;
     }
   }
@@ -221,6 +316,9 @@ STDMETHODIMP CMIDIOut::HandleRealTime(LONGLONG usDelta, BYTE data) {
 unsigned int CMIDIOut::Run(CThread& thread) {
   MSG message;
 
+  if (thread.GetThreadID() == m_streamThread.GetThreadID())
+    return MidiStreamRun(thread);
+
   _ASSERTE(thread.GetThreadID() == m_gcThread.GetThreadID());
 
   RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Garbage collector thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
@@ -245,12 +343,9 @@ unsigned int CMIDIOut::Run(CThread& thread) {
 
       case MM_MOM_DONE:
         _ASSERTE(midiHdr != NULL);
-        _ASSERTE(midiHdr->lpData != NULL);
-        _ASSERTE(midiHdr->dwUser != NULL);
         _ASSERTE((midiHdr->dwFlags & MHDR_DONE) == MHDR_DONE);
 
-        delete[] (CHAR*)(midiHdr->lpData);
-        delete (MIDIHDR*)(midiHdr->dwUser);
+        MidiOutFreeBuffer(hMidiOut, midiHdr);
         break;
 
       case UM_MOM_ERROR:
@@ -276,10 +371,12 @@ unsigned int CMIDIOut::Run(CThread& thread) {
 
 //
 // Callback function invoked by MIDI driver when the device is opened/closed,
-//  or when a (SysEx) buffer finishes playing.
+//  or when a (SysEx) buffer finishes playing.  Finished pooled headers stay
+//  prepared and are handed straight back to HandleSysEx; headers allocated
+//  for a single message are released by the garbage collector thread (no
+//  midiOut calls are allowed from within the callback).
 //
 void CALLBACK CMIDIOut::MidiOutProc(HMIDIOUT hmo, UINT wMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2) {
-  MMRESULT errCode;
   CMIDIOut* pThis = (CMIDIOut*)dwInstance;
   MIDIHDR* midiHdr = (MIDIHDR*)(dwParam1);
 
@@ -296,10 +393,11 @@ void CALLBACK CMIDIOut::MidiOutProc(HMIDIOUT hmo, UINT wMsg, DWORD dwInstance, D
       case MOM_DONE:
         _ASSERTE(hmo == pThis->m_hMidiOut);
         _ASSERTE(midiHdr != NULL);
-        if ((errCode = midiOutUnprepareHeader(hmo, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
-          pThis->m_gcThread.PostMessage(UM_MOM_ERROR, (WPARAM)hmo, (LPARAM)errCode);
+
+        if (midiHdr->dwUser != 0) {
+          pThis->m_gcThread.PostMessage(MM_MOM_DONE, (WPARAM)hmo, (LPARAM)midiHdr);
         } else {
-          pThis->m_gcThread.PostMessage(MM_MOM_DONE, (WPARAM)hmo, (LPARAM)dwParam1);
+          InterlockedIncrement((LPLONG)&(pThis->m_freeHdrs));
         } break;
     }
   } catch (...) { }
@@ -327,7 +425,7 @@ bool CMIDIOut::MidiOutOpen(bool isInteractive) {
   MMRESULT errCode;
 
   // Attempt to open the MIDI-out device
-  while ((errCode = midiOutOpen(&m_hMidiOut, m_deviceID, (DWORD)MidiOutProc, (DWORD)(this), CALLBACK_FUNCTION)) != MMSYSERR_NOERROR) {
+  while ((errCode = (m_isStream ? MidiStreamOpen() : midiOutOpen(&m_hMidiOut, m_deviceID, (DWORD)MidiOutProc, (DWORD)(this), CALLBACK_FUNCTION))) != MMSYSERR_NOERROR) {
     if (isErrLog) {         // do we log the error ?
       RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not open the device %d ('%s'):\n0x%08x - %s"), m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
       isErrLog = false;     // only log this error once, as it will probably (re)occur several times in a row
@@ -348,6 +446,16 @@ bool CMIDIOut::MidiOutOpen(bool isInteractive) {
     }
   }
 
+  if ((m_hMidiOut != NULL) && !MidiOutPrepareBuffers()) {
+    if (m_isStream) {
+      midiStreamClose((HMIDISTRM)m_hMidiOut);
+    } else {
+      midiOutClose(m_hMidiOut);
+    }
+
+    m_hMidiOut = NULL;
+  }
+
   if (m_hMidiOut != NULL) { // The device was opened successfully
     isErrLog    = true;     // Next time we get an error, log it
     isErrPrompt = true;     // Next time we get an error, prompt the user (if interactive)
@@ -361,8 +469,15 @@ bool CMIDIOut::MidiOutOpen(bool isInteractive) {
 // Closes the MIDI device specified in the module's settings
 //
 void CMIDIOut::MidiOutClose(void) {
-  midiOutReset(m_hMidiOut);   // Silence the device
-  midiOutClose(m_hMidiOut);   // Close the device
+  midiOutReset(m_hMidiOut);   // Silence the device (and stop the stream, if any)
+  MidiOutUnprepareBuffers();  // Reclaim the headers (all done after the reset)
+
+  if (m_isStream) {
+    midiStreamClose((HMIDISTRM)m_hMidiOut);
+  } else {
+    midiOutClose(m_hMidiOut); // Close the device
+  }
+
   m_hMidiOut = NULL;          // Lose the handle
 }
 
@@ -389,3 +504,362 @@ CString CMIDIOut::MidiOutGetError(MMRESULT errCode) {
   midiOutGetErrorText(errCode, buf, sizeof(buf) / sizeof(buf[0]));
   return CString(buf);
 }
+
+//
+// Prepares all the SysEx headers (each over its whole slot) on the freshly
+//  opened device; they remain prepared for as long as the device stays open
+//
+bool CMIDIOut::MidiOutPrepareBuffers(void) {
+  if (m_arena == NULL)
+    return false;
+
+  for (int i = 0; i < MIDIHDR_POOL; i++) {
+    MIDIHDR* midiHdr = &(m_midiHdrs[i]);
+    MMRESULT errCode;
+
+    midiHdr->lpData = m_arena + i * MIDIHDR_SLOTLEN;
+    midiHdr->dwBufferLength = MIDIHDR_SLOTLEN;
+    midiHdr->dwBytesRecorded = 0;
+    midiHdr->dwUser = 0;
+    midiHdr->dwFlags = 0;
+
+    if ((errCode = midiOutPrepareHeader(m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
+      CString args = Format(_T("0x%08x, %p, %d"), m_hMidiOut, midiHdr, sizeof(*midiHdr));
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutPrepareHeader(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
+
+      while (--i >= 0)
+        midiOutUnprepareHeader(m_hMidiOut, &(m_midiHdrs[i]), sizeof(m_midiHdrs[i]));
+
+      return false;
+    }
+  }
+
+  m_nextHdr = 0;
+  InterlockedExchange((LPLONG)&m_freeHdrs, MIDIHDR_POOL);
+
+  return true;
+}
+
+//
+// Unprepares all the SysEx headers (the device must have been reset)
+//
+void CMIDIOut::MidiOutUnprepareBuffers(void) {
+  for (int i = 0; i < MIDIHDR_POOL; i++) {
+    MIDIHDR* midiHdr = &(m_midiHdrs[i]);
+    MMRESULT errCode;
+
+    if ((midiHdr->dwFlags & MHDR_PREPARED) == 0)
+      continue;
+
+    if ((errCode = midiOutUnprepareHeader(m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutUnprepareHeader(0x%08x, %p, %d) on device %d ('%s'): 0x%08x - %s"), m_hMidiOut, midiHdr, sizeof(*midiHdr), m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
+  }
+
+  InterlockedExchange((LPLONG)&m_freeHdrs, 0);
+}
+
+//
+// Allocates and prepares a header of <length> bytes for a single SysEx
+//  message, when the pooled headers are all in use or too small; returns
+//  NULL on failure.  SysEx data is never dropped lightly: a lost patch or
+//  parameter upload stays wrong for the rest of the session.
+//
+MIDIHDR* CMIDIOut::MidiOutAllocBuffer(LONG length) {
+  MIDIHDR* midiHdr = NULL;
+  LPSTR sysExMsg = NULL;
+
+  try {
+    midiHdr  = new MIDIHDR;
+    sysExMsg = new CHAR[length];
+  } catch (CMemoryException * pme) {
+    TCHAR errMsg[1024] = _T("<no description available>");
+    pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while handling a MIDI system-exclusive message (%d bytes):\n%s"), length, errMsg));
+    delete midiHdr;
+    return NULL;
+  }
+
+  midiHdr->lpData = sysExMsg;
+  midiHdr->dwBufferLength = length;
+  midiHdr->dwBytesRecorded = 0;
+  midiHdr->dwUser = (DWORD)midiHdr;   // not pooled (see MidiOutProc)
+  midiHdr->dwFlags = 0;
+
+  MMRESULT errCode;
+
+  if ((errCode = midiOutPrepareHeader(m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
+    CString args = Format(_T("0x%08x, %p, %d"), m_hMidiOut, midiHdr, sizeof(*midiHdr));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutPrepareHeader(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
+    delete[] sysExMsg;
+    delete midiHdr;
+    return NULL;
+  }
+
+  return midiHdr;
+}
+
+//
+// Unprepares and releases a header allocated by MidiOutAllocBuffer, once
+//  the device is done with it (the device may have been closed since, in
+//  which case only the memory is released)
+//
+void CMIDIOut::MidiOutFreeBuffer(HMIDIOUT hMidiOut, MIDIHDR* midiHdr) {
+  MMRESULT errCode;
+
+  if (((errCode = midiOutUnprepareHeader(hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) && (hMidiOut == m_hMidiOut))
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiOutUnprepareHeader(0x%08x, %p, %d) on device %d ('%s'): 0x%08x - %s"), hMidiOut, midiHdr, sizeof(*midiHdr), m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
+
+  delete[] (CHAR*)(midiHdr->lpData);
+  delete midiHdr;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Stream mode
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Opens the device for stream playback, stream time being counted in
+//  microseconds (1000 ticks per quarter note, 1000 microseconds per quarter
+//  note); the stream is started once the first buffer is sent
+//
+MMRESULT CMIDIOut::MidiStreamOpen(void) {
+  UINT deviceID = (UINT)m_deviceID;
+  HMIDISTRM hMidiStream = NULL;
+  MMRESULT errCode;
+
+  if ((errCode = midiStreamOpen(&hMidiStream, &deviceID, 1, (DWORD)MidiOutProc, (DWORD)(this), CALLBACK_FUNCTION)) != MMSYSERR_NOERROR)
+    return errCode;
+
+  MIDIPROPTIMEDIV propTimeDiv;
+  propTimeDiv.cbStruct  = sizeof(propTimeDiv);
+  propTimeDiv.dwTimeDiv = 1000;
+
+  MIDIPROPTEMPO propTempo;
+  propTempo.cbStruct = sizeof(propTempo);
+  propTempo.dwTempo  = 1000;
+
+  if (((errCode = midiStreamProperty(hMidiStream, (LPBYTE)&propTimeDiv, MIDIPROP_SET | MIDIPROP_TIMEDIV)) != MMSYSERR_NOERROR) ||
+      ((errCode = midiStreamProperty(hMidiStream, (LPBYTE)&propTempo, MIDIPROP_SET | MIDIPROP_TEMPO)) != MMSYSERR_NOERROR))
+  {
+    midiStreamClose(hMidiStream);
+    return errCode;
+  }
+
+  m_hMidiOut = (HMIDIOUT)hMidiStream;
+
+  m_isStreamStarted = false;
+  m_isWriting = false;
+  m_streamPos = m_streamEnd = 0;
+
+  return MMSYSERR_NOERROR;
+}
+
+//
+// Queues a message (short, or SysEx if data is given) for the stream thread;
+//  never blocks for longer than it takes another caller to do the same.
+//  Messages that were not stamped at the source are stamped now.
+//
+void CMIDIOut::MidiStreamPost(LONGLONG usTime, DWORD message, const BYTE* data, LONG length) {
+  streamrec_t record;
+
+  record.usTime  = (usTime < 0) ? TIM_GetMicros() : usTime;
+  record.message = message;
+  record.length  = 0;
+
+  if (data != NULL) {
+    if ((length < 0) || (length > MDS_MAXSYSEX)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Dropped a %d-byte SysEx message (at most %d bytes can be streamed)"), length, MDS_MAXSYSEX));
+      return;
+    }
+
+    record.length = length + 2;       // framed (F0 ... F7)
+  }
+
+  LONG recordLen = sizeof(record) + record.length;
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_queue.GetFree() < recordLen) {
+    if (m_numDropped++ == 0)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The MIDI stream queue is full, dropping messages")));
+
+    return;
+  }
+
+  // Records go into the queue in one piece, so that the stream thread never
+  //  sees a SysEx record without its data
+  if (record.length > 0) {
+    BYTE* sysExMsg = m_postBuf + sizeof(record);
+
+    memcpy(m_postBuf, &record, sizeof(record));
+    sysExMsg[0] = 0xf0;               // SYSEX event
+    memcpy(sysExMsg + 1, data, length);
+    sysExMsg[length + 1] = 0xf7;      // EOX event
+
+    m_queue.Write(m_postBuf, recordLen);
+  } else {
+    m_queue.Write(&record, sizeof(record));
+  }
+}
+
+//
+// Stream thread: opens the device, then keeps it supplied with stream
+//  buffers every MDS_PERIOD
+//
+unsigned int CMIDIOut::MidiStreamRun(CThread& thread) {
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Stream thread created (handle = 0x%08x, ID = %d)"), (int)thread.GetThreadHandle(), (int)thread.GetThreadID()));
+
+  timeBeginPeriod(1);                 // so that buffers are sent at regular intervals
+
+  while (!m_isQuit) {
+    WaitForSingleObject(m_hStreamEvent, MDS_PERIOD);
+
+    if (m_isQuit)
+      break;
+
+    if ((m_hMidiOut == NULL) && (!MidiOutOpen(false))) {
+      // The device is not open, and an attempt to open it failed; the
+      //  messages are lost, as in direct mode
+      while (m_hasPending || MidiStreamFetch())
+        m_hasPending = false;
+
+      continue;
+    }
+
+    MidiStreamFlush();
+  }
+
+  timeEndPeriod(1);
+
+  return 0;
+}
+
+//
+// Puts the queued messages in stream buffers and sends them to the device.
+//  Each message is played the lookahead after it was stamped; the buffers
+//  sent reach as far as the lookahead past the stream's current position,
+//  the last one ending with a no-op, so that the stream never runs dry and
+//  keeps pace with the system's clock even when there is nothing to play.
+//  Stream time is worked out from the stream's position at each flush, so
+//  that the device's clock drifting (or the stream having been starved)
+//  does not accumulate.
+//
+void CMIDIOut::MidiStreamFlush(void) {
+  LONGLONG now = TIM_GetMicros();
+
+  if (m_isStreamStarted) {
+    MMTIME mmTime;
+    mmTime.wType = TIME_TICKS;
+
+    if ((midiStreamPosition((HMIDISTRM)m_hMidiOut, &mmTime, sizeof(mmTime)) == MMSYSERR_NOERROR) && (mmTime.wType == TIME_TICKS)) {
+      m_streamPos += (DWORD)(mmTime.u.ticks - (DWORD)m_streamPos);  // the position wraps around after 71 minutes
+    } else {
+      m_streamPos += now - m_flushTime;
+    }
+  }
+
+  m_flushTime = now;
+
+  LONGLONG horizon = m_streamPos + m_lookahead;
+
+  while (m_hasPending || MidiStreamFetch()) {
+    LONGLONG tick = m_streamPos + m_lookahead - (now - m_pending.usTime);
+
+    if (tick >= horizon)
+      break;                          // not due within this flush
+
+    if (!m_isWriting) {
+      if (m_freeHdrs <= 0)
+        return;                       // the device is lagging behind; try again next time
+
+      m_writer.Begin((BYTE*)(m_midiHdrs[m_nextHdr].lpData), MIDIHDR_SLOTLEN, m_streamEnd);
+      m_isWriting = true;
+    }
+
+    if (m_pending.length == 0) {
+      m_hasPending = !m_writer.PutShort(tick, m_pending.message);
+    } else {
+      m_pendingOffset += m_writer.PutLong(tick, m_longBuf + m_pendingOffset, m_pending.length - m_pendingOffset);
+      m_hasPending = (m_pendingOffset < m_pending.length);
+    }
+
+    if (!m_hasPending) {
+      if (tick < m_streamPos)
+        m_numLate++;                  // the stream was already past the time the message was due at
+
+      continue;
+    }
+
+    // The buffer is full
+    if (!MidiStreamSubmit())
+      return;
+  }
+
+  if (!m_isWriting) {
+    if (m_freeHdrs <= 0)
+      return;
+
+    m_writer.Begin((BYTE*)(m_midiHdrs[m_nextHdr].lpData), MIDIHDR_SLOTLEN, m_streamEnd);
+    m_isWriting = true;
+  }
+
+  m_writer.Close(horizon);
+  MidiStreamSubmit();
+}
+
+//
+// Retrieves the next queued message; returns false if the queue is empty
+//
+bool CMIDIOut::MidiStreamFetch(void) {
+  if (m_queue.GetUsed() < (LONG)sizeof(m_pending))
+    return false;
+
+  m_queue.Read(&m_pending, sizeof(m_pending));
+
+  if (m_pending.length > 0)
+    m_queue.Read(m_longBuf, m_pending.length);
+
+  m_pendingOffset = 0;
+  m_hasPending    = true;
+
+  return true;
+}
+
+//
+// Sends the buffer being filled to the device (starting the stream if not
+//  yet started); closes the device if that fails, so that it is opened anew
+//
+bool CMIDIOut::MidiStreamSubmit(void) {
+  MIDIHDR* midiHdr = &(m_midiHdrs[m_nextHdr]);
+  MMRESULT errCode;
+
+  m_isWriting = false;
+
+  if (m_writer.GetLength() == 0)
+    return true;
+
+  midiHdr->dwBytesRecorded = m_writer.GetLength();
+  midiHdr->dwFlags &= ~MHDR_DONE;
+
+  InterlockedDecrement((LPLONG)&m_freeHdrs);
+
+  if ((errCode = midiStreamOut((HMIDISTRM)m_hMidiOut, midiHdr, sizeof(*midiHdr))) != MMSYSERR_NOERROR) {
+    CString args = Format(_T("0x%08x, %p, %d"), m_hMidiOut, midiHdr, sizeof(*midiHdr));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("midiStreamOut(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)MidiOutGetError(errCode)));
+    InterlockedIncrement((LPLONG)&m_freeHdrs);
+    MidiOutClose();
+    return false;
+  }
+
+  m_nextHdr = (m_nextHdr + 1) % MIDIHDR_POOL;
+  m_streamEnd = m_writer.GetEndTick();
+
+  if (!m_isStreamStarted) {
+    midiStreamRestart((HMIDISTRM)m_hMidiOut);
+    m_isStreamStarted = true;
+  }
+
+  return true;
+}
@@ -10,6 +10,14 @@
 /* TODO: put this in the .INI file ? */
 #define MIDIOUT_OPEN_RETRY_INTERVAL   2
 
+#define MIDIHDR_POOL                  16      // how many pre-prepared headers (SysEx, or stream buffers) are cycled through
+#define MIDIHDR_SLOTLEN               4096    // how many bytes each header can hold (larger SysEx messages get a header of their own)
+
+#define MDS_PERIOD                    10      // interval (in milliseconds) at which stream buffers are sent to the device
+#define MDS_QUEUELEN                  262144  // room (in bytes) for messages waiting to be put in stream buffers
+#define MDS_MAXSYSEX                  65536   // largest SysEx message that can be streamed
+#define MDS_QUIT_TIMEOUT              5000    // how long to wait for the stream thread to exit
+
 /////////////////////////////////////////////////////////////////////////////
 
 #pragma warning ( disable : 4192 )
@@ -20,8 +28,11 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
+#include <SPSCRing.h>
 #include <Thread.h>
 
+#include "MIDIStream.h"
+
 /////////////////////////////////////////////////////////////////////////////
 // CMIDIOut
 class ATL_NO_VTABLE CMIDIOut : 
@@ -34,7 +45,8 @@ class ATL_NO_VTABLE CMIDIOut :
 {
 public:
   CMIDIOut()
-    : m_hMidiOut(NULL), m_deviceName(_T("<unknown>"))
+    : m_isStream(false), m_lookahead(0), m_hMidiOut(NULL), m_deviceName(_T("<unknown>")), m_arena(NULL), m_nextHdr(0), m_freeHdrs(0),
+      m_hStreamEvent(NULL), m_isQuit(false), m_isStreamStarted(false), m_isWriting(false), m_hasPending(false), m_numLate(0), m_numDropped(0)
     { }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_MIDIOUT)
@@ -75,12 +87,26 @@ protected:
   void MidiOutClose(void);
   CString MidiOutGetName(void);
   CString MidiOutGetError(MMRESULT errCode);
+  bool MidiOutPrepareBuffers(void);
+  void MidiOutUnprepareBuffers(void);
+  MIDIHDR* MidiOutAllocBuffer(LONG length);
+  void MidiOutFreeBuffer(HMIDIOUT hMidiOut, MIDIHDR* midiHdr);
+
+protected:
+  MMRESULT MidiStreamOpen(void);
+  void MidiStreamPost(LONGLONG usTime, DWORD message, const BYTE* data, LONG length);
+  unsigned int MidiStreamRun(CThread& thread);
+  void MidiStreamFlush(void);
+  bool MidiStreamFetch(void);
+  bool MidiStreamSubmit(void);
 
 /////////////////////////////////////////////////////////////////////////////
 
 // Module's settings
 protected:
   int m_deviceID;
+  bool m_isStream;                    // whether messages are played through a stream (see MidiStreamFlush) or sent right away
+  LONGLONG m_lookahead;               // stream mode: how long (in microseconds) after being stamped messages are played
 
 // Other member variables
 protected:
@@ -88,6 +114,45 @@ protected:
   HMIDIOUT m_hMidiOut;
   CThread m_gcThread;
 
+  CHAR* m_arena;                      // SysEx memory, split into MIDIHDR_POOL slots of MIDIHDR_SLOTLEN bytes
+  MIDIHDR m_midiHdrs[MIDIHDR_POOL];   // headers, each permanently pointing at its own slot in m_arena
+  int m_nextHdr;                      // next header to send (headers complete in the order they were sent)
+  volatile LONG m_freeHdrs;           // how many headers are not queued on the device (recycled by MidiOutProc)
+
+  //
+  // Stream mode: messages are queued (with their timestamps) by the
+  //  caller's thread, and put in stream buffers by the stream thread, which
+  //  alone talks to the device.  Stream time is measured in microseconds.
+  //
+  CThread m_streamThread;
+  HANDLE m_hStreamEvent;              // signalled to stop the stream thread
+  CSPSCRing m_queue;
+  CCriticalSection m_mutex;           // regulates access to the producer side of m_queue (there may be more than one caller)
+  volatile bool m_isQuit;
+
+  CMIDIStreamWriter m_writer;
+  bool m_isStreamStarted;             // whether the stream was started since the device was opened
+  bool m_isWriting;                   // whether m_writer is filling the header at m_nextHdr
+  LONGLONG m_streamPos;               // where the stream was at during the last flush
+  LONGLONG m_streamEnd;               // where the buffers sent to the device end
+  LONGLONG m_flushTime;               // when the last flush took place (see TIM_GetMicros)
+
+  typedef struct {
+    LONGLONG usTime;                  // timestamp
+    DWORD message;                    // short message (as for midiOutShortMsg), if length is 0
+    LONG length;                      // how many bytes of long message (framed SysEx) follow the record
+  } streamrec_t;
+
+  streamrec_t m_pending;              // the next message to be put in a stream buffer
+  LONG m_pendingOffset;               // how many bytes of its long message were put in stream buffers already
+  bool m_hasPending;
+
+  LONG m_numLate;                     // how many messages arrived too late to be played on time
+  LONG m_numDropped;                  // how many messages did not fit in the queue
+
+  BYTE m_postBuf[sizeof(streamrec_t) + MDS_MAXSYSEX + 2];   // used by the caller's thread to put together SysEx records
+  BYTE m_longBuf[MDS_MAXSYSEX + 2];   // used by the stream thread to retrieve SysEx data
+
 // Interfaces to dependency modules
 protected:
   IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
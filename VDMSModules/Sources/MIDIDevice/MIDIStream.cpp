@@ -0,0 +1,133 @@
+// MIDIStream.cpp: implementation of the CMIDIStreamWriter class.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MIDIStream.h"
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CMIDIStreamWriter::CMIDIStreamWriter(void)
+  : m_buffer(NULL), m_size(0), m_length(0), m_lastTick(0)
+{ }
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Starts filling a buffer; startTick is the time the previous buffer ended
+//  at (the time the stream will be at when it gets to this buffer)
+//
+void CMIDIStreamWriter::Begin(
+  BYTE* buffer,
+  DWORD size,
+  LONGLONG startTick)
+{
+  m_buffer   = buffer;
+  m_size     = size & ~3;
+  m_length   = 0;
+  m_lastTick = startTick;
+}
+
+//
+// Appends a short message (status and data bytes packed as for
+//  midiOutShortMsg); returns false if the buffer is full
+//
+bool CMIDIStreamWriter::PutShort(
+  LONGLONG tick,
+  DWORD message)
+{
+  return PutEvent(tick, MDS_EVT_SHORTMSG | (message & 0x00ffffff), NULL, 0);
+}
+
+//
+// Appends as much of a long message (raw bytes, e.g. a framed SysEx
+//  message) as fits in the buffer, and returns how many bytes were taken;
+//  the rest can be put in the next buffer, drivers passing long messages on
+//  as a raw byte stream
+//
+long CMIDIStreamWriter::PutLong(
+  LONGLONG tick,
+  const BYTE* data,
+  long length)
+{
+  if ((length <= 0) || (m_length + MDS_LONGLEN(1) > m_size))
+    return 0;
+
+  long maxLength = (long)(m_size - m_length - MDS_SHORTLEN);
+
+  if (length > maxLength)
+    length = maxLength;
+
+  if (!PutEvent(tick, MDS_EVT_LONGMSG | (DWORD)length, data, length))
+    return 0;
+
+  return length;
+}
+
+//
+// Ends the buffer with a no-op event at the given time, so that the stream
+//  gets there even if there was nothing else to play; returns false if the
+//  buffer is full (in which case the stream gets no further than the last
+//  event)
+//
+bool CMIDIStreamWriter::Close(
+  LONGLONG endTick)
+{
+  if (endTick <= m_lastTick)
+    return true;
+
+  return PutEvent(endTick, MDS_EVT_NOP, NULL, 0);
+}
+
+//
+// How many bytes of events are in the buffer
+//
+DWORD CMIDIStreamWriter::GetLength(void) const {
+  return m_length;
+}
+
+//
+// Time the stream will be at once it played the buffer
+//
+LONGLONG CMIDIStreamWriter::GetEndTick(void) const {
+  return m_lastTick;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Utility functions
+//////////////////////////////////////////////////////////////////////
+
+bool CMIDIStreamWriter::PutEvent(
+  LONGLONG tick,
+  DWORD event,
+  const BYTE* data,
+  long length)
+{
+  DWORD eventLen = (length > 0) ? MDS_LONGLEN(length) : MDS_SHORTLEN;
+
+  if (m_length + eventLen > m_size)
+    return false;
+
+  if (tick < m_lastTick)
+    tick = m_lastTick;
+
+  DWORD* record = (DWORD*)(m_buffer + m_length);
+
+  record[0] = (DWORD)(tick - m_lastTick);   // delta-time
+  record[1] = 0;                            // stream ID
+  record[2] = event;
+
+  if (length > 0) {
+    memcpy(record + 3, data, length);
+    memset((BYTE*)(record + 3) + length, 0, eventLen - MDS_SHORTLEN - length);
+  }
+
+  m_length  += eventLen;
+  m_lastTick = tick;
+
+  return true;
+}
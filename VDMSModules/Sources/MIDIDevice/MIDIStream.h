@@ -0,0 +1,50 @@
+#ifndef __MIDISTREAM_H_
+#define __MIDISTREAM_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MDS_SHORTLEN        12      // size of a short event in a stream buffer (delta-time, stream ID, message)
+#define MDS_LONGLEN(len)    (12 + (((len) + 3) & ~3))   // size of a long event of len bytes (padded to a DWORD boundary)
+
+#define MDS_EVT_SHORTMSG    0x00000000L     // event types, as in the high byte of MIDIEVENT::dwEvent
+#define MDS_EVT_NOP         0x02000000L
+#define MDS_EVT_LONGMSG     0x80000000L
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Lays out time-stamped MIDI messages in a stream buffer, in the format
+//  played back by midiStreamOut (a sequence of MIDIEVENT records, each
+//  timed relative to the one before).  Times are given as absolute stream
+//  ticks; the writer works out the delta-times, starting from where the
+//  previous buffer ended.  Messages given for a time already past are
+//  placed at the end of the buffer so far (played as soon as possible).
+//  A buffer can be closed at a given time with a no-op event, so that the
+//  next buffer takes over at that time even if the buffer is idle.
+//
+// No operating system services are used.
+//
+class CMIDIStreamWriter {
+  public:
+    CMIDIStreamWriter(void);
+
+  public:
+    void Begin(BYTE* buffer, DWORD size, LONGLONG startTick);
+    bool PutShort(LONGLONG tick, DWORD message);
+    long PutLong(LONGLONG tick, const BYTE* data, long length);
+    bool Close(LONGLONG endTick);
+
+    DWORD GetLength(void) const;
+    LONGLONG GetEndTick(void) const;
+
+  protected:
+    bool PutEvent(LONGLONG tick, DWORD event, const BYTE* data, long length);
+
+  protected:
+    BYTE* m_buffer;
+    DWORD m_size;
+    DWORD m_length;                     // how many bytes of events were written
+    LONGLONG m_lastTick;                // time of the last event written (or of the end of the previous buffer)
+};
+
+#endif //__MIDISTREAM_H_
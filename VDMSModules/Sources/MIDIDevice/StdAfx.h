@@ -26,6 +26,8 @@ extern CComModule _Module;
 
 // TODO: reference additional headers your program requires here
 
+#include <afxmt.h>
+
 #include <mmsystem.h>
 #pragma comment ( lib , "winmm.lib" )
 
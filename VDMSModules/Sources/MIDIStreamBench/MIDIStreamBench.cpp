@@ -0,0 +1,438 @@
+// MIDIStreamBench.cpp : checks the MIDI Player's stream mode off-target.
+//  The stream buffers laid out by CMIDIStreamWriter, the same way as
+//  CMIDIOut::MidiStreamFlush does, are played back by a virtual stream port
+//  whose clock drifts away from the system's, while the flushes are
+//  scheduled with jitter.  Reports how far from its stamp plus the
+//  lookahead each message was played, and whether the stream ever ran dry;
+//  then checks that a SysEx message spanning several buffers arrives intact.
+//
+// Usage: MIDIStreamBench [events [drift (ppm)]]
+//
+// No operating system services are used (StdAfx.h stands in for the
+//  Windows types elsewhere), so the tool also builds on other platforms.
+//  The exit code is non-zero if any check fails, so that the tool can be
+//  run unattended.
+//
+
+#include "stdafx.h"
+
+#include "../MIDIDevice/MIDIStream.h"
+
+#include <deque>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_EVENTS        20000
+#define DEFAULT_DRIFT         100       // how much faster (in ppm) the port's clock runs than the system's
+
+#define LOOKAHEAD             40000     // microseconds; the MIDI Player's default
+#define FLUSH_PERIOD          10000     // microseconds; as MDS_PERIOD
+#define FLUSH_JITTER          4000      // how late (at most, in microseconds) a flush may run
+#define MAX_EVENT_GAP         3000      // largest interval (in microseconds) between two messages
+
+#define NUM_HDRS              16        // as MIDIHDR_POOL
+#define HDR_LEN               4096      // as MIDIHDR_SLOTLEN
+
+#define SYSEX_LEN             10002     // spans three buffers
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  LONGLONG usTime;                      // when the message was stamped (system time)
+  DWORD message;                        // short message
+  std::vector<BYTE> data;               // long message (if not empty)
+} message_t;
+
+typedef struct {
+  LONGLONG tick;                        // when the message was played (port time)
+  DWORD message;                        // short message (0xf0 for a piece of a long message)
+} played_t;
+
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned long seed = 1;
+
+//
+// Deterministic pseudo-random numbers
+//
+static int Random(int range) {
+  seed = seed * 1103515245UL + 12345UL;
+  return (int)((seed >> 16) & 0x7fff) % range;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Plays stream buffers back to back, as midiStreamOut does: each event is
+//  due its delta-time after the one before.  The port's position is its
+//  own clock; if the port runs out of buffers its clock keeps going, and
+//  the next event plays as soon as it arrives (if it is already late).
+//
+class CVirtualStreamPort {
+  public:
+    CVirtualStreamPort(void)
+      : m_offset(0), m_position(0), m_eventTick(0), m_isStarved(false), m_numStarved(0)
+      { }
+
+  public:
+    void Submit(const BYTE* data, DWORD length) {
+      m_buffers.push_back(std::vector<BYTE>(data, data + length));
+    }
+
+    void Advance(LONGLONG position) {
+      while (true) {
+        if (m_buffers.empty()) {
+          m_isStarved = (m_position < position);
+          m_position  = position;
+          return;
+        }
+
+        std::vector<BYTE>& buffer = m_buffers.front();
+
+        if (m_offset >= buffer.size()) {
+          m_buffers.pop_front();
+          m_offset = 0;
+          continue;
+        }
+
+        const DWORD* record = (const DWORD*)(&buffer[m_offset]);
+        LONGLONG tick = m_eventTick + record[0];
+
+        if (m_isStarved) {
+          m_numStarved++;
+          m_isStarved = false;
+
+          if (tick < m_position)
+            tick = m_position;
+        }
+
+        if (tick > position) {
+          m_position = position;
+          return;
+        }
+
+        m_eventTick = tick;
+
+        if (tick > m_position)
+          m_position = tick;
+
+        played_t played;
+        played.tick = m_position;
+
+        if (record[2] & MDS_EVT_LONGMSG) {
+          DWORD length = record[2] & 0x00ffffff;
+          sysEx.insert(sysEx.end(), (const BYTE*)(record + 3), (const BYTE*)(record + 3) + length);
+          played.message = 0xf0;
+          m_offset += MDS_LONGLEN(length);
+        } else {
+          played.message = record[2] & 0x00ffffff;
+          m_offset += MDS_SHORTLEN;
+        }
+
+        if ((record[2] & 0xff000000) != MDS_EVT_NOP)
+          playedEvents.push_back(played);
+      }
+    }
+
+    LONGLONG GetPosition(void) const {
+      return m_position;
+    }
+
+    int GetNumQueued(void) const {
+      return (int)m_buffers.size();
+    }
+
+    int GetNumStarved(void) const {
+      return m_numStarved;
+    }
+
+  public:
+    std::vector<played_t> playedEvents;
+    std::vector<BYTE> sysEx;            // the pieces of the long messages, put back together
+
+  protected:
+    std::deque<std::vector<BYTE> > m_buffers;
+    size_t m_offset;                    // next event in the first buffer
+    LONGLONG m_position;
+    LONGLONG m_eventTick;               // when the last event was due
+    bool m_isStarved;
+    int m_numStarved;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// The MIDI Player's stream thread, less the device: the same flushing
+//  logic, against the virtual port
+//
+class CStreamFlusher {
+  public:
+    CStreamFlusher(CVirtualStreamPort& port)
+      : m_port(port), m_nextHdr(0), m_isStarted(false), m_isWriting(false), m_startTime(0),
+        m_streamPos(0), m_streamEnd(0), m_hasPending(false), m_pendingOffset(0), m_numLate(0)
+      { }
+
+  public:
+    void Queue(const message_t& message) {
+      m_queue.push_back(message);
+    }
+
+    void Flush(LONGLONG now) {
+      if (m_isStarted)
+        m_streamPos = m_port.GetPosition();
+
+      LONGLONG horizon = m_streamPos + LOOKAHEAD;
+
+      while (m_hasPending || Fetch()) {
+        LONGLONG tick = m_streamPos + LOOKAHEAD - (now - m_pending.usTime);
+
+        if (tick >= horizon)
+          break;
+
+        if (!m_isWriting) {
+          if (m_port.GetNumQueued() >= NUM_HDRS)
+            return;
+
+          m_writer.Begin(m_hdrs[m_nextHdr], HDR_LEN, m_streamEnd);
+          m_isWriting = true;
+        }
+
+        if (m_pending.data.empty()) {
+          m_hasPending = !m_writer.PutShort(tick, m_pending.message);
+        } else {
+          m_pendingOffset += m_writer.PutLong(tick, &m_pending.data[m_pendingOffset], (long)m_pending.data.size() - m_pendingOffset);
+          m_hasPending = (m_pendingOffset < (long)m_pending.data.size());
+        }
+
+        if (!m_hasPending) {
+          if (tick < m_streamPos)
+            m_numLate++;
+
+          continue;
+        }
+
+        Submit(now);
+      }
+
+      if (!m_isWriting) {
+        if (m_port.GetNumQueued() >= NUM_HDRS)
+          return;
+
+        m_writer.Begin(m_hdrs[m_nextHdr], HDR_LEN, m_streamEnd);
+        m_isWriting = true;
+      }
+
+      m_writer.Close(horizon);
+      Submit(now);
+    }
+
+    bool IsStarted(void) const {
+      return m_isStarted;
+    }
+
+    // When the port's clock started (system time)
+    LONGLONG GetStartTime(void) const {
+      return m_startTime;
+    }
+
+    int GetNumLate(void) const {
+      return m_numLate;
+    }
+
+  protected:
+    bool Fetch(void) {
+      if (m_queue.empty())
+        return false;
+
+      m_pending = m_queue.front();
+      m_queue.pop_front();
+      m_pendingOffset = 0;
+      m_hasPending = true;
+
+      return true;
+    }
+
+    void Submit(LONGLONG now) {
+      m_isWriting = false;
+
+      if (m_writer.GetLength() == 0)
+        return;
+
+      m_port.Submit(m_hdrs[m_nextHdr], m_writer.GetLength());
+      m_nextHdr = (m_nextHdr + 1) % NUM_HDRS;
+      m_streamEnd = m_writer.GetEndTick();
+
+      if (!m_isStarted) {
+        m_isStarted = true;
+        m_startTime = now;
+      }
+    }
+
+  protected:
+    CVirtualStreamPort& m_port;
+    CMIDIStreamWriter m_writer;
+    BYTE m_hdrs[NUM_HDRS][HDR_LEN];
+    int m_nextHdr;
+
+    bool m_isStarted;
+    bool m_isWriting;
+    LONGLONG m_startTime;
+    LONGLONG m_streamPos;
+    LONGLONG m_streamEnd;
+
+    std::deque<message_t> m_queue;
+    message_t m_pending;
+    bool m_hasPending;
+    long m_pendingOffset;
+    int m_numLate;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Works out the port's time at the given system time
+//
+static LONGLONG GetPortTime(LONGLONG now, LONGLONG startTime, int drift) {
+  LONGLONG elapsed = now - startTime;
+  return elapsed + elapsed * drift / 1000000;
+}
+
+//
+// Plays <numEvents> short messages at random intervals through a port
+//  drifting by <drift> ppm; returns false if the messages were not all
+//  played, in order and on time, without the stream running dry
+//
+static bool TestTiming(int numEvents, int drift) {
+  CVirtualStreamPort port;
+  CStreamFlusher flusher(port);
+
+  std::vector<message_t> messages(numEvents);
+  LONGLONG usTime = FLUSH_PERIOD / 2;
+  int i;
+
+  for (i = 0; i < numEvents; i++) {
+    usTime += Random(MAX_EVENT_GAP);
+    messages[i].usTime  = usTime;
+    messages[i].message = 0x400090 | ((i & 0x7f) << 8);
+  }
+
+  int nextMessage = 0;
+  LONGLONG end = usTime + 2 * LOOKAHEAD;
+
+  for (LONGLONG flushTime = 0; flushTime < end; flushTime += FLUSH_PERIOD) {
+    LONGLONG now = flushTime + Random(FLUSH_JITTER);
+
+    if (flusher.IsStarted())
+      port.Advance(GetPortTime(now, flusher.GetStartTime(), drift));
+
+    while ((nextMessage < numEvents) && (messages[nextMessage].usTime <= now))
+      flusher.Queue(messages[nextMessage++]);
+
+    flusher.Flush(now);
+  }
+
+  port.Advance(GetPortTime(end + LOOKAHEAD, flusher.GetStartTime(), drift));
+
+  // Compare the time each message was played at (brought back to system
+  //  time) with the time it was due at
+  int numPlayed = (int)port.playedEvents.size();
+  double maxError = 0.0, sumError = 0.0;
+  bool isInOrder = (numPlayed == numEvents);
+
+  for (i = 0; (i < numPlayed) && isInOrder; i++) {
+    double playTime = flusher.GetStartTime() + port.playedEvents[i].tick * 1000000.0 / (1000000.0 + drift);
+    double error = playTime - (messages[i].usTime + LOOKAHEAD);
+
+    isInOrder = (port.playedEvents[i].message == messages[i].message);
+    sumError += error;
+
+    if (fabs(error) > maxError)
+      maxError = fabs(error);
+  }
+
+  printf("Timing: %d of %d messages played %s, %d late, stream ran dry %d times\n",
+    numPlayed, numEvents, isInOrder ? "in order" : "OUT OF ORDER", flusher.GetNumLate(), port.GetNumStarved());
+  printf("        error vs. stamp + %dms: max %.1fus, mean %.1fus (clock drift %dppm, flush jitter %dms)\n",
+    LOOKAHEAD / 1000, maxError, (numPlayed > 0) ? sumError / numPlayed : 0.0, drift, FLUSH_JITTER / 1000);
+
+  // The lookahead is counted in port time, so it stretches or shrinks with
+  //  the drift (by 4us at 100ppm); allow for that, plus rounding
+  double maxErrorAllowed = 1.0 + LOOKAHEAD * fabs((double)drift) / 1000000.0;
+
+  return isInOrder && (port.GetNumStarved() == 0) && (maxError <= maxErrorAllowed);
+}
+
+//
+// Plays a SysEx message too long for one buffer between two short
+//  messages; returns false if it did not arrive intact and in order
+//
+static bool TestSysEx(void) {
+  CVirtualStreamPort port;
+  CStreamFlusher flusher(port);
+  message_t message;
+  int i;
+
+  message.usTime  = 0;
+  message.message = 0x7f3c90;
+  flusher.Queue(message);
+
+  std::vector<BYTE> sysEx(SYSEX_LEN);
+  sysEx[0] = 0xf0;
+
+  for (i = 1; i < SYSEX_LEN - 1; i++)
+    sysEx[i] = (BYTE)((i * 7) & 0x7f);
+
+  sysEx[SYSEX_LEN - 1] = 0xf7;
+
+  message.data = sysEx;
+  flusher.Queue(message);
+
+  message.data.clear();
+  message.message = 0x003c90;
+  flusher.Queue(message);
+
+  for (LONGLONG now = 0; now < 10 * FLUSH_PERIOD; now += FLUSH_PERIOD) {
+    if (flusher.IsStarted())
+      port.Advance(now - flusher.GetStartTime());
+
+    flusher.Flush(now);
+  }
+
+  int numPieces = 0;
+
+  for (i = 0; i < (int)port.playedEvents.size(); i++) {
+    if (port.playedEvents[i].message == 0xf0)
+      numPieces++;
+  }
+
+  int numPlayed  = (int)port.playedEvents.size();
+  bool isIntact  = (port.sysEx == sysEx);
+  bool isInOrder = (numPlayed == numPieces + 2) &&
+                   (port.playedEvents[0].message == 0x7f3c90) &&
+                   (port.playedEvents[numPlayed - 1].message == 0x003c90);
+
+  printf("SysEx:  %d-byte message sent in %d pieces, %s, %s\n",
+    SYSEX_LEN, numPieces, isIntact ? "intact" : "CORRUPTED", isInOrder ? "in order" : "OUT OF ORDER");
+
+  return isIntact && isInOrder && (numPieces > 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+  int numEvents = (argc > 1) ? atoi(argv[1]) : DEFAULT_EVENTS;
+  int drift     = (argc > 2) ? atoi(argv[2]) : DEFAULT_DRIFT;
+
+  if ((argc > 3) || (numEvents < 1) || (drift < -10000) || (drift > 10000)) {
+    fprintf(stderr, "Usage: MIDIStreamBench [events [drift (ppm)]]\n");
+    return 1;
+  }
+
+  bool isTimingOK = TestTiming(numEvents, drift);
+  bool isSysExOK  = TestSysEx();
+
+  printf("\n%s\n", (isTimingOK && isSysExOK) ? "PASS" : "FAIL");
+
+  return (isTimingOK && isSysExOK) ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+// stdafx.h : include file for standard system include files,
+//      or project specific include files that are used frequently,
+//      but are changed infrequently
+
+#if !defined(AFX_STDAFX_H__5D2A7C31_8E4B_4F16_A9D3_6B1E0F47C28A__INCLUDED_)
+#define AFX_STDAFX_H__5D2A7C31_8E4B_4F16_A9D3_6B1E0F47C28A__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// The MIDIDevice sources compiled into this project rely on this header
+//  (through the precompiled header) for their standard includes, and for
+//  the Windows types, which are defined here on other platforms
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+  typedef unsigned char BYTE;
+  typedef unsigned int DWORD;           // 32 bits, as the stream buffers' records
+  typedef int LONG;
+  typedef long long LONGLONG;
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//{{AFX_INSERT_LOCATION}}
+// Microsoft Visual C++ will insert additional declarations immediately before the previous line.
+
+#endif // !defined(AFX_STDAFX_H__5D2A7C31_8E4B_4F16_A9D3_6B1E0F47C28A__INCLUDED_)
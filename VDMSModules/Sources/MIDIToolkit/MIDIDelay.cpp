@@ -63,8 +63,17 @@ STDMETHODIMP CMIDIDelay::Init(IUnknown * configuration) {
 
     /** Get settings *******************************************************/
 
-    // Obtain the name of the file containing the mappings
-    m_delay = CFG_Get(Config, INI_STR_DELAY, 0, 10, false);
+    // Obtain the delay (milliseconds, fractions allowed down to the microsecond)
+    CString delay = (LPCTSTR)CFG_Get(Config, INI_STR_DELAY, "0", false);
+    LPTSTR delayEnd = NULL;
+    double delayMs = _tcstod(delay, &delayEnd);
+
+    if ((delayEnd == (LPCTSTR)delay) || (*delayEnd != _T('\0')) || (delayMs < 0) || (delayMs > 3600000)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Invalid delay '%s', using 0 instead"), (LPCTSTR)delay));
+      delayMs = 0;
+    }
+
+    m_delay = (LONGLONG)(delayMs * 1000 + 0.5);
 
     /** Get modules ********************************************************/
 
@@ -75,13 +84,36 @@ STDMETHODIMP CMIDIDelay::Init(IUnknown * configuration) {
     return ce.Error();                // Propagate the error
   }
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIDelay initialized")));
+  // Start the scheduler thread (no need for one if messages go straight through)
+  if (m_delay > 0) {
+    m_lastDueTime = 0;
+
+    if (!m_scheduler.Init(m_env, m_midiOut, _T("MIDI Delay"))) {
+      Destroy();
+      return E_FAIL;
+    }
+  } else {
+    // Fuse with the MIDIToolkit modules that follow, if any
+    m_pipeline.Build(NULL, m_midiOut);
+  }
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIDelay initialized (delay = %d.%03dms)"), (int)(m_delay / 1000), (int)(m_delay % 1000)));
 
   return S_OK;
 }
 
 STDMETHODIMP CMIDIDelay::Destroy() {
+  // Stop the scheduler thread (it forwards whatever is still queued first)
+  LONG numDropped = m_scheduler.GetNumDropped();
+
+  if (!m_scheduler.Destroy())
+    return E_FAIL;
+
+  if (numDropped > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d MIDI message(s) were dropped because the delay queue was full"), numDropped));
+
   // Release the MIDI-out module
+  m_pipeline.Clear();
   m_midiOut = NULL;
 
   // Release the runtime environment
@@ -98,13 +130,16 @@ STDMETHODIMP CMIDIDelay::Destroy() {
 /////////////////////////////////////////////////////////////////////////////
 
 STDMETHODIMP CMIDIDelay::HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
-  if (m_delay > 0)
-    Sleep(m_delay);
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_delay <= 0)
+    return m_pipeline.HandleEvent(usDelta, status, data1, data2, length);
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Slept for %dms"), m_delay));
+  CSingleLock lock(&m_mutex, TRUE);
 
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleEvent(usDelta, status, data1, data2, length);
+  LONGLONG dueTime = GetDueTime(usDelta);
+  m_scheduler.PostEvent(dueTime, usDelta, status, data1, data2, length);
 
   return S_OK;
 }
@@ -113,15 +148,70 @@ STDMETHODIMP CMIDIDelay::HandleSysEx(LONGLONG usDelta, BYTE * data, LONG length)
 	if (data == NULL)
 		return E_POINTER;
 
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleSysEx(usDelta, data, length);
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_delay <= 0)
+    return m_pipeline.HandleSysEx(usDelta, data, length);
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  LONGLONG dueTime = GetDueTime(usDelta);
+  m_scheduler.PostSysEx(dueTime, usDelta, data, length);
 
   return S_OK;
 }
 
 STDMETHODIMP CMIDIDelay::HandleRealTime(LONGLONG usDelta, BYTE data) {
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleRealTime(usDelta, data);
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_delay <= 0)
+    return m_pipeline.HandleRealTime(usDelta, data);
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  LONGLONG dueTime = GetDueTime(usDelta);
+  m_scheduler.PostRealTime(dueTime, usDelta, data);
 
   return S_OK;
 }
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIStage
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP_(const CMIDIPipeline*) CMIDIDelay::GetPipeline() {
+  // Messages that are scheduled cannot bypass this module
+  return (m_delay > 0) ? NULL : &m_pipeline;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Utility functions
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Works out the time a message is due at (the delay after the time it was
+//  stamped with at the source, or after now if it was not stamped), and
+//  moves the timestamp handed downstream by the delay, too.  Must be called
+//  with m_mutex held, so that due times are posted in order.
+//
+LONGLONG CMIDIDelay::GetDueTime(LONGLONG& usDelta) {
+  LONGLONG dueTime;
+
+  if (usDelta < 0) {
+    dueTime = TIM_GetMicros() + m_delay;
+  } else {
+    dueTime = usDelta + m_delay;
+    usDelta = dueTime;
+  }
+
+  if (dueTime < m_lastDueTime)
+    dueTime = m_lastDueTime;
+
+  return (m_lastDueTime = dueTime);
+}
@@ -13,6 +13,11 @@
 
 #import <IVDMQuery.tlb>
 
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MIDIPipeline.h"
+#include "MIDIScheduler.h"
+
 /////////////////////////////////////////////////////////////////////////////
 // CMIDIDelay
 class ATL_NO_VTABLE CMIDIDelay : 
@@ -20,10 +25,11 @@ class ATL_NO_VTABLE CMIDIDelay :
 	public CComCoClass<CMIDIDelay, &CLSID_MIDIDelay>,
 	public ISupportErrorInfo,
   public IVDMBasicModule,
-  public IMIDIEventHandler
+  public IMIDIEventHandler,
+  public IMIDIStage
 {
 public:
-	CMIDIDelay()
+	CMIDIDelay() : m_delay(0), m_lastDueTime(0)
 	{
 	}
 
@@ -36,6 +42,7 @@ BEGIN_COM_MAP(CMIDIDelay)
   COM_INTERFACE_ENTRY(ISupportErrorInfo)
   COM_INTERFACE_ENTRY(IVDMBasicModule)
   COM_INTERFACE_ENTRY(IMIDIEventHandler)
+  COM_INTERFACE_ENTRY(IMIDIStage)
 END_COM_MAP()
 
 // ISupportsErrorInfo
@@ -53,11 +60,31 @@ public:
 	STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE * data, LONG length);
 	STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data);
 
+// IMIDIStage
+public:
+  STDMETHOD_(const CMIDIPipeline*, GetPipeline)();
+
 /////////////////////////////////////////////////////////////////////////////
 
+// Utility functions
+protected:
+  LONGLONG GetDueTime(LONGLONG& usDelta);
+
 // Other member variables
 protected:
-  int m_delay;
+  LONGLONG m_delay;                   // microseconds
+
+  //
+  // Messages are stamped with the time they are due at by the caller's
+  //  thread, and forwarded by the scheduler when due.  The delay being the
+  //  same for all messages, they are always posted in order of due time
+  //  (messages stamped out of order at the source are held back until the
+  //  previous one is due).
+  //
+  CMIDIScheduler m_scheduler;
+  CMIDIPipeline m_pipeline;           // used instead when messages go straight through
+  CCriticalSection m_mutex;           // regulates posting to m_scheduler (there may be more than one caller)
+  LONGLONG m_lastDueTime;             // due time of the message last posted
 
 // Interfaces to dependency modules
 protected:
@@ -0,0 +1,244 @@
+// MIDIFilters.cpp: implementation of the MIDI filter classes.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MIDIFilters.h"
+
+//////////////////////////////////////////////////////////////////////
+
+#define MIDI_EVENT_NOTE_OFF       0x80
+#define MIDI_EVENT_NOTE_ON        0x90
+#define MIDI_EVENT_KEY_PRESSURE   0xa0
+#define MIDI_EVENT_CONTROL_CHANGE 0xb0
+#define MIDI_EVENT_PROGRAM_CHANGE 0xc0
+#define MIDI_EVENT_CHAN_PRESSURE  0xd0
+#define MIDI_EVENT_PITCH_BEND     0xe0
+
+#define MIDI_EVENT_SYS_RT_RESET   0xff
+
+#define MIDI_CTL_BANK_MSB         0
+#define MIDI_CTL_DATA_ENTRY_MSB   6
+#define MIDI_CTL_BANK_LSB         32
+#define MIDI_CTL_DATA_ENTRY_LSB   38
+#define MIDI_CTL_DATA_INCREMENT   96
+#define MIDI_CTL_DATA_DECREMENT   97
+#define MIDI_CTL_RESET_ALL        121
+#define MIDI_CTL_FIRST_MODE       120   // controllers 120 to 127 are channel mode messages
+
+//////////////////////////////////////////////////////////////////////
+// CMIDIMapFilter
+//////////////////////////////////////////////////////////////////////
+
+CMIDIMapFilter::CMIDIMapFilter(void) {
+  for (int i = 0; i < 128; i++) {
+    m_identity[i] = i;
+  }
+
+  Reset();
+}
+
+//
+// Resets all the tables to identity
+//
+void CMIDIMapFilter::Reset(void) {
+  for (int map = 0; map < MAP_COUNT; map++) {
+    for (int channel = 0; channel < 16; channel++) {
+      memcpy(m_maps[map][channel], m_identity, sizeof(m_identity));
+    }
+  }
+
+  Compile();
+}
+
+//
+// Changes a table entry (channel is 0-based); takes effect at the next
+//  Compile()
+//
+void CMIDIMapFilter::Set(
+  map_t map,
+  int channel,
+  BYTE from,
+  BYTE to)
+{
+  _ASSERTE((channel >= 0) && (channel < 16) && (from < 128) && (to < 128));
+  m_maps[map][channel & 0x0f][from & 0x7f] = to & 0x7f;
+}
+
+BYTE CMIDIMapFilter::Get(
+  map_t map,
+  int channel,
+  BYTE from) const
+{
+  return m_maps[map][channel & 0x0f][from & 0x7f];
+}
+
+//
+// Points each status byte at the tables for its data bytes; a velocity of 0
+//  (note off) always stays 0, and no other velocity may become 0
+//
+void CMIDIMapFilter::Compile(void) {
+  int status, channel;
+
+  for (status = 0; status < 256; status++) {
+    m_data1Map[status] = m_identity;
+    m_data2Map[status] = m_identity;
+  }
+
+  for (channel = 0; channel < 16; channel++) {
+    BYTE* velocities = m_maps[MAP_VELOCITY][channel];
+
+    for (int i = 1; i < 128; i++) {
+      if (velocities[i] == 0)
+        velocities[i] = 1;
+    }
+
+    velocities[0] = 0;
+
+    m_data1Map[MIDI_EVENT_NOTE_OFF | channel]       = m_maps[MAP_NOTE][channel];
+    m_data1Map[MIDI_EVENT_NOTE_ON | channel]        = m_maps[MAP_NOTE][channel];
+    m_data2Map[MIDI_EVENT_NOTE_ON | channel]        = velocities;
+    m_data1Map[MIDI_EVENT_KEY_PRESSURE | channel]   = m_maps[MAP_NOTE][channel];
+    m_data1Map[MIDI_EVENT_CONTROL_CHANGE | channel] = m_maps[MAP_CONTROLLER][channel];
+    m_data1Map[MIDI_EVENT_PROGRAM_CHANGE | channel] = m_maps[MAP_PATCH][channel];
+  }
+}
+
+bool CMIDIMapFilter::FilterEvent(
+  LONGLONG& usDelta,
+  BYTE& status,
+  BYTE& data1,
+  BYTE& data2,
+  BYTE& length)
+{
+  data1 = m_data1Map[status][data1 & 0x7f];
+  data2 = m_data2Map[status][data2 & 0x7f];
+
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CMIDIStateFilter
+//////////////////////////////////////////////////////////////////////
+
+CMIDIStateFilter::CMIDIStateFilter(void) {
+  Reset();
+}
+
+//
+// Forgets the state of all channels
+//
+void CMIDIStateFilter::Reset(void) {
+  for (int channel = 0; channel < 16; channel++)
+    ResetChannel(channel);
+
+  m_numDropped = 0;
+}
+
+LONG CMIDIStateFilter::GetNumDropped(void) const {
+  return m_numDropped;
+}
+
+bool CMIDIStateFilter::FilterEvent(
+  LONGLONG& usDelta,
+  BYTE& status,
+  BYTE& data1,
+  BYTE& data2,
+  BYTE& length)
+{
+  int channel = status & 0x0f;
+  BYTE* value = NULL;
+
+  switch (status & 0xf0) {
+    case MIDI_EVENT_CONTROL_CHANGE:
+      // Data entry and increments act on whichever parameter is selected, and
+      //  channel mode messages act on the notes playing: they always count
+      if ((data1 == MIDI_CTL_DATA_ENTRY_MSB) || (data1 == MIDI_CTL_DATA_ENTRY_LSB) ||
+          (data1 == MIDI_CTL_DATA_INCREMENT) || (data1 == MIDI_CTL_DATA_DECREMENT) ||
+          (data1 >= MIDI_CTL_FIRST_MODE))
+      {
+        if (data1 == MIDI_CTL_RESET_ALL)
+          ResetChannel(channel);
+
+        return true;
+      }
+
+      value = &m_controllers[channel][data1 & 0x7f];
+
+      // A new bank only takes effect at the next program change, which must
+      //  then go through
+      if (((data1 == MIDI_CTL_BANK_MSB) || (data1 == MIDI_CTL_BANK_LSB)) && (*value != data2))
+        m_programs[channel] = MSF_UNKNOWN;
+
+      break;
+
+    case MIDI_EVENT_PROGRAM_CHANGE:
+      if (m_programs[channel] == data1)
+        break;
+
+      m_programs[channel] = data1;
+      return true;
+
+    case MIDI_EVENT_CHAN_PRESSURE:
+      if (m_pressures[channel] == data1)
+        break;
+
+      m_pressures[channel] = data1;
+      return true;
+
+    case MIDI_EVENT_PITCH_BEND:
+      {
+        WORD bend = (WORD)(((data2 & 0x7f) << 7) | (data1 & 0x7f));
+
+        if (m_bends[channel] == bend)
+          break;
+
+        m_bends[channel] = bend;
+        return true;
+      }
+
+    default:
+      return true;
+  }
+
+  if ((value != NULL) && (*value != data2)) {
+    *value = data2;
+    return true;
+  }
+
+  m_numDropped++;
+
+  return false;
+}
+
+bool CMIDIStateFilter::FilterSysEx(
+  LONGLONG& usDelta,
+  BYTE*& data,
+  LONG& length)
+{
+  // Could be a GM/GS reset, or change any parameter
+  for (int channel = 0; channel < 16; channel++)
+    ResetChannel(channel);
+
+  return true;
+}
+
+bool CMIDIStateFilter::FilterRealTime(
+  LONGLONG& usDelta,
+  BYTE& data)
+{
+  if (data == MIDI_EVENT_SYS_RT_RESET) {
+    for (int channel = 0; channel < 16; channel++)
+      ResetChannel(channel);
+  }
+
+  return true;
+}
+
+void CMIDIStateFilter::ResetChannel(int channel) {
+  memset(m_controllers[channel], MSF_UNKNOWN, sizeof(m_controllers[channel]));
+
+  m_programs[channel]  = MSF_UNKNOWN;
+  m_pressures[channel] = MSF_UNKNOWN;
+  m_bends[channel]     = MSF_UNKNOWNBEND;
+}
@@ -0,0 +1,84 @@
+#ifndef __MIDIFILTERS_H_
+#define __MIDIFILTERS_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MIDIPipeline.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Remaps the data bytes of channel messages through per-channel tables
+//  (MIDI Mapper): patches (program change), notes (note on/off and key
+//  pressure), note-on velocities, and controller numbers.  Once the tables
+//  are filled in, Compile() points every status byte at the tables that
+//  apply to each of its data bytes (or at an identity table), so that
+//  filtering any message takes two table lookups and no decisions.
+//
+class CMIDIMapFilter : public CMIDIFilter {
+  public:
+    enum map_t { MAP_PATCH, MAP_NOTE, MAP_VELOCITY, MAP_CONTROLLER, MAP_COUNT };
+
+  public:
+    CMIDIMapFilter(void);
+
+  public:
+    void Reset(void);
+    void Set(map_t map, int channel, BYTE from, BYTE to);
+    BYTE Get(map_t map, int channel, BYTE from) const;
+    void Compile(void);
+
+  // CMIDIFilter
+  public:
+    bool FilterEvent(LONGLONG& usDelta, BYTE& status, BYTE& data1, BYTE& data2, BYTE& length);
+
+  protected:
+    BYTE m_maps[MAP_COUNT][16][128];    // [map][channel][from]
+    BYTE m_identity[128];
+
+    const BYTE* m_data1Map[256];        // table for the first data byte of each status byte
+    const BYTE* m_data2Map[256];        // table for the second data byte of each status byte
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MSF_UNKNOWN       0xff      // a controller, program or pressure value not known yet
+#define MSF_UNKNOWNBEND   0xffff    // a pitch bend value not known yet
+
+//
+// Drops the channel messages that would not change anything (a controller,
+//  program, channel pressure or pitch bend value the channel already has),
+//  as DOS drivers often send the same values over and over.  Values are only
+//  known once they went through; anything that may change them behind the
+//  filter's back (SysEx, a system reset, reset all controllers) makes them
+//  unknown again.  Unlike most filters, this one keeps state as messages go
+//  through it, so calls must not overlap (the MIDI Optimizer runs it under
+//  its lock, and never lets other modules fuse it into their pipelines).
+//
+class CMIDIStateFilter : public CMIDIFilter {
+  public:
+    CMIDIStateFilter(void);
+
+  public:
+    void Reset(void);
+    LONG GetNumDropped(void) const;
+
+  // CMIDIFilter
+  public:
+    bool FilterEvent(LONGLONG& usDelta, BYTE& status, BYTE& data1, BYTE& data2, BYTE& length);
+    bool FilterSysEx(LONGLONG& usDelta, BYTE*& data, LONG& length);
+    bool FilterRealTime(LONGLONG& usDelta, BYTE& data);
+
+  protected:
+    void ResetChannel(int channel);
+
+  protected:
+    BYTE m_controllers[16][128];        // [channel][controller]
+    BYTE m_programs[16];
+    BYTE m_pressures[16];
+    WORD m_bends[16];
+
+    LONG m_numDropped;                  // how many messages were dropped
+};
+
+#endif //__MIDIFILTERS_H_
@@ -13,22 +13,25 @@
 #define MSG_ERR_PARSE_CONFLICT  _T("Symbol redefinition (%1):%nThe entry '%3' was already defined (see %2).%0")
 #define MSG_ERR_PARSE           _T("Unknown parsing error (%1):%nDescription not available.%0")
 
-#define MSG_ERR_MAP_SECTION     _T("Could not find the INI section [%2] in file '%1'.%0")
+#define MSG_ERR_MAP_SECTION     _T("Could not find the INI section [%2] (or any other mapping section) in file '%1'.%0")
 #define MSG_ERR_MAP_UNEXPECTED  _T("An unexpected condition was encountered while trying to access key '%3' in section [%2] of file '%1'.%0")
 #define MSG_ERR_MAP_NUMERICAL   _T("The value '%2' (see %1) is not numerical.  Please provide a numerical value.%0")
 #define MSG_ERR_MAP_RANGE       _T("The value '%2!d!' (see %1) is out of range.  Please provide a value between %3!d! and %4!d!.%0")
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define GET_EVENT(data)           ((data) & 0xf0)
-#define MIDI_EVENT_PROGRAM_CHANGE 0xc0
-
-/////////////////////////////////////////////////////////////////////////////
-
 #define INI_STR_MAPFNAME      L"MapFile"
 #define INI_STR_MIDIOUT       L"MidiOut"
 
 #define INI_STR_PATCHMAP      "patches"
+#define INI_STR_NOTEMAP       "notes"
+#define INI_STR_VELOCITYMAP   "velocity"
+#define INI_STR_CONTROLLERMAP "controllers"
+#define INI_STR_TRANSPOSE     "transpose"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MAP_UNSET             (-1000)   // marks the entries not given in a map section
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -104,13 +107,17 @@ STDMETHODIMP CMIDIMapper::Init(IUnknown * configuration) {
     return ce.Error();                // Propagate the error
   }
 
-  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIMapper initialized")));
+  // Fuse with the MIDIToolkit modules that follow, if any
+  m_pipeline.Build(&m_mapFilter, m_midiOut);
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIMapper initialized (%d module(s) fused)"), m_pipeline.GetNumFused()));
 
   return S_OK;
 }
 
 STDMETHODIMP CMIDIMapper::Destroy() {
   // Release the MIDI-out module
+  m_pipeline.Clear();
   m_midiOut = NULL;
 
   // Release the runtime environment
@@ -127,32 +134,28 @@ STDMETHODIMP CMIDIMapper::Destroy() {
 /////////////////////////////////////////////////////////////////////////////
 
 STDMETHODIMP CMIDIMapper::HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
-  _ASSERTE(data1 < 128);
-
-  if (GET_EVENT(status) == MIDI_EVENT_PROGRAM_CHANGE)
-    data1 = m_patchMap[data1];      // Program change
-
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleEvent(usDelta, status, data1, data2, length);
-
-  return S_OK;
+  return m_pipeline.HandleEvent(usDelta, status, data1, data2, length);
 }
 
 STDMETHODIMP CMIDIMapper::HandleSysEx(LONGLONG usDelta, BYTE * data, LONG length) {
 	if (data == NULL)
 		return E_POINTER;
 
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleSysEx(usDelta, data, length);
-
-  return S_OK;
+  return m_pipeline.HandleSysEx(usDelta, data, length);
 }
 
 STDMETHODIMP CMIDIMapper::HandleRealTime(LONGLONG usDelta, BYTE data) {
-  if (m_midiOut != NULL)
-    return m_midiOut->HandleRealTime(usDelta, data);
+  return m_pipeline.HandleRealTime(usDelta, data);
+}
 
-  return S_OK;
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIStage
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP_(const CMIDIPipeline*) CMIDIMapper::GetPipeline() {
+  return &m_pipeline;
 }
 
 
@@ -161,11 +164,33 @@ STDMETHODIMP CMIDIMapper::HandleRealTime(LONGLONG usDelta, BYTE data) {
 // Utility functions
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// Fills in the entries of a 128-entry curve that were not given (MAP_UNSET)
+//  by joining the ones that were with straight lines; the ends of the curve
+//  default to 0 -> 0 and 127 -> 127
+//
+static void InterpolateCurve(int* values) {
+  if (values[0] == MAP_UNSET)
+    values[0] = 0;
+  if (values[127] == MAP_UNSET)
+    values[127] = 127;
+
+  int last = 0;                       // last entry given
+
+  for (int i = 1; i < 128; i++) {
+    if (values[i] == MAP_UNSET)
+      continue;
+
+    for (int j = last + 1; j < i; j++)
+      values[j] = values[last] + ((values[i] - values[last]) * (j - last) + (i - last) / 2) / (i - last);
+
+    last = i;
+  }
+}
+
 HRESULT CMIDIMapper::loadMapping(LPCSTR fName) {
   // Reset the mapping to identity
-  for (int i = 0; i < 128; i++) {
-    m_patchMap[i] = i;
-  }
+  m_mapFilter.Reset();
 
   // Open the .INI file containig the mapping information
   CINIParser map;
@@ -188,33 +213,132 @@ HRESULT CMIDIMapper::loadMapping(LPCSTR fName) {
     return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_PARSE, /*false, NULL, 0, */false, (LPCTSTR)CString(pe.location.c_str())), __uuidof(IVDMBasicModule), E_ABORT);
   }
 
-  // Get the patch mapping
-  striset_t patchMapKeys;
+  // Get the mappings: a section applies to all channels, and a section for
+  //  a given channel (e.g. [notes.10]) takes precedence over it
+  static const struct {
+    LPCSTR name;
+    CMIDIMapFilter::map_t map;
+  } sections[] = {
+    { INI_STR_PATCHMAP,      CMIDIMapFilter::MAP_PATCH },
+    { INI_STR_NOTEMAP,       CMIDIMapFilter::MAP_NOTE },
+    { INI_STR_VELOCITYMAP,   CMIDIMapFilter::MAP_VELOCITY },
+    { INI_STR_CONTROLLERMAP, CMIDIMapFilter::MAP_CONTROLLER }
+  };
+
+  HRESULT hr;
+  bool isEmpty = true;
+  int values[128];
+
+  for (int i = 0; i < (int)(sizeof(sections) / sizeof(sections[0])); i++) {
+    for (int channel = 0; channel <= 16; channel++) {
+      char section[64];
+      bool isFound;
+
+      if (channel == 0) {
+        strcpy(section, sections[i].name);
+      } else {
+        sprintf(section, "%s.%d", sections[i].name, channel);
+      }
+
+      if (FAILED(hr = loadSection(map, fName, section, 0, 127, 0, 127, values, isFound)))
+        return hr;
+
+      if (!isFound)
+        continue;
+
+      // Velocities in between the points given lie on the straight lines
+      //  joining them (so that a curve can be given in a few points)
+      if (sections[i].map == CMIDIMapFilter::MAP_VELOCITY)
+        InterpolateCurve(values);
+
+      for (int from = 0; from < 128; from++) {
+        if (values[from] == MAP_UNSET)
+          continue;
+
+        for (int c = 0; c < 16; c++) {
+          if ((channel == 0) || (channel == c + 1))
+            m_mapFilter.Set(sections[i].map, c, from, values[from]);
+        }
+      }
+
+      isEmpty = false;
+    }
+  }
+
+  // Get the transpositions (in semitones, by channel), applied on top of the
+  //  note mapping
+  bool isFound;
+
+  if (FAILED(hr = loadSection(map, fName, INI_STR_TRANSPOSE, 1, 16, -127, 127, values, isFound)))
+    return hr;
+
+  if (isFound) {
+    for (int channel = 1; channel <= 16; channel++) {
+      if (values[channel] == MAP_UNSET)
+        continue;
 
-  if (!map.getKeys(INI_STR_PATCHMAP, patchMapKeys))
+      for (int from = 0; from < 128; from++) {
+        int to = m_mapFilter.Get(CMIDIMapFilter::MAP_NOTE, channel - 1, from) + values[channel];
+        m_mapFilter.Set(CMIDIMapFilter::MAP_NOTE, channel - 1, from, max(0, min(to, 127)));
+      }
+    }
+
+    isEmpty = false;
+  }
+
+  if (isEmpty)
     return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_SECTION, /*false, NULL, 0, */false, (LPCTSTR)CString(fName), (LPCTSTR)CString(INI_STR_PATCHMAP)), __uuidof(IVDMBasicModule), E_ABORT);
 
-  // Retrieve the re-mapped patches and store them locally
-  for (striset_t::const_iterator itKey = patchMapKeys.begin(); itKey != patchMapKeys.end(); itKey++) {
+  m_mapFilter.Compile();
+
+  return S_OK;
+}
+
+//
+// Retrieves the entries of a map section (key = value, both numerical);
+//  values[key] is set to MAP_UNSET for the keys not in the section.
+//  isFound tells whether the section exists.
+//
+HRESULT CMIDIMapper::loadSection(
+  const CINIParser& map,
+  LPCSTR fName,
+  LPCSTR section,
+  int keyMin,
+  int keyMax,
+  int valueMin,
+  int valueMax,
+  int* values,
+  bool& isFound)
+{
+  striset_t keys;
+
+  for (int i = keyMin; i <= keyMax; i++)
+    values[i] = MAP_UNSET;
+
+  if (!(isFound = map.getKeys(section, keys)))
+    return S_OK;
+
+  // Retrieve the entries and store them locally
+  for (striset_t::const_iterator itKey = keys.begin(); itKey != keys.end(); itKey++) {
     int mapFrom, mapTo;
     std::string value, keyLoc;
 
-    if (!map.getLocation(INI_STR_PATCHMAP, *itKey, keyLoc))
-      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_UNEXPECTED, /*false, NULL, 0, */false, (LPCTSTR)CString(fName), (LPCTSTR)CString(INI_STR_PATCHMAP), (LPCTSTR)CString(itKey->c_str())), __uuidof(IVDMBasicModule), E_UNEXPECTED);
-    if (!map.getValue(INI_STR_PATCHMAP, *itKey, value))
-      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_UNEXPECTED, /*false, NULL, 0, */false, (LPCTSTR)CString(fName), (LPCTSTR)CString(INI_STR_PATCHMAP), (LPCTSTR)CString(itKey->c_str())), __uuidof(IVDMBasicModule), E_UNEXPECTED);
+    if (!map.getLocation(section, *itKey, keyLoc))
+      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_UNEXPECTED, /*false, NULL, 0, */false, (LPCTSTR)CString(fName), (LPCTSTR)CString(section), (LPCTSTR)CString(itKey->c_str())), __uuidof(IVDMBasicModule), E_UNEXPECTED);
+    if (!map.getValue(section, *itKey, value))
+      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_UNEXPECTED, /*false, NULL, 0, */false, (LPCTSTR)CString(fName), (LPCTSTR)CString(section), (LPCTSTR)CString(itKey->c_str())), __uuidof(IVDMBasicModule), E_UNEXPECTED);
 
     if (sscanf(itKey->c_str(), "%d", &mapFrom) != 1)
       return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_NUMERICAL, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), (LPCTSTR)CString(itKey->c_str())), __uuidof(IVDMBasicModule), E_ABORT);
     if (sscanf(value.c_str(), "%d", &mapTo) != 1)
       return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_NUMERICAL, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), (LPCTSTR)CString(value.c_str())), __uuidof(IVDMBasicModule), E_ABORT);
 
-    if ((mapFrom < 0) || (mapFrom > 127))
-      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_RANGE, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), mapFrom, 0, 127), __uuidof(IVDMBasicModule), E_ABORT);
-    if ((mapTo < 0) || (mapTo > 127))
-      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_RANGE, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), mapTo, 0, 127), __uuidof(IVDMBasicModule), E_ABORT);
+    if ((mapFrom < keyMin) || (mapFrom > keyMax))
+      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_RANGE, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), mapFrom, keyMin, keyMax), __uuidof(IVDMBasicModule), E_ABORT);
+    if ((mapTo < valueMin) || (mapTo > valueMax))
+      return AtlReportError(GetObjectCLSID(), (LPCTSTR)::FormatMessage(MSG_ERR_MAP_RANGE, /*false, NULL, 0, */false, (LPCTSTR)CString(keyLoc.c_str()), mapTo, valueMin, valueMax), __uuidof(IVDMBasicModule), E_ABORT);
 
-    m_patchMap[mapFrom] = mapTo;
+    values[mapFrom] = mapTo;
   }
 
   return S_OK;
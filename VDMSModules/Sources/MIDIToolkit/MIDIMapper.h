@@ -13,6 +13,12 @@
 
 #import <IVDMQuery.tlb>
 
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MIDIFilters.h"
+
+class CINIParser;
+
 /////////////////////////////////////////////////////////////////////////////
 // CMIDIMapper
 class ATL_NO_VTABLE CMIDIMapper : 
@@ -20,7 +26,8 @@ class ATL_NO_VTABLE CMIDIMapper :
   public CComCoClass<CMIDIMapper, &CLSID_MIDIMapper>,
   public ISupportErrorInfo,
   public IVDMBasicModule,
-  public IMIDIEventHandler
+  public IMIDIEventHandler,
+  public IMIDIStage
 {
 public:
   CMIDIMapper()
@@ -36,6 +43,7 @@ BEGIN_COM_MAP(CMIDIMapper)
   COM_INTERFACE_ENTRY(ISupportErrorInfo)
   COM_INTERFACE_ENTRY(IVDMBasicModule)
   COM_INTERFACE_ENTRY(IMIDIEventHandler)
+  COM_INTERFACE_ENTRY(IMIDIStage)
 END_COM_MAP()
 
 // ISupportsErrorInfo
@@ -53,15 +61,20 @@ public:
 	STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE * data, LONG length);
 	STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data);
 
+// IMIDIStage
+public:
+  STDMETHOD_(const CMIDIPipeline*, GetPipeline)();
+
 protected:
   HRESULT loadMapping(LPCSTR fName);
+  HRESULT loadSection(const CINIParser& map, LPCSTR fName, LPCSTR section, int keyMin, int keyMax, int valueMin, int valueMax, int* values, bool& isFound);
 
 /////////////////////////////////////////////////////////////////////////////
 
 // Other member variables
 protected:
-  /* TODO: also implement volume map, drum map, etc. */
-  BYTE m_patchMap[128];
+  CMIDIMapFilter m_mapFilter;
+  CMIDIPipeline m_pipeline;           // the map filter, followed by whatever comes after this module
 
 // Interfaces to dependency modules
 protected:
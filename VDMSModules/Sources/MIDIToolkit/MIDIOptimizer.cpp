@@ -0,0 +1,259 @@
+// MIDIOptimizer.cpp : Implementation of CMIDIOptimizer
+#include "stdafx.h"
+#include "MIDIToolkit.h"
+#include "MIDIOptimizer.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define INI_STR_MIDIOUT       L"MidiOut"
+
+#define INI_STR_DROPREDUNDANT L"dropRedundant"
+#define INI_STR_BENDWINDOW    L"bendWindow"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MIDI_EVENT_PITCH_BEND 0xe0
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <MFCUtil.h>
+#pragma comment ( lib , "MFCUtil.lib" )
+
+#include <VDMUtil.h>
+#pragma comment ( lib , "VDMUtil.lib" )
+
+/////////////////////////////////////////////////////////////////////////////
+// CMIDIOptimizer
+
+/////////////////////////////////////////////////////////////////////////////
+// ISupportsErrorInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIOptimizer::InterfaceSupportsErrorInfo(REFIID riid)
+{
+	static const IID* arr[] =
+	{
+		&IID_IVDMBasicModule,
+		&IID_IMIDIEventHandler
+	};
+	for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
+	{
+		if (InlineIsEqualGUID(*arr[i],riid))
+			return S_OK;
+	}
+	return S_FALSE;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IVDMBasicModule
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIOptimizer::Init(IUnknown * configuration) {
+	if (configuration == NULL)
+		return E_POINTER;
+
+  IVDMQUERYLib::IVDMQueryDependenciesPtr Depends;   // Dependency query object
+  IVDMQUERYLib::IVDMQueryConfigurationPtr Config;   // Configuration query object
+
+  // Grab a copy of the runtime environment (useful for logging, etc.)
+  RTE_Set(m_env, configuration);
+
+  // Initialize configuration
+  try {
+    // Obtain the Query objects (for intialization purposes)
+    Depends    = configuration; // Dependency query object
+    Config     = configuration; // Configuration query object
+
+    /** Get settings *******************************************************/
+
+    // Obtain what to optimize
+    m_isDropRedundant = (CFG_Get(Config, INI_STR_DROPREDUNDANT, 1, 10, true) != 0);
+
+    int bendWindow = CFG_Get(Config, INI_STR_BENDWINDOW, 0, 10, true);
+
+    if ((bendWindow < 0) || (bendWindow > 1000)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The pitch bend window (%dms) must be between 0 (no coalescing) and 1000ms, using 0 instead"), bendWindow));
+      bendWindow = 0;
+    }
+
+    m_bendWindow = bendWindow * 1000;
+
+    /** Get modules ********************************************************/
+
+    // Try to obtain an interface to a MIDI-out module, use NULL if none available
+    m_midiOut = DEP_Get(Depends, INI_STR_MIDIOUT, NULL, false);   // complain if no such module available
+  } catch (_com_error& ce) {
+    SetErrorInfo(0, ce.ErrorInfo());
+    return ce.Error();                // Propagate the error
+  }
+
+  m_stateFilter.Reset();
+  m_numCoalesced = 0;
+
+  // Start the scheduler thread (no need for one if pitch bends are not coalesced)
+  if (m_bendWindow > 0) {
+    for (int i = 0; i < 16; i++) {
+      m_bendSlots[i] = 0;
+      m_bendTimes[i] = 0;
+    }
+
+    if (!m_scheduler.Init(m_env, m_midiOut, _T("MIDI Optimizer"))) {
+      Destroy();
+      return E_FAIL;
+    }
+  } else {
+    // Fuse with the MIDIToolkit modules that follow, if any (the modules
+    //  before this one cannot fuse with it, see GetPipeline)
+    m_pipeline.Build(m_isDropRedundant ? &m_stateFilter : NULL, m_midiOut);
+  }
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIOptimizer initialized (drop redundant = %s, pitch bend window = %dms)"), m_isDropRedundant ? _T("yes") : _T("no"), (int)(m_bendWindow / 1000)));
+
+  return S_OK;
+}
+
+STDMETHODIMP CMIDIOptimizer::Destroy() {
+  LONG numDropped = m_scheduler.GetNumDropped();
+
+  // Stop the scheduler thread (it forwards whatever is still queued first)
+  if (!m_scheduler.Destroy())
+    return E_FAIL;
+
+  if ((m_stateFilter.GetNumDropped() > 0) || (m_numCoalesced > 0))
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("%d redundant MIDI message(s) were dropped, %d pitch bend(s) were coalesced"), m_stateFilter.GetNumDropped(), m_numCoalesced));
+
+  if (numDropped > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d MIDI message(s) were lost because the optimizer queue was full"), numDropped));
+
+  // Release the MIDI-out module
+  m_pipeline.Clear();
+  m_midiOut = NULL;
+
+  // Release the runtime environment
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIOptimizer released")));
+  RTE_Set(m_env, NULL);
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIEventHandler
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIOptimizer::HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_bendWindow <= 0)
+    return m_pipeline.HandleEvent(usDelta, status, data1, data2, length);
+
+  if (m_isDropRedundant && !m_stateFilter.FilterEvent(usDelta, status, data1, data2, length))
+    return S_OK;
+
+  if ((status & 0xf0) == MIDI_EVENT_PITCH_BEND) {
+    int channel = status & 0x0f;
+    LONGLONG now = TIM_GetMicros();
+
+    if (now < m_bendTimes[channel] + m_bendWindow) {
+      // Too soon after the last one: replace the bend held back, if there
+      //  still is one, or else hold this one back until the window is over
+      if (InterlockedExchange((LPLONG)&m_bendSlots[channel], MSC_PACK(status, data1, data2, length)) != 0) {
+        m_numCoalesced++;
+      } else {
+        LONGLONG dueTime = min(m_bendTimes[channel], now) + m_bendWindow;
+
+        if (usDelta >= 0)
+          usDelta += dueTime - now;
+
+        m_bendTimes[channel] = dueTime;
+        m_scheduler.PostLatest(dueTime, usDelta, &m_bendSlots[channel]);
+      }
+
+      return S_OK;
+    }
+
+    m_bendTimes[channel] = now;
+  }
+
+  return ForwardEvent(usDelta, status, data1, data2, length);
+}
+
+STDMETHODIMP CMIDIOptimizer::HandleSysEx(LONGLONG usDelta, BYTE * data, LONG length) {
+	if (data == NULL)
+		return E_POINTER;
+
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  if (m_bendWindow <= 0)
+    return m_pipeline.HandleSysEx(usDelta, data, length);
+
+  if (m_isDropRedundant)
+    m_stateFilter.FilterSysEx(usDelta, data, length);
+
+  if (m_scheduler.IsIdle())
+    return m_midiOut->HandleSysEx(usDelta, data, length);
+
+  m_scheduler.PostSysEx(TIM_GetMicros(), usDelta, data, length);
+
+  return S_OK;
+}
+
+STDMETHODIMP CMIDIOptimizer::HandleRealTime(LONGLONG usDelta, BYTE data) {
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_bendWindow <= 0) {
+    CSingleLock lock(&m_mutex, TRUE);
+    return m_pipeline.HandleRealTime(usDelta, data);
+  }
+
+  if (m_isDropRedundant) {
+    CSingleLock lock(&m_mutex, TRUE);
+    m_stateFilter.FilterRealTime(usDelta, data);
+  }
+
+  // Real-time messages may be sent at any time, even in the middle of other
+  //  messages, so they are never held back
+  return m_midiOut->HandleRealTime(usDelta, data);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIStage
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP_(const CMIDIPipeline*) CMIDIOptimizer::GetPipeline() {
+  // The state filter must not be run by two callers at once, and pitch
+  //  bends that are held back cannot bypass this module either; messages
+  //  always come through this module (and its lock)
+  return NULL;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Utility functions
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Sends a message on right away, unless messages are being held back (in
+//  which case it follows them, so as to stay in order)
+//
+HRESULT CMIDIOptimizer::ForwardEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
+  if (m_scheduler.IsIdle())
+    return m_midiOut->HandleEvent(usDelta, status, data1, data2, length);
+
+  m_scheduler.PostEvent(TIM_GetMicros(), usDelta, status, data1, data2, length);
+
+  return S_OK;
+}
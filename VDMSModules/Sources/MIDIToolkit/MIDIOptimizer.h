@@ -0,0 +1,103 @@
+// MIDIOptimizer.h : Declaration of the CMIDIOptimizer
+
+#ifndef __MIDIOPTIMIZER_H_
+#define __MIDIOPTIMIZER_H_
+
+#include "resource.h"       // main symbols
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IVDMModule.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+#import <IMIDI.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+
+#import <IVDMQuery.tlb>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MIDIFilters.h"
+#include "MIDIPipeline.h"
+#include "MIDIScheduler.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// CMIDIOptimizer
+class ATL_NO_VTABLE CMIDIOptimizer :
+	public CComObjectRootEx<CComMultiThreadModel>,
+	public CComCoClass<CMIDIOptimizer, &CLSID_MIDIOptimizer>,
+	public ISupportErrorInfo,
+  public IVDMBasicModule,
+  public IMIDIEventHandler,
+  public IMIDIStage
+{
+public:
+	CMIDIOptimizer() : m_isDropRedundant(true), m_bendWindow(0), m_numCoalesced(0)
+	{
+	}
+
+DECLARE_REGISTRY_RESOURCEID(IDR_MIDIOPTIMIZER)
+DECLARE_NOT_AGGREGATABLE(CMIDIOptimizer)
+
+DECLARE_PROTECT_FINAL_CONSTRUCT()
+
+BEGIN_COM_MAP(CMIDIOptimizer)
+  COM_INTERFACE_ENTRY(ISupportErrorInfo)
+  COM_INTERFACE_ENTRY(IVDMBasicModule)
+  COM_INTERFACE_ENTRY(IMIDIEventHandler)
+  COM_INTERFACE_ENTRY(IMIDIStage)
+END_COM_MAP()
+
+// ISupportsErrorInfo
+public:
+	STDMETHOD(InterfaceSupportsErrorInfo)(REFIID riid);
+
+// IVDMBasicModule
+public:
+	STDMETHOD(Init)(IUnknown * configuration);
+	STDMETHOD(Destroy)();
+
+// IMIDIEventHandler
+public:
+	STDMETHOD(HandleEvent)(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
+	STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE * data, LONG length);
+	STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data);
+
+// IMIDIStage
+public:
+  STDMETHOD_(const CMIDIPipeline*, GetPipeline)();
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Utility functions
+protected:
+  HRESULT ForwardEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
+
+// Other member variables
+protected:
+  bool m_isDropRedundant;             // whether messages that change nothing are dropped
+  LONGLONG m_bendWindow;              // at most one pitch bend per channel goes out in this long (microseconds), 0 = no coalescing
+
+  CMIDIStateFilter m_stateFilter;
+  CMIDIPipeline m_pipeline;           // used when pitch bends are not coalesced (under m_mutex, as m_stateFilter keeps state)
+
+  //
+  // A pitch bend that comes sooner than m_bendWindow after the last one on
+  //  its channel is held back in the channel's slot, and the scheduler sends
+  //  whichever bend is in the slot by then: a flood of bends comes out as
+  //  one every m_bendWindow, always ending on the last value.  While anything
+  //  is held back, the other messages go through the scheduler as well, to
+  //  keep them in order.
+  //
+  CMIDIScheduler m_scheduler;
+  CCriticalSection m_mutex;           // regulates access to the state and posting to m_scheduler (there may be more than one caller)
+  volatile LONG m_bendSlots[16];      // the pitch bend held back on each channel (see MSC_PACK), 0 = none
+  LONGLONG m_bendTimes[16];           // when the last pitch bend on each channel went (or is to go) out
+
+  LONG m_numCoalesced;                // how many pitch bends were replaced by later ones
+
+// Interfaces to dependency modules
+protected:
+  IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+  IMIDIEventHandlerPtr m_midiOut;
+};
+
+#endif //__MIDIOPTIMIZER_H_
@@ -0,0 +1,104 @@
+// MIDIPipeline.cpp: implementation of the CMIDIPipeline class.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MIDIPipeline.h"
+
+//////////////////////////////////////////////////////////////////////
+// CMIDIFilter
+//////////////////////////////////////////////////////////////////////
+
+//
+// By default, messages go through untouched
+//
+
+bool CMIDIFilter::FilterEvent(
+  LONGLONG& usDelta,
+  BYTE& status,
+  BYTE& data1,
+  BYTE& data2,
+  BYTE& length)
+{
+  return true;
+}
+
+bool CMIDIFilter::FilterSysEx(
+  LONGLONG& usDelta,
+  BYTE*& data,
+  LONG& length)
+{
+  return true;
+}
+
+bool CMIDIFilter::FilterRealTime(
+  LONGLONG& usDelta,
+  BYTE& data)
+{
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CMIDIPipeline::CMIDIPipeline(void)
+  : m_numFilters(0), m_numFused(0)
+{ }
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Puts together the pipeline of a module: the module's own filter (if
+//  any), followed by the module after it (next), which is bypassed in favour
+//  of its own pipeline whenever possible.  The pipeline keeps a reference to
+//  the first module not bypassed only; the caller must keep next alive for
+//  as long as the pipeline is in use (the filters of bypassed modules belong
+//  to them).
+//
+void CMIDIPipeline::Build(
+  CMIDIFilter* filter,
+  IUnknown* next)
+{
+  Clear();
+
+  if (filter != NULL)
+    m_filters[m_numFilters++] = filter;
+
+  if (next == NULL)
+    return;
+
+  IMIDIStage* stage = NULL;
+
+  if (SUCCEEDED(next->QueryInterface(__uuidof(IMIDIStage), (void**)&stage))) {
+    const CMIDIPipeline* nextPipeline = stage->GetPipeline();
+    stage->Release();
+
+    if ((nextPipeline != NULL) && (m_numFilters + nextPipeline->m_numFilters <= MPL_MAXFILTERS)) {
+      for (int i = 0; i < nextPipeline->m_numFilters; i++)
+        m_filters[m_numFilters++] = nextPipeline->m_filters[i];
+
+      m_numFused = nextPipeline->m_numFused + 1;
+      m_midiOut  = nextPipeline->m_midiOut;
+
+      return;
+    }
+  }
+
+  m_midiOut = next;
+}
+
+void CMIDIPipeline::Clear(void) {
+  m_numFilters = 0;
+  m_numFused   = 0;
+  m_midiOut    = NULL;
+}
+
+//
+// How many modules are bypassed by the pipeline
+//
+int CMIDIPipeline::GetNumFused(void) const {
+  return m_numFused;
+}
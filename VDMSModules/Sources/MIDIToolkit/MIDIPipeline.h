@@ -0,0 +1,103 @@
+#ifndef __MIDIPIPELINE_H_
+#define __MIDIPIPELINE_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IMIDI.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MPL_MAXFILTERS    16        // how many filters a pipeline can hold
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// A processing step that MIDI messages go through on their way to the next
+//  module: it may change a message (in place), or drop it by returning
+//  false.  Filters are plain C++ objects, and must not change once they are
+//  part of a pipeline (they may be called from any thread).  A filter that
+//  keeps state as messages go through it must not be shared through
+//  IMIDIStage::GetPipeline; its module runs it under a lock of its own.
+//
+class CMIDIFilter {
+  public:
+    virtual bool FilterEvent(LONGLONG& usDelta, BYTE& status, BYTE& data1, BYTE& data2, BYTE& length);
+    virtual bool FilterSysEx(LONGLONG& usDelta, BYTE*& data, LONG& length);
+    virtual bool FilterRealTime(LONGLONG& usDelta, BYTE& data);
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+class CMIDIPipeline;
+
+//
+// Implemented (privately, in-process) by the MIDIToolkit modules, so that a
+//  module can tell whether the next one in the chain is a MIDIToolkit module
+//  as well.  GetPipeline returns the pipeline messages given to the module
+//  go through, or NULL if the module cannot be bypassed (e.g. if it has a
+//  thread of its own).
+//
+struct __declspec(uuid("816E3CC5-A0AF-11D5-9D8C-00A024112F81")) IMIDIStage : public IUnknown {
+  STDMETHOD_(const CMIDIPipeline*, GetPipeline)(void) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// A flattened chain of MIDIToolkit modules: the filters of each module, in
+//  order, followed by the first module that is not part of the pipeline (a
+//  module in some other DLL, or one that cannot be bypassed), reached
+//  through COM.  A module builds its pipeline at initialization time from
+//  its own filter and from the pipeline of the module after it, if that one
+//  is a MIDIToolkit module too; messages then go through every filter with a
+//  plain function call each, and cross over to COM only once.
+//
+class CMIDIPipeline {
+  public:
+    CMIDIPipeline(void);
+
+  public:
+    void Build(CMIDIFilter* filter, IUnknown* next);
+    void Clear(void);
+
+    int GetNumFused(void) const;
+
+  // Called for every message (inline, so that going through a pipeline
+  //  costs no more than a call to the next module did)
+  public:
+    HRESULT HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) const {
+      for (int i = 0; i < m_numFilters; i++) {
+        if (!m_filters[i]->FilterEvent(usDelta, status, data1, data2, length))
+          return S_OK;
+      }
+
+      return (m_midiOut != NULL) ? m_midiOut->HandleEvent(usDelta, status, data1, data2, length) : S_OK;
+    }
+
+    HRESULT HandleSysEx(LONGLONG usDelta, BYTE* data, LONG length) const {
+      for (int i = 0; i < m_numFilters; i++) {
+        if (!m_filters[i]->FilterSysEx(usDelta, data, length))
+          return S_OK;
+      }
+
+      return (m_midiOut != NULL) ? m_midiOut->HandleSysEx(usDelta, data, length) : S_OK;
+    }
+
+    HRESULT HandleRealTime(LONGLONG usDelta, BYTE data) const {
+      for (int i = 0; i < m_numFilters; i++) {
+        if (!m_filters[i]->FilterRealTime(usDelta, data))
+          return S_OK;
+      }
+
+      return (m_midiOut != NULL) ? m_midiOut->HandleRealTime(usDelta, data) : S_OK;
+    }
+
+  protected:
+    CMIDIFilter* m_filters[MPL_MAXFILTERS];
+    int m_numFilters;
+    int m_numFused;                     // how many modules after the first one were bypassed
+    IMIDIEventHandlerPtr m_midiOut;     // where messages go once through the filters
+};
+
+#endif //__MIDIPIPELINE_H_
@@ -0,0 +1,363 @@
+// MIDIScheduler.cpp: implementation of the CMIDIScheduler class.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "MIDIScheduler.h"
+
+#include <MFCUtil.h>
+#include <VDMUtil.h>
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+CMIDIScheduler::CMIDIScheduler(void)
+  : m_hEvent(NULL), m_hTimer(NULL), m_isQuit(false), m_isWaiting(0), m_numPosted(0), m_numForwarded(0), m_numDropped(0), m_numOversized(0)
+{ }
+
+CMIDIScheduler::~CMIDIScheduler(void) {
+  Destroy();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Methods
+//////////////////////////////////////////////////////////////////////
+
+//
+// Starts the scheduler thread
+//
+bool CMIDIScheduler::Init(
+  IVDMQUERYLib::IVDMRTEnvironmentPtr& env,
+  IMIDIEventHandler* midiOut,
+  LPCTSTR szName)
+{
+  m_env = env;
+  m_midiOut = midiOut;
+
+  m_isQuit = false;
+  m_isWaiting = 0;
+  m_numPosted = m_numForwarded = 0;
+  m_numDropped = m_numOversized = 0;
+
+  if (!m_queue.Create(MSC_QUEUELEN) ||
+      ((m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) ||
+      ((m_hTimer = CreateWaitableTimer(NULL, FALSE, NULL)) == NULL) ||
+      !m_thread.Create(this, szName, true))
+  {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Could not create the MIDI scheduler thread")));
+    Destroy();
+    return false;
+  }
+
+  m_thread.SetPriority(THREAD_PRIORITY_HIGHEST);
+  m_thread.Resume();
+
+  return true;
+}
+
+//
+// Stops the scheduler thread (it forwards whatever is still queued first);
+//  returns false if the thread would not stop
+//
+bool CMIDIScheduler::Destroy(void) {
+  if (m_thread.GetThreadHandle() != NULL) {
+    m_isQuit = true;
+    SetEvent(m_hEvent);
+
+    if (!m_thread.Join(MSC_QUIT_TIMEOUT)) {
+      // The thread may still be using the queue and the MIDI-out module; leave them be
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Timed out while waiting for the MIDI scheduler thread to exit")));
+      return false;
+    }
+  }
+
+  if (m_hEvent != NULL) {
+    CloseHandle(m_hEvent);
+    m_hEvent = NULL;
+  }
+
+  if (m_hTimer != NULL) {
+    CloseHandle(m_hTimer);
+    m_hTimer = NULL;
+  }
+
+  if (m_numOversized > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d SysEx message(s) were dropped because they were longer than %d bytes"), m_numOversized, MSC_MAXSYSEX));
+
+  m_numOversized = 0;
+
+  m_queue.Destroy();
+
+  m_midiOut = NULL;
+  m_env = NULL;
+
+  return true;
+}
+
+bool CMIDIScheduler::PostEvent(
+  LONGLONG dueTime,
+  LONGLONG usDelta,
+  BYTE status,
+  BYTE data1,
+  BYTE data2,
+  BYTE length)
+{
+  record_t record;
+
+  record.dueTime = dueTime;
+  record.type    = REC_EVENT;
+  record.usDelta = usDelta;
+  record.length  = length;
+  record.status  = status;
+  record.data1   = data1;
+  record.data2   = data2;
+
+  return PostRecord(record, NULL);
+}
+
+bool CMIDIScheduler::PostSysEx(
+  LONGLONG dueTime,
+  LONGLONG usDelta,
+  const BYTE* data,
+  LONG length)
+{
+  if ((length < 0) || (length > MSC_MAXSYSEX)) {
+    if (m_numOversized++ == 0)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Dropped a %d-byte SysEx message (at most %d bytes can be scheduled); further ones will be counted"), length, MSC_MAXSYSEX));
+
+    return false;
+  }
+
+  record_t record;
+
+  record.dueTime = dueTime;
+  record.type    = REC_SYSEX;
+  record.usDelta = usDelta;
+  record.length  = length;
+
+  return PostRecord(record, data);
+}
+
+bool CMIDIScheduler::PostRealTime(
+  LONGLONG dueTime,
+  LONGLONG usDelta,
+  BYTE data)
+{
+  record_t record;
+
+  record.dueTime = dueTime;
+  record.type    = REC_REALTIME;
+  record.usDelta = usDelta;
+  record.length  = 0;
+  record.status  = data;
+
+  return PostRecord(record, NULL);
+}
+
+//
+// Forwards whichever short message is in *slot (see MSC_PACK) when it is
+//  due, rather than a copy of the message as it is now: the caller may keep
+//  replacing the message in the slot (with InterlockedExchange) until then,
+//  and need only post again once the slot was emptied.  The message goes
+//  out ahead of time if other messages are posted after it, so that these
+//  are never held back.
+//
+bool CMIDIScheduler::PostLatest(
+  LONGLONG dueTime,
+  LONGLONG usDelta,
+  volatile LONG* slot)
+{
+  record_t record;
+
+  record.dueTime = dueTime;
+  record.type    = REC_LATEST;
+  record.usDelta = usDelta;
+  record.length  = 0;
+  record.slot    = slot;
+
+  return PostRecord(record, NULL);
+}
+
+//
+// Whether every message posted so far was forwarded (in which case the
+//  caller may forward a message itself without getting ahead of the queue)
+//
+bool CMIDIScheduler::IsIdle(void) const {
+  return (m_numForwarded == m_numPosted);
+}
+
+//
+// How many messages were dropped because they did not fit in the queue
+//
+LONG CMIDIScheduler::GetNumDropped(void) const {
+  return m_numDropped;
+}
+
+//////////////////////////////////////////////////////////////////////
+// IRunnable
+//////////////////////////////////////////////////////////////////////
+
+unsigned int CMIDIScheduler::Run(CThread& thread) {
+  record_t record;
+
+  timeBeginPeriod(1);                 // so that the waitable timer is accurate to the millisecond
+
+  while (true) {
+    if (m_queue.GetUsed() < (LONG)sizeof(record)) {
+      if (m_isQuit)
+        break;
+
+      WaitForRecord();
+      continue;
+    }
+
+    m_queue.Read(&record, sizeof(record));
+
+    if (record.type == REC_SYSEX)
+      m_queue.Read(m_sysExBuf, record.length);
+
+    // Wait until the message is due (unless quitting, in which case
+    //  everything still queued is forwarded right away)
+    while (!m_isQuit) {
+      LONGLONG timeLeft = record.dueTime - TIM_GetMicros();
+
+      if (timeLeft <= 0)
+        break;
+
+      if ((record.type == REC_LATEST) && (m_queue.GetUsed() > 0))
+        break;                        // other messages are waiting behind it
+
+      WaitUntil(record.dueTime, record.type == REC_LATEST);
+    }
+
+    ForwardRecord(record, m_sysExBuf);
+    InterlockedIncrement((LPLONG)&m_numForwarded);
+  }
+
+  timeEndPeriod(1);
+
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Utility functions
+//////////////////////////////////////////////////////////////////////
+
+bool CMIDIScheduler::PostRecord(
+  const record_t& record,
+  const BYTE* data)
+{
+  LONG recordLen = sizeof(record) + ((record.type == REC_SYSEX) ? record.length : 0);
+
+  if (m_queue.GetFree() < recordLen) {
+    if (m_numDropped++ == 0)
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The MIDI scheduler queue is full, dropping messages")));
+
+    return false;
+  }
+
+  InterlockedIncrement((LPLONG)&m_numPosted);
+
+  // Records go into the queue in one piece, so that the scheduler thread
+  //  never sees a SysEx record without its data
+  if (record.type == REC_SYSEX) {
+    memcpy(m_postBuf, &record, sizeof(record));
+    memcpy(m_postBuf + sizeof(record), data, record.length);
+    m_queue.Write(m_postBuf, recordLen);
+  } else {
+    m_queue.Write(&record, sizeof(record));
+  }
+
+  if (InterlockedExchange((LPLONG)&m_isWaiting, 0) != 0)
+    SetEvent(m_hEvent);               // the scheduler thread is (or is about to be) waiting for it
+
+  return true;
+}
+
+//
+// Waits (scheduler thread) until a message is queued, unless one already is.
+//  The thread lets posters know it is about to wait before it looks at the
+//  queue one last time, so that a message queued in between still wakes it
+//  up.
+//
+void CMIDIScheduler::WaitForRecord(void) {
+  InterlockedExchange((LPLONG)&m_isWaiting, 1);
+
+  if ((m_queue.GetUsed() == 0) && !m_isQuit)
+    WaitForSingleObject(m_hEvent, INFINITE);
+
+  InterlockedExchange((LPLONG)&m_isWaiting, 0);
+}
+
+//
+// Sleeps (scheduler thread) on the waitable timer until the given time, or
+//  until quitting; if isWakeOnPost is set, also wakes up as soon as a
+//  message is queued (see WaitForRecord)
+//
+void CMIDIScheduler::WaitUntil(LONGLONG dueTime, bool isWakeOnPost) {
+  LARGE_INTEGER timerDue;
+  timerDue.QuadPart = -(dueTime - TIM_GetMicros()) * 10;  // relative, in 100ns units (a positive value would be an absolute time)
+
+  if (timerDue.QuadPart >= 0)
+    return;
+
+  if (isWakeOnPost) {
+    InterlockedExchange((LPLONG)&m_isWaiting, 1);
+
+    if ((m_queue.GetUsed() > 0) || m_isQuit) {
+      InterlockedExchange((LPLONG)&m_isWaiting, 0);
+      return;
+    }
+  }
+
+  if (SetWaitableTimer(m_hTimer, &timerDue, 0, NULL, NULL, FALSE)) {
+    HANDLE handles[] = { m_hEvent, m_hTimer };
+
+    WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+  } else {
+    WaitForSingleObject(m_hEvent, (DWORD)((-timerDue.QuadPart + 9999) / 10000));
+  }
+
+  if (isWakeOnPost)
+    InterlockedExchange((LPLONG)&m_isWaiting, 0);
+}
+
+//
+// Hands a queued message on to the MIDI-out module
+//
+void CMIDIScheduler::ForwardRecord(
+  const record_t& record,
+  BYTE* data)
+{
+  HRESULT hr = S_OK;
+
+  if (m_midiOut == NULL)
+    return;
+
+  switch (record.type) {
+    case REC_EVENT:
+      hr = m_midiOut->HandleEvent(record.usDelta, record.status, record.data1, record.data2, (BYTE)record.length);
+      break;
+
+    case REC_SYSEX:
+      hr = m_midiOut->HandleSysEx(record.usDelta, data, record.length);
+      break;
+
+    case REC_REALTIME:
+      hr = m_midiOut->HandleRealTime(record.usDelta, record.status);
+      break;
+
+    case REC_LATEST:
+      {
+        LONG message = InterlockedExchange((LPLONG)record.slot, 0);
+
+        if (message != 0)
+          hr = m_midiOut->HandleEvent(record.usDelta, (BYTE)message, (BYTE)(message >> 8), (BYTE)(message >> 16), (BYTE)(message >> 24));
+      }
+      break;
+  }
+
+  if (FAILED(hr))
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Could not forward a scheduled MIDI message:\n0x%08x - %s"), hr, (LPCTSTR)FormatMessage(hr)));
+}
@@ -0,0 +1,98 @@
+#ifndef __MIDISCHEDULER_H_
+#define __MIDISCHEDULER_H_
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IMIDI.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+
+#import <IVDMQuery.tlb>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <SPSCRing.h>
+#include <Thread.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MSC_QUEUELEN      65536     // room (in bytes) for messages waiting to be forwarded
+#define MSC_MAXSYSEX      8192      // largest SysEx message that can be scheduled
+#define MSC_QUIT_TIMEOUT  5000      // how long to wait for the scheduler thread to forward the remaining messages and exit
+
+// A short message packed into a LONG, as kept in a slot (see PostLatest); a
+//  status byte is never 0, so neither is a packed message
+#define MSC_PACK(status, data1, data2, length) ((LONG)(status) | ((LONG)(data1) << 8) | ((LONG)(data2) << 16) | ((LONG)(length) << 24))
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Forwards MIDI messages to a MIDI-out module at set times (see
+//  TIM_GetMicros), from a high-priority thread of its own, so that the
+//  caller never waits.  The thread sleeps on a waitable timer until a
+//  message is due, so messages go out within about a millisecond (the
+//  resolution set with timeBeginPeriod) of their due time.  Messages are queued as they are posted, and must be
+//  posted in order of due time; posting is not thread-safe (callers on more
+//  than one thread must take turns).
+// Messages still queued when the scheduler is destroyed are forwarded
+//  right away.
+//
+class CMIDIScheduler : public IRunnable {
+  public:
+    CMIDIScheduler(void);
+    ~CMIDIScheduler(void);
+
+  public:
+    bool Init(IVDMQUERYLib::IVDMRTEnvironmentPtr& env, IMIDIEventHandler* midiOut, LPCTSTR szName);
+    bool Destroy(void);
+
+    bool PostEvent(LONGLONG dueTime, LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
+    bool PostSysEx(LONGLONG dueTime, LONGLONG usDelta, const BYTE* data, LONG length);
+    bool PostRealTime(LONGLONG dueTime, LONGLONG usDelta, BYTE data);
+    bool PostLatest(LONGLONG dueTime, LONGLONG usDelta, volatile LONG* slot);
+
+    bool IsIdle(void) const;
+    LONG GetNumDropped(void) const;
+
+  // IRunnable
+  public:
+    unsigned int Run(CThread& thread);
+
+  protected:
+    enum { REC_EVENT, REC_SYSEX, REC_REALTIME, REC_LATEST };
+
+    typedef struct {
+      LONGLONG dueTime;                 // when to forward the message
+      LONGLONG usDelta;
+      LONG length;                      // REC_EVENT: message length; REC_SYSEX: how many bytes of data follow the record
+      BYTE type;
+      BYTE status, data1, data2;        // REC_REALTIME: the message is in status
+      volatile LONG* slot;              // REC_LATEST: where to take the message from
+    } record_t;
+
+  protected:
+    bool PostRecord(const record_t& record, const BYTE* data);
+    void ForwardRecord(const record_t& record, BYTE* data);
+    void WaitForRecord(void);
+    void WaitUntil(LONGLONG dueTime, bool isWakeOnPost);
+
+  protected:
+    CThread m_thread;
+    HANDLE m_hEvent;                    // signalled when a message is queued while the scheduler thread waits for one (or when quitting)
+    HANDLE m_hTimer;                    // signalled when the message the scheduler thread holds is due
+    CSPSCRing m_queue;
+    volatile bool m_isQuit;
+    volatile LONG m_isWaiting;          // whether the scheduler thread is about to wait for messages to be queued
+
+    volatile LONG m_numPosted;          // how many messages were queued
+    volatile LONG m_numForwarded;       // how many of them were forwarded
+    LONG m_numDropped;                  // how many messages did not fit in the queue
+    LONG m_numOversized;                // how many SysEx messages were too long to be scheduled
+
+    BYTE m_postBuf[sizeof(record_t) + MSC_MAXSYSEX];    // used by the caller's thread to put together SysEx records
+    BYTE m_sysExBuf[MSC_MAXSYSEX];      // used by the scheduler thread to retrieve SysEx data
+
+    IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+    IMIDIEventHandlerPtr m_midiOut;
+};
+
+#endif //__MIDISCHEDULER_H_
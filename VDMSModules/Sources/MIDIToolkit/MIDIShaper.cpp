@@ -0,0 +1,280 @@
+// MIDIShaper.cpp : Implementation of CMIDIShaper
+#include "stdafx.h"
+#include "MIDIToolkit.h"
+#include "MIDIShaper.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define INI_STR_MIDIOUT       L"MidiOut"
+
+#define INI_STR_BAUDRATE      L"baudRate"
+#define INI_STR_RXBUFFER      L"rxBuffer"
+#define INI_STR_RXRATE        L"rxRate"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <MFCUtil.h>
+#pragma comment ( lib , "MFCUtil.lib" )
+
+#include <VDMUtil.h>
+#pragma comment ( lib , "VDMUtil.lib" )
+
+/////////////////////////////////////////////////////////////////////////////
+// CMIDIShaper
+
+/////////////////////////////////////////////////////////////////////////////
+// ISupportsErrorInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIShaper::InterfaceSupportsErrorInfo(REFIID riid)
+{
+	static const IID* arr[] =
+	{
+		&IID_IVDMBasicModule,
+		&IID_IMIDIEventHandler
+	};
+	for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
+	{
+		if (InlineIsEqualGUID(*arr[i],riid))
+			return S_OK;
+	}
+	return S_FALSE;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IVDMBasicModule
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIShaper::Init(IUnknown * configuration) {
+	if (configuration == NULL)
+		return E_POINTER;
+
+  IVDMQUERYLib::IVDMQueryDependenciesPtr Depends;   // Dependency query object
+  IVDMQUERYLib::IVDMQueryConfigurationPtr Config;   // Configuration query object
+
+  // Grab a copy of the runtime environment (useful for logging, etc.)
+  RTE_Set(m_env, configuration);
+
+  // Initialize configuration
+  try {
+    // Obtain the Query objects (for intialization purposes)
+    Depends    = configuration; // Dependency query object
+    Config     = configuration; // Configuration query object
+
+    /** Get settings *******************************************************/
+
+    // Obtain the wire speed (bits per second)
+    m_baudRate = CFG_Get(Config, INI_STR_BAUDRATE, 31250, 10, true);
+
+    if ((m_baudRate != 0) && ((m_baudRate < 1000) || (m_baudRate > 1000000))) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("The baud rate (%d) must be 0 (no shaping) or between 1000 and 1000000, using 31250 instead"), m_baudRate));
+      m_baudRate = 31250;
+    }
+
+    // Obtain the device's receive buffer characteristics
+    m_rxBuffer = CFG_Get(Config, INI_STR_RXBUFFER, 0, 10, true);
+    m_rxRate   = CFG_Get(Config, INI_STR_RXRATE, 0, 10, true);
+
+    if ((m_rxBuffer > 0) && (m_rxRate <= 0)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("No rate given for the %d-byte receive buffer, the buffer will not be modeled"), m_rxBuffer));
+      m_rxBuffer = 0;
+    }
+
+    if (m_rxBuffer < 0)
+      m_rxBuffer = 0;
+
+    /** Get modules ********************************************************/
+
+    // Try to obtain an interface to a MIDI-out module, use NULL if none available
+    m_midiOut = DEP_Get(Depends, INI_STR_MIDIOUT, NULL, false);   // complain if no such module available
+  } catch (_com_error& ce) {
+    SetErrorInfo(0, ce.ErrorInfo());
+    return ce.Error();                // Propagate the error
+  }
+
+  // Start the scheduler thread (no need for one if messages go straight through)
+  if (m_baudRate > 0) {
+    m_wireFree = 0;
+    m_rxLevel  = 0;
+    m_rxTime   = 0;
+    m_numPaced = 0;
+    m_maxWait  = 0;
+
+    if (!m_scheduler.Init(m_env, m_midiOut, _T("MIDI Shaper"))) {
+      Destroy();
+      return E_FAIL;
+    }
+  } else {
+    // Fuse with the MIDIToolkit modules that follow, if any
+    m_pipeline.Build(NULL, m_midiOut);
+  }
+
+  if (m_rxBuffer > 0) {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIShaper initialized (baud rate = %d, receive buffer = %d bytes, emptied at %d bytes/s)"), m_baudRate, m_rxBuffer, m_rxRate));
+  } else {
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIShaper initialized (baud rate = %d)"), m_baudRate));
+  }
+
+  return S_OK;
+}
+
+STDMETHODIMP CMIDIShaper::Destroy() {
+  LONG numDropped = m_scheduler.GetNumDropped();
+
+  // Stop the scheduler thread (it forwards whatever is still queued first)
+  if (!m_scheduler.Destroy())
+    return E_FAIL;
+
+  if (m_numPaced > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("%d SysEx message(s) were paced, held back by up to %d.%03dms"), m_numPaced, (int)(m_maxWait / 1000), (int)(m_maxWait % 1000)));
+
+  if (numDropped > 0)
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("%d MIDI message(s) were dropped because the shaper queue was full"), numDropped));
+
+  // Release the MIDI-out module
+  m_pipeline.Clear();
+  m_midiOut = NULL;
+
+  // Release the runtime environment
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("MIDIShaper released")));
+  RTE_Set(m_env, NULL);
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIEventHandler
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CMIDIShaper::HandleEvent(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length) {
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_baudRate <= 0)
+    return m_pipeline.HandleEvent(usDelta, status, data1, data2, length);
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  LONGLONG now = TIM_GetMicros();
+
+  // Go straight through if there is no SysEx traffic to wait for
+  if ((now >= m_wireFree) && m_scheduler.IsIdle())
+    return m_midiOut->HandleEvent(usDelta, status, data1, data2, length);
+
+  LONGLONG dueTime = max(now, m_wireFree);
+
+  if (usDelta >= 0)
+    usDelta += dueTime - now;
+
+  m_scheduler.PostEvent(dueTime, usDelta, status, data1, data2, length);
+
+  return S_OK;
+}
+
+STDMETHODIMP CMIDIShaper::HandleSysEx(LONGLONG usDelta, BYTE * data, LONG length) {
+	if (data == NULL)
+		return E_POINTER;
+
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_baudRate <= 0)
+    return m_pipeline.HandleSysEx(usDelta, data, length);
+
+  CSingleLock lock(&m_mutex, TRUE);
+
+  LONGLONG now = TIM_GetMicros();
+  LONG numBytes = length + 2;         // framed (F0 ... F7)
+
+  // The message goes out once the wire is free, and once the device has
+  //  room for it; it then keeps the wire busy for as long as it takes to
+  //  send it at the baud rate
+  LONGLONG startTime = ReserveRxBuffer(max(now, m_wireFree), numBytes);
+  m_wireFree = startTime + GetWireTime(numBytes);
+
+  if ((startTime <= now) && m_scheduler.IsIdle())
+    return m_midiOut->HandleSysEx(usDelta, data, length);
+
+  LONGLONG wait = max(startTime - now, 0);
+
+  if (wait > 0) {
+    m_numPaced++;
+    m_maxWait = max(m_maxWait, wait);
+  }
+
+  if (usDelta >= 0)
+    usDelta += wait;
+
+  m_scheduler.PostSysEx(startTime, usDelta, data, length);
+
+  return S_OK;
+}
+
+STDMETHODIMP CMIDIShaper::HandleRealTime(LONGLONG usDelta, BYTE data) {
+  if (m_midiOut == NULL)
+    return S_OK;
+
+  if (m_baudRate <= 0)
+    return m_pipeline.HandleRealTime(usDelta, data);
+
+  // Real-time messages may be sent at any time, even in the middle of other
+  //  messages, so they are never held back
+  return m_midiOut->HandleRealTime(usDelta, data);
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IMIDIStage
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP_(const CMIDIPipeline*) CMIDIShaper::GetPipeline() {
+  // Messages that are scheduled cannot bypass this module
+  return (m_baudRate > 0) ? NULL : &m_pipeline;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Utility functions
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// How long (in microseconds) it takes to send the given number of bytes
+//  over the wire
+//
+LONGLONG CMIDIShaper::GetWireTime(LONG numBytes) {
+  return (numBytes * (LONGLONG)(MSH_BITSPERBYTE * 1000000) + m_baudRate - 1) / m_baudRate;
+}
+
+//
+// Works out when a message can start going out (no sooner than startTime)
+//  without overrunning the device's receive buffer, which empties at a
+//  steady rate; a message larger than the whole buffer waits until the
+//  buffer is empty.  The message is then accounted for in the buffer.
+//
+LONGLONG CMIDIShaper::ReserveRxBuffer(LONGLONG startTime, LONG numBytes) {
+  if (m_rxBuffer <= 0)
+    return startTime;
+
+  double level = m_rxLevel - (double)(startTime - m_rxTime) * m_rxRate / 1000000.0;
+  double room  = (double)(max(m_rxBuffer, numBytes) - numBytes);
+
+  if (level > room) {
+    LONGLONG wait = (LONGLONG)((level - room) * 1000000.0 / m_rxRate + 0.999);
+    startTime += wait;
+    level -= (double)wait * m_rxRate / 1000000.0;
+  }
+
+  if (level < 0)
+    level = 0;
+
+  m_rxLevel = level + numBytes;
+  m_rxTime  = startTime;
+
+  return startTime;
+}
@@ -0,0 +1,109 @@
+// MIDIShaper.h : Declaration of the CMIDIShaper
+
+#ifndef __MIDISHAPER_H_
+#define __MIDISHAPER_H_
+
+#include "resource.h"       // main symbols
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IVDMModule.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+#import <IMIDI.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids
+
+#import <IVDMQuery.tlb>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include "MIDIPipeline.h"
+#include "MIDIScheduler.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MSH_BITSPERBYTE   10        // start bit, 8 data bits, stop bit
+
+/////////////////////////////////////////////////////////////////////////////
+// CMIDIShaper
+class ATL_NO_VTABLE CMIDIShaper :
+	public CComObjectRootEx<CComMultiThreadModel>,
+	public CComCoClass<CMIDIShaper, &CLSID_MIDIShaper>,
+	public ISupportErrorInfo,
+  public IVDMBasicModule,
+  public IMIDIEventHandler,
+  public IMIDIStage
+{
+public:
+	CMIDIShaper() : m_baudRate(0), m_rxBuffer(0), m_rxRate(0), m_wireFree(0), m_rxLevel(0), m_rxTime(0), m_numPaced(0), m_maxWait(0)
+	{
+	}
+
+DECLARE_REGISTRY_RESOURCEID(IDR_MIDISHAPER)
+DECLARE_NOT_AGGREGATABLE(CMIDIShaper)
+
+DECLARE_PROTECT_FINAL_CONSTRUCT()
+
+BEGIN_COM_MAP(CMIDIShaper)
+  COM_INTERFACE_ENTRY(ISupportErrorInfo)
+  COM_INTERFACE_ENTRY(IVDMBasicModule)
+  COM_INTERFACE_ENTRY(IMIDIEventHandler)
+  COM_INTERFACE_ENTRY(IMIDIStage)
+END_COM_MAP()
+
+// ISupportsErrorInfo
+public:
+	STDMETHOD(InterfaceSupportsErrorInfo)(REFIID riid);
+
+// IVDMBasicModule
+public:
+	STDMETHOD(Init)(IUnknown * configuration);
+	STDMETHOD(Destroy)();
+
+// IMIDIEventHandler
+public:
+	STDMETHOD(HandleEvent)(LONGLONG usDelta, BYTE status, BYTE data1, BYTE data2, BYTE length);
+	STDMETHOD(HandleSysEx)(LONGLONG usDelta, BYTE * data, LONG length);
+	STDMETHOD(HandleRealTime)(LONGLONG usDelta, BYTE data);
+
+// IMIDIStage
+public:
+  STDMETHOD_(const CMIDIPipeline*, GetPipeline)();
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Utility functions
+protected:
+  LONGLONG GetWireTime(LONG numBytes);
+  LONGLONG ReserveRxBuffer(LONGLONG startTime, LONG numBytes);
+
+// Other member variables
+protected:
+  int m_baudRate;                     // 0 = messages go straight through
+  int m_rxBuffer;                     // size (in bytes) of the device's receive buffer, 0 = not modeled
+  int m_rxRate;                       // how many bytes per second the device takes out of its receive buffer
+
+  //
+  // The wire is modeled as busy for as long as it takes to send each SysEx
+  //  message at the baud rate; a SysEx message only goes out once the wire
+  //  is free (and, if modeled, once there is room for it in the device's
+  //  receive buffer).  Short messages take no time on the wire: they go
+  //  straight through when the wire is idle, and otherwise follow the SysEx
+  //  traffic ahead of them as soon as the wire frees up.  Messages that are
+  //  held back are forwarded by the scheduler, in order.
+  //
+  CMIDIScheduler m_scheduler;
+  CMIDIPipeline m_pipeline;           // used instead when messages go straight through
+  CCriticalSection m_mutex;           // regulates access to the wire model and posting to m_scheduler (there may be more than one caller)
+  LONGLONG m_wireFree;                // when the wire is done with the SysEx traffic sent so far
+  double m_rxLevel;                   // how many bytes were in the receive buffer ...
+  LONGLONG m_rxTime;                  // ... at this time
+
+  LONG m_numPaced;                    // how many SysEx messages were held back
+  LONGLONG m_maxWait;                 // longest a message was held back (microseconds)
+
+// Interfaces to dependency modules
+protected:
+  IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+  IMIDIEventHandlerPtr m_midiOut;
+};
+
+#endif //__MIDISHAPER_H_
@@ -14,6 +14,8 @@
 #include "MIDIMapper.h"
 #include "MIDISplitter.h"
 #include "MIDIDelay.h"
+#include "MIDIShaper.h"
+#include "MIDIOptimizer.h"
 
 
 CComModule _Module;
@@ -22,6 +24,8 @@ BEGIN_OBJECT_MAP(ObjectMap)
 OBJECT_ENTRY(CLSID_MIDIMapper, CMIDIMapper)
 OBJECT_ENTRY(CLSID_MIDISplitter, CMIDISplitter)
 OBJECT_ENTRY(CLSID_MIDIDelay, CMIDIDelay)
+OBJECT_ENTRY(CLSID_MIDIShaper, CMIDIShaper)
+OBJECT_ENTRY(CLSID_MIDIOptimizer, CMIDIOptimizer)
 END_OBJECT_MAP()
 
 class CMIDIToolkitApp : public CWinApp
@@ -292,10 +292,30 @@ SOURCE=.\MIDIDelay.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIFilters.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDIMapper.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIOptimizer.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIPipeline.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIScheduler.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIShaper.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDISplitter.cpp
 # End Source File
 # Begin Source File
@@ -317,10 +337,30 @@ SOURCE=.\MIDIDelay.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIFilters.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDIMapper.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIOptimizer.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIPipeline.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIScheduler.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIShaper.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDISplitter.h
 # End Source File
 # Begin Source File
@@ -341,6 +381,14 @@ SOURCE=.\MIDIMapper.rgs
 # End Source File
 # Begin Source File
 
+SOURCE=.\MIDIOptimizer.rgs
+# End Source File
+# Begin Source File
+
+SOURCE=.\MIDIShaper.rgs
+# End Source File
+# Begin Source File
+
 SOURCE=.\MIDISplitter.rgs
 # End Source File
 # Begin Source File
@@ -24,6 +24,11 @@
 extern CComModule _Module;
 #include <atlcom.h>
 
+#include <afxmt.h>
+
+#include <mmsystem.h>
+#pragma comment ( lib , "winmm.lib" )
+
 //{{AFX_INSERT_LOCATION}}
 // Microsoft Visual C++ will insert additional declarations immediately before the previous line.
 
@@ -6,6 +6,8 @@
 #define IDR_MIDIMAPPER                  102
 #define IDR_MIDISPLITTER                103
 #define IDR_MIDIDELAY                   104
+#define IDR_MIDISHAPER                  105
+#define IDR_MIDIOPTIMIZER               106
 
 // Next default values for new objects
 // 
@@ -14,6 +16,6 @@
 #define _APS_NEXT_RESOURCE_VALUE        201
 #define _APS_NEXT_COMMAND_VALUE         32768
 #define _APS_NEXT_CONTROL_VALUE         201
-#define _APS_NEXT_SYMED_VALUE           105
+#define _APS_NEXT_SYMED_VALUE           107
 #endif
 #endif
@@ -0,0 +1,193 @@
+// OPLBench.cpp : measures the CPU cost of the OPL synthesis engines
+//  available to the AdLib emulation, on synthetic workloads.
+//
+// Usage: OPLBench [sampleRate [seconds]]
+//
+
+#include "stdafx.h"
+
+#include "../EmuAdLib/OPLChipMAME.h"
+#include "../EmuAdLib/OPLChipAccurate.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_SAMPLE_RATE   44100
+#define DEFAULT_SECONDS       30
+
+#define TICK_RATE             50        // note events per second
+#define RENDER_FRAMES         64        // largest block rendered at once (the emulation renders small blocks)
+
+#define OPL_CHANNELS          9         // melodic channels per register set
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  const char* name;
+  IOPLChip::type_t type;
+  int numChips;
+  int numRegSets;                       // 2 for OPL3 (18 channels)
+} workload_t;
+
+static const workload_t workloads[] = {
+  { "OPL2",      IOPLChip::TYPE_OPL2, 1, 1 },
+  { "dual OPL2", IOPLChip::TYPE_OPL2, 2, 1 },
+  { "OPL3",      IOPLChip::TYPE_OPL3, 1, 2 }
+};
+
+static const unsigned short fnums[12] = {
+  0x157, 0x16b, 0x181, 0x198, 0x1b0, 0x1ca, 0x1e5, 0x202, 0x220, 0x241, 0x263, 0x287
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned long seed = 1;
+
+//
+// Deterministic pseudo-random numbers (the same "song" is played by every
+//  engine)
+//
+static int Random(int range) {
+  seed = seed * 1103515245UL + 12345UL;
+  return (int)((seed >> 16) & 0x7fff) % range;
+}
+
+//
+// Retrieves the register offset of a channel's modulator operator
+//
+static int GetOperator(int channel) {
+  return (channel % 3) + 8 * (channel / 3);
+}
+
+//
+// Programs an instrument on all the channels, and enables the OPL3
+//  features if applicable
+//
+static void SetupChip(IOPLChip& chip, const workload_t& workload, int chipID) {
+  int regSet, channel;
+
+  chip.write(chipID, 0, 0x01, 0x20);    // enable waveform select
+  chip.write(chipID, 0, 0xbd, 0xc0);    // deep AM and vibrato
+
+  if (workload.type == IOPLChip::TYPE_OPL3)
+    chip.write(chipID, 1, 0x05, 0x01);  // OPL3 mode
+
+  for (regSet = 0; regSet < workload.numRegSets; regSet++) {
+    for (channel = 0; channel < OPL_CHANNELS; channel++) {
+      int op = GetOperator(channel);
+
+      chip.write(chipID, regSet, 0x20 + op, 0x21);  // modulator: vibrato, sustain, multiple 1
+      chip.write(chipID, regSet, 0x23 + op, 0xa1);  // carrier: AM, sustain, multiple 1
+      chip.write(chipID, regSet, 0x40 + op, 0x1a);
+      chip.write(chipID, regSet, 0x43 + op, 0x00);
+      chip.write(chipID, regSet, 0x60 + op, 0xf3);
+      chip.write(chipID, regSet, 0x63 + op, 0xf2);
+      chip.write(chipID, regSet, 0x80 + op, 0x44);
+      chip.write(chipID, regSet, 0x83 + op, 0x56);
+      chip.write(chipID, regSet, 0xe0 + op, channel & 0x03);
+      chip.write(chipID, regSet, 0xe3 + op, 0x00);
+      chip.write(chipID, regSet, 0xc0 + channel, 0x30 | 0x0a);  // both speakers (OPL3), feedback 5, FM
+    }
+  }
+}
+
+//
+// Plays the next tick of the "song": a few channels are keyed off and
+//  keyed on again with a new note
+//
+static void PlayTick(IOPLChip& chip, const workload_t& workload, int chipID) {
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    int regSet  = Random(workload.numRegSets);
+    int channel = Random(OPL_CHANNELS);
+    int note    = Random(12);
+    int block   = 2 + Random(4);
+
+    chip.write(chipID, regSet, 0xb0 + channel, 0x00);  // key off
+    chip.write(chipID, regSet, 0xa0 + channel, fnums[note] & 0xff);
+    chip.write(chipID, regSet, 0xb0 + channel, 0x20 | (block << 2) | (fnums[note] >> 8));
+  }
+}
+
+//
+// Runs a workload through an engine; returns the CPU time spent (in
+//  seconds), or a negative value if the engine could not be created
+//
+static double RunWorkload(IOPLChip& chip, const workload_t& workload, int sampleRate, int seconds) {
+  int chipID, tick;
+
+  if (!chip.create(workload.type, workload.numChips, sampleRate))
+    return -1.0;
+
+  OPLSample_t buffer[2 * RENDER_FRAMES];
+
+  seed = 1;
+
+  for (chipID = 0; chipID < workload.numChips; chipID++) {
+    chip.reset(chipID);
+    SetupChip(chip, workload, chipID);
+  }
+
+  clock_t start = clock();
+
+  for (tick = 0; tick < seconds * TICK_RATE; tick++) {
+    // Number of frames between this tick and the next (no drift)
+    int numFrames = (int)(((__int64)(tick + 1) * sampleRate) / TICK_RATE - ((__int64)tick * sampleRate) / TICK_RATE);
+
+    for (chipID = 0; chipID < workload.numChips; chipID++) {
+      PlayTick(chip, workload, chipID);
+
+      for (int done = 0; done < numFrames; done += RENDER_FRAMES) {
+        int toRender = (numFrames - done < RENDER_FRAMES) ? (numFrames - done) : RENDER_FRAMES;
+        chip.render(chipID, buffer, toRender);
+      }
+    }
+  }
+
+  clock_t end = clock();
+
+  chip.destroy();
+
+  return (double)(end - start) / CLOCKS_PER_SEC;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+  int sampleRate = (argc > 1) ? atoi(argv[1]) : DEFAULT_SAMPLE_RATE;
+  int seconds    = (argc > 2) ? atoi(argv[2]) : DEFAULT_SECONDS;
+
+  if ((argc > 3) || (sampleRate < 1000) || (sampleRate > 192000) || (seconds < 1)) {
+    fprintf(stderr, "Usage: OPLBench [sampleRate [seconds]]\n");
+    return 1;
+  }
+
+  printf("Rendering %d seconds of audio at %d Hz\n\n", seconds, sampleRate);
+  printf("%-12s %-10s %14s %12s\n", "engine", "workload", "CPU us/second", "x realtime");
+
+  for (int engine = 0; engine < 2; engine++) {
+    for (int i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+      IOPLChip* chip;
+
+      if (engine == 0) {
+        chip = new COPLChipMAME();
+      } else {
+        chip = new COPLChipAccurate();
+      }
+
+      double cpuTime = RunWorkload(*chip, workloads[i], sampleRate, seconds);
+
+      if (cpuTime < 0.0) {
+        printf("%-12s %-10s %14s\n", chip->getName(), workloads[i].name, "failed");
+      } else if (cpuTime == 0.0) {
+        printf("%-12s %-10s %14.1f %12s\n", chip->getName(), workloads[i].name, 0.0, "-");
+      } else {
+        printf("%-12s %-10s %14.1f %12.1f\n", chip->getName(), workloads[i].name, 1000000.0 * cpuTime / seconds, seconds / cpuTime);
+      }
+
+      delete chip;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+// stdafx.h : include file for standard system include files,
+//      or project specific include files that are used frequently,
+//      but are changed infrequently
+
+#if !defined(AFX_STDAFX_H__6C1F3A52_8E0B_4D27_A1E4_3F9D2B7C5E10__INCLUDED_)
+#define AFX_STDAFX_H__6C1F3A52_8E0B_4D27_A1E4_3F9D2B7C5E10__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// The EmuAdLib engine sources compiled into this project rely on this
+//  header (through the precompiled header) for their standard includes
+
+#include <crtdbg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+//{{AFX_INSERT_LOCATION}}
+// Microsoft Visual C++ will insert additional declarations immediately before the previous line.
+
+#endif // !defined(AFX_STDAFX_H__6C1F3A52_8E0B_4D27_A1E4_3F9D2B7C5E10__INCLUDED_)
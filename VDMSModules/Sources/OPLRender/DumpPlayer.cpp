@@ -0,0 +1,169 @@
+#include "stdafx.h"
+
+#include "DumpPlayer.h"
+
+#include <stdexcept>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define MAX_RENDER_FRAMES   4096        // largest block rendered at once
+
+/////////////////////////////////////////////////////////////////////////////
+
+CDumpPlayer::CDumpPlayer(IOPLChip& chip, bool isVerbose)
+  : m_chip(chip), m_FSM1(this, 0), m_FSM2(this, 1), m_isVerbose(isVerbose),
+    m_hardware(COPLDump::HW_OPL2), m_sampleRate(0), m_tNow(0), m_framesRendered(0), m_output(NULL)
+{
+}
+
+CDumpPlayer::~CDumpPlayer(void)
+{
+}
+
+//
+// Renders a whole dump, appending the audio (interleaved, getChannels()
+//  channels) to <output>.  Throws std::runtime_error on failure.
+//
+void CDumpPlayer::play(const COPLDump& dump, int sampleRate, std::vector<OPLSample_t>& output) {
+  m_hardware       = dump.getHardware();
+  m_sampleRate     = sampleRate;
+  m_tNow           = 0;
+  m_framesRendered = 0;
+  m_output         = &output;
+
+  bool isCreated = false;
+
+  switch (m_hardware) {
+    case COPLDump::HW_OPL2:
+      isCreated = m_chip.create(IOPLChip::TYPE_OPL2, 1, sampleRate);
+      m_FSM1.setType(CAdLibCtlFSM::TYPE_OPL2);
+      break;
+    case COPLDump::HW_DUAL_OPL2:
+      isCreated = m_chip.create(IOPLChip::TYPE_OPL2, 2, sampleRate);
+      m_FSM1.setType(CAdLibCtlFSM::TYPE_OPL2);
+      m_FSM2.setType(CAdLibCtlFSM::TYPE_OPL2);
+      break;
+    case COPLDump::HW_OPL3:
+      isCreated = m_chip.create(IOPLChip::TYPE_OPL3, 1, sampleRate);
+      m_FSM1.setType(CAdLibCtlFSM::TYPE_OPL3);
+      break;
+  }
+
+  if (!isCreated)
+    throw std::runtime_error("Unable to initialize OPL software synthesizer");
+
+  try {
+    m_FSM1.reset();
+    m_FSM2.reset();
+
+    const std::vector<OPLDumpEvent_t>& events = dump.getEvents();
+
+    for (size_t i = 0; i < events.size(); i++) {
+      const OPLDumpEvent_t& event = events[i];
+      CAdLibCtlFSM& fsm = (event.chipID == 0) ? m_FSM1 : m_FSM2;
+
+      m_tNow = event.time;
+
+      // Program the register through the index and data ports of the
+      //  relevant register set, as a DOS program would
+      fsm.write(2 * event.regSet + 0, (char)event.regIdx);
+      fsm.write(2 * event.regSet + 1, (char)event.value);
+    }
+
+    // Play until the end of the last delay
+    m_tNow = dump.getLength();
+    renderUpTo(m_tNow);
+  } catch (...) {
+    m_chip.destroy();
+    m_output = NULL;
+    throw;
+  }
+
+  m_chip.destroy();
+  m_output = NULL;
+}
+
+//
+// Retrieves the number of channels in the rendered audio
+//
+int CDumpPlayer::getChannels(void) const {
+  return (m_hardware == COPLDump::HW_OPL2) ? 1 : 2;
+}
+
+//
+// Synthesizes the audio up to the given point in time
+//
+void CDumpPlayer::renderUpTo(OPLTime_t time) {
+  int i;
+
+  __int64 target = (time * m_sampleRate) / 1000000;
+
+  while (m_framesRendered < target) {
+    int numFrames = (int)((target - m_framesRendered < MAX_RENDER_FRAMES) ? (target - m_framesRendered) : MAX_RENDER_FRAMES);
+    size_t oldSize = m_output->size();
+
+    switch (m_hardware) {
+      case COPLDump::HW_OPL2:
+        m_output->resize(oldSize + numFrames);
+        m_chip.render(0, &(*m_output)[oldSize], numFrames);
+        break;
+
+      case COPLDump::HW_DUAL_OPL2:
+        if ((int)m_scratch.size() < 2 * numFrames)
+          m_scratch.resize(2 * numFrames);
+        m_chip.render(0, &m_scratch[0], numFrames);
+        m_chip.render(1, &m_scratch[numFrames], numFrames);
+        m_output->resize(oldSize + 2 * numFrames);
+        for (i = 0; i < numFrames; i++) {
+          (*m_output)[oldSize + 2 * i + 0] = m_scratch[i];
+          (*m_output)[oldSize + 2 * i + 1] = m_scratch[numFrames + i];
+        }
+        break;
+
+      case COPLDump::HW_OPL3:
+        m_output->resize(oldSize + 2 * numFrames);
+        m_chip.render(0, &(*m_output)[oldSize], numFrames);
+        break;
+    }
+
+    m_framesRendered += numFrames;
+  }
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IAdLibHWEmulationLayer
+/////////////////////////////////////////////////////////////////////////////
+
+void CDumpPlayer::resetOPL(void) {
+  m_chip.reset(0);
+
+  if (m_hardware == COPLDump::HW_DUAL_OPL2)
+    m_chip.reset(1);
+}
+
+void CDumpPlayer::setOPLReg(int chipID, int regSet, int regIdx, int value) {
+  // Render the immediately preceding portion of the audio stream before
+  //  the operators are reprogrammed
+  renderUpTo(m_tNow);
+
+  m_chip.write(chipID, regSet, regIdx, value);
+}
+
+OPLTime_t CDumpPlayer::getTimeMicros(void) {
+  return m_tNow;
+}
+
+void CDumpPlayer::logError(const char* message) {
+  fprintf(stderr, "ERROR: %s\n", message);
+}
+
+void CDumpPlayer::logWarning(const char* message) {
+  fprintf(stderr, "WARNING: %s\n", message);
+}
+
+void CDumpPlayer::logInformation(const char* message) {
+  if (m_isVerbose)
+    fprintf(stderr, "%s\n", message);
+}
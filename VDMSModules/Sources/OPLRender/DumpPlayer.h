@@ -0,0 +1,56 @@
+#ifndef __DUMPPLAYER_H_
+#define __DUMPPLAYER_H_
+
+#include "OPLDump.h"
+
+#include "../EmuAdLib/AdLibCtlFSM.h"
+#include "../EmuAdLib/OPLChip.h"
+
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+
+//
+// This class plays an OPL register dump through the same path as the AdLib
+//  emulation (CAdLibCtlFSM, then an OPL engine), against a virtual clock,
+//  and collects the synthesized audio.  Dual OPL2 output is stereo (one
+//  chip per channel), as in the AdLib emulation.
+//
+class CDumpPlayer : public IAdLibHWEmulationLayer {
+  public:
+    CDumpPlayer(IOPLChip& chip, bool isVerbose = false);
+    virtual ~CDumpPlayer(void);
+
+  public:
+    void play(const COPLDump& dump, int sampleRate, std::vector<OPLSample_t>& output);
+    int getChannels(void) const;
+
+  // IAdLibHWEmulationLayer
+  public:
+    virtual void resetOPL(void);
+    virtual void setOPLReg(int chipID, int regSet, int regIdx, int value);
+    virtual OPLTime_t getTimeMicros(void);
+    virtual void logError(const char* message);
+    virtual void logWarning(const char* message);
+    virtual void logInformation(const char* message);
+
+  protected:
+    void renderUpTo(OPLTime_t time);
+
+  protected:
+    IOPLChip& m_chip;
+    CAdLibCtlFSM m_FSM1, m_FSM2;        // one FSM per OPL chip (the second one is only used for dual OPL2 dumps)
+    bool m_isVerbose;
+
+    COPLDump::hwtype_t m_hardware;
+    int m_sampleRate;
+    OPLTime_t m_tNow;                   // the virtual clock (microseconds)
+    __int64 m_framesRendered;           // how many sample frames were produced so far
+
+    std::vector<OPLSample_t>* m_output;
+    std::vector<OPLSample_t> m_scratch; // temporary storage for de-interleaving dual OPL2 output
+};
+
+#endif //__DUMPPLAYER_H_
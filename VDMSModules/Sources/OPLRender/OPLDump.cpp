@@ -0,0 +1,414 @@
+#include "stdafx.h"
+
+#include "OPLDump.h"
+
+#include <stdexcept>
+#include <string>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DRO_SIGNATURE       "DBRAWOPL"
+#define DRO_SIGNATURE_LEN   8
+
+// DRO 0.1 commands
+#define DRO1_CMD_DELAY8     0x00        // 8-bit delay (ms, minus 1) follows
+#define DRO1_CMD_DELAY16    0x01        // 16-bit delay (ms, minus 1) follows
+#define DRO1_CMD_LOW        0x02        // following writes go to the first chip/register set
+#define DRO1_CMD_HIGH       0x03        // following writes go to the second chip/register set
+#define DRO1_CMD_ESCAPE     0x04        // register index (0x00-0x04) and value follow
+
+// DRO hardware types (0.1 and 2.0 number them differently)
+#define DRO1_HW_OPL2        0
+#define DRO1_HW_OPL3        1
+#define DRO1_HW_DUAL_OPL2   2
+#define DRO2_HW_OPL2        0
+#define DRO2_HW_DUAL_OPL2   1
+#define DRO2_HW_OPL3        2
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Little-endian helpers
+//
+static inline unsigned int GetWord(const std::vector<unsigned char>& data, size_t offset) {
+  return data[offset] | (data[offset + 1] << 8);
+}
+
+static inline unsigned long GetDWord(const std::vector<unsigned char>& data, size_t offset) {
+  return GetWord(data, offset) | ((unsigned long)GetWord(data, offset + 2) << 16);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+COPLDump::COPLDump(void)
+  : m_format(FORMAT_AUTO), m_hardware(HW_OPL2), m_length(0)
+{
+}
+
+COPLDump::~COPLDump(void)
+{
+}
+
+//
+// Loads a register dump (throws std::runtime_error on failure).  When the
+//  format is not given it is guessed from the contents and the file name;
+//  the IMF tick rate defaults to 700Hz for .WLF files and 560Hz otherwise.
+//
+void COPLDump::load(const char* fileName, format_t format, int imfRate) {
+  char buf[1024];
+  FILE* f;
+
+  if ((f = fopen(fileName, "rb")) == NULL) {
+    sprintf(buf, "Unable to open '%.900s'", fileName);
+    throw std::runtime_error(buf);
+  }
+
+  std::vector<unsigned char> data;
+  unsigned char chunk[4096];
+  size_t count;
+
+  while ((count = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    data.insert(data.end(), chunk, chunk + count);
+
+  fclose(f);
+
+  const char* ext = strrchr(fileName, '.');
+
+  if (format == FORMAT_AUTO) {
+    if ((data.size() >= DRO_SIGNATURE_LEN) && (memcmp(&data[0], DRO_SIGNATURE, DRO_SIGNATURE_LEN) == 0)) {
+      format = FORMAT_DRO;
+    } else if ((ext != NULL) && ((stricmp(ext, ".txt") == 0) || (stricmp(ext, ".raw") == 0))) {
+      format = FORMAT_RAW;
+    } else {
+      format = FORMAT_IMF;
+    }
+  }
+
+  if (imfRate <= 0)
+    imfRate = ((ext != NULL) && (stricmp(ext, ".wlf") == 0)) ? WLF_DEFAULT_RATE : IMF_DEFAULT_RATE;
+
+  m_format   = format;
+  m_hardware = HW_OPL2;
+  m_length   = 0;
+  m_events.clear();
+
+  switch (m_format) {
+    case FORMAT_IMF:
+      loadIMF(data, imfRate);
+      break;
+    case FORMAT_DRO:
+      loadDRO(data);
+      break;
+    case FORMAT_RAW:
+      loadRaw(data);
+      break;
+  }
+}
+
+//
+// Retrieves the hardware the dump was captured from
+//
+COPLDump::hwtype_t COPLDump::getHardware(void) const {
+  return m_hardware;
+}
+
+//
+// Retrieves the dump's duration (microseconds)
+//
+OPLTime_t COPLDump::getLength(void) const {
+  return m_length;
+}
+
+//
+// Retrieves the dump's format (for display purposes)
+//
+const char* COPLDump::getFormatName(void) const {
+  switch (m_format) {
+    case FORMAT_IMF: return "IMF";
+    case FORMAT_DRO: return "DRO";
+    case FORMAT_RAW: return "RAW";
+    default:         return "???";
+  }
+}
+
+//
+// Retrieves the register writes, in chronological order
+//
+const std::vector<OPLDumpEvent_t>& COPLDump::getEvents(void) const {
+  return m_events;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Format-specific loaders
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// IMF: a sequence of (register, value, 16-bit delay in ticks) entries,
+//  optionally (type 1) preceded by the 16-bit length of the data in bytes
+//
+void COPLDump::loadIMF(const std::vector<unsigned char>& data, int imfRate) {
+  size_t start = 0, end = data.size();
+
+  if (data.size() < 4)
+    throw std::runtime_error("IMF data is too short");
+
+  // Type 1 files start with a non-zero length, that fits in the file and
+  //  covers whole entries; type 0 files start with an all-zeroes entry
+  unsigned int dataLen = GetWord(data, 0);
+
+  if ((dataLen > 0) && ((dataLen & 3) == 0) && (dataLen + 2 <= data.size())) {
+    start = 2;
+    end   = 2 + dataLen;
+  }
+
+  OPLTime_t ticks = 0;
+
+  for (size_t i = start; i + 4 <= end; i += 4) {
+    addEvent((ticks * 1000000) / imfRate, 0, 0, data[i], data[i + 1]);
+    ticks += GetWord(data, i + 2);
+  }
+
+  m_hardware = HW_OPL2;
+  m_length   = (ticks * 1000000) / imfRate;
+}
+
+//
+// DRO: dispatch on version
+//
+void COPLDump::loadDRO(const std::vector<unsigned char>& data) {
+  if (data.size() < DRO_SIGNATURE_LEN + 4)
+    throw std::runtime_error("DRO header is too short");
+
+  unsigned int major = GetWord(data, DRO_SIGNATURE_LEN);
+  unsigned int minor = GetWord(data, DRO_SIGNATURE_LEN + 2);
+
+  if ((major == 0) && (minor == 1)) {
+    loadDRO1(data);
+  } else if ((major == 2) && (minor == 0)) {
+    loadDRO2(data);
+  } else {
+    char buf[256];
+    sprintf(buf, "Unsupported DRO version %u.%u", major, minor);
+    throw std::runtime_error(buf);
+  }
+}
+
+//
+// DRO 0.1: signature, version, length (ms), length (bytes), hardware type
+//  (one byte in early files, four bytes later on) then the command stream
+//
+void COPLDump::loadDRO1(const std::vector<unsigned char>& data) {
+  size_t pos = DRO_SIGNATURE_LEN + 4;
+
+  if (data.size() < pos + 9)
+    throw std::runtime_error("DRO 0.1 header is too short");
+
+  unsigned long dataLen = GetDWord(data, pos + 4);
+  int hwType = data[pos + 8];
+  pos += 9;
+
+  // Early captures used a single byte for the hardware type; later ones
+  //  use four bytes, the last three of which are zero (a zero byte is
+  //  never a valid start for the command stream's first three bytes)
+  if ((data.size() >= pos + 3) && ((data[pos] == 0) || (data[pos + 1] == 0) || (data[pos + 2] == 0)))
+    pos += 3;
+
+  switch (hwType) {
+    case DRO1_HW_OPL3:      m_hardware = HW_OPL3; break;
+    case DRO1_HW_DUAL_OPL2: m_hardware = HW_DUAL_OPL2; break;
+    default:                m_hardware = HW_OPL2; break;
+  }
+
+  size_t end = (pos + dataLen < data.size()) ? (pos + dataLen) : data.size();
+
+  OPLTime_t tNow = 0;
+  int bank = 0;
+
+  while (pos < end) {
+    int cmd = data[pos++];
+
+    switch (cmd) {
+      case DRO1_CMD_DELAY8:
+        if (pos + 1 > end) break;
+        tNow += 1000 * ((OPLTime_t)data[pos] + 1);
+        pos += 1;
+        break;
+
+      case DRO1_CMD_DELAY16:
+        if (pos + 2 > end) break;
+        tNow += 1000 * ((OPLTime_t)GetWord(data, pos) + 1);
+        pos += 2;
+        break;
+
+      case DRO1_CMD_LOW:
+        bank = 0;
+        break;
+
+      case DRO1_CMD_HIGH:
+        bank = 1;
+        break;
+
+      case DRO1_CMD_ESCAPE:
+        if (pos + 2 > end) break;
+        cmd = data[pos++];
+        // fall through
+
+      default:
+        if (pos + 1 > end) break;
+        if (m_hardware == HW_DUAL_OPL2) {
+          addEvent(tNow, bank, 0, cmd, data[pos]);
+        } else {
+          addEvent(tNow, 0, (m_hardware == HW_OPL3) ? bank : 0, cmd, data[pos]);
+        }
+        pos += 1;
+        break;
+    }
+  }
+
+  m_length = tNow;
+}
+
+//
+// DRO 2.0: signature, version, length (pairs), length (ms), hardware type,
+//  format, compression, short and long delay codes, register code map,
+//  then (code, value) pairs
+//
+void COPLDump::loadDRO2(const std::vector<unsigned char>& data) {
+  size_t pos = DRO_SIGNATURE_LEN + 4;
+
+  if (data.size() < pos + 14)
+    throw std::runtime_error("DRO 2.0 header is too short");
+
+  unsigned long numPairs = GetDWord(data, pos);
+  int hwType       = data[pos + 8];
+  int format       = data[pos + 9];
+  int compression  = data[pos + 10];
+  int shortDelay   = data[pos + 11];
+  int longDelay    = data[pos + 12];
+  int codemapLen   = data[pos + 13];
+  pos += 14;
+
+  if ((format != 0) || (compression != 0))
+    throw std::runtime_error("Unsupported DRO 2.0 data format or compression");
+
+  if ((codemapLen > 128) || (data.size() < pos + codemapLen))
+    throw std::runtime_error("Invalid DRO 2.0 register code map");
+
+  const unsigned char* codemap = &data[pos];
+  pos += codemapLen;
+
+  switch (hwType) {
+    case DRO2_HW_OPL3:      m_hardware = HW_OPL3; break;
+    case DRO2_HW_DUAL_OPL2: m_hardware = HW_DUAL_OPL2; break;
+    default:                m_hardware = HW_OPL2; break;
+  }
+
+  OPLTime_t tNow = 0;
+
+  for (unsigned long i = 0; (i < numPairs) && (pos + 2 <= data.size()); i++, pos += 2) {
+    int code  = data[pos];
+    int value = data[pos + 1];
+
+    if (code == shortDelay) {
+      tNow += 1000 * ((OPLTime_t)value + 1);
+    } else if (code == longDelay) {
+      tNow += 1000 * (((OPLTime_t)value + 1) << 8);
+    } else {
+      int bank = (code & 0x80) ? 1 : 0;
+
+      if ((code & 0x7f) >= codemapLen)
+        throw std::runtime_error("DRO 2.0 register code out of range");
+
+      if (m_hardware == HW_DUAL_OPL2) {
+        addEvent(tNow, bank, 0, codemap[code & 0x7f], value);
+      } else {
+        addEvent(tNow, 0, (m_hardware == HW_OPL3) ? bank : 0, codemap[code & 0x7f], value);
+      }
+    }
+  }
+
+  m_length = tNow;
+}
+
+//
+// RAW: text, one "<time> <chipID> <regSet> <regIdx> <value>" per line
+//
+void COPLDump::loadRaw(const std::vector<unsigned char>& data) {
+  std::string text(data.begin(), data.end());
+  char buf[256];
+
+  int lineNo = 0;
+  size_t pos = 0;
+
+  bool isDual = false, isOPL3 = false;
+
+  while (pos < text.size()) {
+    size_t eol = text.find('\n', pos);
+    if (eol == std::string::npos)
+      eol = text.size();
+
+    std::string line = text.substr(pos, eol - pos);
+    pos = eol + 1;
+    lineNo++;
+
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    const char* p = line.c_str();
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '\0')
+      continue;
+
+    long fields[5];
+    char* next;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+      fields[i] = strtol(p, &next, 0);
+      if (next == p)
+        break;
+      p = next;
+    }
+
+    while (isspace((unsigned char)*p)) p++;
+
+    if ((i < 5) || (*p != '\0') || (fields[0] < 0) || (fields[1] & ~1) || (fields[2] & ~1) || (fields[3] & ~0xff) || (fields[4] & ~0xff)) {
+      sprintf(buf, "Invalid register write on line %d", lineNo);
+      throw std::runtime_error(buf);
+    }
+
+    if (!m_events.empty() && (fields[0] < m_events.back().time)) {
+      sprintf(buf, "Time goes backwards on line %d", lineNo);
+      throw std::runtime_error(buf);
+    }
+
+    isDual |= (fields[1] != 0);
+    isOPL3 |= (fields[2] != 0);
+
+    addEvent(fields[0], fields[1], fields[2], fields[3], fields[4]);
+  }
+
+  if (isDual && isOPL3)
+    throw std::runtime_error("A dump cannot use both a second chip and a second register set");
+
+  m_hardware = isDual ? HW_DUAL_OPL2 : (isOPL3 ? HW_OPL3 : HW_OPL2);
+  m_length   = m_events.empty() ? 0 : m_events.back().time;
+}
+
+//
+// Appends a register write
+//
+void COPLDump::addEvent(OPLTime_t time, int chipID, int regSet, int regIdx, int value) {
+  OPLDumpEvent_t event;
+
+  event.time   = time;
+  event.chipID = chipID;
+  event.regSet = regSet;
+  event.regIdx = regIdx & 0xff;
+  event.value  = value & 0xff;
+
+  m_events.push_back(event);
+}
@@ -0,0 +1,75 @@
+#ifndef __OPLDUMP_H_
+#define __OPLDUMP_H_
+
+#include "../EmuAdLib/AdLibCtlFSM.h"
+
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define IMF_DEFAULT_RATE    560         // Commander Keen, most .IMF files
+#define WLF_DEFAULT_RATE    700         // Wolfenstein 3-D, Spear of Destiny (.WLF)
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+
+//
+// A timed OPL register write
+//
+struct OPLDumpEvent_t {
+  OPLTime_t time;                       // microseconds since the beginning of the dump
+  int chipID;                           // 0, or 1 for the second chip of a dual OPL2
+  int regSet;                           // 0, or 1 for the OPL3's second register set
+  int regIdx;
+  int value;
+};
+
+
+
+//
+// This class loads OPL register dumps into a list of timed register
+//  writes.  The following formats are supported:
+//
+//  IMF   id Software music format (type 0 and type 1), OPL2
+//  DRO   DOSBox raw OPL capture, versions 0.1 and 2.0 (OPL2, dual OPL2 and
+//        OPL3)
+//  RAW   text, one register write per line, as received by setOPLReg():
+//          <time (us)> <chipID> <regSet> <regIdx> <value>
+//        Numbers are decimal, or hexadecimal when prefixed with '0x'.
+//        Everything that follows a '#' is ignored.
+//
+class COPLDump {
+  public:
+    enum format_t { FORMAT_AUTO, FORMAT_IMF, FORMAT_DRO, FORMAT_RAW };
+    enum hwtype_t { HW_OPL2, HW_DUAL_OPL2, HW_OPL3 };
+
+  public:
+    COPLDump(void);
+    ~COPLDump(void);
+
+  public:
+    void load(const char* fileName, format_t format = FORMAT_AUTO, int imfRate = 0);
+
+    hwtype_t getHardware(void) const;
+    OPLTime_t getLength(void) const;
+    const char* getFormatName(void) const;
+    const std::vector<OPLDumpEvent_t>& getEvents(void) const;
+
+  protected:
+    void loadIMF(const std::vector<unsigned char>& data, int imfRate);
+    void loadDRO(const std::vector<unsigned char>& data);
+    void loadDRO1(const std::vector<unsigned char>& data);
+    void loadDRO2(const std::vector<unsigned char>& data);
+    void loadRaw(const std::vector<unsigned char>& data);
+
+    void addEvent(OPLTime_t time, int chipID, int regSet, int regIdx, int value);
+
+  protected:
+    format_t m_format;
+    hwtype_t m_hardware;
+    OPLTime_t m_length;
+    std::vector<OPLDumpEvent_t> m_events;
+};
+
+#endif //__OPLDUMP_H_
@@ -0,0 +1,325 @@
+// OPLRender.cpp : renders OPL register dumps (IMF, DRO, raw setOPLReg()
+//  streams) to WAV files through the AdLib emulation's OPL controller and
+//  synthesis engines, faster than real time.  Also compares renders
+//  against golden WAV files, individually or as a regression suite.
+//
+
+#include "stdafx.h"
+
+#include "DumpPlayer.h"
+#include "OPLDump.h"
+#include "WaveFile.h"
+
+#include "../EmuAdLib/OPLChipMAME.h"
+#include "../EmuAdLib/OPLChipAccurate.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_SAMPLE_RATE   44100
+
+#define EXIT_OK               0
+#define EXIT_MISMATCH         1
+#define EXIT_ERROR            2
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  int sampleRate;
+  const char* engine;
+  COPLDump::format_t format;
+  int imfRate;
+  int tolerance;
+  bool isVerbose;
+} options_t;
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Prints the command-line syntax
+//
+static void Usage(void) {
+  fprintf(stderr,
+    "Usage: OPLRender [options] <dump> <output.wav>\n"
+    "       OPLRender [options] -check <golden.wav> <dump>\n"
+    "       OPLRender [options] -suite <list.txt>\n"
+    "\n"
+    "  -rate <Hz>        output sample rate (default %d; -check and -suite\n"
+    "                    use the golden file's rate)\n"
+    "  -engine <name>    OPL engine: 'fast' (default) or 'accurate'\n"
+    "  -format <fmt>     dump format: 'imf', 'dro' or 'raw' (default: guessed)\n"
+    "  -imfrate <Hz>     IMF tick rate (default 560, or 700 for .wlf files)\n"
+    "  -tolerance <n>    largest sample difference accepted when comparing\n"
+    "                    against a golden file (default 0)\n"
+    "  -v                show the OPL controller's log messages\n"
+    "\n"
+    "A suite lists one test per line: <dump> <golden.wav> [<engine>].\n"
+    "Paths are relative to the suite file; '#' starts a comment.\n",
+    DEFAULT_SAMPLE_RATE);
+}
+
+//
+// Creates the requested OPL engine (NULL if the name is unknown)
+//
+static IOPLChip* CreateEngine(const char* name) {
+  if (stricmp(name, "fast") == 0)
+    return new COPLChipMAME();
+  if (stricmp(name, "accurate") == 0)
+    return new COPLChipAccurate();
+  return NULL;
+}
+
+//
+// Renders a dump, and reports the throughput; throws std::runtime_error on
+//  failure
+//
+static void Render(const char* dumpName, const char* engineName, int sampleRate, const options_t& options, int& channels, std::vector<short>& output) {
+  COPLDump dump;
+  dump.load(dumpName, options.format, options.imfRate);
+
+  IOPLChip* chip = CreateEngine(engineName);
+
+  if (chip == NULL)
+    throw std::runtime_error(std::string("Unknown OPL engine '") + engineName + "'");
+
+  CDumpPlayer player(*chip, options.isVerbose);
+
+  output.clear();
+
+  clock_t start = clock();
+
+  try {
+    player.play(dump, sampleRate, output);
+  } catch (...) {
+    delete chip;
+    throw;
+  }
+
+  clock_t end = clock();
+
+  channels = player.getChannels();
+
+  double audioTime = (double)dump.getLength() / 1000000.0;
+  double cpuTime   = (double)(end - start) / CLOCKS_PER_SEC;
+
+  printf("%s: %s, %s, %s engine, %d Hz, %u writes\n", dumpName, dump.getFormatName(),
+         dump.getHardware() == COPLDump::HW_OPL3 ? "OPL3" : dump.getHardware() == COPLDump::HW_DUAL_OPL2 ? "dual OPL2" : "OPL2",
+         chip->getName(), sampleRate, (unsigned int)dump.getEvents().size());
+
+  if (cpuTime > 0.0) {
+    printf("  %.2fs of audio in %.2fs of CPU time (%.1fs of audio per CPU second)\n", audioTime, cpuTime, audioTime / cpuTime);
+  } else {
+    printf("  %.2fs of audio in less than a clock tick\n", audioTime);
+  }
+
+  delete chip;
+}
+
+//
+// Compares a render against a golden file; returns true if they match
+//  (within the given tolerance)
+//
+static bool Compare(const char* goldenName, int channels, const std::vector<short>& output, int goldenChannels, const std::vector<short>& golden, int tolerance) {
+  if (channels != goldenChannels) {
+    printf("  FAIL: %d channel(s), %s has %d\n", channels, goldenName, goldenChannels);
+    return false;
+  }
+
+  if (output.size() != golden.size()) {
+    printf("  FAIL: %u sample frames, %s has %u\n", (unsigned int)(output.size() / channels), goldenName, (unsigned int)(golden.size() / channels));
+    return false;
+  }
+
+  size_t numDiffs = 0, firstDiff = 0;
+  int maxDiff = 0;
+
+  for (size_t i = 0; i < output.size(); i++) {
+    int diff = abs((int)output[i] - (int)golden[i]);
+
+    if (diff > tolerance) {
+      if (numDiffs++ == 0)
+        firstDiff = i;
+    }
+
+    if (diff > maxDiff)
+      maxDiff = diff;
+  }
+
+  if (numDiffs > 0) {
+    printf("  FAIL: %u sample(s) differ by more than %d (largest difference %d, first at frame %u)\n", (unsigned int)numDiffs, tolerance, maxDiff, (unsigned int)(firstDiff / channels));
+    return false;
+  }
+
+  printf("  PASS (largest difference %d)\n", maxDiff);
+  return true;
+}
+
+//
+// Renders a dump and compares it against a golden file; returns true if
+//  they match
+//
+static bool Check(const char* dumpName, const char* goldenName, const char* engineName, const options_t& options) {
+  int channels, goldenChannels, goldenRate;
+  std::vector<short> output, golden;
+
+  WAV_Read(goldenName, goldenChannels, goldenRate, golden);
+  Render(dumpName, engineName, goldenRate, options, channels, output);
+
+  return Compare(goldenName, channels, output, goldenChannels, golden, options.tolerance);
+}
+
+//
+// Runs all the tests listed in a suite file; returns the number of tests
+//  that failed (throws std::runtime_error if the suite cannot be read)
+//
+static int Suite(const char* suiteName, const options_t& options) {
+  FILE* f;
+
+  if ((f = fopen(suiteName, "rt")) == NULL)
+    throw std::runtime_error(std::string("Unable to open '") + suiteName + "'");
+
+  // Paths in the suite are relative to the suite's own directory
+  std::string baseDir(suiteName);
+  size_t slash = baseDir.find_last_of("/\\");
+  baseDir = (slash == std::string::npos) ? "" : baseDir.substr(0, slash + 1);
+
+  char line[1024];
+  int numTests = 0, numFailed = 0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    char dumpName[512], goldenName[512], engineName[64];
+    int numFields = sscanf(line, "%511s %511s %63s", dumpName, goldenName, engineName);
+
+    if (numFields <= 0)
+      continue;
+
+    if (numFields < 2) {
+      printf("%s: missing golden file name in suite\n", dumpName);
+      numTests++;
+      numFailed++;
+      continue;
+    }
+
+    std::string dumpPath   = ((dumpName[0] == '/') || (dumpName[0] == '\\') || (dumpName[1] == ':')) ? dumpName : baseDir + dumpName;
+    std::string goldenPath = ((goldenName[0] == '/') || (goldenName[0] == '\\') || (goldenName[1] == ':')) ? goldenName : baseDir + goldenName;
+
+    numTests++;
+
+    try {
+      if (!Check(dumpPath.c_str(), goldenPath.c_str(), (numFields > 2) ? engineName : options.engine, options))
+        numFailed++;
+    } catch (std::runtime_error& e) {
+      printf("%s: FAIL: %s\n", dumpPath.c_str(), e.what());
+      numFailed++;
+    }
+  }
+
+  fclose(f);
+
+  printf("\n%d test(s), %d passed, %d failed\n", numTests, numTests - numFailed, numFailed);
+
+  return numFailed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+  options_t options;
+
+  options.sampleRate = DEFAULT_SAMPLE_RATE;
+  options.engine     = "fast";
+  options.format     = COPLDump::FORMAT_AUTO;
+  options.imfRate    = 0;
+  options.tolerance  = 0;
+  options.isVerbose  = false;
+
+  const char* checkName = NULL;
+  const char* suiteName = NULL;
+  std::vector<const char*> args;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = (i + 1 < argc);
+
+    if (stricmp(arg, "-v") == 0) {
+      options.isVerbose = true;
+    } else if ((stricmp(arg, "-rate") == 0) && hasValue) {
+      options.sampleRate = atoi(argv[++i]);
+    } else if ((stricmp(arg, "-engine") == 0) && hasValue) {
+      options.engine = argv[++i];
+    } else if ((stricmp(arg, "-imfrate") == 0) && hasValue) {
+      options.imfRate = atoi(argv[++i]);
+    } else if ((stricmp(arg, "-tolerance") == 0) && hasValue) {
+      options.tolerance = atoi(argv[++i]);
+    } else if ((stricmp(arg, "-check") == 0) && hasValue) {
+      checkName = argv[++i];
+    } else if ((stricmp(arg, "-suite") == 0) && hasValue) {
+      suiteName = argv[++i];
+    } else if ((stricmp(arg, "-format") == 0) && hasValue) {
+      const char* format = argv[++i];
+      if (stricmp(format, "imf") == 0) {
+        options.format = COPLDump::FORMAT_IMF;
+      } else if (stricmp(format, "dro") == 0) {
+        options.format = COPLDump::FORMAT_DRO;
+      } else if (stricmp(format, "raw") == 0) {
+        options.format = COPLDump::FORMAT_RAW;
+      } else {
+        Usage();
+        return EXIT_ERROR;
+      }
+    } else if (arg[0] == '-') {
+      Usage();
+      return EXIT_ERROR;
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if ((options.sampleRate < 1000) || (options.sampleRate > 192000) || (options.tolerance < 0)) {
+    Usage();
+    return EXIT_ERROR;
+  }
+
+  try {
+    if (suiteName != NULL) {
+      if (!args.empty() || (checkName != NULL)) {
+        Usage();
+        return EXIT_ERROR;
+      }
+
+      return (Suite(suiteName, options) == 0) ? EXIT_OK : EXIT_MISMATCH;
+    }
+
+    if (checkName != NULL) {
+      if (args.size() != 1) {
+        Usage();
+        return EXIT_ERROR;
+      }
+
+      return Check(args[0], checkName, options.engine, options) ? EXIT_OK : EXIT_MISMATCH;
+    }
+
+    if (args.size() != 2) {
+      Usage();
+      return EXIT_ERROR;
+    }
+
+    int channels;
+    std::vector<short> output;
+
+    Render(args[0], options.engine, options.sampleRate, options, channels, output);
+    WAV_Write(args[1], channels, options.sampleRate, output);
+
+    return EXIT_OK;
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "OPLRender: %s\n", e.what());
+    return EXIT_ERROR;
+  }
+}
@@ -0,0 +1,191 @@
+# Microsoft Developer Studio Project File - Name="OPLRender" - Package Owner=<4>
+# Microsoft Developer Studio Generated Build File, Format Version 6.00
+# ** DO NOT EDIT **
+
+# TARGTYPE "Win32 (x86) Console Application" 0x0103
+
+CFG=OPLRender - Win32 Debug
+!MESSAGE This is not a valid makefile. To build this project using NMAKE,
+!MESSAGE use the Export Makefile command and run
+!MESSAGE 
+!MESSAGE NMAKE /f "OPLRender.mak".
+!MESSAGE 
+!MESSAGE You can specify a configuration when running NMAKE
+!MESSAGE by defining the macro CFG on the command line. For example:
+!MESSAGE 
+!MESSAGE NMAKE /f "OPLRender.mak" CFG="OPLRender - Win32 Debug"
+!MESSAGE 
+!MESSAGE Possible choices for configuration are:
+!MESSAGE 
+!MESSAGE "OPLRender - Win32 Release" (based on "Win32 (x86) Console Application")
+!MESSAGE "OPLRender - Win32 Debug" (based on "Win32 (x86) Console Application")
+!MESSAGE 
+
+# Begin Project
+# PROP AllowPerConfigDependencies 0
+# PROP Scc_ProjName ""
+# PROP Scc_LocalPath ""
+CPP=cl.exe
+RSC=rc.exe
+
+!IF  "$(CFG)" == "OPLRender - Win32 Release"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 0
+# PROP BASE Output_Dir "Release"
+# PROP BASE Intermediate_Dir "Release"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 0
+# PROP Output_Dir "Release"
+# PROP Intermediate_Dir "Release"
+# PROP Ignore_Export_Lib 0
+# PROP Target_Dir ""
+# ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_CONSOLE" /D "_MBCS" /Yu"stdafx.h" /FD /c
+# ADD CPP /nologo /MT /W3 /GX /O2 /I "$(VDMSCorePath)/Sources/MFCUtil" /D "WIN32" /D "NDEBUG" /D "_CONSOLE" /D "_MBCS" /D "RSMP_USE_SSE" /Yu"stdafx.h" /FD /c
+# ADD BASE RSC /l 0x409 /d "NDEBUG"
+# ADD RSC /l 0x409 /d "NDEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD BASE LINK32 kernel32.lib user32.lib /nologo /subsystem:console /machine:I386
+# ADD LINK32 kernel32.lib user32.lib /nologo /subsystem:console /machine:I386
+
+!ELSEIF  "$(CFG)" == "OPLRender - Win32 Debug"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 1
+# PROP BASE Output_Dir "Debug"
+# PROP BASE Intermediate_Dir "Debug"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 1
+# PROP Output_Dir "Debug"
+# PROP Intermediate_Dir "Debug"
+# PROP Ignore_Export_Lib 0
+# PROP Target_Dir ""
+# ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_CONSOLE" /D "_MBCS" /Yu"stdafx.h" /FD /GZ /c
+# ADD CPP /nologo /MTd /W3 /Gm /GX /ZI /Od /I "$(VDMSCorePath)/Sources/MFCUtil" /D "WIN32" /D "_DEBUG" /D "_CONSOLE" /D "_MBCS" /D "RSMP_USE_SSE" /Yu"stdafx.h" /FD /GZ /c
+# ADD BASE RSC /l 0x409 /d "_DEBUG"
+# ADD RSC /l 0x409 /d "_DEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD BASE LINK32 kernel32.lib user32.lib /nologo /subsystem:console /debug /machine:I386 /pdbtype:sept
+# ADD LINK32 kernel32.lib user32.lib /nologo /subsystem:console /debug /machine:I386 /pdbtype:sept
+
+!ENDIF 
+
+# Begin Target
+
+# Name "OPLRender - Win32 Release"
+# Name "OPLRender - Win32 Debug"
+# Begin Group "Source Files"
+
+# PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
+# Begin Source File
+
+SOURCE=.\DumpPlayer.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLDump.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLRender.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\StdAfx.cpp
+# ADD CPP /Yc"stdafx.h"
+# End Source File
+# Begin Source File
+
+SOURCE=.\WaveFile.cpp
+# End Source File
+# End Group
+# Begin Group "Header Files"
+
+# PROP Default_Filter "h;hpp;hxx;hm;inl"
+# Begin Source File
+
+SOURCE=.\DumpPlayer.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OPLDump.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\StdAfx.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\WaveFile.h
+# End Source File
+# End Group
+# Begin Group "EmuAdLib files"
+
+# PROP Default_Filter ""
+# Begin Source File
+
+SOURCE=..\EmuAdLib\AdLibCtlFSM.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\AdLibCtlFSM.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\fmopl.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPL3Core.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPL3Core.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPLChip.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPLChipAccurate.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPLChipAccurate.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPLChipMAME.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\OPLChipMAME.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\EmuAdLib\ymf262.cpp
+# End Source File
+# End Group
+# Begin Group "MFCUtil files"
+
+# PROP Default_Filter ""
+# Begin Source File
+
+SOURCE=$(VDMSCorePath)\Sources\MFCUtil\Resampler.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=$(VDMSCorePath)\Sources\MFCUtil\Resampler.h
+# End Source File
+# End Group
+# End Target
+# End Project
@@ -0,0 +1,30 @@
+// stdafx.h : include file for standard system include files,
+//      or project specific include files that are used frequently,
+//      but are changed infrequently
+
+#if !defined(AFX_STDAFX_H__0B7E24D9_5A63_4F8C_9E21_7D4C8A1F3B62__INCLUDED_)
+#define AFX_STDAFX_H__0B7E24D9_5A63_4F8C_9E21_7D4C8A1F3B62__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// The EmuAdLib sources compiled into this project rely on this header
+//  (through the precompiled header) for their standard includes
+
+#include <crtdbg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//{{AFX_INSERT_LOCATION}}
+// Microsoft Visual C++ will insert additional declarations immediately before the previous line.
+
+#endif // !defined(AFX_STDAFX_H__0B7E24D9_5A63_4F8C_9E21_7D4C8A1F3B62__INCLUDED_)
@@ -0,0 +1,148 @@
+#include "stdafx.h"
+
+#include "WaveFile.h"
+
+#include <stdexcept>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define WAVE_FORMAT_PCM_TAG 1
+#define WAVE_HEADER_LEN     44
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Little-endian helpers (WAV files are little-endian regardless of the
+//  host's byte order)
+//
+static void PutWord(unsigned char* p, unsigned int value) {
+  p[0] = (unsigned char)(value & 0xff);
+  p[1] = (unsigned char)((value >> 8) & 0xff);
+}
+
+static void PutDWord(unsigned char* p, unsigned long value) {
+  PutWord(p, (unsigned int)(value & 0xffff));
+  PutWord(p + 2, (unsigned int)((value >> 16) & 0xffff));
+}
+
+static unsigned int GetWord(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned long GetDWord(const unsigned char* p) {
+  return GetWord(p) | ((unsigned long)GetWord(p + 2) << 16);
+}
+
+static void ThrowFileError(const char* what, const char* fileName) {
+  char buf[1024];
+  sprintf(buf, "%s '%.900s'", what, fileName);
+  throw std::runtime_error(buf);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Writes a 16-bit PCM WAV file
+//
+void WAV_Write(const char* fileName, int channels, int sampleRate, const std::vector<short>& samples) {
+  unsigned char header[WAVE_HEADER_LEN];
+  unsigned long dataLen = samples.size() * 2;
+  FILE* f;
+
+  memcpy(header + 0, "RIFF", 4);
+  PutDWord(header + 4, WAVE_HEADER_LEN - 8 + dataLen);
+  memcpy(header + 8, "WAVE", 4);
+  memcpy(header + 12, "fmt ", 4);
+  PutDWord(header + 16, 16);
+  PutWord (header + 20, WAVE_FORMAT_PCM_TAG);
+  PutWord (header + 22, channels);
+  PutDWord(header + 24, sampleRate);
+  PutDWord(header + 28, sampleRate * channels * 2);
+  PutWord (header + 32, channels * 2);
+  PutWord (header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  PutDWord(header + 40, dataLen);
+
+  if ((f = fopen(fileName, "wb")) == NULL)
+    ThrowFileError("Unable to create", fileName);
+
+  bool isOK = (fwrite(header, 1, sizeof(header), f) == sizeof(header));
+
+  // Convert to little-endian in blocks
+  unsigned char buf[8192];
+
+  for (size_t i = 0; isOK && (i < samples.size()); ) {
+    size_t count = 0;
+
+    for (; (i < samples.size()) && (count < sizeof(buf)); i++, count += 2)
+      PutWord(buf + count, (unsigned short)samples[i]);
+
+    isOK = (fwrite(buf, 1, count, f) == count);
+  }
+
+  if ((fclose(f) != 0) || !isOK)
+    ThrowFileError("Unable to write", fileName);
+}
+
+//
+// Reads a 16-bit PCM WAV file
+//
+void WAV_Read(const char* fileName, int& channels, int& sampleRate, std::vector<short>& samples) {
+  unsigned char chunk[8];
+  unsigned char fmt[16];
+  bool hasFormat = false;
+  FILE* f;
+
+  if ((f = fopen(fileName, "rb")) == NULL)
+    ThrowFileError("Unable to open", fileName);
+
+  if ((fread(chunk, 1, 8, f) != 8) || (memcmp(chunk, "RIFF", 4) != 0) ||
+      (fread(chunk, 1, 4, f) != 4) || (memcmp(chunk, "WAVE", 4) != 0))
+  {
+    fclose(f);
+    ThrowFileError("Not a WAV file:", fileName);
+  }
+
+  // Walk the chunks until the audio data is found
+  while (fread(chunk, 1, 8, f) == 8) {
+    unsigned long chunkLen = GetDWord(chunk + 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      if ((chunkLen < sizeof(fmt)) || (fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt)))
+        break;
+
+      if ((GetWord(fmt + 0) != WAVE_FORMAT_PCM_TAG) || (GetWord(fmt + 14) != 16)) {
+        fclose(f);
+        ThrowFileError("Not a 16-bit PCM WAV file:", fileName);
+      }
+
+      channels   = GetWord(fmt + 2);
+      sampleRate = GetDWord(fmt + 4);
+      hasFormat  = true;
+
+      chunkLen -= sizeof(fmt);
+    } else if ((memcmp(chunk, "data", 4) == 0) && hasFormat) {
+      unsigned char buf[8192];
+      size_t count;
+
+      samples.clear();
+      samples.reserve(chunkLen / 2);
+
+      while ((chunkLen >= 2) && ((count = fread(buf, 1, (chunkLen < sizeof(buf)) ? (chunkLen & ~1) : sizeof(buf), f)) >= 2)) {
+        for (size_t i = 0; i + 1 < count; i += 2)
+          samples.push_back((short)GetWord(buf + i));
+        chunkLen -= count;
+      }
+
+      fclose(f);
+      return;
+    }
+
+    // Chunks are word-aligned
+    if (fseek(f, chunkLen + (chunkLen & 1), SEEK_CUR) != 0)
+      break;
+  }
+
+  fclose(f);
+  ThrowFileError("No audio data found in", fileName);
+}
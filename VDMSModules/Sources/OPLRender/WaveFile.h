@@ -0,0 +1,15 @@
+#ifndef __WAVEFILE_H_
+#define __WAVEFILE_H_
+
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Minimal support for 16-bit PCM RIFF/WAVE files (samples are interleaved).
+//  Both functions throw std::runtime_error on failure.
+//
+void WAV_Write(const char* fileName, int channels, int sampleRate, const std::vector<short>& samples);
+void WAV_Read(const char* fileName, int& channels, int& sampleRate, std::vector<short>& samples);
+
+#endif //__WAVEFILE_H_
@@ -0,0 +1,165 @@
+// SinkBench.cpp : exercises the producer-side rate control against a
+//  simulated audio device (virtual clock), under various device
+//  imperfections, and reports how well the buffering held up.
+//
+// Usage: SinkBench [bufferMs [seconds]]
+//
+// Each scenario is run twice: with the buffer operating range fixed at
+//  bufferMs, then with it sized adaptively (starting from bufferMs).
+//
+// Scenarios start with the sink holding its target amount of data, and
+//  under/overruns only count once settled; the cold-start scenario starts
+//  from an empty sink instead, and counts them from the very beginning.
+//
+// The exit code is non-zero if any scenario ran into underruns or overruns
+//  once settled, so that the tool can be run unattended.
+//
+
+#include "stdafx.h"
+
+#include <ClockedSink.h>
+#include <RateControl.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define DEFAULT_BUFFER        75        // milliseconds, as in VDMS.ini
+#define DEFAULT_SECONDS       120
+
+#define SAMPLE_RATE           44100
+#define FRAME_SIZE            4         // 16-bit stereo
+
+#define SETTLE_TIME           10.0      // seconds during which under/overruns are not held against the scenario
+
+#define ADAPTIVE_PERCENTILE   99
+#define ADAPTIVE_MIN          10        // milliseconds
+#define ADAPTIVE_MAX          500       // milliseconds
+
+/////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  const char* name;
+  double drift;                         // device clock error (ppm)
+  double deviceJitter;                  // seconds
+  double stallInterval;                 // seconds
+  double stallDuration;                 // seconds
+  double tick;                          // producer's update interval (seconds)
+  double tickJitter;                    // producer's scheduling jitter (seconds)
+  bool isColdStart;                     // start from an empty sink, and count under/overruns from the start
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+  { "ideal",          0.0, 0.000, 0.0, 0.000, 0.001, 0.000, false },
+  { "fast device", +2000.0, 0.000, 0.0, 0.000, 0.001, 0.000, false },
+  { "slow device", -2000.0, 0.000, 0.0, 0.000, 0.001, 0.000, false },
+  { "jitter",         0.0, 0.005, 0.0, 0.000, 0.001, 0.005, false },
+  { "coarse ticks",   0.0, 0.000, 0.0, 0.000, 0.020, 0.010, false },
+  { "stalls",         0.0, 0.000, 2.0, 0.040, 0.001, 0.000, false },
+  { "everything", +1000.0, 0.005, 3.0, 0.040, 0.005, 0.005, false },
+  { "cold start",     0.0, 0.005, 0.0, 0.000, 0.001, 0.005, true }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned long seed = 1;
+
+//
+// Deterministic pseudo-random numbers in [0, 1)
+//
+static double Random(void) {
+  seed = seed * 1103515245UL + 12345UL;
+  return ((seed >> 16) & 0x7fff) / 32768.0;
+}
+
+//
+// Runs one scenario; returns true if no data was lost or starved once
+//  settled (or at all, from a cold start)
+//
+static bool RunScenario(const scenario_t& scenario, int bufOpRange, int seconds, bool isAdaptive) {
+  CClockedSink sink;
+  CRateControl rateControl;
+
+  sink.SetFormat(SAMPLE_RATE * FRAME_SIZE, FRAME_SIZE);
+  sink.SetBuffering(bufOpRange);
+  sink.SetJitter(scenario.deviceJitter);
+  sink.SetStalls(scenario.stallInterval, scenario.stallDuration);
+  sink.SetDrift(scenario.drift);
+
+  if (isAdaptive)
+    sink.SetAdaptiveBuffering(ADAPTIVE_PERCENTILE, ADAPTIVE_MIN, ADAPTIVE_MAX);
+
+  // Start from a steady state (the sink holds its target amount of data),
+  //  or from an empty sink, as when the emulation starts playing
+  double load = 0.0;
+  double credit = 0.0;
+
+  if (!scenario.isColdStart)
+    load = sink.PlayData(sink.GetTargetBytes() - sink.GetTargetBytes() % FRAME_SIZE);
+
+  long settledUnderruns = 0, settledOverruns = 0;
+  bool isSettled = scenario.isColdStart;
+
+  // The producer wakes up periodically, and renders as much audio as the
+  //  elapsed time (trimmed by the rate control) calls for, as the emulated
+  //  devices do
+  while (sink.GetTime() < seconds) {
+    double deltaTime = scenario.tick + scenario.tickJitter * Random();
+
+    sink.Advance(deltaTime);
+
+    if (!isSettled && (sink.GetTime() >= SETTLE_TIME)) {
+      settledUnderruns = sink.GetUnderruns();
+      settledOverruns  = sink.GetOverruns();
+      isSettled = true;
+    }
+
+    credit += SAMPLE_RATE * rateControl.Update(load, deltaTime) * deltaTime;
+
+    long numFrames = (long)credit;
+    credit -= numFrames;
+
+    if (numFrames > 0)
+      load = sink.PlayData(numFrames * FRAME_SIZE);
+  }
+
+  long underruns = sink.GetUnderruns() - settledUnderruns;
+  long overruns  = sink.GetOverruns() - settledOverruns;
+
+  printf("%-13s %8ld %8ld %8.1f %8.1f %8.1f %6ld %6ld %s\n", scenario.name, rateControl.GetCorrectionPPM(), sink.GetBufOpRange(),
+         1000.0 * sink.GetTargetBytes() / (SAMPLE_RATE * FRAME_SIZE),
+         1000.0 * sink.GetMinBuffered() / (SAMPLE_RATE * FRAME_SIZE),
+         1000.0 * sink.GetMaxBuffered() / (SAMPLE_RATE * FRAME_SIZE),
+         sink.GetUnderruns(), sink.GetOverruns(),
+         ((underruns == 0) && (overruns == 0)) ? "ok" : "FAILED");
+
+  return (underruns == 0) && (overruns == 0);
+}
+
+int main(int argc, char* argv[]) {
+  int bufOpRange = (argc > 1) ? atoi(argv[1]) : DEFAULT_BUFFER;
+  int seconds    = (argc > 2) ? atoi(argv[2]) : DEFAULT_SECONDS;
+
+  if ((argc > 3) || (bufOpRange < 1) || (seconds <= SETTLE_TIME)) {
+    fprintf(stderr, "Usage: SinkBench [bufferMs [seconds]]\n");
+    return 2;
+  }
+
+  printf("Simulating %d seconds of playback with %dms buffering\n\n", seconds, bufOpRange);
+  int numFailed = 0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 0) {
+      printf("Fixed buffering\n");
+    } else {
+      printf("\nAdaptive buffering (%dth percentile, %d-%dms)\n", ADAPTIVE_PERCENTILE, ADAPTIVE_MIN, ADAPTIVE_MAX);
+    }
+
+    printf("%-13s %8s %8s %8s %8s %8s %6s %6s\n", "scenario", "ppm", "buffer", "target", "min ms", "max ms", "under", "over");
+
+    for (int i = 0; i < (int)(sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+      if (!RunScenario(scenarios[i], bufOpRange, seconds, (pass > 0)))
+        numFailed++;
+    }
+  }
+
+  return (numFailed > 0) ? 1 : 0;
+}
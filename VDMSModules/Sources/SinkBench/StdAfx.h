@@ -0,0 +1,27 @@
+// stdafx.h : include file for standard system include files,
+//      or project specific include files that are used frequently,
+//      but are changed infrequently
+
+#if !defined(AFX_STDAFX_H__3B7E9D14_5A2C_4F81_9E63_C08D1F4A7B25__INCLUDED_)
+#define AFX_STDAFX_H__3B7E9D14_5A2C_4F81_9E63_C08D1F4A7B25__INCLUDED_
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+// The MFCUtil sources compiled into this project rely on this
+//  header (through the precompiled header) for their standard includes
+
+#ifdef _MSC_VER
+# include <crtdbg.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+//{{AFX_INSERT_LOCATION}}
+// Microsoft Visual C++ will insert additional declarations immediately before the previous line.
+
+#endif // !defined(AFX_STDAFX_H__3B7E9D14_5A2C_4F81_9E63_C08D1F4A7B25__INCLUDED_)
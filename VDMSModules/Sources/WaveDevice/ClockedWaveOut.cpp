@@ -0,0 +1,264 @@
+// ClockedWaveOut.cpp : Implementation of CClockedWaveOut
+#include "stdafx.h"
+#include "WaveDevice.h"
+#include "ClockedWaveOut.h"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define INI_STR_BUFOPRANGE    L"buffer"
+#define INI_STR_BUFMIN        L"bufferMin"
+#define INI_STR_BUFMAX        L"bufferMax"
+#define INI_STR_BUFPERCENTILE L"bufferPercentile"
+#define INI_STR_PERIOD        L"period"
+#define INI_STR_JITTER        L"jitter"
+#define INI_STR_STALLINTERVAL L"stallInterval"
+#define INI_STR_STALLDURATION L"stallDuration"
+#define INI_STR_DRIFT         L"drift"
+#define INI_STR_WAVEOUT       L"WaveOut"
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <MFCUtil.h>
+#pragma comment ( lib , "MFCUtil.lib" )
+
+#include <VDMUtil.h>
+#pragma comment ( lib , "VDMUtil.lib" )
+
+/////////////////////////////////////////////////////////////////////////////
+// CClockedWaveOut
+
+/////////////////////////////////////////////////////////////////////////////
+// ISupportsErrorInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CClockedWaveOut::InterfaceSupportsErrorInfo(REFIID riid)
+{
+	static const IID* arr[] = 
+	{
+    &IID_IVDMBasicModule,
+    &IID_IWaveDataConsumer,
+    &IID_IWaveBufferInfo,
+    &IID_IWaveTelemetry
+	};
+	for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
+	{
+		if (InlineIsEqualGUID(*arr[i],riid))
+			return S_OK;
+	}
+	return S_FALSE;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IVDMBasicModule
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CClockedWaveOut::Init(IUnknown * configuration) {
+  if (configuration == NULL)
+    return E_POINTER;
+
+  IVDMQUERYLib::IVDMQueryDependenciesPtr Depends;   // Dependency query object
+  IVDMQUERYLib::IVDMQueryConfigurationPtr Config;   // Configuration query object
+
+  // Grab a copy of the runtime environment (useful for logging, etc.)
+  RTE_Set(m_env, configuration);
+
+  // Initialize configuration
+  try {
+    // Obtain the Query objects (for intialization purposes)
+    Depends    = configuration; // Dependency query object
+    Config     = configuration; // Configuration query object
+
+    /** Get settings *******************************************************/
+
+    // Try to obtain the buffer operating range (milliseconds), use default if none specified
+    m_bufOpRange = CFG_Get(Config, INI_STR_BUFOPRANGE, 125, 10, false);
+
+    // Try to obtain the simulated device's behaviour (milliseconds, ppm), use defaults if none specified
+    m_sink.SetBuffering(m_bufOpRange);
+    m_sink.SetPeriod(CFG_Get(Config, INI_STR_PERIOD, 10, 10, true) / 1000.0);
+    m_sink.SetJitter(CFG_Get(Config, INI_STR_JITTER, 0, 10, true) / 1000.0);
+    m_sink.SetStalls(CFG_Get(Config, INI_STR_STALLINTERVAL, 0, 10, true) / 1000.0, CFG_Get(Config, INI_STR_STALLDURATION, 0, 10, true) / 1000.0);
+    m_sink.SetDrift(CFG_Get(Config, INI_STR_DRIFT, 0, 10, true));
+
+    // Try to obtain the adaptive buffering settings (milliseconds, percentile; 0 = fixed buffering), use defaults if none specified
+    m_sink.SetAdaptiveBuffering(CFG_Get(Config, INI_STR_BUFPERCENTILE, 99, 10, true), CFG_Get(Config, INI_STR_BUFMIN, 20, 10, true), CFG_Get(Config, INI_STR_BUFMAX, 500, 10, true));
+
+    /** Get modules ********************************************************/
+
+    // Try to obtain an interface to a Wave-out module, use NULL if none available
+    m_waveOut  = DEP_Get(Depends, INI_STR_WAVEOUT, NULL, true);   // do not complain if no such module available
+  } catch (_com_error& ce) {
+    SetErrorInfo(0, ce.ErrorInfo());
+    return ce.Error();                // Propagate the error
+  }
+
+  m_lastTime = GetTimeMicros();
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("ClockedWaveOut initialized")));
+
+  return S_OK;
+}
+
+STDMETHODIMP CClockedWaveOut::Destroy() {
+  AdvanceClock();
+
+  // Report how the producer(s) fared against the simulated device
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("ClockedWaveOut statistics after %0.1fs: %0.0f bytes played (%0.0f bytes of priming silence), %d underrun(s) (%0.0f bytes of silence), %d overrun(s) (%0.0f bytes dropped), buffering between %d and %d bytes (target = %d bytes)"),
+                     m_sink.GetTime(), m_sink.GetPlayedBytes(), m_sink.GetPrimedBytes(), m_sink.GetUnderruns(), m_sink.GetUnderrunBytes(), m_sink.GetOverruns(), m_sink.GetOverrunBytes(), m_sink.GetMinBuffered(), m_sink.GetMaxBuffered(), m_sink.GetTargetBytes()));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("ClockedWaveOut telemetry: %s"), (LPCTSTR)m_telemetry.GetReport()));
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("ClockedWaveOut buffer settled at %dms (set 'buffer = %d' to start there)"), m_sink.GetBufOpRange(), m_sink.GetBufOpRange()));
+
+  // Release the Wave-out module
+  m_waveOut = NULL;
+
+  // Release the runtime environment
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("ClockedWaveOut released")));
+  RTE_Set(m_env, NULL);
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IWaveDataConsumer
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CClockedWaveOut::SetFormat(WORD channels, DWORD samplesPerSec, WORD bitsPerSample) {
+  HRESULT hrThat = S_OK;
+
+  // The simulated device consumes data at the rate given by the format
+  AdvanceClock();
+  m_sink.SetFormat(channels * samplesPerSec * bitsPerSample / 8, channels * bitsPerSample / 8);
+  m_telemetry.SetFormat(channels * samplesPerSec * bitsPerSample / 8);
+
+  if (m_waveOut != NULL)
+    hrThat = m_waveOut->SetFormat(channels, samplesPerSec, bitsPerSample);
+
+  return hrThat;
+}
+
+STDMETHODIMP CClockedWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
+  if (data == NULL)
+    return E_POINTER;
+
+  if (load == NULL)
+    return E_POINTER;
+
+  HRESULT hrThat = S_OK;
+  DOUBLE loadThis = 1.0, loadThat = 1.0;
+
+  // Let the simulated device catch up, then queue the data
+  long underruns = m_sink.GetUnderruns(), overruns = m_sink.GetOverruns();
+  double underrunBytes = m_sink.GetUnderrunBytes();
+
+  AdvanceClock();
+  m_telemetry.AddFill(m_sink.GetBuffered());
+  loadThis = m_sink.PlayData(length);
+
+  if ((m_sink.GetUnderruns() != underruns) || (m_sink.GetUnderrunBytes() != underrunBytes))
+    m_telemetry.AddUnderruns(m_sink.GetUnderruns() - underruns, 1000.0 * (m_sink.GetUnderrunBytes() - underrunBytes) / m_sink.GetBytesPerSecond());
+
+  if (m_sink.GetOverruns() != overruns)
+    m_telemetry.AddOverrun(length);
+
+  // Forward the call to other module(s) daisy-chained after us (if any)
+  if (m_waveOut != NULL)
+    hrThat = m_waveOut->PlayData(data, length, &loadThat);
+
+  // Decide the load (compromise between us and other modules)
+  *load = loadThis * loadThat;
+
+  return hrThat;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IWaveBufferInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CClockedWaveOut::GetBufferSize(LONG * milliseconds) {
+  if (milliseconds == NULL)
+    return E_POINTER;
+
+  *milliseconds = m_sink.GetBufOpRange();
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IWaveTelemetry
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CClockedWaveOut::GetErrorStats(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime) {
+  if ((underruns == NULL) || (underrunTime == NULL) || (overruns == NULL) || (overrunTime == NULL))
+    return E_POINTER;
+
+  *underruns    = m_telemetry.GetUnderruns();
+  *underrunTime = m_telemetry.GetUnderrunTime();
+  *overruns     = m_telemetry.GetOverruns();
+  *overrunTime  = m_telemetry.GetOverrunTime();
+
+  return S_OK;
+}
+
+STDMETHODIMP CClockedWaveOut::GetFillStats(LONG * fill, LONG * peakFill) {
+  if ((fill == NULL) || (peakFill == NULL))
+    return E_POINTER;
+
+  *fill     = m_telemetry.GetFill();
+  *peakFill = m_telemetry.GetPeakFill();
+
+  return S_OK;
+}
+
+STDMETHODIMP CClockedWaveOut::GetLatencyHistogram(LONG numBins, LONG * histogram, LONG * binWidth) {
+  if ((histogram == NULL) || (binWidth == NULL))
+    return E_POINTER;
+
+  if (numBins < 0)
+    return E_INVALIDARG;
+
+  m_telemetry.GetLatencyHistogram(histogram, numBins);
+  *binWidth = TLM_BIN_WIDTH;
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Utility functions
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Brings the simulated device up to date with the system clock
+//
+void CClockedWaveOut::AdvanceClock(void) {
+  LONGLONG curTime = GetTimeMicros();
+
+  m_sink.Advance((curTime - m_lastTime) / 1000000.0);
+  m_lastTime = curTime;
+}
+
+//
+// Retrieves the value of the system's monotonic clock (microseconds)
+//
+LONGLONG CClockedWaveOut::GetTimeMicros(void) {
+  static LARGE_INTEGER perfCountFreq = { 0 };
+
+  if ((perfCountFreq.QuadPart == 0) && !QueryPerformanceFrequency(&perfCountFreq))
+    perfCountFreq.QuadPart = 1;
+
+  if (perfCountFreq.QuadPart < 1000) {
+    return timeGetTime() * (LONGLONG)1000;
+  } else {
+    LARGE_INTEGER currentCount;
+    VERIFY(QueryPerformanceCounter(&currentCount));
+    return (currentCount.QuadPart * (LONGLONG)1000000) / perfCountFreq.QuadPart;
+  }
+}
@@ -0,0 +1,97 @@
+// ClockedWaveOut.h : Declaration of the CClockedWaveOut
+
+#ifndef __CLOCKEDWAVEOUT_H_
+#define __CLOCKEDWAVEOUT_H_
+
+#include "resource.h"       // main symbols
+
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma warning ( disable : 4192 )
+#import <IVDMModule.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids 
+#import <IWave.tlb> raw_interfaces_only, raw_native_types, no_namespace, named_guids 
+
+#import <IVDMQuery.tlb>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#include <ClockedSink.h>
+#include <SinkTelemetry.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// CClockedWaveOut
+class ATL_NO_VTABLE CClockedWaveOut : 
+	public CComObjectRootEx<CComMultiThreadModel>,
+	public CComCoClass<CClockedWaveOut, &CLSID_ClockedWaveOut>,
+	public ISupportErrorInfo,
+  public IVDMBasicModule,
+  public IWaveDataConsumer,
+  public IWaveBufferInfo,
+  public IWaveTelemetry
+{
+public:
+	CClockedWaveOut()
+    : m_lastTime(0)
+  { }
+
+DECLARE_REGISTRY_RESOURCEID(IDR_CLOCKEDWAVEOUT)
+DECLARE_NOT_AGGREGATABLE(CClockedWaveOut)
+
+DECLARE_PROTECT_FINAL_CONSTRUCT()
+
+BEGIN_COM_MAP(CClockedWaveOut)
+  COM_INTERFACE_ENTRY(ISupportErrorInfo)
+  COM_INTERFACE_ENTRY(IVDMBasicModule)
+  COM_INTERFACE_ENTRY(IWaveDataConsumer)
+  COM_INTERFACE_ENTRY(IWaveBufferInfo)
+  COM_INTERFACE_ENTRY(IWaveTelemetry)
+END_COM_MAP()
+
+// ISupportsErrorInfo
+public:
+  STDMETHOD(InterfaceSupportsErrorInfo)(REFIID riid);
+
+// IVDMBasicModule
+public:
+  STDMETHOD(Init)(IUnknown * configuration);
+  STDMETHOD(Destroy)();
+
+// IWaveDataConsumer
+public:
+  STDMETHOD(SetFormat)(WORD channels, DWORD samplesPerSec, WORD bitsPerSample);
+  STDMETHOD(PlayData)(BYTE * data, LONG length, DOUBLE * load);
+
+// IWaveBufferInfo
+public:
+  STDMETHOD(GetBufferSize)(LONG * milliseconds);
+
+// IWaveTelemetry
+public:
+  STDMETHOD(GetErrorStats)(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime);
+  STDMETHOD(GetFillStats)(LONG * fill, LONG * peakFill);
+  STDMETHOD(GetLatencyHistogram)(LONG numBins, LONG * histogram, LONG * binWidth);
+
+protected:
+  void AdvanceClock(void);
+  LONGLONG GetTimeMicros(void);
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Module's settings
+protected:
+  int m_bufOpRange;
+
+// Other member variables
+protected:
+  CClockedSink m_sink;                // simulated device, driven by the system's monotonic clock
+  LONGLONG m_lastTime;                // when the simulated device was last brought up to date (microseconds)
+
+  CSinkTelemetry m_telemetry;
+
+// Interfaces to dependency modules
+protected:
+  IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
+  IWaveDataConsumerPtr m_waveOut;
+};
+
+#endif //__CLOCKEDWAVEOUT_H_
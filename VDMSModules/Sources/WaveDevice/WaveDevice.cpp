@@ -12,12 +12,14 @@
 
 #include "WaveDevice_i.c"
 #include "WaveOut.h"
+#include "ClockedWaveOut.h"
 
 
 CComModule _Module;
 
 BEGIN_OBJECT_MAP(ObjectMap)
 OBJECT_ENTRY(CLSID_WaveOut, CWaveOut)
+OBJECT_ENTRY(CLSID_ClockedWaveOut, CClockedWaveOut)
 END_OBJECT_MAP()
 
 class CWaveDeviceApp : public CWinApp
@@ -13,6 +13,11 @@
 
 #define INI_STR_DEVICEID      L"device"
 #define INI_STR_BUFOPRANGE    L"buffer"
+#define INI_STR_BUFMIN        L"bufferMin"
+#define INI_STR_BUFMAX        L"bufferMax"
+#define INI_STR_BUFPERCENTILE L"bufferPercentile"
+#define INI_STR_SAMPLERATE    L"sampleRate"
+#define INI_STR_CHANNELS      L"channels"
 #define INI_STR_WAVEOUT       L"WaveOut"
 
 /////////////////////////////////////////////////////////////////////////////
@@ -21,7 +26,7 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define TOLERANCE_FREQ        10
+#define SLOT_MINLEN           4096  // minimum size of a sample slot (in bytes)
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -43,7 +48,9 @@ STDMETHODIMP CWaveOut::InterfaceSupportsErrorInfo(REFIID riid)
 	static const IID* arr[] = 
 	{
     &IID_IVDMBasicModule,
-    &IID_IWaveDataConsumer
+    &IID_IWaveDataConsumer,
+    &IID_IWaveBufferInfo,
+    &IID_IWaveTelemetry
 	};
 	for (int i=0; i < sizeof(arr) / sizeof(arr[0]); i++)
 	{
@@ -82,6 +89,23 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
     // Try to obtain the buffer operating range (milliseconds), use default if none specified
     m_bufOpRange = CFG_Get(Config, INI_STR_BUFOPRANGE, 125, 10, false);
 
+    // Try to obtain the adaptive buffering settings (milliseconds, percentile; 0 = fixed buffering), use defaults if none specified
+    m_bufferSizer.Init(m_bufOpRange, CFG_Get(Config, INI_STR_BUFMIN, 20, 10, true), CFG_Get(Config, INI_STR_BUFMAX, 500, 10, true), CFG_Get(Config, INI_STR_BUFPERCENTILE, 99, 10, true));
+
+    // Try to obtain the device's playback format, use default if none specified
+    m_sampleRate  = CFG_Get(Config, INI_STR_SAMPLERATE, 44100, 10, true);
+    m_numChannels = CFG_Get(Config, INI_STR_CHANNELS, 2, 10, true);
+
+    if ((m_sampleRate < 8000) || (m_sampleRate > 192000)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Sample rate (%dHz) is out of range; playing back at 44100Hz"), m_sampleRate));
+      m_sampleRate = 44100;
+    }
+
+    if ((m_numChannels < 1) || (m_numChannels > 2)) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_WARNING, Format(_T("Number of channels (%d) is out of range; playing back in stereo"), m_numChannels));
+      m_numChannels = 2;
+    }
+
     /** Get modules ********************************************************/
 
     // Try to obtain an interface to a Wave-out module, use NULL if none available
@@ -93,7 +117,27 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
 
   m_deviceName = WaveOutGetName();    // Obtain information about the device (its name)
 
-  // Create the garbage-collector thread (manages packets that have finished playing)
+  // The device is always opened with the same format (16-bit PCM), whatever
+  //  the format of the data; the data is converted as it comes in
+  m_waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+  m_waveFormat.nChannels = m_numChannels;
+  m_waveFormat.nSamplesPerSec = m_sampleRate;
+  m_waveFormat.nAvgBytesPerSec = m_numChannels * m_sampleRate * 2;
+  m_waveFormat.nBlockAlign = m_numChannels * 2;
+  m_waveFormat.wBitsPerSample = 16;
+  m_waveFormat.cbSize = 0;
+
+  m_converter.SetOutputFormat(m_numChannels, m_sampleRate);
+  m_telemetry.SetFormat(m_waveFormat.nAvgBytesPerSec);
+
+  // Compute the ideal amount of buffering (in bytes)
+  UpdateBufferSize();
+
+  // Size the sample memory after the device's format (and the largest
+  //  amount of buffering it may come to)
+  ArenaCreate();
+
+  // Create the garbage-collector thread (reports device notifications; finished packets are recycled by WaveOutProc)
   m_gcThread.Create(this, _T("Wave-Out Garbage Collector"), true);      /* TODO: check that creation was successful */
   m_gcThread.SetPriority(THREAD_PRIORITY_LOWEST);
   m_gcThread.Resume();
@@ -104,6 +148,13 @@ STDMETHODIMP CWaveOut::Init(IUnknown * configuration) {
 }
 
 STDMETHODIMP CWaveOut::Destroy() {
+  // Report the buffering the measurements settled at, so that it can be
+  //  used as the starting point next time
+  if (m_bufferSizer.IsAdaptive())
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut buffer settled at %dms (set 'buffer = %d' to start there)"), m_bufferSizer.GetSize(), m_bufferSizer.GetSize()));
+
+  RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("WaveOut statistics: %s"), (LPCTSTR)m_telemetry.GetReport()));
+
   // Release the Wave device
   if (m_hWaveOut != NULL)
     WaveOutClose();
@@ -112,6 +163,9 @@ STDMETHODIMP CWaveOut::Destroy() {
   if (m_gcThread.GetThreadHandle() != NULL)
     m_gcThread.Cancel();
 
+  // Release the sample memory
+  ArenaDestroy();
+
   // Release the Wave-out module
   m_waveOut = NULL;
 
@@ -129,59 +183,22 @@ STDMETHODIMP CWaveOut::Destroy() {
 /////////////////////////////////////////////////////////////////////////////
 
 STDMETHODIMP CWaveOut::SetFormat(WORD channels, DWORD samplesPerSec, WORD bitsPerSample) {
-  /* TODO: validate that 10% tolerance in frequency chane is worth anything; if yes, make it parametrizable
-     in VDMS.ini file as a number n = 0...100, then use tolerance range = 1.00 +/- (n / 100.0) */
-
   HRESULT hrThis = S_OK, hrThat = S_OK;
 
-  // Check if the device has to be (re)opened either because it was not
-  //  opened before, or following a change in playback format that requires
-  //  the device to be closed then opened again with the new format
-  if ((m_hWaveOut == NULL) ||
-      (m_waveFormat.nChannels != channels) ||
-      (m_waveFormat.nSamplesPerSec * (1.00 - TOLERANCE_FREQ / 100.0) > samplesPerSec) || // accept 10% tolerance in freq. change, avoids excessive overhead in
-      (m_waveFormat.nSamplesPerSec * (1.00 + TOLERANCE_FREQ / 100.0) < samplesPerSec) || // closing/re-opening the device (some games abuse the time-constant)
-      (m_waveFormat.wBitsPerSample != bitsPerSample))
+  // The device stays open (in its own format) across format changes; only
+  //  the conversion of the data that follows is affected
+  if (((channels != 1) && (channels != 2)) ||
+      ((bitsPerSample != 8) && (bitsPerSample != 16)) ||
+      (samplesPerSec == 0))
   {
-    MMRESULT errCode;
-
-    // If the device is open, try to close it first
-    while (m_hWaveOut != NULL) {
-      switch (errCode = waveOutClose(m_hWaveOut)) {
-        case MMSYSERR_NOERROR:
-          m_hWaveOut = NULL;
-          break;
-        case WAVERR_STILLPLAYING:
-          Sleep(15);
-          break;
-        default:
-          RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutClose(0x%08x) on device %d ('%s'): 0x%08x - %s"), (int)m_hWaveOut, (int)m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
-          hrThis = S_FALSE;
-      }
-    }
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("Unsupported format (%d channels, %dHz, %d bits)"), (int)channels, (int)samplesPerSec, (int)bitsPerSample));
+    hrThis = S_FALSE;
+  } else {
+    m_converter.SetInputFormat(channels, samplesPerSec, bitsPerSample);
 
-    // (Re)open the (now closed) device
-    if (hrThis == S_OK) {
-      // Change the format
-      m_waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-      m_waveFormat.nChannels = channels;
-      m_waveFormat.nSamplesPerSec = samplesPerSec;
-      m_waveFormat.nAvgBytesPerSec = channels * samplesPerSec * bitsPerSample / 8;
-      m_waveFormat.nBlockAlign = channels * bitsPerSample / 8;
-      m_waveFormat.wBitsPerSample = bitsPerSample;
-      m_waveFormat.cbSize = 0;
-
-      // Open the device with the new format
-      if (!WaveOutOpen(false))
-        hrThis = S_FALSE;
-
-      // No bytes are enqueued for playback (yet)
-      InterlockedExchange(&m_bufferedBytes, 0);
-
-      // Compute the ideal amount of buffering (in bytes)
-      m_bufferedLo = m_waveFormat.nAvgBytesPerSec * m_bufOpRange / 1000;
-      m_bufferedHi = m_bufferedLo * 2;
-    }
+    // Open the device (if not already open)
+    if (!WaveOutOpen(false))
+      hrThis = S_FALSE;
   }
 
   if (m_waveOut != NULL)
@@ -203,69 +220,63 @@ STDMETHODIMP CWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
   if ((m_hWaveOut == NULL) && (!WaveOutOpen())) {
     hrThis = S_FALSE;         // The device is not open, and an attempt to open it failed
   } else {
-    WAVEHDR* waveHdr = NULL;
-    LPSTR waveData = NULL;
+    DWORD curTime = timeGetTime();
 
-    try {
+    // Measure the jitter: how irregularly the data comes in, how coarsely
+    //  the device takes it (WaveOutProc keeps track of that), and whether
+    //  the device ran dry in between two deliveries (a longer gap is a
+    //  pause in playback, not an underrun)
+    if (m_lastDelivery != 0) {
+      DWORD interval = curTime - m_lastDelivery;
 
-      /* TODO: get rid of this silly new/delete scheme; replace with static,
-         pre-allocated circular buffer (size specifiable in VDMS.ini?) and
-         pre-allocated WAVEHDR's that point at consecutive locations in the
-         buffer -- new/delete is too inefficient (we can make use of the fact
-         that we know that data will only be allocated/released in a FIFO
-         manner) */
+      m_bufferSizer.AddDelivery(interval);
 
-      // Allocate header & data needed by Windows to play back a sound-block
-      waveHdr  = new WAVEHDR;
-      waveData = new CHAR[length];
+      if ((m_bufferedBytes == 0) && (interval < BSZ_HISTOGRAM_LEN)) {
+        m_bufferSizer.AddUnderrun();
+        m_telemetry.AddUnderruns(1, min(interval, curTime - m_dryTime));
+      }
+    }
 
-      // Fill in the header information
-      waveHdr->lpData = waveData;
-      waveHdr->dwBufferLength = length;
-      waveHdr->dwBytesRecorded = 0;
-      waveHdr->dwUser = (DWORD)waveHdr;
-      waveHdr->dwFlags = 0;
-      waveHdr->dwLoops = 0;
+    LONG doneInterval = InterlockedExchange((LPLONG)&m_doneInterval, 0);
 
-      // Copy the data to the playback buffer
-      memcpy(waveData, data, length);
+    if (doneInterval > 0)
+      m_bufferSizer.AddDeviceQuantum(doneInterval);
 
-      // Prepare and send the header + data to the Windows device
+    m_lastDelivery = curTime;
 
-      MMRESULT errCode;
+    if (m_bufferSizer.Update(curTime / 1000.0))
+      UpdateBufferSize();
 
-      if ((errCode = waveOutPrepareHeader(m_hWaveOut, waveHdr, sizeof(*waveHdr))) != MMSYSERR_NOERROR) {
-        CString args = Format(_T("0x%08x, %p, %d"), m_hWaveOut, waveHdr, sizeof(*waveHdr));
-        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutPrepareHeader(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
-        AfxThrowUserException();
-      }
+    LONG outLength = 0;
+    const BYTE* outData = m_converter.Convert(data, length, &outLength);
+    LONG targetBytes = (m_bufferedLo + m_bufferedHi) / 2;
 
-      if ((errCode = waveOutWrite(m_hWaveOut, waveHdr, sizeof(*waveHdr))) != MMSYSERR_NOERROR) {
-        CString args = Format(_T("0x%08x, %p, %d"), m_hWaveOut, waveHdr, sizeof(*waveHdr));
-        RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutWrite(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
-        AfxThrowUserException();
-      }
+    // A device that has not started yet, or has run dry, is first primed
+    //  with silence up to the target: it would otherwise start out (again)
+    //  with next to no data queued, and starve until the producers' rate
+    //  control caught up
+    if ((m_bufferedBytes == 0) && (m_pendingLen == 0)) {
+      LONG primeLen = targetBytes - outLength;
+      primeLen -= primeLen % m_waveFormat.nBlockAlign;
 
-      // The data was enqueued successfully => update buffer byte count
-      LONG lastBufferedBytes = InterlockedExchangeAdd(&m_bufferedBytes, length);
+      if (primeLen > 0)
+        WaveOutQueue(NULL, primeLen);
+    }
 
-      if (lastBufferedBytes < m_bufferedLo) {
-        loadThis = (double)lastBufferedBytes / m_bufferedLo;
-      } else if (lastBufferedBytes > m_bufferedHi) {
-        loadThis = (double)lastBufferedBytes / m_bufferedHi;
-      }
-    } catch (CMemoryException * pme) {
-      TCHAR errMsg[1024] = _T("<no description available>");
-      pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
-      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while handling a Wave system-exclusive message:\nwaveHdr  = %p (%d bytes)\nwaveData= %p (%d bytes)\n%s"), waveHdr, sizeof(*waveHdr), waveData, length + 2, errMsg));
-      delete waveHdr;
-      delete[] waveData;
-      hrThis = S_FALSE;
-    } catch (CUserException * /*pue*/) {
-      delete waveHdr;
-      delete[] waveData;
-      hrThis = S_FALSE;
+    LONG fillBytes = m_bufferedBytes + m_pendingLen;
+    LONG sentBytes = WaveOutQueue(outData, outLength);
+
+    if (sentBytes < outLength) {
+      hrThis = S_FALSE;       // Some (or all) of the data could not be enqueued
+      m_telemetry.AddOverrun(outLength - sentBytes);
     }
+
+    m_telemetry.AddFill(fillBytes);
+
+    // Report the fill level relative to the middle of the optimal range;
+    //  producers trim their rate in proportion (see CRateControl)
+    if (targetBytes > 0)
+      loadThis = (double)fillBytes / targetBytes;
   }
 
   // Forward the call to other module(s) daisy-chained after us (if any)
@@ -280,6 +291,62 @@ STDMETHODIMP CWaveOut::PlayData(BYTE * data, LONG length, DOUBLE * load) {
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// IWaveBufferInfo
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CWaveOut::GetBufferSize(LONG * milliseconds) {
+  if (milliseconds == NULL)
+    return E_POINTER;
+
+  *milliseconds = m_bufferSizer.GetSize();
+
+  return S_OK;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+// IWaveTelemetry
+/////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CWaveOut::GetErrorStats(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime) {
+  if ((underruns == NULL) || (underrunTime == NULL) || (overruns == NULL) || (overrunTime == NULL))
+    return E_POINTER;
+
+  *underruns    = m_telemetry.GetUnderruns();
+  *underrunTime = m_telemetry.GetUnderrunTime();
+  *overruns     = m_telemetry.GetOverruns();
+  *overrunTime  = m_telemetry.GetOverrunTime();
+
+  return S_OK;
+}
+
+STDMETHODIMP CWaveOut::GetFillStats(LONG * fill, LONG * peakFill) {
+  if ((fill == NULL) || (peakFill == NULL))
+    return E_POINTER;
+
+  *fill     = m_telemetry.GetFill();
+  *peakFill = m_telemetry.GetPeakFill();
+
+  return S_OK;
+}
+
+STDMETHODIMP CWaveOut::GetLatencyHistogram(LONG numBins, LONG * histogram, LONG * binWidth) {
+  if ((histogram == NULL) || (binWidth == NULL))
+    return E_POINTER;
+
+  if (numBins < 0)
+    return E_INVALIDARG;
+
+  m_telemetry.GetLatencyHistogram(histogram, numBins);
+  *binWidth = TLM_BIN_WIDTH;
+
+  return S_OK;
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // IRunnable
 /////////////////////////////////////////////////////////////////////////////
@@ -293,7 +360,6 @@ unsigned int CWaveOut::Run(CThread& thread) {
 
   while (thread.GetMessage(&message)) {
     HWAVEOUT hWaveOut = (HWAVEOUT)(message.wParam);
-    WAVEHDR* waveHdr = (WAVEHDR*)(message.lParam);
     MMRESULT errCode = (MMRESULT)(message.lParam);
 
     switch (message.message) {
@@ -309,16 +375,6 @@ unsigned int CWaveOut::Run(CThread& thread) {
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_INFORMATION, Format(_T("Wave-out device closed (handle = 0x%08x)"), hWaveOut));
         break;
 
-      case MM_WOM_DONE:
-        _ASSERTE(waveHdr != NULL);
-        _ASSERTE(waveHdr->lpData != NULL);
-        _ASSERTE(waveHdr->dwUser != NULL);
-        _ASSERTE((waveHdr->dwFlags & WHDR_DONE) == WHDR_DONE);
-
-        delete[] (CHAR*)(waveHdr->lpData);
-        delete (WAVEHDR*)(waveHdr->dwUser);
-        break;
-
       case UM_WOM_ERROR:
         RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("WaveOut (hWaveOut = 0x%08x) error on device %d ('%s'): 0x%08x - %s"), hWaveOut, m_deviceID, (LPCTSTR)(m_deviceName), (int)errCode, (LPCTSTR)(WaveOutGetError(errCode))));
         break;
@@ -342,10 +398,11 @@ unsigned int CWaveOut::Run(CThread& thread) {
 
 //
 // Callback function invoked by WAVE driver when the device is opened/closed,
-//  or when a wave "packet" finishes playing.
+//  or when a wave "packet" finishes playing.  Finished headers stay prepared
+//  and are handed straight back to PlayData (no waveOut calls are allowed
+//  from within the callback anyway).
 //
 void CALLBACK CWaveOut::WaveOutProc(HWAVEOUT hwo, UINT wMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2) {
-  MMRESULT errCode;
   CWaveOut* pThis = (CWaveOut*)dwInstance;
   WAVEHDR* waveHdr = (WAVEHDR*)(dwParam1);
 
@@ -363,13 +420,24 @@ void CALLBACK CWaveOut::WaveOutProc(HWAVEOUT hwo, UINT wMsg, DWORD dwInstance, D
         _ASSERTE(hwo == pThis->m_hWaveOut);
         _ASSERTE(waveHdr != NULL);
 
-        InterlockedExchangeAdd(&(pThis->m_bufferedBytes), -(LONG)(waveHdr->dwBufferLength));
+        if (InterlockedExchangeAdd(&(pThis->m_bufferedBytes), -(LONG)(waveHdr->dwBufferLength)) == (LONG)(waveHdr->dwBufferLength))
+          pThis->m_dryTime = timeGetTime();   // that was the last of the data
 
-        if ((errCode = waveOutUnprepareHeader(hwo, waveHdr, sizeof(*waveHdr))) != MMSYSERR_NOERROR) {
-          pThis->m_gcThread.PostMessage(UM_WOM_ERROR, (WPARAM)hwo, (LPARAM)errCode);
-        } else {
-          pThis->m_gcThread.PostMessage(MM_WOM_DONE, (WPARAM)hwo, (LPARAM)dwParam1);
-        } break;
+        InterlockedIncrement((LPLONG)&(pThis->m_freeHdrs));
+
+        // Keep track of how coarsely the device consumes the data (PlayData
+        //  may reset m_doneInterval in between the test and the update,
+        //  which only loses one measurement)
+        {
+          DWORD curTime = timeGetTime();
+          LONG interval = (LONG)(curTime - pThis->m_lastDone);
+
+          if ((pThis->m_lastDone != 0) && (interval > pThis->m_doneInterval))
+            InterlockedExchange((LPLONG)&(pThis->m_doneInterval), interval);
+
+          pThis->m_lastDone = curTime;
+        }
+        break;
     }
   } catch (...) { }
 }
@@ -414,6 +482,11 @@ bool CWaveOut::WaveOutOpen(bool isInteractive) {
     }
   }
 
+  if ((m_hWaveOut != NULL) && !WaveOutPrepareBuffers()) {
+    waveOutClose(m_hWaveOut);
+    m_hWaveOut = NULL;
+  }
+
   if (m_hWaveOut != NULL) { // The device was opened successfully
     isErrLog    = true;     // Next time we get an error, log it
     isErrPrompt = true;     // Next time we get an error, prompt the user (if interactive)
@@ -430,6 +503,7 @@ bool CWaveOut::WaveOutOpen(bool isInteractive) {
 //
 void CWaveOut::WaveOutClose(void) {
   waveOutReset(m_hWaveOut);   // Silence the device
+  WaveOutUnprepareBuffers();  // Reclaim the headers (all done after the reset)
   waveOutClose(m_hWaveOut);   // Close the device
   m_hWaveOut = NULL;          // Lose the handle
 }
@@ -457,3 +531,183 @@ CString CWaveOut::WaveOutGetError(MMRESULT errCode) {
   waveOutGetErrorText(errCode, buf, sizeof(buf) / sizeof(buf[0]));
   return CString(buf);
 }
+
+//
+// Prepares all the headers (each over its whole slot) on the freshly opened
+//  device; they remain prepared for as long as the device stays open
+//
+bool CWaveOut::WaveOutPrepareBuffers(void) {
+  if (m_arena == NULL)
+    return false;             // no format was set yet
+
+  for (int i = 0; i < WAVEHDR_POOL; i++) {
+    WAVEHDR* waveHdr = &(m_waveHdrs[i]);
+    MMRESULT errCode;
+
+    waveHdr->lpData = m_arena + i * m_slotLen;
+    waveHdr->dwBufferLength = m_slotLen;
+    waveHdr->dwBytesRecorded = 0;
+    waveHdr->dwUser = 0;
+    waveHdr->dwFlags = 0;
+    waveHdr->dwLoops = 0;
+
+    if ((errCode = waveOutPrepareHeader(m_hWaveOut, waveHdr, sizeof(*waveHdr))) != MMSYSERR_NOERROR) {
+      CString args = Format(_T("0x%08x, %p, %d"), m_hWaveOut, waveHdr, sizeof(*waveHdr));
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutPrepareHeader(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
+
+      while (--i >= 0)
+        waveOutUnprepareHeader(m_hWaveOut, &(m_waveHdrs[i]), sizeof(m_waveHdrs[i]));
+
+      return false;
+    }
+  }
+
+  m_nextHdr = 0;
+  m_pendingLen = 0;
+  InterlockedExchange((LPLONG)&m_freeHdrs, WAVEHDR_POOL);
+
+  return true;
+}
+
+//
+// Copies <length> bytes of data (silence if <data> is NULL) to the next
+//  header, and sends it to the device right away while headers are
+//  plentiful.  Once fewer than WAVEHDR_RESERVE headers are free (small
+//  packets, or a large amount of buffering), packets are appended to the
+//  header until it is full, so that the headers left can still hold the
+//  whole buffering range (see ArenaCreate); data is only dropped once
+//  every header is queued.  Returns how many bytes were queued
+//
+LONG CWaveOut::WaveOutQueue(const BYTE* data, LONG length) {
+  LONG sentBytes = 0;
+
+  while ((sentBytes < length) && (m_freeHdrs > 0)) {
+    WAVEHDR* waveHdr = &(m_waveHdrs[m_nextHdr]);
+    LONG chunkLen = min(length - sentBytes, m_slotLen - m_pendingLen);
+
+    _ASSERTE((waveHdr->dwFlags & WHDR_PREPARED) == WHDR_PREPARED);
+    _ASSERTE((waveHdr->dwFlags & WHDR_INQUEUE) == 0);
+
+    if (data != NULL) {
+      memcpy(waveHdr->lpData + m_pendingLen, data + sentBytes, chunkLen);
+    } else {
+      memset(waveHdr->lpData + m_pendingLen, 0, chunkLen);  // the device is always 16-bit
+    }
+
+    m_pendingLen += chunkLen;
+    sentBytes += chunkLen;
+
+    if (((m_pendingLen >= m_slotLen) || (m_freeHdrs > WAVEHDR_RESERVE)) && !WaveOutSubmit())
+      break;
+  }
+
+  return sentBytes;
+}
+
+//
+// Sends the data copied to the next header to the device; the header was
+//  prepared for its whole slot, and is only shortened to fit the data.  If
+//  the device refuses it, the data is dropped (and false is returned)
+//
+bool CWaveOut::WaveOutSubmit(void) {
+  WAVEHDR* waveHdr = &(m_waveHdrs[m_nextHdr]);
+  LONG length = m_pendingLen;
+  MMRESULT errCode;
+
+  if (length <= 0)
+    return true;
+
+  m_pendingLen = 0;
+
+  waveHdr->dwBufferLength = length;
+  waveHdr->dwFlags &= ~WHDR_DONE;
+
+  InterlockedDecrement((LPLONG)&m_freeHdrs);
+
+  // Send the header + data to the Windows device
+  if ((errCode = waveOutWrite(m_hWaveOut, waveHdr, sizeof(*waveHdr))) != MMSYSERR_NOERROR) {
+    CString args = Format(_T("0x%08x, %p, %d"), m_hWaveOut, waveHdr, sizeof(*waveHdr));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutWrite(%s) on device %d ('%s'): 0x%08x - %s"), (LPCTSTR)args, m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
+    InterlockedIncrement((LPLONG)&m_freeHdrs);
+    m_telemetry.AddOverrun(length);
+    return false;
+  }
+
+  // The data was enqueued successfully => update buffer byte count
+  InterlockedExchangeAdd(&m_bufferedBytes, length);
+
+  m_nextHdr = (m_nextHdr + 1) % WAVEHDR_POOL;
+
+  return true;
+}
+
+//
+// Waits for all the headers to finish playing, then unprepares them
+//
+bool CWaveOut::WaveOutUnprepareBuffers(void) {
+  bool retVal = true;
+
+  for (int i = 0; i < WAVEHDR_POOL; i++) {
+    WAVEHDR* waveHdr = &(m_waveHdrs[i]);
+    MMRESULT errCode;
+
+    if ((waveHdr->dwFlags & WHDR_PREPARED) == 0)
+      continue;
+
+    while ((errCode = waveOutUnprepareHeader(m_hWaveOut, waveHdr, sizeof(*waveHdr))) == WAVERR_STILLPLAYING)
+      Sleep(15);
+
+    if (errCode != MMSYSERR_NOERROR) {
+      RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("waveOutUnprepareHeader(0x%08x, %p, %d) on device %d ('%s'): 0x%08x - %s"), m_hWaveOut, waveHdr, sizeof(*waveHdr), m_deviceID, (LPCTSTR)m_deviceName, (int)errCode, (LPCTSTR)WaveOutGetError(errCode)));
+      retVal = false;
+    }
+  }
+
+  InterlockedExchange((LPLONG)&m_freeHdrs, 0);
+
+  return retVal;
+}
+
+//
+// Allocates the sample memory for the device's format (the device must be
+//  closed).  At the largest operating range the buffering may adapt to,
+//  the WAVEHDR_RESERVE headers alone (filled up before they are sent) hold
+//  the upper buffering limit, and the whole pool twice that much
+//
+void CWaveOut::ArenaCreate(void) {
+  ArenaDestroy();
+
+  LONG maxBufferedHi = 2 * (m_waveFormat.nAvgBytesPerSec * m_bufferSizer.GetMaxSize() / 1000);
+  LONG slotLen = max(SLOT_MINLEN, maxBufferedHi / WAVEHDR_RESERVE);
+
+  if (m_waveFormat.nBlockAlign > 0)
+    slotLen -= slotLen % m_waveFormat.nBlockAlign;  // don't split frames over headers
+
+  try {
+    m_arena = new CHAR[slotLen * WAVEHDR_POOL];
+    m_slotLen = slotLen;
+  } catch (CMemoryException * pme) {
+    TCHAR errMsg[1024] = _T("<no description available>");
+    pme->GetErrorMessage(errMsg, sizeof(errMsg)/sizeof(errMsg[0]));
+    RTE_RecordLogEntry(m_env, IVDMQUERYLib::LOG_ERROR, Format(_T("An unexpected out-of-memory condition was encountered while allocating Wave sample memory (%d bytes):\n%s"), slotLen * WAVEHDR_POOL, errMsg));
+  }
+}
+
+//
+// Releases the sample memory (the device must be closed)
+//
+void CWaveOut::ArenaDestroy(void) {
+  delete[] m_arena;
+
+  m_arena = NULL;
+  m_slotLen = 0;
+}
+
+//
+// Derives the optimal buffering range (in bytes) from the operating range
+//  currently decided by the buffer sizer
+//
+void CWaveOut::UpdateBufferSize(void) {
+  m_bufferedLo = m_waveFormat.nAvgBytesPerSec * m_bufferSizer.GetSize() / 1000;
+  m_bufferedHi = m_bufferedLo * 2;
+}
@@ -10,6 +10,9 @@
 /* TODO: put this in the .INI file ? */
 #define WAVEOPEN_RETRY_INTERVAL   2
 
+#define WAVEHDR_POOL              64      // how many pre-prepared headers are cycled through
+#define WAVEHDR_RESERVE           (WAVEHDR_POOL / 2)  // free headers below which small packets are coalesced
+
 /////////////////////////////////////////////////////////////////////////////
 
 #pragma warning ( disable : 4192 )
@@ -20,6 +23,9 @@
 
 /////////////////////////////////////////////////////////////////////////////
 
+#include <BufferSizer.h>
+#include <FormatConverter.h>
+#include <SinkTelemetry.h>
 #include <Thread.h>
 
 /////////////////////////////////////////////////////////////////////////////
@@ -30,11 +36,13 @@ class ATL_NO_VTABLE CWaveOut :
   public IRunnable,
 	public ISupportErrorInfo,
   public IVDMBasicModule,
-  public IWaveDataConsumer
+  public IWaveDataConsumer,
+  public IWaveBufferInfo,
+  public IWaveTelemetry
 {
 public:
 	CWaveOut()
-    : m_hWaveOut(NULL), m_deviceName(_T("<unknown>")), m_bufferedBytes(0)
+    : m_hWaveOut(NULL), m_deviceName(_T("<unknown>")), m_bufferedBytes(0), m_lastDelivery(0), m_lastDone(0), m_doneInterval(0), m_dryTime(0), m_arena(NULL), m_slotLen(0), m_nextHdr(0), m_pendingLen(0), m_freeHdrs(0)
   {
     m_waveFormat.nChannels = 0;
     m_waveFormat.nSamplesPerSec = 0;
@@ -50,6 +58,8 @@ BEGIN_COM_MAP(CWaveOut)
   COM_INTERFACE_ENTRY(ISupportErrorInfo)
   COM_INTERFACE_ENTRY(IVDMBasicModule)
   COM_INTERFACE_ENTRY(IWaveDataConsumer)
+  COM_INTERFACE_ENTRY(IWaveBufferInfo)
+  COM_INTERFACE_ENTRY(IWaveTelemetry)
 END_COM_MAP()
 
 // IRunnable
@@ -70,6 +80,16 @@ public:
   STDMETHOD(SetFormat)(WORD channels, DWORD samplesPerSec, WORD bitsPerSample);
   STDMETHOD(PlayData)(BYTE * data, LONG length, DOUBLE * load);
 
+// IWaveBufferInfo
+public:
+  STDMETHOD(GetBufferSize)(LONG * milliseconds);
+
+// IWaveTelemetry
+public:
+  STDMETHOD(GetErrorStats)(LONG * underruns, LONG * underrunTime, LONG * overruns, LONG * overrunTime);
+  STDMETHOD(GetFillStats)(LONG * fill, LONG * peakFill);
+  STDMETHOD(GetLatencyHistogram)(LONG numBins, LONG * histogram, LONG * binWidth);
+
 protected:
   static void CALLBACK WaveOutProc(HWAVEOUT hwo, UINT wMsg, DWORD dwInstance, DWORD dwParam1, DWORD dwParam2);
 
@@ -78,6 +98,13 @@ protected:
   void WaveOutClose(void);
   CString WaveOutGetName(void);
   CString WaveOutGetError(MMRESULT errCode);
+  bool WaveOutPrepareBuffers(void);
+  LONG WaveOutQueue(const BYTE* data, LONG length);
+  bool WaveOutSubmit(void);
+  bool WaveOutUnprepareBuffers(void);
+  void ArenaCreate(void);
+  void ArenaDestroy(void);
+  void UpdateBufferSize(void);
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -85,17 +112,36 @@ protected:
 protected:
   int m_deviceID;
   int m_bufOpRange;
+  int m_sampleRate;
+  int m_numChannels;
 
 // Other member variables
 protected:
   CString m_deviceName;
   HWAVEOUT m_hWaveOut;
-  WAVEFORMATEX m_waveFormat;
+  WAVEFORMATEX m_waveFormat;         // the device's (fixed) format
   CThread m_gcThread;
 
+  CFormatConverter m_converter;       // converts the data from the format set by SetFormat to the device's format
+
   LONG m_bufferedBytes;
   LONG m_bufferedLo, m_bufferedHi;
 
+  CBufferSizer m_bufferSizer;         // decides the operating range (initially m_bufOpRange) from the measured jitter
+  DWORD m_lastDelivery;               // when PlayData was last called (timeGetTime)
+  DWORD m_lastDone;                   // when a header last finished playing (timeGetTime, maintained by WaveOutProc)
+  volatile LONG m_doneInterval;       // longest interval between two finished headers since the last PlayData (milliseconds)
+  DWORD m_dryTime;                    // when the device last ran out of data (timeGetTime, maintained by WaveOutProc)
+
+  CSinkTelemetry m_telemetry;
+
+  CHAR* m_arena;                      // sample memory, split into WAVEHDR_POOL slots of m_slotLen bytes
+  LONG m_slotLen;
+  WAVEHDR m_waveHdrs[WAVEHDR_POOL];   // headers, each permanently pointing at its own slot in m_arena
+  int m_nextHdr;                      // next header to send (headers complete in the order they were sent)
+  LONG m_pendingLen;                  // how many bytes were copied to the next header, but not sent yet
+  volatile LONG m_freeHdrs;           // how many headers are not queued on the device (recycled by WaveOutProc)
+
 // Interfaces to dependency modules
 protected:
   IVDMQUERYLib::IVDMRTEnvironmentPtr m_env;
@@ -4,6 +4,7 @@
 //
 #define IDS_PROJNAME                    100
 #define IDR_WAVEOUT                     102
+#define IDR_CLOCKEDWAVEOUT              103
 
 // Next default values for new objects
 // 
@@ -12,6 +13,6 @@
 #define _APS_NEXT_RESOURCE_VALUE        201
 #define _APS_NEXT_COMMAND_VALUE         32768
 #define _APS_NEXT_CONTROL_VALUE         201
-#define _APS_NEXT_SYMED_VALUE           103
+#define _APS_NEXT_SYMED_VALUE           104
 #endif
 #endif